@@ -42,6 +42,88 @@ void RaytracingCamera::setupFrame(const dvec3& viewingPos, const dvec3& lookAtPt
 	cameraFrame.setFrame(viewingPos, u, v, w);
 }
 
+/**
+ * @fn	Frustum RaytracingCamera::getFrustum(double x0, double y0, double x1, double y1) const
+ * @brief	Builds the region of space that camera rays through a rectangle of the
+ * 			window can reach. The rectangle is given in the coordinates getRay takes,
+ * 			so its corners map onto the projection plane (left..right, bottom..top)
+ * 			and out along the camera's frame. The near side is the plane through the
+ * 			camera's origin facing -w.
+ * @param	x0	The left edge of the rectangle.
+ * @param	y0	The bottom edge of the rectangle.
+ * @param	x1	The right edge of the rectangle.
+ * @param	y1	The top edge of the rectangle.
+ * @return	The frustum.
+ */
+
+Frustum RaytracingCamera::getFrustum(double x0, double y0, double x1, double y1) const {
+	const Ray corners[4] = { getRay(x0, y0), getRay(x1, y0), getRay(x1, y1), getRay(x0, y1) };
+	const dvec3 inside = getRay((x0 + x1) / 2, (y0 + y1) / 2).getPoint(1.0);
+
+	Frustum frustum;
+	for (int i = 0; i < 4; i++) {
+		const Ray& a = corners[i];
+		const Ray& b = corners[(i + 1) % 4];
+		// Handles rays sharing an origin (perspective) and parallel rays (orthographic).
+		dvec3 n = glm::cross(a.dir, b.origin + b.dir - a.origin);
+		if (glm::dot(n, inside - a.origin) < 0) {
+			n = -n;
+		}
+		frustum.addPlane(n, a.origin);
+	}
+	frustum.addPlane(-cameraFrame.w, cameraFrame.origin);
+	return frustum;
+}
+
+/**
+ * @fn	double RaytracingCamera::getPixelFootprint(double distance) const
+ * @brief	Gets the width a pixel covers at some distance along its ray, measured
+ * 			between the rays of two neighboring pixels at the center of the window.
+ * @param	distance	Distance from the camera along the ray.
+ * @return	The width of the pixel there.
+ */
+
+double RaytracingCamera::getPixelFootprint(double distance) const {
+	const Ray a = getRay(nx / 2.0, ny / 2.0);
+	const Ray b = getRay(nx / 2.0 + 1.0, ny / 2.0);
+	return glm::length(b.origin - a.origin) + distance * glm::length(b.dir - a.dir);
+}
+
+/**
+ * @fn	void Frustum::addPlane(const dvec3 &normal, const dvec3 &pointOnPlane)
+ * @brief	Adds a bounding plane.
+ * @param	normal			Normal pointing into the frustum.
+ * @param	pointOnPlane	Any point on the plane.
+ */
+
+void Frustum::addPlane(const dvec3& normal, const dvec3& pointOnPlane) {
+	dvec3 n = glm::normalize(normal);
+	normals.push_back(n);
+	offsets.push_back(-glm::dot(n, pointOnPlane));
+}
+
+/**
+ * @fn	bool Frustum::mayIntersect(const BoundingBox &box) const
+ * @brief	Conservative overlap test. For each plane, the box corner farthest along
+ * 			the normal is checked; if it is outside, so is the whole box.
+ * @param	box	The box.
+ * @return	false only if the box is certainly outside the frustum.
+ */
+
+bool Frustum::mayIntersect(const BoundingBox& box) const {
+	const double TOLERANCE = 1.0E-6;
+	for (size_t i = 0; i < normals.size(); i++) {
+		const dvec3& n = normals[i];
+		dvec3 farthest(n.x >= 0 ? box.hi.x : box.lo.x,
+			n.y >= 0 ? box.hi.y : box.lo.y,
+			n.z >= 0 ? box.hi.z : box.lo.z);
+		if (glm::dot(n, farthest) + offsets[i] < -TOLERANCE) {
+			return false;
+		}
+	}
+	return true;
+}
+
 /**
  * @fn	PerspectiveCamera::PerspectiveCamera(const dvec3 &pos, const dvec3 &lookAtPt,
  *												const dvec3 &up, double FOVRads)
@@ -11,6 +11,20 @@
 #include <iostream>
 #include "ishape.h"
 
+/**
+ * @struct	Frustum
+ * @brief	A convex region bounded by planes. Each plane is stored as an inward
+ * 			normal n and an offset d; a point p is inside when dot(n, p) + d >= 0
+ * 			for every plane.
+ */
+
+struct Frustum {
+	vector<dvec3> normals;		//!< inward-facing plane normals.
+	vector<double> offsets;		//!< plane offsets.
+	void addPlane(const dvec3& normal, const dvec3& pointOnPlane);
+	bool mayIntersect(const BoundingBox& box) const;
+};
+
  /**
   * @struct	RaytracingCamera
   * @brief	Base class for cameras in raytracing applications.
@@ -27,6 +41,8 @@ struct RaytracingCamera {
 	double getRight() const { return right; }
 	double getBottom() const { return bottom; }
 	double getTop() const { return top; }
+	Frustum getFrustum(double x0, double y0, double x1, double y1) const;
+	double getPixelFootprint(double distance) const;
 protected:
 	Frame cameraFrame;					//!< The camera's frame
 	int nx, ny;							//!< Window size
@@ -46,6 +46,7 @@ struct Material {
 	Material operator *(double w) const;
 	Material& operator +=(const Material& mat);
 	Material operator +(const Material& mat) const;
+	bool operator ==(const Material& mat) const;
 };
 
 // http://www.it.hiof.no/~borres/j3d/explain/light/p-materials.html
@@ -0,0 +1,305 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include "denoiser.h"
+#include "parallel.h"
+#include "simd.h"
+
+/**
+ * @fn	DenoiseBuffers::DenoiseBuffers()
+ * @brief	Constructs empty buffers. They are sized by the ray tracer on first use.
+ */
+
+DenoiseBuffers::DenoiseBuffers()
+	: width(0), height(0) {
+}
+
+/**
+ * @fn	void DenoiseBuffers::setSize(int width, int height)
+ * @brief	Resizes every plane and clears it to zero.
+ * @param	width 	The width.
+ * @param	height	The height.
+ */
+
+void DenoiseBuffers::setSize(int width, int height) {
+	this->width = width;
+	this->height = height;
+	const int area = width * height;
+	for (int c = 0; c < 3; c++) {
+		radiance[c].assign(area, 0.0f);
+		albedo[c].assign(area, 0.0f);
+		normal[c].assign(area, 0.0f);
+	}
+	depth.assign(area, 0.0f);
+}
+
+/**
+ * @fn	void DenoiseBuffers::setPixel(int x, int y, const color &C, const color &albedo,
+ *									const dvec3 &normal, double depth)
+ * @brief	Records everything known about one pixel.
+ * @param	x	  	The x coordinate.
+ * @param	y	  	The y coordinate.
+ * @param	C	  	The pixel's color.
+ * @param	albedo	The albedo of the first surface hit.
+ * @param	normal	The unit normal of the first surface hit (zero if nothing was hit).
+ * @param	depth 	The distance to the first surface hit.
+ */
+
+void DenoiseBuffers::setPixel(int x, int y, const color& C, const color& albedo,
+	const dvec3& normal, double depth) {
+	const int i = y * width + x;
+	for (int c = 0; c < 3; c++) {
+		this->radiance[c][i] = (float)C[c];
+		this->albedo[c][i] = (float)albedo[c];
+		this->normal[c][i] = (float)normal[c];
+	}
+	this->depth[i] = (float)depth;
+}
+
+/**
+ * @fn	void DenoiseBuffers::setRadiance(int x, int y, const color &C)
+ * @brief	Replaces a pixel's color, keeping its surface data.
+ * @param	x	The x coordinate.
+ * @param	y	The y coordinate.
+ * @param	C	The pixel's color.
+ */
+
+void DenoiseBuffers::setRadiance(int x, int y, const color& C) {
+	const int i = y * width + x;
+	for (int c = 0; c < 3; c++) {
+		radiance[c][i] = (float)C[c];
+	}
+}
+
+/**
+ * @fn	Denoiser::Denoiser()
+ * @brief	Constructs a denoiser with settings that suit the images this ray tracer
+ * 			produces.
+ */
+
+Denoiser::Denoiser()
+	: iterations(3), sigmaColor(0.1f), normalPower(64), sigmaDepth(0.05f) {
+}
+
+/**
+ * @fn	static Float4 loadLanes(const float *row, int x, int W)
+ * @brief	Loads row[x] .. row[x+3]. Lanes that fall outside [0, W) are zero.
+ * @param	row	The start of a row.
+ * @param	x  	Index of the first lane.
+ * @param	W  	Width of the row.
+ * @return	The four values.
+ */
+
+static Float4 loadLanes(const float* row, int x, int W) {
+	if (x >= 0 && x + 4 <= W) {
+		return Float4::load(row + x);
+	}
+	float f[4];
+	for (int i = 0; i < 4; i++) {
+		f[i] = (x + i >= 0 && x + i < W) ? row[x + i] : 0.0f;
+	}
+	return Float4::load(f);
+}
+
+/**
+ * @fn	static Float4 laneMask(int x, int W)
+ * @brief	Mask of the lanes x .. x+3 that fall inside [0, W).
+ * @param	x	Index of the first lane.
+ * @param	W	Width of the row.
+ * @return	The mask.
+ */
+
+static Float4 laneMask(int x, int W) {
+	Float4 lane = Float4((float)x) + Float4(0.0f, 1.0f, 2.0f, 3.0f);
+	return (lane >= Float4(0.0f)) & (lane < Float4((float)W));
+}
+
+/**
+ * @fn	static Float4 powInt(Float4 b, int e)
+ * @brief	Raises four values to a non-negative integer power.
+ * @param	b	The bases.
+ * @param	e	The exponent.
+ * @return	b^e.
+ */
+
+static Float4 powInt(Float4 b, int e) {
+	Float4 r(1.0f);
+	while (e > 0) {
+		if (e & 1) {
+			r = r * b;
+		}
+		b = b * b;
+		e >>= 1;
+	}
+	return r;
+}
+
+/**
+ * @fn	static Float4 luminance(const Float4 &r, const Float4 &g, const Float4 &b)
+ * @brief	Rec. 709 luminance of four colors.
+ * @return	The luminances.
+ */
+
+static Float4 luminance(const Float4& r, const Float4& g, const Float4& b) {
+	return r * Float4(0.2126f) + g * Float4(0.7152f) + b * Float4(0.0722f);
+}
+
+/**
+ * @fn	void Denoiser::filterRow(const DenoiseBuffers &buffers, const vector<float> *in,
+ *								vector<float> *out, int y, int step) const
+ * @brief	Runs one a-trous pass over row y, four pixels at a time.
+ * @param 		  	buffers	The auxiliary buffers.
+ * @param 		  	in	   	R, G, B planes being filtered.
+ * @param [in,out]	out	   	R, G, B planes receiving the result.
+ * @param 		  	y	   	The row.
+ * @param 		  	step   	Distance between neighboring taps.
+ */
+
+void Denoiser::filterRow(const DenoiseBuffers& buffers, const vector<float>* in,
+	vector<float>* out, int y, int step) const {
+	static const float kernel[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+	const int W = buffers.width;
+	const int H = buffers.height;
+	const Float4 zero(0.0f);
+	const Float4 invSigmaColor(1.0f / sigmaColor);
+	const int row = y * W;
+
+	for (int x = 0; x < W; x += 4) {
+		Float4 cR = loadLanes(&in[0][row], x, W);
+		Float4 cG = loadLanes(&in[1][row], x, W);
+		Float4 cB = loadLanes(&in[2][row], x, W);
+		Float4 cNx = loadLanes(&buffers.normal[0][row], x, W);
+		Float4 cNy = loadLanes(&buffers.normal[1][row], x, W);
+		Float4 cNz = loadLanes(&buffers.normal[2][row], x, W);
+		Float4 cZ = loadLanes(&buffers.depth[row], x, W);
+		Float4 cL = luminance(cR, cG, cB);
+		Float4 invDepthScale = Float4(1.0f) / (cZ * Float4(sigmaDepth * step) + Float4(1e-4f));
+
+		// The center tap always counts fully, so pixels that match no neighbor keep their value.
+		Float4 wSum(kernel[2] * kernel[2]);
+		Float4 sR = cR * wSum;
+		Float4 sG = cG * wSum;
+		Float4 sB = cB * wSum;
+
+		for (int j = 0; j < 5; j++) {
+			const int yy = y + (j - 2) * step;
+			if (yy < 0 || yy >= H) {
+				continue;
+			}
+			const int tapRow = yy * W;
+			for (int i = 0; i < 5; i++) {
+				if (i == 2 && j == 2) {
+					continue;
+				}
+				const int xx = x + (i - 2) * step;
+				if (xx + 3 < 0 || xx >= W) {
+					continue;
+				}
+				Float4 nx = loadLanes(&buffers.normal[0][tapRow], xx, W);
+				Float4 ny = loadLanes(&buffers.normal[1][tapRow], xx, W);
+				Float4 nz = loadLanes(&buffers.normal[2][tapRow], xx, W);
+				Float4 z = loadLanes(&buffers.depth[tapRow], xx, W);
+				Float4 r = loadLanes(&in[0][tapRow], xx, W);
+				Float4 g = loadLanes(&in[1][tapRow], xx, W);
+				Float4 b = loadLanes(&in[2][tapRow], xx, W);
+
+				Float4 cosine = max(cNx * nx + cNy * ny + cNz * nz, zero);
+				Float4 wNormal = powInt(cosine, normalPower);
+				Float4 wDepth = expNegApprox(abs(cZ - z) * invDepthScale);
+				Float4 wColor = expNegApprox(abs(cL - luminance(r, g, b)) * invSigmaColor);
+				Float4 w = Float4(kernel[i] * kernel[j]) * wNormal * wDepth * wColor;
+				if (xx < 0 || xx + 4 > W) {
+					w = w & laneMask(xx, W);
+				}
+
+				wSum += w;
+				sR += w * r;
+				sG += w * g;
+				sB += w * b;
+			}
+		}
+
+		Float4 invSum = Float4(1.0f) / wSum;
+		float fR[4], fG[4], fB[4];
+		(sR * invSum).store(fR);
+		(sG * invSum).store(fG);
+		(sB * invSum).store(fB);
+		const int lanes = std::min(4, W - x);
+		for (int k = 0; k < lanes; k++) {
+			out[0][row + x + k] = fR[k];
+			out[1][row + x + k] = fG[k];
+			out[2][row + x + k] = fB[k];
+		}
+	}
+}
+
+/**
+ * @fn	void Denoiser::denoise(const DenoiseBuffers &buffers, FrameBuffer &frameBuffer) const
+ * @brief	Filters the radiance in buffers and writes the result into the framebuffer.
+ * 			The buffers must have been filled by the ray tracer for the framebuffer's
+ * 			current size.
+ * @param 		  	buffers	   	Auxiliary buffers written while ray tracing.
+ * @param [in,out]	frameBuffer	Framebuffer receiving the filtered image.
+ */
+
+void Denoiser::denoise(const DenoiseBuffers& buffers, FrameBuffer& frameBuffer) const {
+	const int W = buffers.width;
+	const int H = buffers.height;
+	if (W != frameBuffer.getWindowWidth() || H != frameBuffer.getWindowHeight()) {
+		std::cerr << "Denoise buffers are " << W << "x" << H
+			<< " but the framebuffer is " << frameBuffer.getWindowWidth()
+			<< "x" << frameBuffer.getWindowHeight() << endl;
+		return;
+	}
+
+	const int area = W * H;
+	const float MIN_ALBEDO = 0.01f;
+	vector<float> ping[3], pong[3];
+	for (int c = 0; c < 3; c++) {
+		ping[c].resize(area);
+		pong[c].resize(area);
+	}
+
+	// Filter irradiance rather than radiance so textures and material edges stay sharp.
+	parallelFor(H, [&](int y) {
+		for (int c = 0; c < 3; c++) {
+			const float* R = &buffers.radiance[c][y * W];
+			const float* A = &buffers.albedo[c][y * W];
+			float* I = &ping[c][y * W];
+			int x = 0;
+			for (; x + 4 <= W; x += 4) {
+				(Float4::load(R + x) / max(Float4::load(A + x), Float4(MIN_ALBEDO))).store(I + x);
+			}
+			for (; x < W; x++) {
+				I[x] = R[x] / std::max(A[x], MIN_ALBEDO);
+			}
+		}
+	});
+
+	vector<float>* in = ping;
+	vector<float>* out = pong;
+	for (int i = 0; i < iterations; i++) {
+		const int step = 1 << i;
+		parallelFor(H, [&](int y) {
+			filterRow(buffers, in, out, y, step);
+		});
+		std::swap(in, out);
+	}
+
+	parallelFor(H, [&](int y) {
+		for (int x = 0; x < W; x++) {
+			const int i = y * W + x;
+			color C(in[0][i] * std::max(buffers.albedo[0][i], MIN_ALBEDO),
+				in[1][i] * std::max(buffers.albedo[1][i], MIN_ALBEDO),
+				in[2][i] * std::max(buffers.albedo[2][i], MIN_ALBEDO));
+			frameBuffer.setColor(x, y, C);
+		}
+	});
+}
@@ -0,0 +1,61 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include "defs.h"
+#include "colorandmaterials.h"
+#include "framebuffer.h"
+
+/**
+ * @struct	DenoiseBuffers
+ * @brief	Per-pixel auxiliary data written by the ray tracer next to each pixel's
+ * 			color: the radiance itself, the albedo, normal and depth of the first
+ * 			surface seen through the pixel. Every channel is stored in its own
+ * 			plane of floats so that filters can process several pixels at once.
+ * 			Pixels whose primary ray hits nothing have a zero normal.
+ */
+
+struct DenoiseBuffers {
+	DenoiseBuffers();
+	void setSize(int width, int height);
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	void setPixel(int x, int y, const color& C, const color& albedo,
+		const dvec3& normal, double depth);
+	void setRadiance(int x, int y, const color& C);
+	int width;					//!< width of the buffers
+	int height;					//!< height of the buffers
+	vector<float> radiance[3];	//!< R, G and B planes of the noisy color
+	vector<float> albedo[3];	//!< R, G and B planes of the surface albedo
+	vector<float> normal[3];	//!< X, Y and Z planes of the unit surface normal
+	vector<float> depth;		//!< distance along the primary ray (0 when nothing is hit)
+};
+
+/**
+ * @struct	Denoiser
+ * @brief	Edge-aware a-trous wavelet filter. The radiance is divided by the albedo
+ * 			so that texture and material detail survive, then blurred with a 5x5
+ * 			B3-spline kernel whose taps spread out by a factor of two on every
+ * 			iteration. Each tap is weighted down when its normal, depth or
+ * 			luminance differs from the center pixel, so the blur stays on one
+ * 			surface. Rows are filtered in parallel, four pixels at a time.
+ */
+
+struct Denoiser {
+	int iterations;			//!< number of a-trous passes (filter radius is 2^iterations).
+	float sigmaColor;		//!< luminance difference that reduces a weight by 1/e.
+	int normalPower;		//!< exponent applied to the cosine between normals.
+	float sigmaDepth;		//!< relative depth difference that reduces a weight by 1/e.
+	Denoiser();
+	void denoise(const DenoiseBuffers& buffers, FrameBuffer& frameBuffer) const;
+protected:
+	void filterRow(const DenoiseBuffers& buffers, const vector<float>* in,
+		vector<float>* out, int y, int step) const;
+};
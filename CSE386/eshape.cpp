@@ -7,6 +7,9 @@
  * permission is granted.
  ****************************************************/
 
+#include <algorithm>
+#include <array>
+#include <map>
 #include "eshape.h"
 
  /**
@@ -139,3 +142,111 @@ EShapeData EShape::createECheckerBoard(const Material& mat1, const Material& mat
 	}
 	return result;
 }
+
+/**
+ * @fn	EIndexedShapeData EShape::createIndexed(const EShapeData &triangles)
+ * @brief	Converts a triangle list into an indexed shape, merging the vertices
+ * 			that have the same material and whose positions and normals agree to
+ * 			within WELD_DISTANCE (snapped to a grid of that size, so a few such
+ * 			pairs may stay apart). The triangles are kept in the same order, and
+ * 			the shape's bounding box is worked out for culling.
+ * @param	triangles	The triangles; each successive triplet is a triangle.
+ * @return	The indexed shape.
+ */
+
+EIndexedShapeData EShape::createIndexed(const EShapeData& triangles) {
+	EIndexedShapeData result;
+	vector<Material> materials;
+	std::map<std::array<long long, 7>, unsigned int> index;
+
+	result.indices.reserve(triangles.size());
+	for (const VertexData& v : triangles) {
+		std::array<long long, 7> key;
+		for (int i = 0; i < 3; i++) {
+			key[i] = std::llround(v.pos[i] / v.pos.w / WELD_DISTANCE);
+			key[i + 3] = std::llround(v.normal[i] / WELD_DISTANCE);
+		}
+		key[6] = std::find(materials.begin(), materials.end(), v.material) - materials.begin();
+		if (key[6] == (long long)materials.size()) {
+			materials.push_back(v.material);
+		}
+
+		auto it = index.find(key);
+		if (it == index.end()) {
+			it = index.insert(std::make_pair(key, (unsigned int)result.vertices.size())).first;
+			result.vertices.push_back(v);
+			result.bounds.expand(v.pos.xyz());
+		}
+		result.indices.push_back(it->second);
+	}
+	return result;
+}
+
+/**
+ * @fn	EIndexedShapeData EShape::createIndexedCylinder(const Material &mat, int slices)
+ * @brief	Creates the cylinder createECylinder does, but smooth shaded: each
+ * 			vertex of the side has the outward normal of the true cylinder there and is
+ * 			shared by the six triangles around it.
+ * @param	mat   	Material.
+ * @param	slices	Slices.
+ * @return	The new cylinder.
+ */
+
+EIndexedShapeData EShape::createIndexedCylinder(const Material& mat, int slices) {
+	EIndexedShapeData result;
+
+	double angle = TWO_PI / slices;
+
+	for (int i = 0; i < slices; i++) {
+		double A = i * angle;
+		dvec3 normal(std::sin(A), 0.0, std::cos(A));
+		result.vertices.push_back(VertexData(dvec4(normal.x, 0.5, normal.z, 1), normal, mat));
+		result.vertices.push_back(VertexData(dvec4(normal.x, -0.5, normal.z, 1), normal, mat));
+	}
+	for (int i = 0; i < slices; i++) {
+		unsigned int top1 = 2 * i, bottom1 = top1 + 1;
+		unsigned int top2 = 2 * ((i + 1) % slices), bottom2 = top2 + 1;
+		unsigned int triangles[] = { top1, top2, bottom1, top2, bottom2, bottom1 };
+		result.indices.insert(result.indices.end(), triangles, triangles + 6);
+	}
+	for (const VertexData& v : result.vertices) {
+		result.bounds.expand(v.pos.xyz());
+	}
+	return result;
+}
+
+/**
+ * @fn	EIndexedShapeData EShape::createIndexedCone(const Material &mat, int slices)
+ * @brief	Creates the cone createECone does, but smooth shaded: the base ring's
+ * 			vertices have the normal of the true cone there and are shared by
+ * 			the neighboring slices. Each slice keeps its own apex, with the
+ * 			normal halfway around its slice, as there is no one normal there.
+ * @param	mat   	Material.
+ * @param	slices	Slices.
+ * @return	The new cone.
+ */
+
+EIndexedShapeData EShape::createIndexedCone(const Material& mat, int slices) {
+	EIndexedShapeData result;
+
+	double angle = TWO_PI / slices;
+
+	for (int i = 0; i < slices; i++) {
+		double A = i * angle;
+		double middle = A + angle / 2;
+		dvec3 normal = glm::normalize(dvec3(std::cos(A), 1.0, std::sin(A)));
+		dvec3 apexNormal = glm::normalize(dvec3(std::cos(middle), 1.0, std::sin(middle)));
+		result.vertices.push_back(VertexData(dvec4(std::cos(A), 0.0, std::sin(A), 1), normal, mat));
+		result.vertices.push_back(VertexData(dvec4(0.0, 1.0, 0.0, 1.0), apexNormal, mat));
+	}
+	for (int i = 0; i < slices; i++) {
+		unsigned int B = 2 * i, apex = B + 1;
+		unsigned int C = 2 * ((i + 1) % slices);
+		unsigned int triangle[] = { apex, C, B };
+		result.indices.insert(result.indices.end(), triangle, triangle + 3);
+	}
+	for (const VertexData& v : result.vertices) {
+		result.bounds.expand(v.pos.xyz());
+	}
+	return result;
+}
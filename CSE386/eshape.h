@@ -16,6 +16,21 @@
 
 typedef vector<VertexData> EShapeData;
 
+const double WELD_DISTANCE = 1.0E-9;	//!< Vertices this close, in every coordinate, are merged by createIndexed.
+
+/**
+ * @struct	EIndexedShapeData
+ * @brief	An explicitly represented shape whose triangles share vertices. Each
+ * 			successive triplet of indices is a triangle, made of the vertices
+ * 			they index.
+ */
+
+struct EIndexedShapeData {
+	vector<VertexData> vertices;	//!< Each distinct vertex, once.
+	vector<unsigned int> indices;	//!< Three per triangle, into vertices.
+	BoundingBox bounds;				//!< Box around the vertices, in object coordinates.
+};
+
 /**
  * @struct	EShape
  * @brief	This class contains functions that create explicitly represented shapes.
@@ -31,4 +46,7 @@ struct EShape {
 	static EShapeData createECylinder(const Material& mat, int slices = DEFAULT_SLICES);
 	static EShapeData createECone(const Material& mat, int slices = DEFAULT_SLICES);
 	static EShapeData createECheckerBoard(const Material& mat1, const Material& mat2, double WIDTH, double HEIGHT, int DIV);
+	static EIndexedShapeData createIndexed(const EShapeData& triangles);
+	static EIndexedShapeData createIndexedCylinder(const Material& mat, int slices = DEFAULT_SLICES);
+	static EIndexedShapeData createIndexedCone(const Material& mat, int slices = DEFAULT_SLICES);
 };
@@ -24,14 +24,15 @@ dmat4& viewingMatrix = pipeMats.viewingMatrix;
 dmat4& projectionMatrix = pipeMats.projectionMatrix;
 dmat4& viewportMatrix = pipeMats.viewportMatrix;
 
-EShapeData board = EShape::createECheckerBoard(copper, polishedCopper, 10, 10, 10);
+EIndexedShapeData board = EShape::createIndexed(EShape::createECheckerBoard(copper, polishedCopper, 10, 10, 10));
 dvec4 A(-1, -1, 0, 1);
 dvec4 B(+1, -1, 0, 1);
 dvec4 C( 0, +1, 0, 1);
 EShapeData tri1 = EShape::createETriangle(gold, A, B, C);
 EShapeData tri2 = EShape::createETriangle(polishedCopper, A, B, C);
 EShapeData tri3 = EShape::createETriangle(cyanPlastic, A, B, C);
-EShapeData cone = EShape::createECone(pewter, 8);
+EIndexedShapeData cone = EShape::createIndexedCone(pewter, 8);
+EIndexedShapeData cylinder = EShape::createIndexedCylinder(greenPlastic, 16);
 	
 void renderObjects() {
 	// The rendering should work regardless of the order in which
@@ -41,14 +42,22 @@ void renderObjects() {
 	VertexOps::render(frameBuffer, tri2, lights, T(-1, 0, 0) *Ry(-PI_3)* S(10, 3, 1), pipeMats, true);
 	VertexOps::render(frameBuffer, tri3, lights, T(0,1,0)*S(8,1,1)*Ry(PI_4)*Rz(PI_2), pipeMats, true);
 	VertexOps::render(frameBuffer, cone, lights, T(-3, 0, 3), pipeMats, true);
+	VertexOps::render(frameBuffer, cylinder, lights, T(3, 0.5, 3), pipeMats, true);
 }
 
 static void render() {
 	frameBuffer.clearColorAndDepthBuffers();
+	VertexOps::resetCullStats();
 	int width = frameBuffer.getWindowWidth();
 	int height = frameBuffer.getWindowHeight();
 	viewingMatrix = glm::lookAt(glm::dvec3(0, 5, 5), glm::dvec3(0, 0, 0), Y_AXIS);
 	renderObjects();
+	if (FragmentOps::deferredShading) {
+		FragmentOps::shadeGBuffer(frameBuffer, lights, viewingMatrix);
+	}
+	CullStats cullStats = VertexOps::getCullStats();
+	cout << "Culled " << cullStats.frustumCulled << " outside the view and "
+		<< cullStats.occlusionCulled << " hidden, of " << cullStats.draws << " objects" << endl;
 	frameBuffer.showAxes(viewingMatrix, projectionMatrix, viewportMatrix,
 						BoundingBoxi(0, width, 0, height));
 	frameBuffer.showColorBuffer();
@@ -79,6 +88,10 @@ void keyboard(unsigned char key, int x, int y) {
 	case 'z':	theLight->pos.z += (isupper(key) ? INC : -INC);
 		cout << theLight->pos << endl;
 		break;
+	case 'D':
+	case 'd':	FragmentOps::deferredShading = !FragmentOps::deferredShading;
+		cout << "Deferred shading: " << (FragmentOps::deferredShading ? "on" : "off") << endl;
+		break;
 	case ESCAPE:
 		glutLeaveMainLoop();
 		break;
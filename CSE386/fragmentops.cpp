@@ -7,13 +7,17 @@
  * permission is granted.
  ****************************************************/
 
+#include <typeinfo>
 #include <vector>
 #include "fragmentops.h"
+#include "parallel.h"
+#include "simd.h"
 
 FogParams FragmentOps::fogParams;
 bool FragmentOps::performDepthTest = true;
 bool FragmentOps::readonlyDepthBuffer = false;
 bool FragmentOps::readonlyColorBuffer = false;
+bool FragmentOps::deferredShading = false;
 
 /**
  * @fn	double FogParams::fogFactor(const dvec3 &fragPos, const dvec3 &eyePos) const
@@ -46,8 +50,7 @@ double FogParams::fogFactor(const dvec3& fragPos, const dvec3& eyePos) const {
 color FragmentOps::applyLighting(const Fragment& fragment, const dvec3& eyePositionInWorldCoords,
 	const vector<LightSourcePtr>& lights,
 	const Frame& eyeFrame) {
-	/* CSE 386 - todo  */
-	return fragment.material.diffuse;
+	return lights[0]->illuminate(fragment.worldPos, fragment.worldNormal, fragment.material, eyeFrame, false);
 }
 
 /**
@@ -82,10 +85,13 @@ color FragmentOps::applyBlending(double alpha, const color& srcColor, const colo
 /**
  * @fn	void FragmentOps::processFragment(FrameBuffer &frameBuffer,
  *											const dvec3 &eyePositionInWorldCoords,
- *											const vector<LightSourcePtr> lights,
+ *											const vector<LightSourcePtr> &lights,
  *											const Fragment &fragment,
  *											const dmat4 &viewingMatrix)
- * @brief	Process the fragment, leaving the results in the framebuffer.
+ * @brief	Process the fragment, leaving the results in the framebuffer. A
+ * 			fragment with a G-buffer material is not lit here but recorded in the
+ * 			G-buffer; with deferred shading on, a fragment lit here clears the
+ * 			G-buffer pixel it covers.
  * @param [in,out]	frameBuffer	                The frame buffer
  * @param 		  	eyePositionInWorldCoords	The eye position in world coordinates.
  * @param 		  	lights						Vector of lights in scene.
@@ -94,7 +100,7 @@ color FragmentOps::applyBlending(double alpha, const color& srcColor, const colo
  */
 
 void FragmentOps::processFragment(FrameBuffer& frameBuffer, const dvec3& eyePositionInWorldCoords,
-	const vector<LightSourcePtr> lights,
+	const vector<LightSourcePtr>& lights,
 	const Fragment& fragment,
 	const Frame& eyeFrame) {
 	const dvec3& eyePos = eyePositionInWorldCoords;
@@ -106,8 +112,230 @@ void FragmentOps::processFragment(FrameBuffer& frameBuffer, const dvec3& eyePosi
 
 	/* CSE 386 - todo */
 	if (Z < frameBuffer.getDepth(X, Y)) {
-		color C = lights[0]->illuminate(fragment.worldPos, fragment.worldNormal, fragment.material, eyeFrame, false);
-		frameBuffer.setColor(X, Y, C);
+		if (fragment.materialID < 0) {
+			color C = applyLighting(fragment, eyePos, lights, eyeFrame);
+			frameBuffer.setColor(X, Y, C);
+		}
+		if (deferredShading) {
+			frameBuffer.setGBuffer(X, Y, fragment.worldNormal, fragment.worldPos, fragment.materialID);
+		}
 		frameBuffer.setDepth(X, Y, Z);
 	}
-}
\ No newline at end of file
+}
+
+/**
+ * @struct	SpanMaterial
+ * @brief	What one light makes of one G-buffer material, before the geometry of
+ * 			each pixel is taken into account.
+ */
+
+struct SpanMaterial {
+	float ambient[3];	//!< Ambient color the light produces
+	float diffuse[3];	//!< Diffuse color where the light hits head on
+	float specular[3];	//!< Specular color at the highlight's center
+	float shininess;	//!< Specular exponent
+};
+
+/**
+ * @fn	static bool canLightSpans(const LightSource *light)
+ * @brief	Determines if lightSpan computes what the light's illuminate does. Only
+ * 			the positional and spot lights, switched on, are done four pixels at
+ * 			a time; any other light is left to applyLighting.
+ * @param	light	The light.
+ * @return	True if rows can be lit with lightSpan.
+ */
+
+static bool canLightSpans(const LightSource* light) {
+	return light->isOn &&
+		(typeid(*light) == typeid(PositionalLight) || typeid(*light) == typeid(SpotLight));
+}
+
+/**
+ * @fn	static vector<SpanMaterial> getSpanMaterials(const FrameBuffer &frameBuffer, const LightSource *light)
+ * @brief	Works out the light's terms for every G-buffer material. One more, all
+ * 			zero, entry stands for pixels with nothing to light.
+ * @param	frameBuffer	The frame buffer.
+ * @param	light	   	The light.
+ * @return	The terms, indexed by material id.
+ */
+
+static vector<SpanMaterial> getSpanMaterials(const FrameBuffer& frameBuffer, const LightSource* light) {
+	vector<SpanMaterial> materials(frameBuffer.getGBufferMaterialCount() + 1, SpanMaterial());
+	for (int id = 0; id < frameBuffer.getGBufferMaterialCount(); id++) {
+		const Material& mat = frameBuffer.getGBufferMaterial(id);
+		const color ambi = ambientColor(mat.ambient, light->lightColor);
+		const color diff = glm::clamp(mat.diffuse * light->lightColor, 0.0, 1.0);
+		const color spec = glm::clamp(mat.specular * light->lightColor, 0.0, 1.0);
+		for (int c = 0; c < 3; c++) {
+			materials[id].ambient[c] = (float)ambi[c];
+			materials[id].diffuse[c] = (float)diff[c];
+			materials[id].specular[c] = (float)spec[c];
+		}
+		materials[id].shininess = (float)mat.shininess;
+	}
+	return materials;
+}
+
+/**
+ * @fn	static void lightSpan(FrameBuffer &frameBuffer, int x, int y, int n,
+ *								const float *normals, const float *positions,
+ *								const unsigned short *materialIds,
+ *								const vector<SpanMaterial> &materials,
+ *								const PositionalLight &light, const SpotLight *spot,
+ *								const Frame &eyeFrame)
+ * @brief	Lights a span of G-buffer pixels four at a time, the way
+ * 			PositionalLight::illuminate (and SpotLight::illuminate, given a spot)
+ * 			lights one pixel, and writes their colors.
+ * @param [in,out]	frameBuffer	The frame buffer.
+ * @param 		  	x		   	The x coordinate of the span's first pixel.
+ * @param 		  	y		   	The y coordinate of the span.
+ * @param 		  	n		   	The number of pixels in the span.
+ * @param 		  	normals	   	The span's world normals, from getGBufferSpan.
+ * @param 		  	positions  	The span's world positions, from getGBufferSpan.
+ * @param 		  	materialIds	The span's material ids, from getGBufferSpan.
+ * @param 		  	materials  	The light's terms for each material, from getSpanMaterials.
+ * @param 		  	light	   	The light.
+ * @param 		  	spot	   	The light as a spot light, or nullptr.
+ * @param 		  	eyeFrame   	The camera's frame.
+ */
+
+static void lightSpan(FrameBuffer& frameBuffer, int x, int y, int n,
+						const float* normals, const float* positions,
+						const unsigned short* materialIds,
+						const vector<SpanMaterial>& materials,
+						const PositionalLight& light, const SpotLight* spot,
+						const Frame& eyeFrame) {
+	const int none = (int)materials.size() - 1;
+	const Float4 lightX((float)light.pos.x), lightY((float)light.pos.y), lightZ((float)light.pos.z);
+	const Float4 eyeX((float)eyeFrame.origin.x), eyeY((float)eyeFrame.origin.y), eyeZ((float)eyeFrame.origin.z);
+	const Float4 zero(0.0f), one(1.0f);
+	for (int i = 0; i < n; i += 4) {
+		int ids[4];
+		float N[3][4], P[3][4];
+		bool anyToLight = false;
+		for (int k = 0; k < 4; k++) {
+			const int j = i + k;
+			ids[k] = j < n && materialIds[j] != GBUFFER_NO_MATERIAL ? materialIds[j] : none;
+			for (int c = 0; c < 3; c++) {
+				N[c][k] = ids[k] != none ? normals[3 * j + c] : 0.0f;
+				P[c][k] = ids[k] != none ? positions[3 * j + c] : 0.0f;
+			}
+			anyToLight = anyToLight || ids[k] != none;
+		}
+		if (!anyToLight) {
+			continue;
+		}
+		const SpanMaterial* M[4] = { &materials[ids[0]], &materials[ids[1]], &materials[ids[2]], &materials[ids[3]] };
+		const Float4 nx = Float4::load(N[0]), ny = Float4::load(N[1]), nz = Float4::load(N[2]);
+		const Float4 px = Float4::load(P[0]), py = Float4::load(P[1]), pz = Float4::load(P[2]);
+
+		Float4 lx = lightX - px, ly = lightY - py, lz = lightZ - pz;
+		const Float4 distance = sqrt(lx * lx + ly * ly + lz * lz);
+		lx = lx / distance;
+		ly = ly / distance;
+		lz = lz / distance;
+		const Float4 nDotL = lx * nx + ly * ny + lz * nz;
+		Float4 rx = Float4(2.0f) * nDotL * nx - lx;
+		Float4 ry = Float4(2.0f) * nDotL * ny - ly;
+		Float4 rz = Float4(2.0f) * nDotL * nz - lz;
+		const Float4 rLength = sqrt(rx * rx + ry * ry + rz * rz);
+		rx = rx / rLength;
+		ry = ry / rLength;
+		rz = rz / rLength;
+		Float4 vx = eyeX - px, vy = eyeY - py, vz = eyeZ - pz;
+		const Float4 vLength = sqrt(vx * vx + vy * vy + vz * vz);
+		vx = vx / vLength;
+		vy = vy / vLength;
+		vz = vz / vLength;
+
+		const Float4 diffuseFactor = max(nDotL, zero);
+		const Float4 rDotV = min(max(rx * vx + ry * vy + rz * vz, zero), one);
+		float rv[4];
+		rDotV.store(rv);
+		const Float4 specularFactor(std::pow(rv[0], M[0]->shininess), std::pow(rv[1], M[1]->shininess),
+									std::pow(rv[2], M[2]->shininess), std::pow(rv[3], M[3]->shininess));
+		Float4 atFact = one;
+		if (light.attenuationIsTurnedOn) {
+			atFact = one / (Float4((float)light.atParams.constant) +
+							Float4((float)light.atParams.linear) * distance +
+							Float4((float)light.atParams.quadratic) * distance * distance);
+		}
+		Float4 lit = zero < one;
+		if (spot != nullptr) {
+			const Float4 towardSpot = lx * Float4((float)spot->spotDir.x) +
+									ly * Float4((float)spot->spotDir.y) +
+									lz * Float4((float)spot->spotDir.z);
+			lit = Float4((float)glm::cos(spot->fov / 2)) < zero - towardSpot;
+		}
+
+		float C[3][4];
+		for (int c = 0; c < 3; c++) {
+			const Float4 ambi(M[0]->ambient[c], M[1]->ambient[c], M[2]->ambient[c], M[3]->ambient[c]);
+			const Float4 diff = min(Float4(M[0]->diffuse[c], M[1]->diffuse[c],
+											M[2]->diffuse[c], M[3]->diffuse[c]) * diffuseFactor, one);
+			const Float4 spec = min(Float4(M[0]->specular[c], M[1]->specular[c],
+											M[2]->specular[c], M[3]->specular[c]) * specularFactor, one);
+			const Float4 total = min(max(ambi + atFact * (diff + spec), zero), one);
+			select(lit, total, zero).store(C[c]);
+		}
+		for (int k = 0; k < 4; k++) {
+			if (ids[k] != none) {
+				frameBuffer.setColor(x + i + k, y, color(C[0][k], C[1][k], C[2][k]));
+			}
+		}
+	}
+}
+
+/**
+ * @fn	void FragmentOps::shadeGBuffer(FrameBuffer &frameBuffer,
+ *										const vector<LightSourcePtr> &lights,
+ *										const dmat4 &viewingMatrix)
+ * @brief	The lighting pass of deferred shading: lights each pixel recorded in the
+ * 			G-buffer once, however many fragments were drawn there, and writes its
+ * 			color. Rows are lit in parallel, and with a positional or spot light,
+ * 			four pixels at a time along each row. The span path does what
+ * 			applyLighting does; runDeferredShadingTests checks that they agree.
+ * @param [in,out]	frameBuffer  	The frame buffer
+ * @param 		  	lights		 	Vector of lights in scene.
+ * @param 		  	viewingMatrix	The viewing matrix the scene was drawn with.
+ */
+
+void FragmentOps::shadeGBuffer(FrameBuffer& frameBuffer,
+	const vector<LightSourcePtr>& lights,
+	const dmat4& viewingMatrix) {
+	const dvec3 eyePos = glm::inverse(viewingMatrix)[3].xyz();
+	const Frame eyeFrame = Frame::createOrthoNormalBasis(viewingMatrix);
+	const int W = frameBuffer.getWindowWidth();
+	if (canLightSpans(lights[0])) {
+		const PositionalLight& light = *static_cast<const PositionalLight*>(lights[0]);
+		const SpotLight* spot = typeid(light) == typeid(SpotLight) ? static_cast<const SpotLight*>(&light) : nullptr;
+		const vector<SpanMaterial> materials = getSpanMaterials(frameBuffer, lights[0]);
+		parallelForRange(frameBuffer.getWindowHeight(), FRAMEBUFFER_TILE_SIZE, [&](int firstRow, int lastRow) {
+			for (int y = firstRow; y < lastRow; y++) {
+				for (int x = 0; x < W; x += FRAMEBUFFER_TILE_SIZE - x % FRAMEBUFFER_TILE_SIZE) {
+					const float* normals;
+					const float* positions;
+					const unsigned short* materialIds;
+					const int n = frameBuffer.getGBufferSpan(x, y, normals, positions, materialIds);
+					if (n > 0) {
+						lightSpan(frameBuffer, x, y, n, normals, positions, materialIds,
+									materials, light, spot, eyeFrame);
+					}
+				}
+			}
+		});
+		return;
+	}
+	parallelForRange(frameBuffer.getWindowHeight(), FRAMEBUFFER_TILE_SIZE, [&](int firstRow, int lastRow) {
+		Fragment fragment;
+		for (int y = firstRow; y < lastRow; y++) {
+			for (int x = 0; x < W; x++) {
+				fragment.materialID = frameBuffer.getGBuffer(x, y, fragment.worldNormal, fragment.worldPos);
+				if (fragment.materialID >= 0) {
+					fragment.material = frameBuffer.getGBufferMaterial(fragment.materialID);
+					frameBuffer.setColor(x, y, applyLighting(fragment, eyePos, lights, eyeFrame));
+				}
+			}
+		}
+	});
+}
@@ -47,6 +47,8 @@ struct Fragment {
 	Material material;	//!< Material to use
 	dvec3 worldNormal;	//!< Transformed normal vector from early in pipeline
 	dvec3 worldPos;		//!< Saved position from early in the pipeline
+	int materialID;		//!< G-buffer id of the material, or -1 to light the fragment now
+	Fragment() : materialID(-1) {}
 };
 
 /**
@@ -60,10 +62,14 @@ public:
 	static bool readonlyDepthBuffer;	//!< True ==> rendering will not affect depth buffer. Typically false
 	static bool readonlyColorBuffer;	//!< True ==> rendering will not affect color buffer. Typically false
 	static FogParams fogParams;			//!< Parameters controlling fog effects.
+	static bool deferredShading;		//!< True ==> fragments go to the G-buffer, lit by shadeGBuffer. Typically false
 	static void processFragment(FrameBuffer& frameBuffer, const dvec3& eyePositionInWorldCoords,
-		const vector<LightSourcePtr> lights,
+		const vector<LightSourcePtr>& lights,
 		const Fragment& fragment,
 		const Frame& eyeFrame);
+	static void shadeGBuffer(FrameBuffer& frameBuffer,
+		const vector<LightSourcePtr>& lights,
+		const dmat4& viewingMatrix);
 protected:
 	static color applyFog(const color& destColor,
 		const dvec3& eyePos, const dvec3& fragPos);
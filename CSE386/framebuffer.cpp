@@ -7,9 +7,14 @@
  * permission is granted.
  ****************************************************/
 
+#include <algorithm>
+#include <limits>
+#include <thread>
 #include "defs.h"
 #include "utilities.h"
 #include "framebuffer.h"
+#include "parallel.h"
+#include "simd.h"
 
  /**
   * @fn	FrameBuffer::FrameBuffer(const int width, const int height)
@@ -18,7 +23,11 @@
   * @param	height	The height.
   */
 
-FrameBuffer::FrameBuffer(const int width, const int height) {
+FrameBuffer::FrameBuffer(const int width, const int height)
+	: colorBuffer(nullptr), hdrBuffer(nullptr), depthBuffer(nullptr), tileFlags(nullptr),
+	tileMaxDepth(nullptr), gBufferNormals(nullptr), gBufferPositions(nullptr), gBufferMaterialIds(nullptr),
+	exposure(1.0), toneMap(TONE_MAP_CLAMP) {
+	setClearColor(black);
 	setFrameBufferSize(width, height);
 }
 
@@ -29,7 +38,11 @@ FrameBuffer::FrameBuffer(const int width, const int height) {
 
 FrameBuffer::~FrameBuffer() {
 	delete[] colorBuffer;
+	delete[] hdrBuffer;
 	delete[] depthBuffer;
+	delete[] tileFlags;
+	delete[] tileMaxDepth;
+	deleteGBuffer();
 }
 
 /**
@@ -44,10 +57,22 @@ void FrameBuffer::setFrameBufferSize(int width, int height) {
 	this->width = width;
 	this->height = height;
 	int area = width * height;
+	tilesPerRow = (width + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE;
+	tilesPerColumn = (height + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE;
+	size_t numTiles = (size_t)tilesPerRow * tilesPerColumn;
 	delete[] colorBuffer;
+	delete[] hdrBuffer;
 	delete[] depthBuffer;
+	delete[] tileFlags;
+	delete[] tileMaxDepth;
+	deleteGBuffer();
 	colorBuffer = new GLubyte[area * BYTES_PER_PIXEL];
+	hdrBuffer = new float[numTiles * FRAMEBUFFER_TILE_SIZE * FRAMEBUFFER_TILE_SIZE * HDR_FLOATS_PER_PIXEL];
 	depthBuffer = new double[area];
+	tileFlags = new std::atomic<unsigned char>[numTiles];
+	tileMaxDepth = new double[numTiles];
+	flagAllTiles(0);
+	clearColorAndDepthBuffers();
 }
 
 /**
@@ -76,34 +101,285 @@ void FrameBuffer::clearColorAndDepthBuffers() {
 
 /**
  * @fn	void FrameBuffer::clearColorBuffer()
- * @brief	Clears the color buffer
+ * @brief	Clears the color buffer. Only flags the blocks; see clearTile.
  */
 
 void FrameBuffer::clearColorBuffer() {
-	for (int y = 0; y < height; ++y) {
-		for (int x = 0; x < width; ++x) {
-			std::memcpy(colorBuffer + BYTES_PER_PIXEL * (x + y * width),
-				clearColorUB, BYTES_PER_PIXEL);
-		}
-	}
+	flagAllTiles(TILE_COLOR_CLEAR);
 }
 
 /**
  * @fn	void FrameBuffer::clearDepthBuffer()
- * @brief	Clears the depth buffer
+ * @brief	Clears the depth buffer, and the G-buffer with it. Only flags the
+ * 			blocks; see clearTile.
  */
 
 void FrameBuffer::clearDepthBuffer() {
-	int area = width * height;
-	const int SZ = area;
-	std::fill(depthBuffer, depthBuffer + SZ, 1.0);
+	flagAllTiles(TILE_DEPTH_CLEAR);
+	gBufferMaterials.clear();
+}
+
+/**
+ * @fn	void FrameBuffer::flagAllTiles(unsigned char what)
+ * @brief	Flags every block as needing to be cleared. Not to be called while
+ * 			other threads draw.
+ * @param	what	The TILE_ flags to add; 0 resets the flags.
+ */
+
+void FrameBuffer::flagAllTiles(unsigned char what) {
+	const size_t numTiles = (size_t)tilesPerRow * tilesPerColumn;
+	for (size_t i = 0; i < numTiles; i++) {
+		tileFlags[i].store(what == 0 ? 0 : (unsigned char)(tileFlags[i].load(std::memory_order_relaxed) | what),
+							std::memory_order_relaxed);
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::clearTile(size_t tile, unsigned char what)
+ * @brief	Clears a block's colors (to no samples) or depths (to 1, with nothing
+ * 			in the G-buffer), if it is
+ * 			still flagged. Threads drawing into the same block wait while one of
+ * 			them clears it.
+ * @param	tile	The block.
+ * @param	what	TILE_COLOR_CLEAR or TILE_DEPTH_CLEAR.
+ */
+
+void FrameBuffer::clearTile(size_t tile, unsigned char what) {
+	unsigned char flags = tileFlags[tile].load(std::memory_order_acquire);
+	while (true) {
+		if ((flags & what) == 0) {
+			return;
+		}
+		if ((flags & TILE_BUSY) != 0) {
+			std::this_thread::yield();
+			flags = tileFlags[tile].load(std::memory_order_acquire);
+		} else if (tileFlags[tile].compare_exchange_weak(flags, flags | TILE_BUSY, std::memory_order_acquire)) {
+			break;
+		}
+	}
+
+	const int x0 = (int)(tile % tilesPerRow) * FRAMEBUFFER_TILE_SIZE;
+	const int y0 = (int)(tile / tilesPerRow) * FRAMEBUFFER_TILE_SIZE;
+	if (what == TILE_COLOR_CLEAR) {
+		float* p = hdrBuffer + hdrIndex(x0, y0);
+		std::fill(p, p + FRAMEBUFFER_TILE_SIZE * FRAMEBUFFER_TILE_SIZE * HDR_FLOATS_PER_PIXEL, 0.0f);
+	} else {
+		const int x1 = std::min(x0 + FRAMEBUFFER_TILE_SIZE, width);
+		const int y1 = std::min(y0 + FRAMEBUFFER_TILE_SIZE, height);
+		for (int y = y0; y < y1; y++) {
+			std::fill(depthBuffer + y * width + x0, depthBuffer + y * width + x1, 1.0);
+			if (gBufferMaterialIds != nullptr) {
+				std::fill(gBufferMaterialIds + y * width + x0, gBufferMaterialIds + y * width + x1,
+							GBUFFER_NO_MATERIAL);
+			}
+		}
+		tileMaxDepth[tile] = 1.0;
+	}
+	tileFlags[tile].store(flags & ~what, std::memory_order_release);
+}
+/**
+ * @fn	void FrameBuffer::allocateGBuffer()
+ * @brief	Allocates the G-buffer planes, with nothing in them.
+ */
+
+void FrameBuffer::allocateGBuffer() {
+	const size_t area = (size_t)width * height;
+	gBufferNormals = new float[3 * area];
+	gBufferPositions = new float[3 * area];
+	gBufferMaterialIds = new unsigned short[area];
+	std::fill(gBufferMaterialIds, gBufferMaterialIds + area, GBUFFER_NO_MATERIAL);
+}
+
+/**
+ * @fn	void FrameBuffer::deleteGBuffer()
+ * @brief	Frees the G-buffer planes, if they were allocated.
+ */
+
+void FrameBuffer::deleteGBuffer() {
+	delete[] gBufferNormals;
+	delete[] gBufferPositions;
+	delete[] gBufferMaterialIds;
+	gBufferNormals = gBufferPositions = nullptr;
+	gBufferMaterialIds = nullptr;
+}
+
+/**
+ * @fn	int FrameBuffer::addGBufferMaterial(const Material &mat)
+ * @brief	Adds a material to the ones that G-buffer pixels can refer to, until
+ * 			the depths are next cleared, allocating the G-buffer if need be.
+ * 			Adding the material that was added last gives its id again. Not to be
+ * 			called while other threads draw.
+ * @param	mat	The material.
+ * @return	The material's id, or -1 if the G-buffer cannot take more materials.
+ */
+
+int FrameBuffer::addGBufferMaterial(const Material& mat) {
+	if (gBufferMaterialIds == nullptr) {
+		allocateGBuffer();
+	}
+	if (!gBufferMaterials.empty() && gBufferMaterials.back() == mat) {
+		return (int)gBufferMaterials.size() - 1;
+	}
+	if (gBufferMaterials.size() >= GBUFFER_NO_MATERIAL) {
+		return -1;
+	}
+	gBufferMaterials.push_back(mat);
+	return (int)gBufferMaterials.size() - 1;
+}
+
+/**
+ * @fn	void FrameBuffer::setGBuffer(int x, int y, const dvec3 &normal, const dvec3 &worldPos, int materialId)
+ * @brief	Records the surface seen at (x, y), to be lit later.
+ * @param	x		  	The x coordinate.
+ * @param	y		  	The y coordinate.
+ * @param	normal	  	The surface's world normal.
+ * @param	worldPos  	The surface's world position.
+ * @param	materialId	An id from addGBufferMaterial, or -1 if the pixel has been
+ * 						lit already and is to be left alone.
+ */
+
+void FrameBuffer::setGBuffer(int x, int y, const dvec3& normal, const dvec3& worldPos, int materialId) {
+	if (!checkInWindow(x, y) || gBufferMaterialIds == nullptr) {
+		return;
+	}
+	prepareTile(tileIndex(x, y), TILE_DEPTH_CLEAR);
+	const size_t i = (size_t)y * width + x;
+	gBufferMaterialIds[i] = materialId < 0 ? GBUFFER_NO_MATERIAL : (unsigned short)materialId;
+	float* n = gBufferNormals + 3 * i;
+	float* p = gBufferPositions + 3 * i;
+	n[0] = (float)normal.x;
+	n[1] = (float)normal.y;
+	n[2] = (float)normal.z;
+	p[0] = (float)worldPos.x;
+	p[1] = (float)worldPos.y;
+	p[2] = (float)worldPos.z;
 }
+
 /**
- * @fn	void FrameBuffer::showColorBuffer() const
- * @brief	Shows the contents of the color buffer to screen.
+ * @fn	int FrameBuffer::getGBuffer(int x, int y, dvec3 &normal, dvec3 &worldPos) const
+ * @brief	Gets the surface recorded at (x, y).
+ * @param 	   	x			The x coordinate.
+ * @param 	   	y			The y coordinate.
+ * @param [out]	normal  	The surface's world normal.
+ * @param [out]	worldPos	The surface's world position.
+ * @return	The surface's material id, or -1 if there is nothing to light.
  */
 
-void FrameBuffer::showColorBuffer() const {
+int FrameBuffer::getGBuffer(int x, int y, dvec3& normal, dvec3& worldPos) const {
+	if (!checkInWindow(x, y) || gBufferMaterialIds == nullptr ||
+		isPending(tileIndex(x, y), TILE_DEPTH_CLEAR)) {
+		return -1;
+	}
+	const size_t i = (size_t)y * width + x;
+	if (gBufferMaterialIds[i] == GBUFFER_NO_MATERIAL) {
+		return -1;
+	}
+	const float* n = gBufferNormals + 3 * i;
+	const float* p = gBufferPositions + 3 * i;
+	normal = dvec3(n[0], n[1], n[2]);
+	worldPos = dvec3(p[0], p[1], p[2]);
+	return gBufferMaterialIds[i];
+}
+
+/**
+ * @fn	int FrameBuffer::getGBufferSpan(int x, int y, const float* &normals, const float* &positions,
+ *										const unsigned short* &materialIds) const
+ * @brief	Gets the surfaces recorded from (x, y) to the right edge of its block,
+ * 			so that a row can be lit several pixels at a time. Pixels whose id is
+ * 			GBUFFER_NO_MATERIAL have nothing to light.
+ * @param 	   	x		   	The x coordinate.
+ * @param 	   	y		   	The y coordinate.
+ * @param [out]	normals	   	The world normals (x, y, z) of the span's pixels.
+ * @param [out]	positions  	The world positions (x, y, z) of the span's pixels.
+ * @param [out]	materialIds	The material ids of the span's pixels.
+ * @return	The number of pixels in the span, or 0 if there is nothing to light.
+ */
+
+int FrameBuffer::getGBufferSpan(int x, int y, const float*& normals, const float*& positions,
+								const unsigned short*& materialIds) const {
+	if (!checkInWindow(x, y) || gBufferMaterialIds == nullptr ||
+		isPending(tileIndex(x, y), TILE_DEPTH_CLEAR)) {
+		return 0;
+	}
+	const size_t i = (size_t)y * width + x;
+	normals = gBufferNormals + 3 * i;
+	positions = gBufferPositions + 3 * i;
+	materialIds = gBufferMaterialIds + i;
+	return std::min(x - x % FRAMEBUFFER_TILE_SIZE + FRAMEBUFFER_TILE_SIZE, width) - x;
+}
+
+/**
+ * @fn	static Float4 applyToneMap(const Float4 &C, ToneMap toneMap)
+ * @brief	Brings an exposed color towards [0, 1].
+ * @param	C	   	The color, in the first three lanes.
+ * @param	toneMap	The tone map.
+ * @return	The mapped color, still to be clamped.
+ */
+
+static Float4 applyToneMap(const Float4& C, ToneMap toneMap) {
+	switch (toneMap) {
+	case TONE_MAP_REINHARD:
+		return C / (Float4(1.0f) + C);
+	case TONE_MAP_ACES:
+		return (C * (Float4(2.51f) * C + Float4(0.03f))) /
+				(C * (Float4(2.43f) * C + Float4(0.59f)) + Float4(0.14f));
+	default:
+		return C;
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::resolve()
+ * @brief	Fills the color buffer from the HDR buffer: averages each pixel's
+ * 			samples, scales by the exposure, tone maps, and converts to 8 bits.
+ * 			Pixels with no samples, and blocks still flagged to be cleared, get
+ * 			the clear color. Rows of blocks are resolved in parallel, a pixel's
+ * 			channels at a time.
+ */
+
+void FrameBuffer::resolve() {
+	const float exposureF = (float)exposure;
+	GLubyte clearRow[BYTES_PER_PIXEL * FRAMEBUFFER_TILE_SIZE];
+	for (int i = 0; i < FRAMEBUFFER_TILE_SIZE; i++) {
+		std::memcpy(clearRow + BYTES_PER_PIXEL * i, clearColorUB, BYTES_PER_PIXEL);
+	}
+	parallelForRange(tilesPerColumn, 1, [&](int firstTileRow, int lastTileRow) {
+		const Float4 zero(0.0f), one(1.0f), scale(255.0f);
+		for (int y = firstTileRow * FRAMEBUFFER_TILE_SIZE;
+			 y < std::min(lastTileRow * FRAMEBUFFER_TILE_SIZE, height); y++) {
+			GLubyte* out = colorBuffer + BYTES_PER_PIXEL * y * width;
+			for (int x = 0; x < width; x += FRAMEBUFFER_TILE_SIZE) {
+				const int count = std::min(FRAMEBUFFER_TILE_SIZE, width - x);
+				if (isPending(tileIndex(x, y), TILE_COLOR_CLEAR)) {
+					std::memcpy(out, clearRow, BYTES_PER_PIXEL * count);
+					out += BYTES_PER_PIXEL * count;
+					continue;
+				}
+				const float* p = hdrBuffer + hdrIndex(x, y);		// a row of a block is contiguous
+				for (int i = 0; i < count; i++, p += HDR_FLOATS_PER_PIXEL, out += BYTES_PER_PIXEL) {
+					if (p[3] == 0.0f) {
+						std::memcpy(out, clearColorUB, BYTES_PER_PIXEL);
+						continue;
+					}
+					Float4 C = Float4::load(p) * Float4(p[3] == 1.0f ? exposureF : exposureF / p[3]);
+					C = min(max(applyToneMap(C, toneMap), zero), one) * scale;
+					const unsigned int bytes = truncateToBytes(C);
+					out[0] = (GLubyte)bytes;
+					out[1] = (GLubyte)(bytes >> 8);
+					out[2] = (GLubyte)(bytes >> 16);
+				}
+			}
+		}
+	});
+}
+
+/**
+ * @fn	void FrameBuffer::showColorBuffer()
+ * @brief	Resolves the HDR buffer and shows the color buffer on screen.
+ */
+
+void FrameBuffer::showColorBuffer() {
+	resolve();
 	glRasterPos2d(-1, -1);
 	glDrawPixels(width, height, GL_RGB, GL_UNSIGNED_BYTE, colorBuffer);
 	glFlush();
@@ -111,7 +387,8 @@ void FrameBuffer::showColorBuffer() const {
 
 /**
  * @fn	void FrameBuffer::setColor(int x, int y, const color &rgb)
- * @brief	Sets a color at (x, y)
+ * @brief	Sets a color at (x, y), replacing any samples there. The color is
+ * 			kept as it is; clamping happens when the buffer is resolved.
  * @param	x  	The x coordinate.
  * @param	y  	The y coordinate.
  * @param	rgb	The new RGB value.
@@ -121,37 +398,53 @@ void FrameBuffer::setColor(int x, int y, const color& rgb) {
 	if (x < 0 || x >= width || y < 0 || y >= height) {
 		return;
 	}
+	prepareTile(tileIndex(x, y), TILE_COLOR_CLEAR);
+	float* p = hdrBuffer + hdrIndex(x, y);
+	p[0] = (float)rgb.r;
+	p[1] = (float)rgb.g;
+	p[2] = (float)rgb.b;
+	p[3] = 1.0f;
+}
 
-	color clampedColor = glm::clamp(rgb, 0.0, 1.0);
-
-	GLubyte c[] = { (GLubyte)(clampedColor.r * 255),
-					(GLubyte)(clampedColor.g * 255),
-					(GLubyte)(clampedColor.b * 255) };
+/**
+ * @fn	void FrameBuffer::addSample(int x, int y, const color &rgb, double weight)
+ * @brief	Adds a weighted sample at (x, y). The pixel's color is the weighted
+ * 			average of the samples added since it was cleared or set.
+ * @param	x	  	The x coordinate.
+ * @param	y	  	The y coordinate.
+ * @param	rgb   	The sample's color.
+ * @param	weight	The sample's weight.
+ */
 
-	std::memcpy(colorBuffer + BYTES_PER_PIXEL * (x + y * width), c, BYTES_PER_PIXEL);
+void FrameBuffer::addSample(int x, int y, const color& rgb, double weight) {
+	if (x < 0 || x >= width || y < 0 || y >= height) {
+		return;
+	}
+	prepareTile(tileIndex(x, y), TILE_COLOR_CLEAR);
+	float* p = hdrBuffer + hdrIndex(x, y);
+	p[0] += (float)(weight * rgb.r);
+	p[1] += (float)(weight * rgb.g);
+	p[2] += (float)(weight * rgb.b);
+	p[3] += (float)weight;
 }
 
 /**
  * @fn	color FrameBuffer::getColor(int x, int y) const
- * @brief	Gets the color at (x, y)
+ * @brief	Gets the color at (x, y), unclamped and before exposure and tone mapping.
  * @param	x	The x coordinate.
  * @param	y	The y coordinate.
- * @return	The color at (x, y)
+ * @return	The color at (x, y); the clear color where nothing has been drawn.
  */
 
 color FrameBuffer::getColor(int x, int y) const {
 	double red, green, blue;
+	const float* p = checkInWindow(x, y) && !isPending(tileIndex(x, y), TILE_COLOR_CLEAR) ?
+						hdrBuffer + hdrIndex(x, y) : nullptr;
 
-	if (checkInWindow(x, y)) {
-		GLubyte c[BYTES_PER_PIXEL];
-
-		// Retrieve color values from the color buffer
-		std::memcpy(c, colorBuffer + BYTES_PER_PIXEL * (x + y * width), BYTES_PER_PIXEL);
-
-		// Convert individual color components back to doubleing point values
-		red = c[0] / 255.0;
-		green = c[1] / 255.0;
-		blue = c[2] / 255.0;
+	if (p != nullptr && p[3] != 0.0f) {
+		red = p[0] / p[3];
+		green = p[1] / p[3];
+		blue = p[2] / p[3];
 	} else {
 		red = clearColorUB[0] / 255.0;
 		green = clearColorUB[1] / 255.0;
@@ -182,8 +475,49 @@ void FrameBuffer::setDepth(double x, double y, double depth) {
 
 void FrameBuffer::setDepth(int x, int y, double depth) {
 	if (checkInWindow(x, y)) {
-		depthBuffer[y * width + x] = depth;
+		const size_t tile = tileIndex(x, y);
+		prepareTile(tile, TILE_DEPTH_CLEAR);
+		double& current = depthBuffer[y * width + x];
+		double& maxDepth = tileMaxDepth[tile];
+		if (depth >= maxDepth) {
+			maxDepth = depth;
+		} else if (current >= maxDepth) {
+			maxDepth = std::numeric_limits<double>::quiet_NaN();	// the greatest depth may have dropped
+		}
+		current = depth;
+	}
+}
+
+/**
+ * @fn	double FrameBuffer::getTileMaxDepth(int x, int y)
+ * @brief	Gets a depth that no pixel in the block holding (x, y) exceeds. A
+ * 			fragment in the block no nearer than this fails the depth test. The
+ * 			bound is worked out again, from the block's depths, after writes may
+ * 			have lowered it. Like the depths themselves, a block's bound must not
+ * 			be used while another thread writes the block.
+ * @param	x	The x coordinate, in the window.
+ * @param	y	The y coordinate, in the window.
+ * @return	The greatest depth in the block.
+ */
+
+double FrameBuffer::getTileMaxDepth(int x, int y) {
+	const size_t tile = tileIndex(x, y);
+	if (isPending(tile, TILE_DEPTH_CLEAR)) {
+		return 1.0;
+	}
+	double& maxDepth = tileMaxDepth[tile];
+	if (std::isnan(maxDepth)) {
+		const int x0 = x - x % FRAMEBUFFER_TILE_SIZE;
+		const int y0 = y - y % FRAMEBUFFER_TILE_SIZE;
+		const int x1 = std::min(x0 + FRAMEBUFFER_TILE_SIZE, width);
+		const int y1 = std::min(y0 + FRAMEBUFFER_TILE_SIZE, height);
+		maxDepth = depthBuffer[y0 * width + x0];
+		for (int row = y0; row < y1; row++) {
+			maxDepth = std::max(maxDepth, *std::max_element(depthBuffer + row * width + x0,
+															depthBuffer + row * width + x1));
+		}
 	}
+	return maxDepth;
 }
 
 /**
@@ -196,7 +530,7 @@ void FrameBuffer::setDepth(int x, int y, double depth) {
 
 double FrameBuffer::getDepth(int x, int y) const {
 	if (checkInWindow(x, y)) {
-		return depthBuffer[y * width + x];
+		return isPending(tileIndex(x, y), TILE_DEPTH_CLEAR) ? 1.0 : depthBuffer[y * width + x];
 	} else {
 		return 0.0;
 	}
@@ -9,6 +9,7 @@
 
 #pragma once
 
+#include <atomic>
 #include "defs.h"
 #include "ishape.h"
 #include "colorandmaterials.h"
@@ -18,12 +19,38 @@
 #endif
 
 const int BYTES_PER_PIXEL = 3;			//!< RGB requires 3 bytes.
+const int HDR_FLOATS_PER_PIXEL = 4;		//!< RGB plus the weight of the samples.
+const int FRAMEBUFFER_TILE_SIZE = 8;	//!< Width and height of the blocks the HDR buffer is stored in.
+const unsigned char TILE_COLOR_CLEAR = 1;	//!< A block's colors still have to be cleared.
+const unsigned char TILE_DEPTH_CLEAR = 2;	//!< A block's depths still have to be cleared.
+const unsigned char TILE_BUSY = 4;			//!< A block is being cleared by some thread.
+const unsigned short GBUFFER_NO_MATERIAL = 0xFFFF;	//!< G-buffer pixel with nothing left to light.
+
+/**
+ * @enum	ToneMap
+ * @brief	How exposed HDR colors are brought into [0, 1] for display.
+ */
+
+enum ToneMap {
+	TONE_MAP_CLAMP,			//!< clamp each channel.
+	TONE_MAP_REINHARD,		//!< c / (1 + c).
+	TONE_MAP_ACES			//!< a fit of the ACES filmic curve.
+};
 
 /**
  * @struct	FrameBuffer
- * @brief	Represents a framebuffer. Two identically sized 2D arrays. The color
- * 			buffer stores the colors and the depth buffer stores the corresponding
- * 			depth at each pixel.
+ * @brief	Represents a framebuffer. Identically sized 2D arrays. The HDR buffer
+ * 			stores the colors written, unclamped, in floats; the depth buffer
+ * 			stores the corresponding depth at each pixel. resolve applies exposure
+ * 			and tone mapping to the HDR buffer, filling the 8-bit color buffer
+ * 			that is shown on screen. Clears only flag each block; a block is
+ * 			really cleared when first written, reads of a flagged block give the
+ * 			clear value, and resolve fills flagged blocks with the clear color.
+ * 			Each block also keeps a bound on its depths, so that rasterizers can
+ * 			reject fragments that are hidden a block at a time. For deferred
+ * 			shading, a G-buffer holds the normal, world position and material of
+ * 			the surface seen at each pixel, in planes allocated on first use and
+ * 			cleared along with the depths.
  */
 
 struct FrameBuffer {
@@ -33,12 +60,18 @@ struct FrameBuffer {
 	void setClearColor(const color& clearColor);
 	color getClearColor() const { return clearColor; }
 	void setColor(int x, int y, const color& C);
+	void addSample(int x, int y, const color& C, double weight = 1.0);
 	color getColor(int x, int y) const;
+	void setExposure(double exposure) { this->exposure = exposure; }
+	double getExposure() const { return exposure; }
+	void setToneMap(ToneMap toneMap) { this->toneMap = toneMap; }
+	ToneMap getToneMap() const { return toneMap; }
+	void resolve();
 
 	void clearColorAndDepthBuffers();
 	void clearColorBuffer();
 	void clearDepthBuffer();
-	void showColorBuffer() const;
+	void showColorBuffer();
 	int getWindowWidth() const { return width; }
 	int getWindowHeight() const { return height; }
 
@@ -46,6 +79,15 @@ struct FrameBuffer {
 	void setDepth(int x, int y, double depth);
 	double getDepth(int x, int y) const;
 	double getDepth(double x, double y) const;
+	double getTileMaxDepth(int x, int y);
+
+	int addGBufferMaterial(const Material& mat);
+	const Material& getGBufferMaterial(int id) const { return gBufferMaterials[id]; }
+	int getGBufferMaterialCount() const { return (int)gBufferMaterials.size(); }
+	void setGBuffer(int x, int y, const dvec3& normal, const dvec3& worldPos, int materialId);
+	int getGBuffer(int x, int y, dvec3& normal, dvec3& worldPos) const;
+	int getGBufferSpan(int x, int y, const float*& normals, const float*& positions,
+						const unsigned short*& materialIds) const;
 
 	void showAxes(int x, int y, const Ray& ray, double thickness);
 	void showAxes(const dmat4& VM, const dmat4& PM, const dmat4& VPM,
@@ -57,6 +99,54 @@ protected:
 	int height;								//!< height of framebuffer
 	GLubyte clearColorUB[BYTES_PER_PIXEL];	//!< Clear color, as unsigned bytes
 	color clearColor;						//!< Clear color
-	GLubyte* colorBuffer;					//!< 2D array for holding colors
+	GLubyte* colorBuffer;					//!< 2D array for holding displayed colors
+	float* hdrBuffer;						//!< Weighted color sums and total weights, in blocks
 	double* depthBuffer;					//!< 2D array for holding depths
+	std::atomic<unsigned char>* tileFlags;	//!< TILE_ flags of each block
+	double* tileMaxDepth;					//!< No depth in each block is greater; NaN if unknown
+	float* gBufferNormals;					//!< 2D array of world normals (x, y, z); nullptr until used
+	float* gBufferPositions;				//!< 2D array of world positions (x, y, z); nullptr until used
+	unsigned short* gBufferMaterialIds;		//!< 2D array of indices into gBufferMaterials; nullptr until used
+	vector<Material> gBufferMaterials;		//!< Materials drawn into the G-buffer since the depths were cleared
+	int tilesPerRow;						//!< Blocks across the HDR buffer
+	int tilesPerColumn;						//!< Blocks down the HDR buffer
+	double exposure;						//!< Scale applied to colors by resolve
+	ToneMap toneMap;						//!< Tone mapping applied by resolve
+
+	/**
+	 * @fn	size_t hdrIndex(int x, int y) const
+	 * @brief	Finds a pixel in the HDR buffer, which holds the pixels of each
+	 * 			FRAMEBUFFER_TILE_SIZE square block together.
+	 * @param	x	The x coordinate.
+	 * @param	y	The y coordinate.
+	 * @return	Index of the pixel's first float.
+	 */
+	size_t hdrIndex(int x, int y) const {
+		const size_t tile = tileIndex(x, y);
+		const int inTile = (y % FRAMEBUFFER_TILE_SIZE) * FRAMEBUFFER_TILE_SIZE + x % FRAMEBUFFER_TILE_SIZE;
+		return HDR_FLOATS_PER_PIXEL * (tile * FRAMEBUFFER_TILE_SIZE * FRAMEBUFFER_TILE_SIZE + inTile);
+	}
+	size_t tileIndex(int x, int y) const {
+		return (size_t)(y / FRAMEBUFFER_TILE_SIZE) * tilesPerRow + x / FRAMEBUFFER_TILE_SIZE;
+	}
+	bool isPending(size_t tile, unsigned char what) const {
+		return (tileFlags[tile].load(std::memory_order_acquire) & what) != 0;
+	}
+
+	/**
+	 * @fn	void prepareTile(size_t tile, unsigned char what)
+	 * @brief	Makes sure a block's colors or depths have been cleared before
+	 * 			they are written.
+	 * @param	tile	The block.
+	 * @param	what	TILE_COLOR_CLEAR or TILE_DEPTH_CLEAR.
+	 */
+	void prepareTile(size_t tile, unsigned char what) {
+		if (isPending(tile, what)) {
+			clearTile(tile, what);
+		}
+	}
+	void clearTile(size_t tile, unsigned char what);
+	void flagAllTiles(unsigned char what);
+	void allocateGBuffer();
+	void deleteGBuffer();
 };
\ No newline at end of file
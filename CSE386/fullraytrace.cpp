@@ -24,6 +24,9 @@
 #include "image.h"
 #include "camera.h"
 #include "rasterization.h"
+#include "scenefile.h"
+#include "textureregistry.h"
+#include "tilecache.h"
 
 int currLight = 0;
 double angle = 0.5;
@@ -34,6 +37,10 @@ bool isAnimated = false;
 int numReflections = 0;
 int antiAliasing = 1;
 bool multiViewOn = false;
+bool progressiveOn = false;
+bool denoiseOn = false;
+bool wavefrontOn = false;
+const int PROGRESSIVE_SAMPLES_PER_FRAME = 2;
 double spotDirX = 0;
 double spotDirY = -1;
 double spotDirZ = 0;
@@ -57,20 +64,46 @@ SpotLightPtr spotLight = (SpotLightPtr)lights[1];
 
 FrameBuffer frameBuffer(WINDOW_WIDTH, WINDOW_HEIGHT);
 RayTracer rayTrace(paleGreen);
+AccumulationBuffer accumBuffer;
+DenoiseBuffers denoiseBuffers;
+Denoiser denoiser;
 IScene scene;
+SceneDescription sceneDesc;
+bool sceneFromFile = false;
 
-Image im("usflag.ppm");
+Image* im = TextureRegistry::getInstance().get("usflag.ppm");
 
 void render() {
 	int frameStartTime = glutGet(GLUT_ELAPSED_TIME);
 	int width = frameBuffer.getWindowWidth();
 	int height = frameBuffer.getWindowHeight();
-	scene.camera = new PerspectiveCamera(cameraPos1, cameraFocus1, cameraUp1, cameraFOV, width, height);
-	rayTrace.raytraceScene(frameBuffer, numReflections, scene, antiAliasing);
+	scene.camera = sceneFromFile ? SceneFile::createCamera(sceneDesc.camera, width, height)
+								: new PerspectiveCamera(cameraPos1, cameraFocus1, cameraUp1, cameraFOV, width, height);
+	rayTrace.denoiseBuffers = denoiseOn ? &denoiseBuffers : nullptr;
+	if (progressiveOn) {
+		bool done = rayTrace.raytraceSceneProgressive(frameBuffer, numReflections, scene,
+			accumBuffer, PROGRESSIVE_SAMPLES_PER_FRAME);
+		cout << "Frame " << accumBuffer.getFrameNumber() << ": " << accumBuffer.getNumConverged()
+			<< " of " << width * height << " pixels converged" << (done ? " (done)" : "") << endl;
+	} else if (wavefrontOn) {
+		rayTrace.raytraceSceneWavefront(frameBuffer, numReflections, scene, antiAliasing);
+	} else {
+		rayTrace.raytraceScene(frameBuffer, numReflections, scene, antiAliasing);
+	}
+	if (denoiseOn) {
+		denoiser.denoise(denoiseBuffers, frameBuffer);
+		frameBuffer.showColorBuffer();
+	}
 
 	int frameEndTime = glutGet(GLUT_ELAPSED_TIME); // Get end time
 	double totalTimeSec = (frameEndTime - frameStartTime) / 1000.0;
 	cout << "Render time: " << totalTimeSec << " sec." << endl;
+	TileCacheStats tileStats = TileCache::getInstance().getFrameStats();
+	if (tileStats.lookups > 0) {
+		cout << "Texture tiles: " << tileStats.misses << " misses, " << tileStats.evictions
+			<< " evictions in " << tileStats.lookups << " lookups" << endl;
+	}
+	TileCache::getInstance().resetFrameStats();
 }
 
 void resize(int width, int height) {
@@ -96,7 +129,8 @@ void buildScene() {
 	scene.addOpaqueObject(new VisibleIShape(sphere2, silver));
 	scene.addOpaqueObject(new VisibleIShape(disk, copper));
 
-	scene.addOpaqueObject(new VisibleIShape(cylinder, gold, &im));
+	scene.addOpaqueObject(new VisibleIShape(cylinder, gold, im));
+	TextureRegistry::getInstance().decodeInBackground(im);
 	scene.addOpaqueObject(new VisibleIShape(cylinder2, copper));
 	scene.addOpaqueObject(new VisibleIShape(closedCyl, copper));
 
@@ -104,6 +138,7 @@ void buildScene() {
 
 	scene.addLight(lights[0]);
 	scene.addLight(lights[1]);
+	scene.buildAccelerationStructure();
 }
 
 void incrementClamp(double& v, double delta, double lo, double hi) {
@@ -124,6 +159,9 @@ void timer(int id) {
 		}
 	}
 	clearPlane->a = dvec3(0, 0, z);
+	if (isAnimated) {
+		accumBuffer.reset();
+	}
 	glutTimerFunc(TIME_INTERVAL, timer, 0);
 	glutPostRedisplay();
 }
@@ -143,57 +181,70 @@ void keyboard(unsigned char key, int x, int y) {
 	case 'O':
 	case 'o':	lights[currLight]->isOn = !lights[currLight]->isOn;
 		cout << (lights[currLight]->isOn ? "ON" : "OFF") << endl;
+		accumBuffer.reset();
 		break;
 	case 'V':
 	case 'v':	lights[currLight]->isTiedToWorld = !lights[currLight]->isTiedToWorld;
 		cout << (lights[currLight]->isTiedToWorld ? "World" : "Camera") << endl;
+		accumBuffer.reset();
 		break;
 	case 'Q':
 	case 'q':	lights[currLight]->attenuationIsTurnedOn = !lights[currLight]->attenuationIsTurnedOn;
 		cout << (lights[currLight]->attenuationIsTurnedOn ? "Atten ON" : "Atten OFF") << endl;
+		accumBuffer.reset();
 		break;
 	case 'W':
 	case 'w':	incrementClamp(lights[currLight]->atParams.constant, isupper(key) ? INC : -INC, 0.0, 10.0);
 		cout << lights[currLight]->atParams << endl;
+		accumBuffer.reset();
 		break;
 	case 'E':
 	case 'e':	incrementClamp(lights[currLight]->atParams.linear, isupper(key) ? INC : -INC, 0.0, 10.0);
 		cout << lights[currLight]->atParams << endl;
+		accumBuffer.reset();
 		break;
 	case 'R':
 	case 'r':	incrementClamp(lights[currLight]->atParams.quadratic, isupper(key) ? INC : -INC, 0.0, 10.0);
 		cout << lights[currLight]->atParams << endl;
+		accumBuffer.reset();
 		break;
 	case 'X':
 	case 'x': lights[currLight]->pos.x += (isupper(key) ? INC : -INC);
 		cout << lights[currLight]->pos << endl;
+		accumBuffer.reset();
 		break;
 	case 'Y':
 	case 'y': lights[currLight]->pos.y += (isupper(key) ? INC : -INC);
 		cout << lights[currLight]->pos << endl;
+		accumBuffer.reset();
 		break;
 	case 'Z':
 	case 'z': lights[currLight]->pos.z += (isupper(key) ? INC : -INC);
 		cout << lights[currLight]->pos << endl;
+		accumBuffer.reset();
 		break;
 	case 'J':
 	case 'j':	spotDirX += (isupper(key) ? INC : -INC);
 		spotLight->setDir(spotDirX, spotDirY, spotDirZ);
 		cout << spotLight->spotDir << endl;
+		accumBuffer.reset();
 		break;
 	case 'K':
 	case 'k':	spotDirY += (isupper(key) ? INC : -INC);
 		spotLight->setDir(spotDirX, spotDirY, spotDirZ);
 		cout << spotLight->spotDir << endl;
+		accumBuffer.reset();
 		break;
 	case 'L':
 	case 'l':	spotDirZ += (isupper(key) ? INC : -INC);
 		spotLight->setDir(spotDirX, spotDirY, spotDirZ);
 		cout << spotLight->spotDir << endl;
+		accumBuffer.reset();
 		break;
 	case 'F':
 	case 'f':	incrementClamp(spotLight->fov, isupper(key) ? 0.2 : -0.2, 0.1, PI);
 		cout << spotLight->fov << endl;
+		accumBuffer.reset();
 		break;
 	case 'P':
 	case 'p':	isAnimated = !isAnimated;
@@ -201,14 +252,42 @@ void keyboard(unsigned char key, int x, int y) {
 	case 'C':
 	case 'c':
 		break;
+	case 'I':
+	case 'i':	progressiveOn = !progressiveOn;
+		cout << (progressiveOn ? "Progressive ON" : "Progressive OFF") << endl;
+		accumBuffer.reset();
+		break;
+	case 'S':
+	case 's':	wavefrontOn = !wavefrontOn;
+		cout << (wavefrontOn ? "Wavefront ON" : "Wavefront OFF") << endl;
+		break;
+	case 'N':
+	case 'n':	denoiseOn = !denoiseOn;
+		cout << (denoiseOn ? "Denoise ON" : "Denoise OFF") << endl;
+		accumBuffer.reset();		// albedo and normals are only recorded by a pixel's first sample
+		break;
 	case 'U':
 	case 'u':	incrementClamp(cameraFOV, isupper(key) ? 0.2 : -0.2, glm::radians(10.0), glm::radians(160.0));
 		W = frameBuffer.getWindowWidth();
 		H = frameBuffer.getWindowWidth();
 		cout << cameraFOV << endl;
+		accumBuffer.reset();
 		break;
 	case 'M':
-	case 'm':	break;
+	case 'm':	rayTrace.textureFilter = (TextureFilter)((rayTrace.textureFilter + 1) % 3);
+		cout << "Texture filter: " << (rayTrace.textureFilter == TEXTURE_NEAREST ? "nearest" :
+			rayTrace.textureFilter == TEXTURE_BILINEAR ? "bilinear" : "trilinear") << endl;
+		accumBuffer.reset();
+		break;
+	case 'T':
+	case 't':	frameBuffer.setToneMap((ToneMap)((frameBuffer.getToneMap() + 1) % 3));
+		cout << "Tone map: " << (frameBuffer.getToneMap() == TONE_MAP_CLAMP ? "clamp" :
+			frameBuffer.getToneMap() == TONE_MAP_REINHARD ? "Reinhard" : "ACES") << endl;
+		break;
+	case 'G':
+	case 'g':	frameBuffer.setExposure(frameBuffer.getExposure() * (isupper(key) ? 1.25 : 0.8));
+		cout << "Exposure: " << frameBuffer.getExposure() << endl;
+		break;
 	case '+':	antiAliasing = 3;
 		cout << "Anti aliasing: " << antiAliasing << endl;
 		break;
@@ -222,6 +301,7 @@ void keyboard(unsigned char key, int x, int y) {
 	case '1':
 	case '2':	numReflections = key - '0';
 		cout << "Num reflections: " << numReflections << endl;
+		accumBuffer.reset();
 		break;
 	case 'd':	isAnimated = !isAnimated;
 		break;
@@ -243,7 +323,14 @@ int main(int argc, char* argv[]) {
 	glutKeyboardFunc(keyboard);
 	glutMouseFunc(mouseUtility);
 	glutTimerFunc(TIME_INTERVAL, timer, 0);
-	buildScene();
+	if (argc > 1) {
+		sceneFromFile = SceneFile::load(argv[1], scene, sceneDesc,
+			frameBuffer.getWindowWidth(), frameBuffer.getWindowHeight());
+	}
+	if (!sceneFromFile) {
+		buildScene();
+	}
+	TextureRegistry::getInstance().waitForPrefetch();
 
 	glutMainLoop();
 
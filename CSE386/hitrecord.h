@@ -35,6 +35,7 @@ struct OpaqueHitRecord : HitRecord {
 	Material material;		//!< the Material value of the object.
 	Image* texture;			//!< the texture associated with this object, if any (nullptr when not textured).
 	double u, v;			//!< (u,v) correpsonding to intersection point.
+	double texelsPerUnit;	//!< texels of the texture per unit of distance across the ray, at the hit.
 
 	/**
 	 * @fn	static HitRecord getClosest(const vector<HitRecord> &hits)
@@ -8,98 +8,569 @@
  ****************************************************/
 
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <fstream>
 #include <utility>
 #include <set>
 #include "utilities.h"
 #include "image.h"
+#include "mappedfile.h"
+#include "parallel.h"
+#include "tilecache.h"
 
-static unsigned int getNextChar(std::ifstream& input, string& str) {
-	const int N = 2000;
-	char buf;
-	input.read(&buf, 1);
-	unsigned int result = (unsigned char)buf;
-	return result;
+const int PPM_ROWS_PER_TASK = 64;	//!< P6 rows converted by one thread at a time.
+const long long PPM_MAX_TEXELS = 1LL << 28;	//!< Larger PPM images are taken to be corrupt.
+const char TILED_IMAGE_MAGIC[8] = { 'C', 'S', 'E', 'T', 'I', 'L', 'E', 'S' };	//!< Starts a tiled image file.
+const int TILED_IMAGE_VERSION = 1;	//!< Changes whenever the tiled layout does.
+
+/**
+ * @struct	TiledImageHeader
+ * @brief	Start of a tiled image file. It is followed by a TiledLevelRecord per
+ * 			mip level, then by the tiles of every level, TEXTURE_TILE_BYTES each.
+ */
+
+struct TiledImageHeader {
+	char magic[8];			//!< TILED_IMAGE_MAGIC.
+	int version;			//!< TILED_IMAGE_VERSION.
+	int isSRGB;				//!< 1 if texels are sRGB encoded.
+	int W, H;				//!< size of the full-size image.
+	int numLevels;			//!< number of mip levels.
+	int tileSize;			//!< TEXTURE_TILE_SIZE.
+};
+
+/**
+ * @struct	TiledLevelRecord
+ * @brief	Where a mip level's tiles are in a tiled image file. Tiles are stored
+ * 			row by row; those on the right and bottom edges are padded by
+ * 			repeating the last column and row.
+ */
+
+struct TiledLevelRecord {
+	int W, H;				//!< size of the level.
+	int tilesPerRow;		//!< tiles across the level.
+	int tilesPerColumn;		//!< tiles down the level.
+	long long firstTile;	//!< index of the level's first tile.
+};
+
+/**
+ * @fn	static bool skipToNextToken(const char* &p, const char *end)
+ * @brief	Skips whitespace and # comments in a PPM header or P3 body.
+ * @param [in,out]	p  	The read position.
+ * @param 		  	end	The end of the file.
+ * @return	false if the end of the file was reached.
+ */
+
+static bool skipToNextToken(const char*& p, const char* end) {
+	while (p < end) {
+		if (*p == '#') {
+			while (p < end && *p != '\n') {
+				p++;
+			}
+		} else if (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '\v' || *p == '\f') {
+			p++;
+		} else {
+			return true;
+		}
+	}
+	return false;
 }
 
-static void p3(std::ifstream& input, Image& im) {
-	const int N = 100;
-	char buf[N + 1];
+/**
+ * @fn	static bool scanInt(const char* &p, const char *end, int &value)
+ * @brief	Reads a non-negative decimal integer, skipping whitespace and comments first.
+ * @param [in,out]	p	 	The read position; left just past the integer.
+ * @param 		  	end  	The end of the file.
+ * @param [out]   	value	The integer.
+ * @return	false if there is no integer at the read position.
+ */
 
-	int maxValue;
-	input >> im.W >> im.H >> maxValue;
-	input.getline(buf, N);
-
-	im.pixels = new color[im.W * im.H];
-	color* p = im.pixels;
-	for (int row = 0; row < im.H; row++) {
-		for (int col = 0; col < im.W; col++, p++) {
-			int r, g, b;
-			input >> r >> g >> b;
-			double R = map((double)r, 0.0, (double)maxValue, 0.0, 1.0);
-			double G = map((double)g, 0.0, (double)maxValue, 0.0, 1.0);
-			double B = map((double)b, 0.0, (double)maxValue, 0.0, 1.0);
-			*p = color(R, G, B);
+static bool scanInt(const char*& p, const char* end, int& value) {
+	if (!skipToNextToken(p, end) || *p < '0' || *p > '9') {
+		return false;
+	}
+	int result = 0;
+	while (p < end && *p >= '0' && *p <= '9' && result < 100000000) {
+		result = 10 * result + (*p - '0');
+		p++;
+	}
+	value = result;
+	return true;
+}
+
+/**
+ * @fn	static vector<unsigned char> makeSampleTable(int maxValue)
+ * @brief	Makes the table that converts samples to 8-bit texel values.
+ * @param	maxValue	The largest sample value of the image.
+ * @return	The texel value of each sample value from 0 to maxValue.
+ */
+
+static vector<unsigned char> makeSampleTable(int maxValue) {
+	vector<unsigned char> table(maxValue + 1);
+	for (int i = 0; i <= maxValue; i++) {
+		table[i] = (unsigned char)((255 * i + maxValue / 2) / maxValue);
+	}
+	return table;
+}
+
+/**
+ * @fn	static bool p3(const char *p, const char *end, unsigned char *out, size_t numSamples, int maxValue)
+ * @brief	Reads the texels of a plain (ASCII) PPM file.
+ * @param 	   	p		  	Start of the texels.
+ * @param 	   	end		  	The end of the file.
+ * @param [out]	out		  	The 8-bit samples, three per texel.
+ * @param 	   	numSamples	Number of samples to read.
+ * @param 	   	maxValue  	The largest sample value.
+ * @return	false if the file ends early.
+ */
+
+static bool p3(const char* p, const char* end, unsigned char* out, size_t numSamples, int maxValue) {
+	const vector<unsigned char> table = makeSampleTable(maxValue);
+	for (size_t i = 0; i < numSamples; i++) {
+		int value;
+		if (!scanInt(p, end, value)) {
+			return false;
 		}
+		out[i] = value <= maxValue ? table[value] : 255;
 	}
+	return true;
 }
 
-static void p6(std::ifstream& input, Image& im) {
-	const int N = 100;
-	char buf[N + 1];
+/**
+ * @fn	static bool p6(const char *p, const char *end, unsigned char *out, int W, int H, int maxValue)
+ * @brief	Reads the texels of a raw (binary) PPM file, a band of rows per thread.
+ * 			One-byte samples with a maximum of 255 are copied as they are; others
+ * 			(two bytes, most significant first, when maxValue is over 255) are
+ * 			converted through a table.
+ * @param 	   	p		 	Start of the texels.
+ * @param 	   	end		 	The end of the file.
+ * @param [out]	out		 	The 8-bit samples, three per texel.
+ * @param 	   	W		 	Width of the image.
+ * @param 	   	H		 	Height of the image.
+ * @param 	   	maxValue 	The largest sample value.
+ * @return	false if the file ends early.
+ */
+
+static bool p6(const char* p, const char* end, unsigned char* out, int W, int H, int maxValue) {
+	const int bytesPerSample = maxValue > 255 ? 2 : 1;
+	const size_t samplesPerRow = 3 * (size_t)W;
+	if ((size_t)(end - p) / bytesPerSample / samplesPerRow < (size_t)H) {
+		return false;
+	}
+	vector<unsigned char> table = makeSampleTable(maxValue);
+	table.resize(bytesPerSample == 1 ? 256 : 65536, 255);
+	const unsigned char* in = (const unsigned char*)p;
+	parallelForRange(H, PPM_ROWS_PER_TASK, [&](int firstRow, int lastRow) {
+		const size_t first = firstRow * samplesPerRow;
+		const size_t last = lastRow * samplesPerRow;
+		if (maxValue == 255) {
+			std::memcpy(out + first, in + first, last - first);
+		} else if (bytesPerSample == 1) {
+			for (size_t i = first; i < last; i++) {
+				out[i] = table[in[i]];
+			}
+		} else {
+			for (size_t i = first; i < last; i++) {
+				out[i] = table[(in[2 * i] << 8) | in[2 * i + 1]];
+			}
+		}
+	});
+	return true;
+}
 
+/**
+ * @fn	static bool readHeader(const char* &p, const char *end, string &type, int &width, int &height, int &maxValue)
+ * @brief	Reads the header of a PPM file.
+ * @param [in,out]	p		The start of the file; left at the first texel.
+ * @param 		  	end		The end of the file.
+ * @param [out]   	type	 	The magic number, P3 or P6.
+ * @param [out]   	width	 	Width of the image.
+ * @param [out]   	height	 	Height of the image.
+ * @param [out]   	maxValue	The largest sample value.
+ * @return	false if this is not a P3 or P6 file with a sensible size (at most
+ * 			PPM_MAX_TEXELS texels, so a damaged header cannot ask for more memory
+ * 			than there is).
+ */
+
+static bool readHeader(const char*& p, const char* end, string& type, int& width, int& height, int& maxValue) {
+	type = end - p >= 2 ? string(p, 2) : string();
+	p += type.size();
+	if ((type != "P3" && type != "P6") || !scanInt(p, end, width) || !scanInt(p, end, height) ||
+		!scanInt(p, end, maxValue) || width <= 0 || height <= 0 || (long long)width * height > PPM_MAX_TEXELS ||
+		maxValue <= 0 || maxValue > 65535 || p == end) {
+		return false;
+	}
+	p++;	// the single whitespace character ending the header
+	return true;
+}
+
+/**
+ * @fn	Image::Image(std::string ppmFileName, bool isSRGB, bool deferred)
+ * @brief	Constructs an image given the name of a PPM file. The file must be
+ * 			P3 or P6. Samples are kept to 8 bits.
+ * @param	ppmFileName	Filename of the ppm file.
+ * @param	isSRGB	   	true if the file is sRGB encoded, so that lookups convert
+ * 						texels to linear colors; false to use samples as they are.
+ * @param	deferred   	true to read only the size now, and the texels when the
+ * 						image is first looked up (or load is called).
+ */
+
+Image::Image(std::string ppmFileName, bool isSRGB, bool deferred)
+	: W(0), H(0), fileName(ppmFileName), isSRGB(isSRGB), loaded(false), tileFileId(-1) {
+	makeDecodeTable();
+	MappedFile file;
+	const char* p = file.open(fileName) ? file.getData() : nullptr;
+	if (p != nullptr && file.getSize() >= sizeof(TILED_IMAGE_MAGIC) &&
+		std::equal(TILED_IMAGE_MAGIC, TILED_IMAGE_MAGIC + sizeof(TILED_IMAGE_MAGIC), p)) {
+		if (!openTiled(p, p + file.getSize())) {
+			std::cerr << "Problem with tiled image file: " << fileName << endl;
+		}
+		loaded.store(true);
+		return;
+	}
+	if (!deferred) {
+		file.close();
+		load();
+		return;
+	}
+	string type;
 	int maxValue;
-	input >> im.W >> im.H >> maxValue;
-	input.getline(buf, N);
-
-	im.pixels = new color[im.W * im.H];
-	string buffer;
-	color* p = im.pixels;
-	for (int row = 0; row < im.H; row++) {
-		for (int col = 0; col < im.W; col++, p++) {
-			int r, g, b;
-			r = getNextChar(input, buffer);
-			g = getNextChar(input, buffer);
-			b = getNextChar(input, buffer);
-			double R = map((double)r, 0.0, (double)maxValue, 0.0, 1.0);
-			double G = map((double)g, 0.0, (double)maxValue, 0.0, 1.0);
-			double B = map((double)b, 0.0, (double)maxValue, 0.0, 1.0);
-			*p = color(R, G, B);
+	if (p == nullptr || !readHeader(p, p + file.getSize(), type, W, H, maxValue)) {
+		std::cerr << "Problem with PPM file: " << fileName << "(" << type << ")" << endl;
+		W = H = 0;
+		loaded.store(true);
+	}
+}
+
+/**
+ * @fn	Image::~Image()
+ * @brief	Drops the tiles of a tiled image from the tile cache.
+ */
+
+Image::~Image() {
+	if (tileFileId >= 0) {
+		TileCache::getInstance().releaseFile(tileFileId);
+	}
+}
+
+/**
+ * @fn	bool Image::openTiled(const char *p, const char *end)
+ * @brief	Reads the header and level table of a tiled image file and registers
+ * 			the file with the tile cache. No texels are read.
+ * @param	p  	The start of the file, memory mapped.
+ * @param	end	The end of the file.
+ * @return	false if the file is not a valid tiled image.
+ */
+
+bool Image::openTiled(const char* p, const char* end) {
+	const char* start = p;
+	TiledImageHeader header;
+	if (end - p < (long long)sizeof(header)) {
+		return false;
+	}
+	std::memcpy(&header, p, sizeof(header));
+	p += sizeof(header);
+	if (header.version != TILED_IMAGE_VERSION || header.tileSize != TEXTURE_TILE_SIZE ||
+		header.W <= 0 || header.H <= 0 || header.numLevels <= 0 ||
+		end - p < (long long)(header.numLevels * sizeof(TiledLevelRecord))) {
+		return false;
+	}
+	long long numTiles = 0;
+	vector<ImageLevel> tiledLevels(header.numLevels);
+	for (int i = 0; i < header.numLevels; i++) {
+		TiledLevelRecord record;
+		std::memcpy(&record, p, sizeof(record));
+		p += sizeof(record);
+		if (record.W <= 0 || record.H <= 0 || record.firstTile != numTiles ||
+			record.tilesPerRow != (record.W + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE ||
+			record.tilesPerColumn != (record.H + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE) {
+			return false;
 		}
+		tiledLevels[i].W = record.W;
+		tiledLevels[i].H = record.H;
+		tiledLevels[i].firstTile = record.firstTile;
+		tiledLevels[i].tilesPerRow = record.tilesPerRow;
+		numTiles += (long long)record.tilesPerRow * record.tilesPerColumn;
+	}
+	const long long dataOffset = p - start;
+	if (end - start < dataOffset + numTiles * TEXTURE_TILE_BYTES || !tiledFile.open(fileName)) {
+		return false;
 	}
+	W = header.W;
+	H = header.H;
+	isSRGB = header.isSRGB != 0;
+	makeDecodeTable();
+	levels = tiledLevels;
+	tileFileId = TileCache::getInstance().registerFile(&tiledFile, dataOffset);
+	return true;
 }
 
 /**
- * @fn	Image::Image(char *ppmFileName)
- * @brief	Constructs and image given the name of a PPM file. The file must be
- * 			P3 or P6.
- * @param [in,out]	ppmFileName	Filename of the ppm file.
+ * @fn	bool Image::writeTiled(const string &tiledFileName) const
+ * @brief	Writes the image, with its mip chain, as a tiled image file. Opening
+ * 			that file as an Image gives the same lookups as this image, without
+ * 			holding its texels in memory.
+ * @param	tiledFileName	The file to write.
+ * @return	false if the image could not be loaded or the file written.
  */
 
-Image::Image(std::string ppmFileName) : W(0), H(0) {
-	const int N = 100;
-	char buf1[N + 1];
-	char buf2[N + 1];
-	std::ifstream input(ppmFileName.c_str(), std::ios::binary);
-	input.getline(buf1, N);
-	int type = 3;
-	pixels = nullptr;
+bool Image::writeTiled(const string& tiledFileName) const {
+	ensureLoaded();
+	if (levels.empty() || isTiled()) {
+		std::cerr << "Cannot convert " << fileName << " to a tiled image" << endl;
+		return false;
+	}
+	std::ofstream out(tiledFileName.c_str(), std::ios::binary);
+	if (!out) {
+		std::cerr << "Cannot open " << tiledFileName << endl;
+		return false;
+	}
+	TiledImageHeader header;
+	std::memcpy(header.magic, TILED_IMAGE_MAGIC, sizeof(header.magic));
+	header.version = TILED_IMAGE_VERSION;
+	header.isSRGB = isSRGB ? 1 : 0;
+	header.W = W;
+	header.H = H;
+	header.numLevels = (int)levels.size();
+	header.tileSize = TEXTURE_TILE_SIZE;
+	out.write((const char*)&header, sizeof(header));
+
+	vector<TiledLevelRecord> records(levels.size());
+	long long numTiles = 0;
+	for (size_t i = 0; i < levels.size(); i++) {
+		records[i].W = levels[i].W;
+		records[i].H = levels[i].H;
+		records[i].tilesPerRow = (levels[i].W + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+		records[i].tilesPerColumn = (levels[i].H + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+		records[i].firstTile = numTiles;
+		numTiles += (long long)records[i].tilesPerRow * records[i].tilesPerColumn;
+	}
+	out.write((const char*)records.data(), records.size() * sizeof(TiledLevelRecord));
+
+	vector<unsigned char> tile(TEXTURE_TILE_BYTES);
+	for (size_t i = 0; i < levels.size(); i++) {
+		const ImageLevel& L = levels[i];
+		for (int ty = 0; ty < records[i].tilesPerColumn; ty++) {
+			for (int tx = 0; tx < records[i].tilesPerRow; tx++) {
+				for (int y = 0; y < TEXTURE_TILE_SIZE; y++) {
+					const int row = std::min(ty * TEXTURE_TILE_SIZE + y, L.H - 1);
+					for (int x = 0; x < TEXTURE_TILE_SIZE; x++) {
+						const int column = std::min(tx * TEXTURE_TILE_SIZE + x, L.W - 1);
+						std::memcpy(&tile[3 * (y * TEXTURE_TILE_SIZE + x)],
+									&L.texels[3 * ((size_t)row * L.W + column)], 3);
+					}
+				}
+				out.write((const char*)tile.data(), tile.size());
+			}
+		}
+	}
+	if (!out) {
+		std::cerr << "Problem writing " << tiledFileName << endl;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @fn	void Image::load()
+ * @brief	Decodes the file, memory mapped, and builds the mip chain, unless
+ * 			that has been done. Safe to call from several threads at once.
+ */
 
-	while (input.peek() == '#') {
-		input.getline(buf2, N);
+void Image::load() {
+	std::lock_guard<std::mutex> lock(loadMutex);
+	if (loaded.load(std::memory_order_acquire)) {
+		return;
 	}
-	string header(buf1);
-	header = header.substr(0, 2);
-	if (header == "P3") {
-		p3(input, *this);
-	} else if (header == "P6") {
-		p6(input, *this);
-	} else {
-		std::cerr << "Problem with PPM file: " << ppmFileName << "(" << header << ")" << endl;
+	MappedFile file;
+	string type;
+	int width = 0, height = 0, maxValue;
+	const char* p = file.open(fileName) ? file.getData() : nullptr;
+	const char* end = p + file.getSize();
+	if (p == nullptr || !readHeader(p, end, type, width, height, maxValue)) {
+		std::cerr << "Problem with PPM file: " << fileName << "(" << type << ")" << endl;
+		loaded.store(true, std::memory_order_release);
 		return;
 	}
 
-	input.close();
+	W = width;
+	H = height;
+	levels.resize(1);
+	levels[0].W = W;
+	levels[0].H = H;
+	levels[0].texels.resize(3 * (size_t)W * H);
+	unsigned char* out = levels[0].texels.data();
+	bool complete = type == "P3" ? p3(p, end, out, levels[0].texels.size(), maxValue)
+								: p6(p, end, out, W, H, maxValue);
+	if (!complete) {
+		std::cerr << "PPM file " << fileName << " is truncated" << endl;
+	}
+	buildMipChain();
+	loaded.store(true, std::memory_order_release);
+}
+
+/**
+ * @fn	void Image::makeDecodeTable()
+ * @brief	Fills in the linear intensity of each 8-bit texel value.
+ */
+
+void Image::makeDecodeTable() {
+	for (int i = 0; i < 256; i++) {
+		double c = map((double)i, 0.0, 255.0, 0.0, 1.0);
+		if (isSRGB) {
+			c = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+		}
+		decode[i] = c;
+	}
+}
+
+/**
+ * @fn	unsigned char Image::encode(double intensity) const
+ * @brief	Finds the 8-bit texel value whose intensity is closest to a linear intensity.
+ * @param	intensity	The linear intensity.
+ * @return	The texel value.
+ */
+
+unsigned char Image::encode(double intensity) const {
+	if (!isSRGB) {
+		return (unsigned char)glm::clamp((int)(intensity * 255.0 + 0.5), 0, 255);
+	}
+	int i = (int)(std::lower_bound(decode, decode + 256, intensity) - decode);
+	if (i == 256 || (i > 0 && intensity - decode[i - 1] < decode[i] - intensity)) {
+		i--;
+	}
+	return (unsigned char)i;
+}
+
+/**
+ * @struct	MipTaps
+ * @brief	The texels of a level, along one axis, that make up one texel of the
+ * 			next level, with the share of each. Halving an odd size gives texels
+ * 			covering one and a half texels of the level above.
+ */
+
+struct MipTaps {
+	int first;				//!< first texel covered.
+	int count;				//!< number of texels covered (2 or 3).
+	double weight[3];		//!< share of each, summing to 1.
+};
+
+/**
+ * @fn	static vector<MipTaps> makeMipTaps(int srcSize, int dstSize)
+ * @brief	Works out, along one axis, which texels of a level each texel of the
+ * 			next level covers, and by how much.
+ * @param	srcSize	Size of the level.
+ * @param	dstSize	Size of the next level.
+ * @return	The taps of each texel of the next level.
+ */
+
+static vector<MipTaps> makeMipTaps(int srcSize, int dstSize) {
+	vector<MipTaps> taps(dstSize);
+	const double scale = (double)srcSize / dstSize;
+	for (int i = 0; i < dstSize; i++) {
+		const double lo = i * scale, hi = (i + 1) * scale;
+		MipTaps& tap = taps[i];
+		tap.first = (int)lo;
+		tap.count = 0;
+		for (int k = tap.first; k < hi && k < srcSize && tap.count < 3; k++) {
+			double overlap = std::min(hi, k + 1.0) - std::max(lo, (double)k);
+			tap.weight[tap.count++] = overlap / scale;
+		}
+	}
+	return taps;
+}
+
+/**
+ * @fn	void Image::buildMipChain()
+ * @brief	Adds half-size levels until one is a single texel. Each texel is the
+ * 			area-weighted average, in linear intensity, of the texels it covers
+ * 			in the level above.
+ */
+
+void Image::buildMipChain() {
+	while (levels.back().W > 1 || levels.back().H > 1) {
+		const ImageLevel& src = levels.back();
+		ImageLevel dst;
+		dst.W = std::max(1, src.W / 2);
+		dst.H = std::max(1, src.H / 2);
+		dst.texels.resize(3 * (size_t)dst.W * dst.H);
+		const vector<MipTaps> xTaps = makeMipTaps(src.W, dst.W);
+		const vector<MipTaps> yTaps = makeMipTaps(src.H, dst.H);
+		parallelForRange(dst.H, PPM_ROWS_PER_TASK, [&](int firstRow, int lastRow) {
+			for (int y = firstRow; y < lastRow; y++) {
+				const MipTaps& ty = yTaps[y];
+				for (int x = 0; x < dst.W; x++) {
+					const MipTaps& tx = xTaps[x];
+					double sum[3] = { 0, 0, 0 };
+					for (int j = 0; j < ty.count; j++) {
+						const unsigned char* row = &src.texels[3 * (size_t)(ty.first + j) * src.W];
+						for (int i = 0; i < tx.count; i++) {
+							const unsigned char* t = row + 3 * (tx.first + i);
+							const double w = ty.weight[j] * tx.weight[i];
+							for (int c = 0; c < 3; c++) {
+								sum[c] += w * decode[t[c]];
+							}
+						}
+					}
+					unsigned char* out = &dst.texels[3 * ((size_t)y * dst.W + x)];
+					for (int c = 0; c < 3; c++) {
+						out[c] = encode(sum[c]);
+					}
+				}
+			}
+		});
+		levels.push_back(dst);
+	}
+}
+
+/**
+ * @fn	size_t Image::getMemorySize() const
+ * @brief	Gets the memory taken by the texels of all levels.
+ * @return	The size in bytes; 0 for a deferred image not yet decoded, or a
+ * 			tiled image, whose texels are in the TileCache.
+ */
+
+size_t Image::getMemorySize() const {
+	if (!isLoaded()) {
+		return 0;
+	}
+	size_t size = 0;
+	for (size_t i = 0; i < levels.size(); i++) {
+		size += levels[i].texels.size();
+	}
+	return size;
+}
+
+/**
+ * @fn	color Image::getTexel(int level, int x, int y) const
+ * @brief	Gets one texel of a mip level as a linear color. Coordinates outside
+ * 			the level are clamped to its edges.
+ * @param	level	The mip level; 0 is full size.
+ * @param	x	 	The column.
+ * @param	y	 	The row.
+ * @return	The color of the texel, or black if the image could not be loaded.
+ */
+
+color Image::getTexel(int level, int x, int y) const {
+	ensureLoaded();
+	if (levels.empty()) {
+		return black;
+	}
+	const ImageLevel& L = levels[glm::clamp(level, 0, (int)levels.size() - 1)];
+	x = glm::clamp(x, 0, L.W - 1);
+	y = glm::clamp(y, 0, L.H - 1);
+	if (isTiled()) {
+		unsigned char t[3];
+		const long long tile = L.firstTile + (long long)(y / TEXTURE_TILE_SIZE) * L.tilesPerRow + x / TEXTURE_TILE_SIZE;
+		const int texel = (y % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE + x % TEXTURE_TILE_SIZE;
+		if (!TileCache::getInstance().getTexel(tileFileId, tile, texel, t)) {
+			return black;
+		}
+		return color(decode[t[0]], decode[t[1]], decode[t[2]]);
+	}
+	const unsigned char* t = &L.texels[3 * ((size_t)y * L.W + x)];
+	return color(decode[t[0]], decode[t[1]], decode[t[2]]);
 }
 
 /**
@@ -113,7 +584,72 @@ Image::Image(std::string ppmFileName) : W(0), H(0) {
  */
 
 color Image::getPixelUV(double u, double v) const {
-	int x = glm::clamp((int)(W * u), 0, W - 1);
-	int y = glm::clamp((int)(H * v), 0, H - 1);
-	return pixels[y * W + x];
+	return getTexel(0, (int)(W * u), (int)(H * v));
+}
+
+/**
+ * @fn	color Image::getBilinearUV(double u, double v, int level) const
+ * @brief	Gets the color at (u, v) interpolated between the four nearest texel
+ * 			centers of a mip level.
+ * @param	u	 	The u in (u, v).
+ * @param	v	 	The v in (u, v).
+ * @param	level	The mip level; 0 is full size.
+ * @return	The interpolated color.
+ */
+
+color Image::getBilinearUV(double u, double v, int level) const {
+	ensureLoaded();
+	if (levels.empty()) {
+		return black;
+	}
+	level = glm::clamp(level, 0, (int)levels.size() - 1);
+	const ImageLevel& L = levels[level];
+	double x = glm::clamp(u, 0.0, 1.0) * L.W - 0.5;
+	double y = glm::clamp(v, 0.0, 1.0) * L.H - 0.5;
+	int x0 = (int)std::floor(x);
+	int y0 = (int)std::floor(y);
+	double fx = x - x0;
+	double fy = y - y0;
+	color top = (1 - fx) * getTexel(level, x0, y0) + fx * getTexel(level, x0 + 1, y0);
+	color bottom = (1 - fx) * getTexel(level, x0, y0 + 1) + fx * getTexel(level, x0 + 1, y0 + 1);
+	return (1 - fy) * top + fy * bottom;
+}
+
+/**
+ * @fn	color Image::getTrilinearUV(double u, double v, double lod) const
+ * @brief	Gets the color at (u, v) blended between bilinear lookups in the two mip
+ * 			levels around a fractional level of detail.
+ * @param	u  	The u in (u, v).
+ * @param	v  	The v in (u, v).
+ * @param	lod	The level of detail; 0 is full size, each step halves the size.
+ * @return	The interpolated color.
+ */
+
+color Image::getTrilinearUV(double u, double v, double lod) const {
+	lod = glm::clamp(lod, 0.0, (double)std::max(0, getNumLevels() - 1));
+	int level = (int)lod;
+	double f = lod - level;
+	color C = getBilinearUV(u, v, level);
+	return f > 0 ? (1 - f) * C + f * getBilinearUV(u, v, level + 1) : C;
+}
+
+/**
+ * @fn	color Image::getFilteredUV(double u, double v, double footprint, TextureFilter filter) const
+ * @brief	Gets the color at (u, v) for a lookup that covers footprint texels of
+ * 			the full-size image. The level of detail is log2(footprint), so a pixel
+ * 			covering many texels reads from a small, pre-averaged level.
+ * @param	u		 	The u in (u, v).
+ * @param	v		 	The v in (u, v).
+ * @param	footprint	Width of the area the lookup stands for, in full-size texels.
+ * @param	filter   	The filter.
+ * @return	The filtered color.
+ */
+
+color Image::getFilteredUV(double u, double v, double footprint, TextureFilter filter) const {
+	double lod = footprint > 1.0 ? std::log2(footprint) : 0.0;
+	switch (filter) {
+	case TEXTURE_NEAREST:	return getPixelUV(u, v);
+	case TEXTURE_BILINEAR:	return getBilinearUV(u, v, (int)(lod + 0.5));
+	default:				return getTrilinearUV(u, v, lod);
+	}
 }
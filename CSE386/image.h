@@ -9,18 +9,79 @@
 
 #pragma once
 #include <memory>
+#include <atomic>
+#include <mutex>
 #include "defs.h"
 #include "colorandmaterials.h"
+#include "mappedfile.h"
+
+/**
+ * @enum	TextureFilter
+ * @brief	How texels are combined when a texture is looked up.
+ */
+
+enum TextureFilter {
+	TEXTURE_NEAREST,		//!< the closest texel of the full-size image.
+	TEXTURE_BILINEAR,		//!< the four closest texels of the best-fitting mip level.
+	TEXTURE_TRILINEAR		//!< bilinear lookups in the two nearest mip levels, blended.
+};
+
+/**
+ * @struct	ImageLevel
+ * @brief	One level of an image's mip chain: 8-bit RGB texels, row by row. The
+ * 			levels of a tiled image hold no texels, only where their tiles are.
+ */
+
+struct ImageLevel {
+	int W, H;						//!< size of the level, in texels.
+	vector<unsigned char> texels;	//!< three bytes per texel.
+	long long firstTile;			//!< index of the level's first tile in a tiled file.
+	int tilesPerRow;				//!< tiles across the level in a tiled file.
+};
 
  /**
   * @struct	Image
-  * @brief	Represents a rectangular RGB image.
+  * @brief	Represents a rectangular RGB image, used as a texture. Texels are
+  * 			stored in 8 bits per channel, optionally sRGB encoded, along with a
+  * 			chain of half-size copies (mip levels) made when the image is loaded.
+  * 			Lookups decode texels to linear colors through a table. A deferred
+  * 			image knows only its size until it is first looked up. A tiled image
+  * 			(see writeTiled) stays on disk, and lookups read it through the
+  * 			shared TileCache, so very large textures take bounded memory.
   */
 
 struct Image {
-	int W, H;
-	color* pixels;
-	Image(std::string ppmFileName);
-	~Image() { delete[] pixels; }
+	int W, H;						//!< size of the full-size image, in texels.
+	Image(std::string ppmFileName, bool isSRGB = false, bool deferred = false);
+	~Image();
+	void load();
+	bool isLoaded() const { return loaded.load(std::memory_order_acquire); }
+	bool isTiled() const { return tileFileId >= 0; }
+	bool writeTiled(const string& tiledFileName) const;
+	const string& getFileName() const { return fileName; }
 	color getPixelUV(double u, double v) const;
+	color getBilinearUV(double u, double v, int level) const;
+	color getTrilinearUV(double u, double v, double lod) const;
+	color getFilteredUV(double u, double v, double footprint, TextureFilter filter) const;
+	color getTexel(int level, int x, int y) const;
+	int getNumLevels() const { ensureLoaded(); return (int)levels.size(); }
+	size_t getMemorySize() const;
+protected:
+	string fileName;				//!< the PPM or tiled file.
+	bool isSRGB;					//!< true if texels are sRGB encoded.
+	double decode[256];				//!< linear intensity of each 8-bit value.
+	vector<ImageLevel> levels;		//!< the mip chain; levels[0] is full size.
+	std::atomic<bool> loaded;		//!< true once levels is filled in (or loading failed).
+	std::mutex loadMutex;			//!< serializes load.
+	RandomAccessFile tiledFile;		//!< the open file of a tiled image.
+	int tileFileId;					//!< the TileCache id of tiledFile; -1 if not tiled.
+	void ensureLoaded() const {
+		if (!isLoaded()) {
+			const_cast<Image*>(this)->load();
+		}
+	}
+	bool openTiled(const char* p, const char* end);
+	void makeDecodeTable();
+	void buildMipChain();
+	unsigned char encode(double intensity) const;
 };
@@ -0,0 +1,365 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include "instance.h"
+#include "mappedfile.h"
+
+const int SCENE_BVH_LEAF_SIZE = 2;		//!< Objects per leaf of the top-level hierarchy.
+const int SCENE_BVH_STACK_SIZE = 64;	//!< Deeper than any median-split hierarchy of ints.
+
+/**
+ * @fn	IInstance::IInstance(IShapePtr shape, const dmat4 &transform)
+ * @brief	Places a shared shape in the world.
+ * @param	shape	 	The shape, which may be shared by many instances.
+ * @param	transform	Shape coordinates to world coordinates, e.g. T(...) * Ry(...) * S(...).
+ */
+
+IInstance::IInstance(IShapePtr shape, const dmat4& transform)
+	: shape(shape), toWorld(transform), toObject(glm::inverse(transform)),
+	normalToWorld(glm::transpose(glm::inverse(dmat3(transform)))) {
+}
+
+/**
+ * @fn	void IInstance::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Intersects the ray with the shared shape in the shape's coordinates and
+ * 			brings the hit back into the world.
+ * @param 		  	ray	The ray, in world coordinates.
+ * @param [in,out]	hit	The hit, in world coordinates; t is FLT_MAX if there is none.
+ */
+
+void IInstance::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
+	dvec3 origin = dvec3(toObject * dvec4(ray.origin, 1.0));
+	dvec3 dir = dvec3(toObject * dvec4(ray.dir, 0.0));
+	double scale = glm::length(dir);
+	if (scale == 0.0) {
+		hit.t = FLT_MAX;
+		return;
+	}
+	shape->findClosestIntersection(Ray(origin, dir), hit);
+	if (hit.t == FLT_MAX) {
+		return;
+	}
+	// The object-space ray has unit direction, so its t values are scaled.
+	hit.t /= scale;
+	hit.interceptPt = ray.getPoint(hit.t);
+	hit.normal = glm::normalize(normalToWorld * hit.normal);
+}
+
+/**
+ * @fn	void IInstance::getTexCoords(const dvec3 &pt, double &u, double &v) const
+ * @brief	Gets the shared shape's texture coordinates for a point on this instance.
+ * @param 		  	pt	The point, in world coordinates.
+ * @param [in,out]	u 	The u, in (u, v).
+ * @param [in,out]	v 	The v, in (u, v).
+ */
+
+void IInstance::getTexCoords(const dvec3& pt, double& u, double& v) const {
+	shape->getTexCoords(dvec3(toObject * dvec4(pt, 1.0)), u, v);
+}
+
+/**
+ * @fn	bool IInstance::getBoundingBox(BoundingBox &box) const
+ * @brief	Gets a world-space box around the instance: the box around the eight
+ * 			transformed corners of the shape's box.
+ * @param [out]	box	The bounding box, if there is one.
+ * @return	true iff the shared shape is bounded.
+ */
+
+bool IInstance::getBoundingBox(BoundingBox& box) const {
+	BoundingBox objectBox;
+	if (!shape->getBoundingBox(objectBox)) {
+		return false;
+	}
+	box = BoundingBox();
+	for (int i = 0; i < 8; i++) {
+		dvec3 corner((i & 1) ? objectBox.hi.x : objectBox.lo.x,
+			(i & 2) ? objectBox.hi.y : objectBox.lo.y,
+			(i & 4) ? objectBox.hi.z : objectBox.lo.z);
+		box.expand(dvec3(toWorld * dvec4(corner, 1.0)));
+	}
+	return true;
+}
+
+/**
+ * @fn	SceneBVH::SceneBVH()
+ * @brief	Constructs an empty hierarchy. Call build before use.
+ */
+
+SceneBVH::SceneBVH()
+	: built(false) {
+}
+
+/**
+ * @fn	void SceneBVH::clear()
+ * @brief	Discards the hierarchy.
+ */
+
+void SceneBVH::clear() {
+	built = false;
+	objs.clear();
+	unbounded.clear();
+	order.clear();
+	nodes.clear();
+}
+
+/**
+ * @fn	void SceneBVH::build(const vector<VisibleIShapePtr> &objs)
+ * @brief	Builds the hierarchy over a list of objects.
+ * @param	objs	The objects, in scene order.
+ */
+
+void SceneBVH::build(const vector<VisibleIShapePtr>& objs) {
+	clear();
+	this->objs = objs;
+	vector<BoundingBox> boxes(objs.size());
+	for (int i = 0; i < (int)objs.size(); i++) {
+		if (objs[i]->shape->getBoundingBox(boxes[i])) {
+			dvec3 largest = glm::max(glm::abs(boxes[i].lo), glm::abs(boxes[i].hi));
+			double pad = 1.0E-9 * (1.0 + std::max(largest.x, std::max(largest.y, largest.z)));
+			boxes[i].lo -= dvec3(pad, pad, pad);
+			boxes[i].hi += dvec3(pad, pad, pad);
+			order.push_back(i);
+		} else {
+			unbounded.push_back(i);
+		}
+	}
+	if (!order.empty()) {
+		nodes.reserve(2 * order.size());
+		buildNode(boxes, 0, (int)order.size());
+	}
+	built = true;
+}
+
+/**
+ * @fn	int SceneBVH::buildNode(const vector<BoundingBox> &boxes, int begin, int end)
+ * @brief	Builds the subtree over order[begin, end), splitting at the median along
+ * 			the axis where the objects' centers are most spread out.
+ * @param	boxes	Bounds of each object.
+ * @param	begin	First object of the subtree.
+ * @param	end  	One past the last object of the subtree.
+ * @return	Index of the subtree's root.
+ */
+
+int SceneBVH::buildNode(const vector<BoundingBox>& boxes, int begin, int end) {
+	const int index = (int)nodes.size();
+	nodes.push_back(SceneBVHNode());
+	BoundingBox box, centers;
+	for (int i = begin; i < end; i++) {
+		box.expand(boxes[order[i]]);
+		centers.expand(boxes[order[i]].center());
+	}
+	nodes[index].box = box;
+	if (end - begin <= SCENE_BVH_LEAF_SIZE) {
+		nodes[index].first = begin;
+		nodes[index].count = end - begin;
+		return index;
+	}
+
+	const dvec3 spread = centers.extent();
+	const int axis = spread.x >= spread.y && spread.x >= spread.z ? 0 : (spread.y >= spread.z ? 1 : 2);
+	const int mid = (begin + end) / 2;
+	std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+		[&](int a, int b) { return boxes[a].center()[axis] < boxes[b].center()[axis]; });
+	buildNode(boxes, begin, mid);
+	nodes[index].first = buildNode(boxes, mid, end);
+	nodes[index].count = 0;
+	return index;
+}
+
+/**
+ * @fn	static bool hitsBox(const BoundingBox &box, const Ray &ray, const dvec3 &invDir, double tLimit)
+ * @brief	Slab test of a ray against a box.
+ * @return	true iff the ray passes through the box between 0 and tLimit.
+ */
+
+static bool hitsBox(const BoundingBox& box, const Ray& ray, const dvec3& invDir, double tLimit) {
+	double tNear = 0.0, tFar = tLimit;
+	for (int a = 0; a < 3; a++) {
+		double t1 = (box.lo[a] - ray.origin[a]) * invDir[a];
+		double t2 = (box.hi[a] - ray.origin[a]) * invDir[a];
+		tNear = std::max(tNear, std::min(t1, t2));
+		tFar = std::min(tFar, std::max(t1, t2));
+	}
+	return tNear <= tFar;
+}
+
+/**
+ * @fn	static dvec3 inverseDirection(const dvec3 &dir)
+ * @brief	Componentwise inverse of a direction, kept finite.
+ */
+
+static dvec3 inverseDirection(const dvec3& dir) {
+	const double TINY = 1.0E-300;
+	dvec3 inv;
+	for (int a = 0; a < 3; a++) {
+		double d = std::fabs(dir[a]) < TINY ? (dir[a] < 0 ? -TINY : TINY) : dir[a];
+		inv[a] = 1.0 / d;
+	}
+	return inv;
+}
+
+/**
+ * @fn	void SceneBVH::findIntersection(const Ray &ray, OpaqueHitRecord &hit, int *objectIndex) const
+ * @brief	Finds the closest hit of a ray with the objects.
+ * @param 		  	ray		   	The ray.
+ * @param [out]	hit		   	The closest hit; t is FLT_MAX if there is none.
+ * @param [out]	objectIndex	If not nullptr, receives the index of the object hit (-1 if none).
+ */
+
+void SceneBVH::findIntersection(const Ray& ray, OpaqueHitRecord& hit, int* objectIndex) const {
+	hit.t = FLT_MAX;
+	int closest = -1;
+	auto test = [&](int i) {
+		OpaqueHitRecord hitForThisShape;
+		objs[i]->findClosestIntersection(ray, hitForThisShape);
+		if (hitForThisShape.t < hit.t || (hitForThisShape.t == hit.t && hit.t != FLT_MAX && i < closest)) {
+			hit = hitForThisShape;
+			closest = i;
+		}
+	};
+	for (int i : unbounded) {
+		test(i);
+	}
+	if (!nodes.empty()) {
+		const dvec3 invDir = inverseDirection(ray.dir);
+		int stack[SCENE_BVH_STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			const int index = stack[--top];
+			const SceneBVHNode& node = nodes[index];
+			if (!hitsBox(node.box, ray, invDir, hit.t)) {
+				continue;
+			}
+			if (node.count > 0) {
+				for (int i = node.first; i < node.first + node.count; i++) {
+					test(order[i]);
+				}
+			} else {
+				stack[top++] = node.first;
+				stack[top++] = index + 1;
+			}
+		}
+	}
+	if (objectIndex != nullptr) {
+		*objectIndex = closest;
+	}
+}
+
+/**
+ * @fn	bool SceneBVH::isOccluded(const Ray &ray, double maxT) const
+ * @brief	Tells whether any object is hit closer than maxT, stopping at the first
+ * 			such hit.
+ * @param	ray 	The ray (e.g., a shadow feeler).
+ * @param	maxT	Hits at or beyond this do not count.
+ * @return	true iff some object is hit before maxT.
+ */
+
+bool SceneBVH::isOccluded(const Ray& ray, double maxT) const {
+	for (int i : unbounded) {
+		HitRecord hit;
+		objs[i]->shape->findClosestIntersection(ray, hit);
+		if (hit.t < maxT) {
+			return true;
+		}
+	}
+	if (nodes.empty()) {
+		return false;
+	}
+	const dvec3 invDir = inverseDirection(ray.dir);
+	int stack[SCENE_BVH_STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const int index = stack[--top];
+		const SceneBVHNode& node = nodes[index];
+		if (!hitsBox(node.box, ray, invDir, maxT)) {
+			continue;
+		}
+		if (node.count > 0) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				HitRecord hit;
+				objs[order[i]]->shape->findClosestIntersection(ray, hit);
+				if (hit.t < maxT) {
+					return true;
+				}
+			}
+		} else {
+			stack[top++] = node.first;
+			stack[top++] = index + 1;
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	void SceneBVH::write(std::ostream &out) const
+ * @brief	Writes the hierarchy in binary form. The objects themselves are not
+ * 			written; they are identified by their index in the scene.
+ * @param	out	The binary output stream.
+ */
+
+void SceneBVH::write(std::ostream& out) const {
+	writeArray(out, unbounded);
+	writeArray(out, order);
+	writeArray(out, nodes);
+}
+
+/**
+ * @fn	bool SceneBVH::read(const char* &p, const char *end, const vector<VisibleIShapePtr> &objs)
+ * @brief	Restores a hierarchy saved by write, over the same objects in the same
+ * 			order, without rebuilding it.
+ * @param [in,out]	p   	The position to read from; advanced past the hierarchy.
+ * @param 		  	end 	The end of the readable memory.
+ * @param 		  	objs	The objects, in scene order.
+ * @return	false if the data is truncated, does not match the objects, or is
+ * 			too deep to traverse.
+ */
+
+bool SceneBVH::read(const char*& p, const char* end, const vector<VisibleIShapePtr>& objs) {
+	clear();
+	if (!readArray(p, end, unbounded) || !readArray(p, end, order) || !readArray(p, end, nodes) ||
+		unbounded.size() + order.size() != objs.size() || order.empty() != nodes.empty()) {
+		clear();
+		return false;
+	}
+	for (size_t i = 0; i < unbounded.size(); i++) {
+		if (unbounded[i] < 0 || unbounded[i] >= (int)objs.size()) {
+			clear();
+			return false;
+		}
+	}
+	for (size_t i = 0; i < order.size(); i++) {
+		if (order[i] < 0 || order[i] >= (int)objs.size()) {
+			clear();
+			return false;
+		}
+	}
+	// Children follow their parents, so a backward pass sees them first and can
+	// find how deep a traversal stack each subtree needs.
+	vector<int> stackNeeded(nodes.size(), 0);
+	for (int i = (int)nodes.size() - 1; i >= 0; i--) {
+		const SceneBVHNode& node = nodes[i];
+		bool valid = node.count > 0 ? node.first >= 0 && node.first <= (int)order.size() &&
+										node.count <= (int)order.size() - node.first
+									: node.first > i + 1 && node.first < (int)nodes.size();
+		if (valid && node.count == 0) {
+			stackNeeded[i] = std::max(2, 1 + std::max(stackNeeded[i + 1], stackNeeded[node.first]));
+			valid = stackNeeded[i] <= SCENE_BVH_STACK_SIZE;
+		}
+		if (!valid) {
+			clear();
+			return false;
+		}
+	}
+	this->objs = objs;
+	built = true;
+	return true;
+}
@@ -0,0 +1,77 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include "defs.h"
+#include "ishape.h"
+#include "hitrecord.h"
+
+/**
+ * @struct	IInstance
+ * @brief	A placed copy of a shared shape. The instance keeps only a transform;
+ * 			rays are carried into the shape's own coordinates, so any number of
+ * 			instances can reuse one shape or triangle mesh (and its hierarchy).
+ */
+
+struct IInstance : public IShape {
+	IInstance(IShapePtr shape, const dmat4& transform);
+	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual void getTexCoords(const dvec3& pt, double& u, double& v) const;
+	virtual bool getBoundingBox(BoundingBox& box) const;
+	IShapePtr getShape() const { return shape; }
+	const dmat4& getTransform() const { return toWorld; }
+protected:
+	IShapePtr shape;		//!< the shared shape, in its own coordinates.
+	dmat4 toWorld;			//!< shape coordinates to world coordinates.
+	dmat4 toObject;			//!< world coordinates to shape coordinates.
+	dmat3 normalToWorld;	//!< inverse transpose of toWorld's upper 3x3.
+};
+
+/**
+ * @struct	SceneBVHNode
+ * @brief	A node of the scene's top-level hierarchy. The left child of an interior
+ * 			node immediately follows it; the right child is at index first. A leaf
+ * 			holds count objects, starting at index first of SceneBVH::order.
+ */
+
+struct SceneBVHNode {
+	BoundingBox box;		//!< bounds of everything below this node.
+	int first;				//!< right child (interior node) or first object (leaf).
+	int count;				//!< number of objects in a leaf; 0 for interior nodes.
+};
+
+/**
+ * @struct	SceneBVH
+ * @brief	Top-level acceleration structure over the objects of a scene, most
+ * 			usefully instances. Each object's shape handles its own geometry (a
+ * 			triangle mesh has its own hierarchy), so the top level only has to
+ * 			find the objects a ray may hit. Objects without bounds are always
+ * 			tested. Hits are the same as testing the objects in order: of equally
+ * 			close hits, the object added first wins.
+ */
+
+struct SceneBVH {
+	SceneBVH();
+	void build(const vector<VisibleIShapePtr>& objs);
+	void clear();
+	bool isBuilt() const { return built; }
+	int getNumObjects() const { return (int)objs.size(); }
+	void findIntersection(const Ray& ray, OpaqueHitRecord& hit, int* objectIndex = nullptr) const;
+	bool isOccluded(const Ray& ray, double maxT) const;
+	void write(std::ostream& out) const;
+	bool read(const char*& p, const char* end, const vector<VisibleIShapePtr>& objs);
+protected:
+	bool built;							//!< true once build has been called.
+	vector<VisibleIShapePtr> objs;		//!< the objects, in scene order.
+	vector<int> unbounded;				//!< objects without bounds.
+	vector<int> order;					//!< bounded objects, grouped by leaf.
+	vector<SceneBVHNode> nodes;			//!< the hierarchy; nodes[0] is the root.
+	int buildNode(const vector<BoundingBox>& boxes, int begin, int end);
+};
@@ -7,7 +7,9 @@
  * permission is granted.
  ****************************************************/
 
+#include <algorithm>
 #include "iscene.h"
+#include "parallel.h"
 
 /**
  * @fn	void IScene::addOpaqueObject(const VisibleIShapePtr obj)
@@ -17,6 +19,7 @@
 
 void IScene::addOpaqueObject(const VisibleIShapePtr obj) {
 	opaqueObjs.push_back(obj);
+	opaqueBVH.clear();
 }
 
 /**
@@ -38,3 +41,212 @@ void IScene::addTransparentObject(const TransparentIShapePtr obj) {
 void IScene::addLight(const PositionalLightPtr light) {
 	lights.push_back(light);
 }
+
+/**
+ * @fn	void IScene::buildAccelerationStructure()
+ * @brief	Builds the top-level hierarchy over the opaque objects. Call it after
+ * 			the scene is complete; adding an opaque object discards it again.
+ */
+
+void IScene::buildAccelerationStructure() {
+	opaqueBVH.build(opaqueObjs);
+}
+
+/**
+ * @fn	void IScene::findOpaqueIntersection(const Ray &ray, OpaqueHitRecord &hit, int *objectIndex) const
+ * @brief	Finds the closest opaque object a ray hits, using the top-level hierarchy
+ * 			when it has been built.
+ * @param 		  	ray		   	The ray.
+ * @param [out]	hit		   	The closest hit; t is FLT_MAX if there is none.
+ * @param [out]	objectIndex	If not nullptr, receives the index of the object hit (-1 if none).
+ */
+
+void IScene::findOpaqueIntersection(const Ray& ray, OpaqueHitRecord& hit, int* objectIndex) const {
+	if (opaqueBVH.isBuilt()) {
+		opaqueBVH.findIntersection(ray, hit, objectIndex);
+		return;
+	}
+	hit.t = FLT_MAX;
+	int closest = -1;
+	for (int i = 0; i < (int)opaqueObjs.size(); i++) {
+		OpaqueHitRecord hitForThisShape;
+		opaqueObjs[i]->findClosestIntersection(ray, hitForThisShape);
+		if (hitForThisShape.t < hit.t) {
+			hit = hitForThisShape;
+			closest = i;
+		}
+	}
+	if (objectIndex != nullptr) {
+		*objectIndex = closest;
+	}
+}
+
+/**
+ * @fn	bool IScene::pointIsInAShadow(const PositionalLight &light, const dvec3 &intercept,
+ * 									const dvec3 &normal) const
+ * @brief	Determines if an intercept point is in the shadow of a light, using the
+ * 			top-level hierarchy when it has been built.
+ * @param	light	 	The light.
+ * @param	intercept	The position of the intercept.
+ * @param	normal   	The normal vector at the intercept point.
+ * @return	true iff an opaque object lies between the point and the light.
+ */
+
+bool IScene::pointIsInAShadow(const PositionalLight& light, const dvec3& intercept,
+	const dvec3& normal) const {
+	if (!opaqueBVH.isBuilt()) {
+		return light.pointIsInAShadow(intercept, normal, opaqueObjs, camera->getFrame());
+	}
+	Ray shadowFeeler = light.getShadowFeeler(intercept, normal, camera->getFrame());
+	return opaqueBVH.isOccluded(shadowFeeler, glm::distance(intercept, light.pos));
+}
+
+/**
+ * @fn	PrimaryRayTiles::PrimaryRayTiles()
+ * @brief	Constructs an empty set of tiles. Call build before use.
+ */
+
+PrimaryRayTiles::PrimaryRayTiles()
+	: tileSize(PRIMARY_TILE_SIZE), tilesPerRow(0), tilesPerColumn(0) {
+}
+
+/**
+ * @struct	TileBlock
+ * @brief	A rectangle of primary ray tiles, in the hierarchy PrimaryRayTiles::build
+ * 			culls objects down.
+ */
+
+struct TileBlock {
+	int x0, y0, x1, y1;	//!< Tile columns x0..x1-1 and rows y0..y1-1.
+	Frustum frustum;	//!< Frustum of the block's pixels, widened like a tile's.
+	int firstChild;		//!< Index of the first of the block's children.
+	int numChildren;	//!< Number of children, which follow each other; 0 for one tile.
+};
+
+/**
+ * @fn	static void splitTileBlock(vector<TileBlock> &blocks, int b)
+ * @brief	Splits a block into up to four halves along each side, and those in turn,
+ * 			until each block is a single tile.
+ * @param [in,out]	blocks	The blocks, to which the children are added.
+ * @param 		  	b	  	Index of the block to split.
+ */
+
+static void splitTileBlock(vector<TileBlock>& blocks, int b) {
+	const TileBlock block = blocks[b];
+	if (block.x1 - block.x0 == 1 && block.y1 - block.y0 == 1) {
+		return;
+	}
+	const int xs[3] = { block.x0, (block.x0 + block.x1 + 1) / 2, block.x1 };
+	const int ys[3] = { block.y0, (block.y0 + block.y1 + 1) / 2, block.y1 };
+	blocks[b].firstChild = (int)blocks.size();
+	blocks[b].numChildren = 0;
+	for (int j = 0; j < 2; j++) {
+		for (int i = 0; i < 2; i++) {
+			if (xs[i] < xs[i + 1] && ys[j] < ys[j + 1]) {
+				TileBlock child = { xs[i], ys[j], xs[i + 1], ys[j + 1], Frustum(), -1, 0 };
+				blocks.push_back(child);
+				blocks[b].numChildren++;
+			}
+		}
+	}
+	for (int c = 0; c < blocks[b].numChildren; c++) {
+		splitTileBlock(blocks, blocks[b].firstChild + c);
+	}
+}
+
+/**
+ * @fn	static void findTiles(const vector<TileBlock> &blocks, int b, const BoundingBox &box,
+ * 							int tilesPerRow, vector<int> &found)
+ * @brief	Finds the tiles of a block whose frustums a box may overlap.
+ * @param 		  	blocks	   	The block hierarchy.
+ * @param 		  	b		   	Index of the block to search.
+ * @param 		  	box		   	The box.
+ * @param 		  	tilesPerRow	Number of tile columns.
+ * @param [in,out]	found	   	Receives the index of each tile found.
+ */
+
+static void findTiles(const vector<TileBlock>& blocks, int b, const BoundingBox& box,
+	int tilesPerRow, vector<int>& found) {
+	const TileBlock& block = blocks[b];
+	if (!block.frustum.mayIntersect(box)) {
+		return;
+	}
+	if (block.numChildren == 0) {
+		found.push_back(block.y0 * tilesPerRow + block.x0);
+		return;
+	}
+	for (int c = 0; c < block.numChildren; c++) {
+		findTiles(blocks, block.firstChild + c, box, tilesPerRow, found);
+	}
+}
+
+/**
+ * @fn	void PrimaryRayTiles::build(const IScene &theScene, int width, int height, int tileSize)
+ * @brief	Builds the candidate lists of every tile for the scene's current camera.
+ * 			The frustum of a tile is widened by a pixel on each side so that it
+ * 			holds every sample the ray tracers take inside the tile's pixels.
+ * 			Each object is culled down a hierarchy of tile blocks, so it is only
+ * 			tested against the tiles in blocks its bounding box may overlap.
+ * 			The opaque lists are left empty once the scene's hierarchy is built,
+ * 			as primary rays then find their opaque hits through it.
+ * @param	theScene	The scene.
+ * @param	width   	Width of the window, in pixels.
+ * @param	height  	Height of the window, in pixels.
+ * @param	tileSize	Width and height of a tile, in pixels.
+ */
+
+void PrimaryRayTiles::build(const IScene& theScene, int width, int height, int tileSize) {
+	this->tileSize = tileSize;
+	tilesPerRow = (width + tileSize - 1) / tileSize;
+	tilesPerColumn = (height + tileSize - 1) / tileSize;
+	tiles.assign(tilesPerRow * tilesPerColumn, TileObjects());
+	if (tiles.empty()) {
+		return;
+	}
+
+	const RaytracingCamera& camera = *theScene.camera;
+	vector<TileBlock> blocks(1);
+	blocks[0] = { 0, 0, tilesPerRow, tilesPerColumn, Frustum(), -1, 0 };
+	splitTileBlock(blocks, 0);
+	parallelFor((int)blocks.size(), [&](int b) {
+		TileBlock& block = blocks[b];
+		const int x1 = std::min(block.x1 * tileSize, width);
+		const int y1 = std::min(block.y1 * tileSize, height);
+		block.frustum = camera.getFrustum(block.x0 * tileSize - 1.0, block.y0 * tileSize - 1.0,
+											x1 + 0.0, y1 + 0.0);
+	});
+
+	// The tiles each object may be seen in; every tile if it has no bounds
+	const vector<VisibleIShapePtr>& opaqueObjs = theScene.opaqueObjs;
+	const vector<TransparentIShapePtr>& transparentObjs = theScene.transparentObjs;
+	const int numOpaque = theScene.opaqueBVH.isBuilt() ? 0 : (int)opaqueObjs.size();
+	const int numObjects = numOpaque + (int)transparentObjs.size();
+	vector<vector<int>> objectTiles(numObjects);
+	vector<unsigned char> bounded(numObjects);
+	parallelFor(numObjects, [&](int i) {
+		IShapePtr shape = i < numOpaque ? opaqueObjs[i]->shape : transparentObjs[i - numOpaque]->shape;
+		BoundingBox box;
+		bounded[i] = shape->getBoundingBox(box);
+		if (bounded[i]) {
+			findTiles(blocks, 0, box, tilesPerRow, objectTiles[i]);
+		}
+	});
+
+	// Objects are added in scene order, so each tile's lists keep that order
+	for (int i = 0; i < numObjects; i++) {
+		if (!bounded[i]) {
+			objectTiles[i].resize(tiles.size());
+			for (size_t t = 0; t < tiles.size(); t++) {
+				objectTiles[i][t] = (int)t;
+			}
+		}
+		for (int t : objectTiles[i]) {
+			if (i < numOpaque) {
+				tiles[t].opaqueObjs.push_back(opaqueObjs[i]);
+				tiles[t].opaqueIndices.push_back(i);
+			} else {
+				tiles[t].transparentObjs.push_back(transparentObjs[i - numOpaque]);
+			}
+		}
+	}
+}
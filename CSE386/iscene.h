@@ -16,6 +16,7 @@
 #include "light.h"
 #include "eshape.h"
 #include "ishape.h"
+#include "instance.h"
 
  /**
   * @struct	IScene
@@ -27,7 +28,47 @@ struct IScene {
 	vector<VisibleIShapePtr> opaqueObjs;			//!< All the visible objects in the scene
 	vector<TransparentIShapePtr> transparentObjs;	//!< All the transparent objects in the scene
 	RaytracingCamera* camera;						//!< The one camera in the scene
+	SceneBVH opaqueBVH;								//!< Top-level hierarchy over opaqueObjs, once built
 	void addOpaqueObject(const VisibleIShapePtr obj);
 	void addTransparentObject(const TransparentIShapePtr obj);
 	void addLight(const PositionalLightPtr light);
+	void buildAccelerationStructure();
+	void findOpaqueIntersection(const Ray& ray, OpaqueHitRecord& hit, int* objectIndex = nullptr) const;
+	bool pointIsInAShadow(const PositionalLight& light, const dvec3& intercept, const dvec3& normal) const;
+};
+
+const int PRIMARY_TILE_SIZE = 16;	//!< Primary rays are culled in PRIMARY_TILE_SIZE^2 pixel tiles.
+
+/**
+ * @struct	TileObjects
+ * @brief	The objects that primary rays through one screen tile might hit, in the
+ * 			same order as in the scene.
+ */
+
+struct TileObjects {
+	vector<VisibleIShapePtr> opaqueObjs;			//!< opaque objects overlapping the tile's frustum.
+	vector<int> opaqueIndices;						//!< index of each of them in IScene::opaqueObjs.
+	vector<TransparentIShapePtr> transparentObjs;	//!< transparent objects overlapping the tile's frustum.
+};
+
+/**
+ * @struct	PrimaryRayTiles
+ * @brief	Per-tile candidate lists for primary rays. Every object is culled against
+ * 			the tiles' view frustums once per frame, so a primary ray only has to be
+ * 			intersected with the objects of its own tile. Objects without bounds
+ * 			are kept in every list. Opaque objects are only listed when the scene
+ * 			has no top-level hierarchy.
+ */
+
+struct PrimaryRayTiles {
+	PrimaryRayTiles();
+	void build(const IScene& theScene, int width, int height, int tileSize = PRIMARY_TILE_SIZE);
+	const TileObjects& getTile(int x, int y) const {
+		return tiles[(y / tileSize) * tilesPerRow + x / tileSize];
+	}
+protected:
+	int tileSize;					//!< width and height of a tile, in pixels.
+	int tilesPerRow;				//!< number of tile columns.
+	int tilesPerColumn;				//!< number of tile rows.
+	vector<TileObjects> tiles;		//!< candidate lists, row by row.
 };
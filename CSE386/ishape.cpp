@@ -11,6 +11,7 @@
 // CSE 386
 // Dr. Zmuda
 
+#include <algorithm>
 #include <vector>
 #include "ishape.h"
 #include "io.h"
@@ -36,6 +37,18 @@ void IShape::getTexCoords(const dvec3& pt, double& u, double& v) const {
 	u = v = 0;
 }
 
+/**
+ * @fn	bool IShape::getBoundingBox(BoundingBox &box) const
+ * @brief	Gets an axis-aligned box enclosing the shape. The default is to report
+ * 			the shape as unbounded.
+ * @param [out]	box	The bounding box, if there is one.
+ * @return	true iff the shape is bounded and box was set.
+ */
+
+bool IShape::getBoundingBox(BoundingBox& /*box*/) const {
+	return false;
+}
+
 /**
  * @fn	dvec3 IShape::movePointOffSurface(const dvec3 &pt, const dvec3 &n)
  * @brief	Compute point that is slightly off surface.
@@ -74,10 +87,46 @@ void VisibleIShape::findClosestIntersection(const Ray& ray, OpaqueHitRecord& hit
 	if (hit.t < FLT_MAX) {
 		hit.material = material;
 		hit.texture = texture;
-		if (hit.texture != nullptr)
-
+		if (hit.texture != nullptr) {
 			shape->getTexCoords(hit.interceptPt, hit.u, hit.v);
+			hit.texelsPerUnit = getTexelsPerUnit(ray, hit);
+		}
+	}
+}
+
+/**
+ * @fn	double VisibleIShape::getTexelsPerUnit(const Ray &ray, const OpaqueHitRecord &hit) const
+ * @brief	Estimates how many texels of the texture lie across one unit of width
+ * 			of the ray where it hits the surface, by stepping along the surface
+ * 			and measuring the change in texture coordinates. Along the direction
+ * 			the ray leans, the width is stretched by the obliquity of the hit.
+ * @param	ray	The ray.
+ * @param	hit	The hit, with its texture coordinates set.
+ * @return	The larger of the rates in the two directions across the surface.
+ */
+
+double VisibleIShape::getTexelsPerUnit(const Ray& ray, const OpaqueHitRecord& hit) const {
+	const dvec3 n = glm::normalize(hit.normal);
+	const dvec3 d = glm::normalize(ray.dir);
+	const double cosine = std::max(std::abs(glm::dot(d, n)), 0.05);
+	dvec3 along = d - glm::dot(d, n) * n;
+	if (glm::length(along) < 1.0E-6) {
+		along = glm::cross(n, std::abs(n.x) < 0.9 ? X_AXIS : Y_AXIS);
+	}
+	along = glm::normalize(along);
+	const dvec3 across = glm::cross(n, along);
+	const double step = 1.0E-4 * std::max(1.0, hit.t);
+	double result = 0.0;
+	for (int k = 0; k < 2; k++) {
+		double u, v;
+		shape->getTexCoords(hit.interceptPt + step * (k == 0 ? along : across), u, v);
+		// Coordinates that wrap around (e.g. at a cylinder's seam) change by less than half.
+		double du = (u - hit.u) - std::round(u - hit.u);
+		double dv = (v - hit.v) - std::round(v - hit.v);
+		double rate = glm::length(dvec2(du * hit.texture->W, dv * hit.texture->H)) / step;
+		result = std::max(result, k == 0 ? rate / cosine : rate);
 	}
+	return result;
 }
 
 /**
@@ -198,6 +247,22 @@ void IDisk::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
 	}
 }
 
+/**
+ * @fn	bool IDisk::getBoundingBox(BoundingBox &box) const
+ * @brief	Gets the box enclosing the disk. Along each axis the disk extends
+ * 			radius * sqrt(1 - n_i^2) from its center.
+ * @param [out]	box	The bounding box.
+ * @return	true.
+ */
+
+bool IDisk::getBoundingBox(BoundingBox& box) const {
+	dvec3 halfSize(radius * std::sqrt(std::max(0.0, 1.0 - n.x * n.x)),
+		radius * std::sqrt(std::max(0.0, 1.0 - n.y * n.y)),
+		radius * std::sqrt(std::max(0.0, 1.0 - n.z * n.z)));
+	box = BoundingBox(center - halfSize, center + halfSize);
+	return true;
+}
+
 /**
  * @fn	void IDisk::getTexCoords(const dvec3& pt, double& u, double& v) const
  * @brief	Determines the tex coords for a surface coordinate (x, y, z)
@@ -668,6 +733,26 @@ void IQuadricSurface::findClosestIntersection(const Ray& ray, HitRecord& hit) co
 	}
 }
 
+/**
+ * @fn	bool IQuadricSurface::getBoundingBox(BoundingBox &box) const
+ * @brief	Gets the box enclosing the quadric. Only axis-aligned ellipsoids
+ * 			(Ax^2 + By^2 + Cz^2 + J = 0, with A, B, C > 0 and J < 0) are bounded;
+ * 			other quadrics are reported as unbounded.
+ * @param [out]	box	The bounding box, if there is one.
+ * @return	true iff the quadric is an axis-aligned ellipsoid.
+ */
+
+bool IQuadricSurface::getBoundingBox(BoundingBox& box) const {
+	const QuadricParameters& q = qParams;
+	if (q.D != 0 || q.E != 0 || q.F != 0 || q.G != 0 || q.H != 0 || q.I != 0 ||
+		q.A <= 0 || q.B <= 0 || q.C <= 0 || q.J >= 0) {
+		return false;
+	}
+	dvec3 halfSize(std::sqrt(-q.J / q.A), std::sqrt(-q.J / q.B), std::sqrt(-q.J / q.C));
+	box = BoundingBox(center - halfSize, center + halfSize);
+	return true;
+}
+
 /**
  * @fn	dvec3 IQuadricSurface::normal(const dvec3 &P) const
  * @brief	Normals the given p
@@ -742,7 +827,7 @@ IConeY::IConeY(const dvec3& pos, double rad, double H)
  */
 
 void IConeY::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
-	static HitRecord hits[2];
+	HitRecord hits[2];
 	int numHits = IQuadricSurface::findIntersections(ray, hits);
 
 	if (numHits == 0) {
@@ -759,6 +844,19 @@ void IConeY::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
 	}
 }
 
+/**
+ * @fn	bool IConeY::getBoundingBox(BoundingBox &box) const
+ * @brief	Gets the box enclosing the cone, which hangs down from its tip at
+ * 			center to a base of the given radius.
+ * @param [out]	box	The bounding box.
+ * @return	true.
+ */
+
+bool IConeY::getBoundingBox(BoundingBox& box) const {
+	box = BoundingBox(center - dvec3(radius, height, radius), center + dvec3(radius, 0, radius));
+	return true;
+}
+
 /**
  * @fn	ICylinderY::ICylinderY()
  * @brief	Constructor for default ICylinderY
@@ -788,7 +886,7 @@ ICylinderY::ICylinderY(const dvec3& pos, double rad, double len)
  */
 
 void ICylinderY::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
-	static HitRecord hits[2];
+	HitRecord hits[2];
 	int numHits = IQuadricSurface::findIntersections(ray, hits);
 
 	const dvec3& origin = ray.origin, direction = ray.dir;
@@ -802,6 +900,19 @@ void ICylinderY::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
 	hit.t = FLT_MAX;
 }
 
+/**
+ * @fn	bool ICylinderY::getBoundingBox(BoundingBox &box) const
+ * @brief	Gets the box enclosing the cylinder.
+ * @param [out]	box	The bounding box.
+ * @return	true.
+ */
+
+bool ICylinderY::getBoundingBox(BoundingBox& box) const {
+	dvec3 halfSize(radius, length / 2, radius);
+	box = BoundingBox(center - halfSize, center + halfSize);
+	return true;
+}
+
 /**
 * @fn	void ICylinderY::getTexCoords(const dvec3 &pt, double &u, double &v) const
 * @brief	Gets tex coordinates
@@ -828,7 +939,7 @@ ICylinderZ::ICylinderZ(const dvec3& pos, double rad, double len)
 }
 
 void ICylinderZ::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
-	static HitRecord hits[2];
+	HitRecord hits[2];
 	int numHits = IQuadricSurface::findIntersections(ray, hits);
 
 	const dvec3& origin = ray.origin, direction = ray.dir;
@@ -842,6 +953,19 @@ void ICylinderZ::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
 	hit.t = FLT_MAX;
 }
 
+/**
+ * @fn	bool ICylinderZ::getBoundingBox(BoundingBox &box) const
+ * @brief	Gets the box enclosing the cylinder.
+ * @param [out]	box	The bounding box.
+ * @return	true.
+ */
+
+bool ICylinderZ::getBoundingBox(BoundingBox& box) const {
+	dvec3 halfSize(radius, radius, length / 2);
+	box = BoundingBox(center - halfSize, center + halfSize);
+	return true;
+}
+
 IClosedCylinderY::IClosedCylinderY(const dvec3& pos, double radius, double length) {
 	this->bottom = new IDisk(pos + dvec3(0.0, length / 2, 0.0), dvec3(0.0, 1.0, 0.0), radius);
 	this->top = new IDisk(pos - dvec3(0.0, length / 2, 0.0), dvec3(0.0, 1.0, 0.0), radius);
@@ -849,19 +973,28 @@ IClosedCylinderY::IClosedCylinderY(const dvec3& pos, double radius, double lengt
 }
 
 void IClosedCylinderY::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
-	static HitRecord tHit, bHit, cylHit;
 	top->findClosestIntersection(ray, hit);
 	bottom->findClosestIntersection(ray, hit);
 	body->findClosestIntersection(ray, hit);
-	if (tHit.t > cylHit.t && bHit.t > cylHit.t) {
-		hit = cylHit;
-	}
-	else if (tHit.t > bHit.t && cylHit.t > bHit.t) {
-		hit = bHit;
-	}
-	else if (cylHit.t > tHit.t && bHit.t > tHit.t) {
-		hit = tHit;
-	}
+}
+
+/**
+ * @fn	bool IClosedCylinderY::getBoundingBox(BoundingBox &box) const
+ * @brief	Gets the box enclosing the body and both lids.
+ * @param [out]	box	The bounding box.
+ * @return	true.
+ */
+
+bool IClosedCylinderY::getBoundingBox(BoundingBox& box) const {
+	BoundingBox part;
+	box = BoundingBox();
+	body->getBoundingBox(part);
+	box.expand(part);
+	top->getBoundingBox(part);
+	box.expand(part);
+	bottom->getBoundingBox(part);
+	box.expand(part);
+	return true;
 }
 
 /**
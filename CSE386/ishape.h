@@ -27,6 +27,8 @@ typedef TransparentIShape* TransparentIShapePtr;
 struct Ray {
 	dvec3 origin;		//!< starting point for this ray
 	dvec3 dir;			//!< direction for this ray, given it's origin
+	Ray() : origin(ORIGIN3D), dir(-Z_AXIS) {
+	}
 	Ray(const dvec3& rayOrigin, const dvec3& rayDirection) :
 		origin(rayOrigin), dir(glm::normalize(rayDirection)) {
 	}
@@ -35,6 +37,37 @@ struct Ray {
 	}
 };
 
+/**
+ * @struct	BoundingBox
+ * @brief	An axis-aligned box in 3D. A default-constructed box is empty and
+ * 			grows to enclose the points and boxes added to it.
+ */
+
+struct BoundingBox {
+	dvec3 lo;		//!< corner with the smallest coordinates
+	dvec3 hi;		//!< corner with the largest coordinates
+	BoundingBox() : lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX) {
+	}
+	BoundingBox(const dvec3& low, const dvec3& high) : lo(low), hi(high) {
+	}
+	bool isEmpty() const { return lo.x > hi.x || lo.y > hi.y || lo.z > hi.z; }
+	dvec3 center() const { return (lo + hi) / 2.0; }
+	dvec3 extent() const { return hi - lo; }
+	void expand(const dvec3& pt) {
+		lo = glm::min(lo, pt);
+		hi = glm::max(hi, pt);
+	}
+	void expand(const BoundingBox& box) {
+		lo = glm::min(lo, box.lo);
+		hi = glm::max(hi, box.hi);
+	}
+	bool overlaps(const BoundingBox& box) const {
+		return lo.x <= box.hi.x && hi.x >= box.lo.x &&
+			lo.y <= box.hi.y && hi.y >= box.lo.y &&
+			lo.z <= box.hi.z && hi.z >= box.lo.z;
+	}
+};
+
 /**
  * @struct	IShape
  * @brief	Base class for all implicit shapes.
@@ -42,8 +75,10 @@ struct Ray {
 
 struct IShape {
 	IShape();
+	virtual ~IShape() {}
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const = 0;
 	virtual void getTexCoords(const dvec3& pt, double& u, double& v) const;
+	virtual bool getBoundingBox(BoundingBox& box) const;
 	static dvec3 movePointOffSurface(const dvec3& pt, const dvec3& n);
 };
 
@@ -60,6 +95,8 @@ struct VisibleIShape {
 	void findClosestIntersection(const Ray& ray, OpaqueHitRecord& hit) const;
 	static void findIntersection(const Ray& ray, const vector<VisibleIShapePtr>& surfaces,
 		OpaqueHitRecord& opaqueHitRecord);
+protected:
+	double getTexelsPerUnit(const Ray& ray, const OpaqueHitRecord& hit) const;
 };
 
 /**
@@ -109,6 +146,7 @@ struct IDisk : public IShape {
 	IDisk(const dvec3& position, const dvec3& n, double rad);
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
 	virtual void getTexCoords(const dvec3& pt, double& u, double& v) const;
+	virtual bool getBoundingBox(BoundingBox& box) const;
 	dvec3 center;	//!< center point of disk
 	dvec3 n;		//!< normal vector of disk
 	double radius;
@@ -147,6 +185,7 @@ struct IQuadricSurface : public IShape {
 		const dvec3& position);
 	IQuadricSurface(const dvec3& position);
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual bool getBoundingBox(BoundingBox& box) const;
 	int findIntersections(const Ray& ray, HitRecord hits[2]) const;
 	dvec3 normal(const dvec3& pt) const;
 	void computeAqBqCq(const Ray& ray, double& Aq, double& Bq, double& Cq) const;
@@ -195,6 +234,7 @@ struct ICone : public IQuadricSurface {
 struct IConeY : public ICone {
 	IConeY(const dvec3& position, double R, double H);
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual bool getBoundingBox(BoundingBox& box) const;
 };
 
 /**
@@ -206,6 +246,7 @@ struct ICylinderY : public ICylinder {
 	ICylinderY();
 	ICylinderY(const dvec3& position, double R, double len);
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual bool getBoundingBox(BoundingBox& box) const;
 	void getTexCoords(const dvec3& pt, double& u, double& v) const;
 };
 
@@ -213,6 +254,7 @@ struct ICylinderZ : public ICylinder {
 	ICylinderZ();
 	ICylinderZ(const dvec3& pos, double r, double length);
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual bool getBoundingBox(BoundingBox& box) const;
 	// void getTexCoords(const dvec3& pt, double& u, double& v) const;
 };
 
@@ -223,6 +265,7 @@ struct IClosedCylinderY : public ICylinderY {
 	// IClosedCylinderY();
 	IClosedCylinderY(const dvec3& pos, double radius, double length);
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual bool getBoundingBox(BoundingBox& box) const;
 };
 
 /**
@@ -171,10 +171,7 @@ bool PositionalLight::pointIsInAShadow(const dvec3& intercept,
 	Ray shadowFeeler = getShadowFeeler(intercept, normal, eyeFrame);
 	OpaqueHitRecord hit;
 	VisibleIShape::findIntersection(shadowFeeler, objects, hit);
-	if (hit.t == FLT_MAX) {
-		return false;
-	}
-	return true;
+	return hit.t < dist;
 }
 
 /**
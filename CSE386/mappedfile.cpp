@@ -0,0 +1,259 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "mappedfile.h"
+
+#ifdef WINDOWS
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @fn	MappedFile::MappedFile()
+ * @brief	Constructs an object with no file mapped.
+ */
+
+MappedFile::MappedFile()
+	: data(nullptr), size(0), opened(false) {
+#ifdef WINDOWS
+	fileHandle = INVALID_HANDLE_VALUE;
+	mappingHandle = nullptr;
+#endif
+}
+
+/**
+ * @fn	MappedFile::~MappedFile()
+ * @brief	Releases the mapping.
+ */
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+/**
+ * @fn	bool MappedFile::open(const string &fileName)
+ * @brief	Maps a whole file into memory, read-only.
+ * @param	fileName	Name of the file.
+ * @return	true iff the file was mapped.
+ */
+
+bool MappedFile::open(const string& fileName) {
+	close();
+#ifdef WINDOWS
+	fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE) {
+		std::cerr << "Cannot open " << fileName << endl;
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(fileHandle, &fileSize);
+	size = (size_t)fileSize.QuadPart;
+	opened = true;
+	if (size == 0) {
+		return true;
+	}
+	mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mappingHandle != nullptr) {
+		data = (const char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	}
+#else
+	int fd = ::open(fileName.c_str(), O_RDONLY);
+	if (fd < 0) {
+		std::cerr << "Cannot open " << fileName << endl;
+		return false;
+	}
+	struct stat info;
+	fstat(fd, &info);
+	size = (size_t)info.st_size;
+	opened = true;
+	if (size == 0) {
+		::close(fd);
+		return true;
+	}
+	void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (p != MAP_FAILED) {
+		data = (const char*)p;
+		madvise(p, size, MADV_SEQUENTIAL);
+	}
+#endif
+	if (data == nullptr) {
+		std::cerr << "Cannot map " << fileName << endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @fn	void MappedFile::close()
+ * @brief	Releases the mapping, if there is one.
+ */
+
+void MappedFile::close() {
+#ifdef WINDOWS
+	if (data != nullptr) {
+		UnmapViewOfFile(data);
+	}
+	if (mappingHandle != nullptr) {
+		CloseHandle(mappingHandle);
+		mappingHandle = nullptr;
+	}
+	if (fileHandle != INVALID_HANDLE_VALUE) {
+		CloseHandle(fileHandle);
+		fileHandle = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (data != nullptr) {
+		munmap((void*)data, size);
+	}
+#endif
+	data = nullptr;
+	size = 0;
+	opened = false;
+}
+
+/**
+ * @fn	RandomAccessFile::RandomAccessFile()
+ * @brief	Constructs an object with no file open.
+ */
+
+RandomAccessFile::RandomAccessFile() {
+#ifdef WINDOWS
+	fileHandle = INVALID_HANDLE_VALUE;
+#else
+	fd = -1;
+#endif
+}
+
+/**
+ * @fn	RandomAccessFile::~RandomAccessFile()
+ * @brief	Closes the file.
+ */
+
+RandomAccessFile::~RandomAccessFile() {
+	close();
+}
+
+/**
+ * @fn	bool RandomAccessFile::open(const string &fileName)
+ * @brief	Opens a file for reading.
+ * @param	fileName	Name of the file.
+ * @return	true iff the file was opened.
+ */
+
+bool RandomAccessFile::open(const string& fileName) {
+	close();
+#ifdef WINDOWS
+	fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+#else
+	fd = ::open(fileName.c_str(), O_RDONLY);
+#endif
+	if (!isOpen()) {
+		std::cerr << "Cannot open " << fileName << endl;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @fn	void RandomAccessFile::close()
+ * @brief	Closes the file, if one is open.
+ */
+
+void RandomAccessFile::close() {
+#ifdef WINDOWS
+	if (fileHandle != INVALID_HANDLE_VALUE) {
+		CloseHandle(fileHandle);
+		fileHandle = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (fd >= 0) {
+		::close(fd);
+		fd = -1;
+	}
+#endif
+}
+
+/**
+ * @fn	bool RandomAccessFile::isOpen() const
+ * @brief	Tells whether a file is open.
+ * @return	true iff a file is open.
+ */
+
+bool RandomAccessFile::isOpen() const {
+#ifdef WINDOWS
+	return fileHandle != INVALID_HANDLE_VALUE;
+#else
+	return fd >= 0;
+#endif
+}
+
+/**
+ * @fn	bool RandomAccessFile::read(long long offset, void *buffer, size_t count) const
+ * @brief	Reads bytes at an offset, without moving any shared file position.
+ * @param 	   	offset	Position of the first byte.
+ * @param [out]	buffer	Receives the bytes.
+ * @param 	   	count 	Number of bytes.
+ * @return	false unless all count bytes were read.
+ */
+
+bool RandomAccessFile::read(long long offset, void* buffer, size_t count) const {
+	char* out = (char*)buffer;
+	while (count > 0) {
+#ifdef WINDOWS
+		OVERLAPPED position = {};
+		position.Offset = (DWORD)offset;
+		position.OffsetHigh = (DWORD)(offset >> 32);
+		DWORD got = 0;
+		DWORD request = (DWORD)std::min(count, (size_t)1 << 30);
+		if (!ReadFile(fileHandle, out, request, &got, &position) || got == 0) {
+			return false;
+		}
+#else
+		ssize_t got = pread(fd, out, count, (off_t)offset);
+		if (got <= 0) {
+			return false;
+		}
+#endif
+		out += got;
+		offset += got;
+		count -= (size_t)got;
+	}
+	return true;
+}
+
+/**
+ * @fn	bool getFileStamp(const string &fileName, long long &size, long long &modificationTime)
+ * @brief	Gets the size and modification time of a file, used to tell whether a
+ * 			cache built from it is stale.
+ * @param 		  	fileName			Name of the file.
+ * @param [out]	size				The size, in bytes.
+ * @param [out]	modificationTime	The time of the last modification.
+ * @return	true iff the file exists.
+ */
+
+bool getFileStamp(const string& fileName, long long& size, long long& modificationTime) {
+	struct stat info;
+	if (stat(fileName.c_str(), &info) != 0) {
+		return false;
+	}
+	size = (long long)info.st_size;
+	modificationTime = (long long)info.st_mtime;
+	return true;
+}
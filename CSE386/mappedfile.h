@@ -0,0 +1,110 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <cstring>
+#include <ostream>
+#include "defs.h"
+
+/**
+ * @struct	MappedFile
+ * @brief	A file mapped read-only into memory, so it can be parsed in place
+ * 			without copying it into a buffer first. The mapping is released when
+ * 			the object is destroyed or another file is opened.
+ */
+
+struct MappedFile {
+	MappedFile();
+	~MappedFile();
+	bool open(const string& fileName);
+	void close();
+	bool isOpen() const { return opened; }
+	const char* getData() const { return data; }
+	size_t getSize() const { return size; }
+protected:
+	const char* data;			//!< first byte of the file; nullptr if nothing is mapped.
+	size_t size;				//!< size of the file, in bytes.
+	bool opened;				//!< true if a file (possibly empty) is open.
+#ifdef WINDOWS
+	void* fileHandle;			//!< handle of the open file.
+	void* mappingHandle;		//!< handle of the file mapping.
+#endif
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator = (const MappedFile&) = delete;
+};
+
+/**
+ * @struct	RandomAccessFile
+ * @brief	A file open for reading at arbitrary offsets, for data too large to
+ * 			map or hold in memory. Reads from several threads may overlap.
+ */
+
+struct RandomAccessFile {
+	RandomAccessFile();
+	~RandomAccessFile();
+	bool open(const string& fileName);
+	void close();
+	bool isOpen() const;
+	bool read(long long offset, void* buffer, size_t count) const;
+protected:
+#ifdef WINDOWS
+	void* fileHandle;			//!< handle of the open file.
+#else
+	int fd;						//!< descriptor of the open file; -1 if none.
+#endif
+	RandomAccessFile(const RandomAccessFile&) = delete;
+	RandomAccessFile& operator = (const RandomAccessFile&) = delete;
+};
+
+bool getFileStamp(const string& fileName, long long& size, long long& modificationTime);
+
+/**
+ * @fn	template <class T> void writeArray(std::ostream &out, const vector<T> &V)
+ * @brief	Writes a vector of plain data as a count followed by its raw bytes, in the
+ * 			machine's own byte order.
+ * @param	out	The binary output stream.
+ * @param	V  	The vector.
+ */
+
+template <class T>
+void writeArray(std::ostream& out, const vector<T>& V) {
+	long long n = (long long)V.size();
+	out.write((const char*)&n, sizeof(n));
+	out.write((const char*)V.data(), V.size() * sizeof(T));
+}
+
+/**
+ * @fn	template <class T> bool readArray(const char* &p, const char *end, vector<T> &V)
+ * @brief	Reads a vector written by writeArray from memory (typically a mapped file),
+ * 			advancing past it.
+ * @param [in,out]	p  	The position to read from.
+ * @param 		  	end	The end of the readable memory.
+ * @param [out]   	V  	The vector.
+ * @return	false if the data is truncated.
+ */
+
+template <class T>
+bool readArray(const char*& p, const char* end, vector<T>& V) {
+	long long n;
+	if (end - p < (long long)sizeof(n)) {
+		return false;
+	}
+	std::memcpy(&n, p, sizeof(n));
+	p += sizeof(n);
+	if (n < 0 || (unsigned long long)(end - p) / sizeof(T) < (unsigned long long)n) {
+		return false;
+	}
+	V.resize((size_t)n);
+	if (n > 0) {
+		std::memcpy((void*)V.data(), p, (size_t)n * sizeof(T));
+	}
+	p += (size_t)n * sizeof(T);
+	return true;
+}
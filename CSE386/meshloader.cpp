@@ -0,0 +1,628 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include "meshloader.h"
+#include "mappedfile.h"
+#include "parallel.h"
+
+const char MESH_CACHE_MAGIC[8] = { 'C', 'S', 'E', 'M', 'E', 'S', 'H', '\0' };
+const unsigned int MESH_CACHE_VERSION = 1;		//!< Bump whenever the cache layout changes.
+const size_t OBJ_MIN_CHUNK_SIZE = 1 << 20;		//!< Smallest piece of a file given to one thread.
+
+/**
+ * @struct	MeshCacheHeader
+ * @brief	Start of a binary mesh cache. It is followed by the positions, the
+ * 			normals, the texture coordinates (if any) and the indices, as stored
+ * 			in memory.
+ */
+
+struct MeshCacheHeader {
+	char magic[8];					//!< MESH_CACHE_MAGIC.
+	unsigned int version;			//!< MESH_CACHE_VERSION.
+	unsigned int hasTexCoords;		//!< 1 if texture coordinates follow the normals.
+	long long sourceSize;			//!< size of the OBJ file the cache was built from.
+	long long sourceTime;			//!< modification time of that file.
+	long long numVertices;			//!< number of vertices.
+	long long numIndices;			//!< number of indices.
+};
+
+/**
+ * @fn	void IndexedMesh::clear()
+ * @brief	Removes all the vertices and triangles.
+ */
+
+void IndexedMesh::clear() {
+	positions.clear();
+	normals.clear();
+	texCoords.clear();
+	indices.clear();
+}
+
+/**
+ * @fn	EShapeData IndexedMesh::toEShapeData(const Material &mat) const
+ * @brief	Expands the mesh into the triangle list VertexOps::render draws.
+ * @param	mat	The material of every vertex.
+ * @return	Three vertices per triangle.
+ */
+
+EShapeData IndexedMesh::toEShapeData(const Material& mat) const {
+	EShapeData result;
+	result.reserve(indices.size());
+	for (int i : indices) {
+		result.push_back(VertexData(dvec4(positions[i], 1.0), normals[i], mat));
+	}
+	return result;
+}
+
+/**
+ * @fn	ITriangleMesh* IndexedMesh::createTriangleMesh() const
+ * @brief	Creates a ray tracing shape from the mesh.
+ * @return	The new shape.
+ */
+
+ITriangleMesh* IndexedMesh::createTriangleMesh() const {
+	return new ITriangleMesh(positions, indices, normals);
+}
+
+/**
+ * @struct	ObjCorner
+ * @brief	One corner of an OBJ face: zero-based position, texture coordinate and
+ * 			normal indices, the last two -1 when absent.
+ */
+
+struct ObjCorner {
+	int v;		//!< position index.
+	int vt;		//!< texture coordinate index.
+	int vn;		//!< normal index.
+};
+
+/**
+ * @struct	ObjChunk
+ * @brief	The part of an OBJ file one thread parses, and what it found there.
+ */
+
+struct ObjChunk {
+	const char* begin;			//!< first byte of the chunk; always the start of a line.
+	const char* end;			//!< one past the last byte.
+	int numPositions;			//!< "v" lines in the chunk.
+	int numTexCoords;			//!< "vt" lines in the chunk.
+	int numNormals;				//!< "vn" lines in the chunk.
+	int firstPosition;			//!< "v" lines before the chunk.
+	int firstTexCoord;			//!< "vt" lines before the chunk.
+	int firstNormal;			//!< "vn" lines before the chunk.
+	vector<ObjCorner> corners;	//!< corners of the chunk's faces.
+	vector<int> faceSizes;		//!< number of corners of each face.
+	const char* error;			//!< start of the first malformed line, or nullptr.
+};
+
+/**
+ * @fn	static const char* skipBlanks(const char *p, const char *end)
+ * @brief	Skips spaces and tabs.
+ */
+
+static const char* skipBlanks(const char* p, const char* end) {
+	while (p < end && (*p == ' ' || *p == '\t')) {
+		p++;
+	}
+	return p;
+}
+
+/**
+ * @fn	static const char* nextLine(const char *p, const char *end)
+ * @brief	Finds the start of the line after the one p is in.
+ */
+
+static const char* nextLine(const char* p, const char* end) {
+	const char* newline = (const char*)std::memchr(p, '\n', end - p);
+	return newline != nullptr ? newline + 1 : end;
+}
+
+/**
+ * @fn	static bool isBlank(char c)
+ * @brief	Tells whether a character separates tokens or ends a line.
+ */
+
+static bool isBlank(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/**
+ * @fn	static bool parseInt(const char *&p, const char *end, int &x)
+ * @brief	Parses an optionally signed decimal integer and advances p past it.
+ * @return	true iff there was one and its magnitude is at most INT_MAX.
+ */
+
+static bool parseInt(const char*& p, const char* end, int& x) {
+	bool negative = p < end && *p == '-';
+	if (p < end && (*p == '-' || *p == '+')) {
+		p++;
+	}
+	if (p >= end || *p < '0' || *p > '9') {
+		return false;
+	}
+	long long value = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		value = value * 10 + (*p++ - '0');
+		if (value > INT_MAX) {
+			return false;
+		}
+	}
+	x = (int)(negative ? -value : value);
+	return true;
+}
+
+/**
+ * @fn	static bool parseDouble(const char *&p, const char *end, double &x)
+ * @brief	Parses a decimal floating-point number and advances p past it. Unlike
+ * 			strtod, it needs no terminating zero, so it can read a mapped file.
+ * @return	true iff there was one.
+ */
+
+static bool parseDouble(const char*& p, const char* end, double& x) {
+	static const double powersOf10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	bool negative = p < end && *p == '-';
+	if (p < end && (*p == '-' || *p == '+')) {
+		p++;
+	}
+	unsigned long long mantissa = 0;
+	int exponent = 0;
+	int numDigits = 0;
+	for (; p < end && *p >= '0' && *p <= '9'; p++, numDigits++) {
+		if (mantissa < 100000000000000000ULL) {
+			mantissa = mantissa * 10 + (*p - '0');
+		} else {
+			exponent++;
+		}
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++, numDigits++) {
+			if (mantissa < 100000000000000000ULL) {
+				mantissa = mantissa * 10 + (*p - '0');
+				exponent--;
+			}
+		}
+	}
+	if (numDigits == 0) {
+		return false;
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		int e;
+		if (!parseInt(p, end, e)) {
+			return false;
+		}
+		exponent += e;
+	}
+	double value = (double)mantissa;
+	if (exponent < 0 && exponent >= -22) {
+		value /= powersOf10[-exponent];
+	} else if (exponent > 0 && exponent <= 22) {
+		value *= powersOf10[exponent];
+	} else if (exponent != 0) {
+		value *= std::pow(10.0, exponent);
+	}
+	x = negative ? -value : value;
+	return true;
+}
+
+/**
+ * @fn	static int lineKind(const char *&p, const char *end)
+ * @brief	Classifies a line by its keyword and advances p past the keyword.
+ * @return	'v', 't' (vt), 'n' (vn), 'f', or 0 for lines that are ignored.
+ */
+
+static int lineKind(const char*& p, const char* end) {
+	p = skipBlanks(p, end);
+	if (end - p < 2) {
+		return 0;
+	}
+	if (p[0] == 'v') {
+		if (isBlank(p[1])) {
+			p += 1;
+			return 'v';
+		}
+		if ((p[1] == 't' || p[1] == 'n') && p + 2 < end && isBlank(p[2])) {
+			p += 2;
+			return p[-1];
+		}
+	} else if (p[0] == 'f' && isBlank(p[1])) {
+		p += 1;
+		return 'f';
+	}
+	return 0;
+}
+
+/**
+ * @fn	static void countChunk(ObjChunk &chunk)
+ * @brief	First pass: counts the vertex attributes in a chunk so every chunk
+ * 			knows where its own go.
+ */
+
+static void countChunk(ObjChunk& chunk) {
+	chunk.numPositions = chunk.numTexCoords = chunk.numNormals = 0;
+	for (const char* line = chunk.begin; line < chunk.end; line = nextLine(line, chunk.end)) {
+		const char* p = line;
+		switch (lineKind(p, chunk.end)) {
+		case 'v':	chunk.numPositions++;	break;
+		case 't':	chunk.numTexCoords++;	break;
+		case 'n':	chunk.numNormals++;		break;
+		}
+	}
+}
+
+/**
+ * @fn	static bool resolveIndex(int index, int countSoFar, int &result)
+ * @brief	Converts a one-based or negative (relative) OBJ index to zero-based.
+ * @return	false for index 0, which OBJ does not allow, and for relative indices
+ * 			that reach before the first element.
+ */
+
+static bool resolveIndex(int index, int countSoFar, int& result) {
+	if (index > 0) {
+		result = index - 1;
+	} else if (index < 0) {
+		result = countSoFar + index;
+	} else {
+		return false;
+	}
+	return result >= 0;
+}
+
+/**
+ * @fn	static void parseChunk(ObjChunk &chunk, vector<dvec3> &positions,
+ * 							vector<dvec2> &texCoords, vector<dvec3> &normals)
+ * @brief	Second pass: parses a chunk, storing its vertex attributes directly into
+ * 			their final places and collecting its faces.
+ */
+
+static void parseChunk(ObjChunk& chunk, vector<dvec3>& positions,
+	vector<dvec2>& texCoords, vector<dvec3>& normals) {
+	int numPositions = chunk.firstPosition;
+	int numTexCoords = chunk.firstTexCoord;
+	int numNormals = chunk.firstNormal;
+	chunk.error = nullptr;
+	for (const char* line = chunk.begin; line < chunk.end; line = nextLine(line, chunk.end)) {
+		const char* p = line;
+		const char* end = chunk.end;
+		const int kind = lineKind(p, end);
+		bool ok = true;
+		if (kind == 'v' || kind == 'n') {
+			dvec3 value;
+			for (int c = 0; c < 3 && ok; c++) {
+				p = skipBlanks(p, end);
+				ok = parseDouble(p, end, value[c]);
+			}
+			if (kind == 'v') {
+				positions[numPositions++] = value;
+			} else {
+				normals[numNormals++] = value;
+			}
+		} else if (kind == 't') {
+			dvec2 value(0, 0);
+			p = skipBlanks(p, end);
+			ok = parseDouble(p, end, value.x);
+			p = skipBlanks(p, end);
+			if (ok && p < end && !isBlank(*p)) {
+				ok = parseDouble(p, end, value.y);
+			}
+			texCoords[numTexCoords++] = value;
+		} else if (kind == 'f') {
+			int size = 0;
+			while (ok) {
+				p = skipBlanks(p, end);
+				if (p >= end || *p == '\r' || *p == '\n' || *p == '#') {
+					break;
+				}
+				ObjCorner corner = { -1, -1, -1 };
+				int index;
+				ok = parseInt(p, end, index) && resolveIndex(index, numPositions, corner.v);
+				if (ok && p < end && *p == '/') {
+					p++;
+					if (p < end && *p != '/') {
+						ok = parseInt(p, end, index) && resolveIndex(index, numTexCoords, corner.vt);
+					}
+					if (ok && p < end && *p == '/') {
+						p++;
+						ok = parseInt(p, end, index) && resolveIndex(index, numNormals, corner.vn);
+					}
+				}
+				ok = ok && (p >= end || isBlank(*p));
+				chunk.corners.push_back(corner);
+				size++;
+			}
+			chunk.faceSizes.push_back(size);
+		}
+		if (!ok && chunk.error == nullptr) {
+			chunk.error = line;
+		}
+	}
+}
+
+/**
+ * @fn	bool MeshLoader::parseOBJ(const char *text, size_t length, IndexedMesh &mesh)
+ * @brief	Parses the contents of an OBJ file. Only positions ("v"), texture
+ * 			coordinates ("vt"), normals ("vn") and faces ("f") are used; polygons
+ * 			are split into fans of triangles. Corners that share a position but not
+ * 			a normal or texture coordinate become separate vertices. Vertices
+ * 			without a normal get the average of the normals of their triangles.
+ * @param 		  	text  	The file's contents; they need not end in a zero.
+ * @param 		  	length	The length of the contents.
+ * @param [out]	mesh  	The mesh.
+ * @return	true iff the contents are well formed.
+ */
+
+bool MeshLoader::parseOBJ(const char* text, size_t length, IndexedMesh& mesh) {
+	mesh.clear();
+	const char* end = text + length;
+
+	// Split the file into pieces that start at line boundaries.
+	const int maxChunks = 4 * ThreadPool::getInstance().getNumThreads();
+	const int numChunks = (int)std::max((size_t)1, std::min((size_t)maxChunks, length / OBJ_MIN_CHUNK_SIZE));
+	vector<ObjChunk> chunks(numChunks);
+	for (int i = 0; i < numChunks; i++) {
+		const char* start = text + length * i / numChunks;
+		chunks[i].begin = i == 0 ? text : nextLine(start - 1, end);
+		if (i > 0) {
+			chunks[i - 1].end = chunks[i].begin;
+		}
+	}
+	chunks[numChunks - 1].end = end;
+
+	parallelFor(numChunks, [&](int i) { countChunk(chunks[i]); });
+	int numPositions = 0, numTexCoords = 0, numNormals = 0;
+	for (ObjChunk& chunk : chunks) {
+		chunk.firstPosition = numPositions;
+		chunk.firstTexCoord = numTexCoords;
+		chunk.firstNormal = numNormals;
+		numPositions += chunk.numPositions;
+		numTexCoords += chunk.numTexCoords;
+		numNormals += chunk.numNormals;
+	}
+	vector<dvec3> positions(numPositions), normals(numNormals);
+	vector<dvec2> texCoords(numTexCoords);
+	parallelFor(numChunks, [&](int i) { parseChunk(chunks[i], positions, texCoords, normals); });
+
+	bool needsCornerVertices = false;
+	for (const ObjChunk& chunk : chunks) {
+		if (chunk.error != nullptr) {
+			int lineNumber = 1 + (int)std::count(text, chunk.error, '\n');
+			std::cerr << "OBJ line " << lineNumber << " is malformed" << endl;
+			return false;
+		}
+		for (const ObjCorner& c : chunk.corners) {
+			if (c.v >= numPositions || c.vt >= numTexCoords || c.vn >= numNormals) {
+				std::cerr << "OBJ face refers to a missing vertex" << endl;
+				return false;
+			}
+			needsCornerVertices = needsCornerVertices || c.vt >= 0 || c.vn >= 0;
+		}
+	}
+
+	// Give every distinct (position, texture coordinate, normal) its own vertex.
+	// The variants of each position are chained, since there are rarely more than a few.
+	vector<ObjCorner> vertices;
+	vector<int> firstVariant, nextVariant;
+	if (needsCornerVertices) {
+		firstVariant.assign(numPositions, -1);
+		vertices.reserve(numPositions);
+		nextVariant.reserve(numPositions);
+	} else {
+		mesh.positions.swap(positions);
+	}
+	auto vertexOf = [&](const ObjCorner& c) {
+		if (!needsCornerVertices) {
+			return c.v;
+		}
+		for (int k = firstVariant[c.v]; k >= 0; k = nextVariant[k]) {
+			if (vertices[k].vt == c.vt && vertices[k].vn == c.vn) {
+				return k;
+			}
+		}
+		const int k = (int)vertices.size();
+		vertices.push_back(c);
+		nextVariant.push_back(firstVariant[c.v]);
+		firstVariant[c.v] = k;
+		return k;
+	};
+
+	for (const ObjChunk& chunk : chunks) {
+		size_t first = 0;
+		for (int size : chunk.faceSizes) {
+			if (size >= 3) {
+				const int v0 = vertexOf(chunk.corners[first]);
+				int previous = vertexOf(chunk.corners[first + 1]);
+				for (int k = 2; k < size; k++) {
+					const int current = vertexOf(chunk.corners[first + k]);
+					mesh.indices.push_back(v0);
+					mesh.indices.push_back(previous);
+					mesh.indices.push_back(current);
+					previous = current;
+				}
+			}
+			first += size;
+		}
+	}
+
+	vector<unsigned char> hasNormal;
+	if (needsCornerVertices) {
+		const int numVertices = (int)vertices.size();
+		mesh.positions.resize(numVertices);
+		mesh.normals.assign(numVertices, dvec3(0, 0, 0));
+		hasNormal.assign(numVertices, 0);
+		if (numTexCoords > 0) {
+			mesh.texCoords.assign(numVertices, dvec2(0, 0));
+		}
+		for (int i = 0; i < numVertices; i++) {
+			mesh.positions[i] = positions[vertices[i].v];
+			if (vertices[i].vn >= 0 && glm::length(normals[vertices[i].vn]) > 0) {
+				mesh.normals[i] = glm::normalize(normals[vertices[i].vn]);
+				hasNormal[i] = 1;
+			}
+			if (vertices[i].vt >= 0) {
+				mesh.texCoords[i] = texCoords[vertices[i].vt];
+			}
+		}
+	} else {
+		mesh.normals.assign(mesh.positions.size(), dvec3(0, 0, 0));
+		hasNormal.assign(mesh.positions.size(), 0);
+	}
+
+	// Vertices without a normal get the area-weighted average of their triangles'.
+	for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+		const int* tri = &mesh.indices[i];
+		const dvec3& a = mesh.positions[tri[0]];
+		dvec3 n = glm::cross(mesh.positions[tri[1]] - a, mesh.positions[tri[2]] - a);
+		for (int k = 0; k < 3; k++) {
+			if (!hasNormal[tri[k]]) {
+				mesh.normals[tri[k]] += n;
+			}
+		}
+	}
+	for (size_t i = 0; i < mesh.normals.size(); i++) {
+		if (!hasNormal[i]) {
+			double len = glm::length(mesh.normals[i]);
+			mesh.normals[i] = len > 0 ? mesh.normals[i] / len : Y_AXIS;
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	bool MeshLoader::readCache(const string &cacheName, const string &sourceName, IndexedMesh &mesh)
+ * @brief	Loads a mesh from a binary cache, provided the cache was built from the
+ * 			current version of the source file and every index in it names one of
+ * 			its vertices.
+ * @param 		  	cacheName 	Name of the cache.
+ * @param 		  	sourceName	Name of the OBJ file the cache was built from.
+ * @param [out]	mesh	  	The mesh.
+ * @return	true iff the cache was valid and up to date.
+ */
+
+bool MeshLoader::readCache(const string& cacheName, const string& sourceName, IndexedMesh& mesh) {
+	long long cacheSize, cacheTime, sourceSize, sourceTime;
+	if (!getFileStamp(cacheName, cacheSize, cacheTime) ||
+		!getFileStamp(sourceName, sourceSize, sourceTime)) {
+		return false;
+	}
+	MappedFile file;
+	if (!file.open(cacheName) || file.getSize() < sizeof(MeshCacheHeader)) {
+		return false;
+	}
+	MeshCacheHeader header;
+	std::memcpy(&header, file.getData(), sizeof(header));
+	if (std::memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != MESH_CACHE_VERSION ||
+		header.sourceSize != sourceSize || header.sourceTime != sourceTime ||
+		header.numVertices < 0 || header.numVertices > INT_MAX ||
+		header.numIndices < 0 || header.numIndices > INT_MAX || header.numIndices % 3 != 0) {
+		return false;
+	}
+	const size_t n = (size_t)header.numVertices;
+	const size_t expected = sizeof(header) + n * (2 * sizeof(dvec3) + (header.hasTexCoords ? sizeof(dvec2) : 0)) +
+		(size_t)header.numIndices * sizeof(int);
+	if (file.getSize() != expected) {
+		std::cerr << cacheName << " is truncated" << endl;
+		return false;
+	}
+
+	const char* p = file.getData() + sizeof(header);
+	mesh.clear();
+	mesh.positions.resize(n);
+	mesh.normals.resize(n);
+	mesh.indices.resize((size_t)header.numIndices);
+	std::memcpy(mesh.positions.data(), p, n * sizeof(dvec3));
+	p += n * sizeof(dvec3);
+	std::memcpy(mesh.normals.data(), p, n * sizeof(dvec3));
+	p += n * sizeof(dvec3);
+	if (header.hasTexCoords) {
+		mesh.texCoords.resize(n);
+		std::memcpy(mesh.texCoords.data(), p, n * sizeof(dvec2));
+		p += n * sizeof(dvec2);
+	}
+	std::memcpy(mesh.indices.data(), p, mesh.indices.size() * sizeof(int));
+	for (int index : mesh.indices) {
+		if (index < 0 || index >= (int)n) {
+			std::cerr << cacheName << " refers to a missing vertex" << endl;
+			mesh.clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	bool MeshLoader::writeCache(const string &cacheName, const string &sourceName, const IndexedMesh &mesh)
+ * @brief	Saves a mesh in a binary cache, stamped with the source file's size and
+ * 			modification time. The cache is in the machine's own byte order.
+ * @param	cacheName 	Name of the cache.
+ * @param	sourceName	Name of the OBJ file the mesh was read from.
+ * @param	mesh	  	The mesh.
+ * @return	true iff the cache was written.
+ */
+
+bool MeshLoader::writeCache(const string& cacheName, const string& sourceName, const IndexedMesh& mesh) {
+	MeshCacheHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+	header.version = MESH_CACHE_VERSION;
+	header.hasTexCoords = mesh.texCoords.empty() ? 0 : 1;
+	header.numVertices = (long long)mesh.positions.size();
+	header.numIndices = (long long)mesh.indices.size();
+	if (!getFileStamp(sourceName, header.sourceSize, header.sourceTime)) {
+		return false;
+	}
+
+	std::ofstream out(cacheName.c_str(), std::ios::binary);
+	out.write((const char*)&header, sizeof(header));
+	out.write((const char*)mesh.positions.data(), mesh.positions.size() * sizeof(dvec3));
+	out.write((const char*)mesh.normals.data(), mesh.normals.size() * sizeof(dvec3));
+	if (header.hasTexCoords) {
+		out.write((const char*)mesh.texCoords.data(), mesh.texCoords.size() * sizeof(dvec2));
+	}
+	out.write((const char*)mesh.indices.data(), mesh.indices.size() * sizeof(int));
+	if (!out) {
+		std::cerr << "Cannot write " << cacheName << endl;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @fn	bool MeshLoader::loadOBJ(const string &fileName, IndexedMesh &mesh, bool useCache)
+ * @brief	Loads a mesh from an OBJ file, or from its binary cache if that is up to
+ * 			date. A fresh cache is written after parsing.
+ * @param 		  	fileName	Name of the OBJ file.
+ * @param [out]	mesh		The mesh.
+ * @param 		  	useCache	false to always parse and never write a cache.
+ * @return	true iff the mesh was loaded.
+ */
+
+bool MeshLoader::loadOBJ(const string& fileName, IndexedMesh& mesh, bool useCache) {
+	const string cacheName = getCacheName(fileName);
+	if (useCache && readCache(cacheName, fileName, mesh)) {
+		return true;
+	}
+	MappedFile file;
+	if (!file.open(fileName)) {
+		return false;
+	}
+	if (!parseOBJ(file.getData(), file.getSize(), mesh)) {
+		std::cerr << "Cannot load " << fileName << endl;
+		return false;
+	}
+	if (useCache) {
+		writeCache(cacheName, fileName, mesh);
+	}
+	return true;
+}
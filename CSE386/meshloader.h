@@ -0,0 +1,49 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include "defs.h"
+#include "eshape.h"
+#include "trianglemesh.h"
+
+/**
+ * @struct	IndexedMesh
+ * @brief	Triangles sharing a single list of vertices. Every vertex has a
+ * 			position and a normal, and texture coordinates when the source had
+ * 			them.
+ */
+
+struct IndexedMesh {
+	vector<dvec3> positions;		//!< vertex positions.
+	vector<dvec3> normals;			//!< unit vertex normals, one per position.
+	vector<dvec2> texCoords;		//!< texture coordinates, one per position, or none.
+	vector<int> indices;			//!< three vertex indices per triangle.
+	int getNumVertices() const { return (int)positions.size(); }
+	int getNumTriangles() const { return (int)indices.size() / 3; }
+	void clear();
+	EShapeData toEShapeData(const Material& mat) const;
+	ITriangleMesh* createTriangleMesh() const;
+};
+
+/**
+ * @struct	MeshLoader
+ * @brief	Reads meshes from Wavefront OBJ files. The file is memory mapped and
+ * 			tokenized in place by several threads at once. The result is saved
+ * 			in a binary cache next to the file (name + ".mesh"), which later
+ * 			loads skip straight to while the OBJ file is unchanged.
+ */
+
+struct MeshLoader {
+	static bool loadOBJ(const string& fileName, IndexedMesh& mesh, bool useCache = true);
+	static bool parseOBJ(const char* text, size_t length, IndexedMesh& mesh);
+	static bool readCache(const string& cacheName, const string& sourceName, IndexedMesh& mesh);
+	static bool writeCache(const string& cacheName, const string& sourceName, const IndexedMesh& mesh);
+	static string getCacheName(const string& fileName) { return fileName + ".mesh"; }
+};
@@ -0,0 +1,135 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include "parallel.h"
+
+static thread_local bool insideParallelLoop = false;	//!< true while a thread runs loop iterations.
+
+/**
+ * @fn	ThreadPool &ThreadPool::getInstance()
+ * @brief	Gets the shared thread pool, creating it on first use with one worker
+ * 			per hardware thread, less the caller.
+ * @return	The thread pool.
+ */
+
+ThreadPool& ThreadPool::getInstance() {
+	static ThreadPool pool((int)std::thread::hardware_concurrency() - 1);
+	return pool;
+}
+
+/**
+ * @fn	ThreadPool::ThreadPool(int numWorkers)
+ * @brief	Starts the worker threads.
+ * @param	numWorkers	Number of worker threads. Zero or less runs everything serially.
+ */
+
+ThreadPool::ThreadPool(int numWorkers)
+	: body(nullptr), count(0), nextIndex(0), remaining(0),
+	activeWorkers(0), generation(0), stopping(false) {
+	for (int i = 0; i < numWorkers; i++) {
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+/**
+ * @fn	ThreadPool::~ThreadPool()
+ * @brief	Stops and joins the worker threads.
+ */
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeWorkers.notify_all();
+	for (std::thread& t : workers) {
+		t.join();
+	}
+}
+
+/**
+ * @fn	void ThreadPool::runIterations()
+ * @brief	Claims and runs iterations of the current loop until none are left.
+ */
+
+void ThreadPool::runIterations() {
+	bool wasInside = insideParallelLoop;
+	insideParallelLoop = true;
+	int i;
+	while ((i = nextIndex.fetch_add(1)) < count) {
+		(*body)(i);
+		if (remaining.fetch_sub(1) == 1) {
+			std::lock_guard<std::mutex> lock(mutex);
+			loopDone.notify_all();
+		}
+	}
+	insideParallelLoop = wasInside;
+}
+
+/**
+ * @fn	void ThreadPool::workerLoop()
+ * @brief	Body of each worker thread: waits for a loop to be posted and helps run it.
+ */
+
+void ThreadPool::workerLoop() {
+	unsigned long long seen = 0;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wakeWorkers.wait(lock, [&] { return stopping || generation != seen; });
+		if (stopping) {
+			return;
+		}
+		seen = generation;
+		activeWorkers++;
+		lock.unlock();
+		runIterations();
+		lock.lock();
+		activeWorkers--;
+		if (activeWorkers == 0) {
+			loopDone.notify_all();
+		}
+	}
+}
+
+/**
+ * @fn	void ThreadPool::parallelFor(int count, const std::function<void(int)> &body)
+ * @brief	Runs body(i) for every i in [0, count) and waits for all of them.
+ * @param	count	Number of iterations.
+ * @param	body 	The loop body.
+ */
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& body) {
+	if (count <= 0) {
+		return;
+	}
+	if (workers.empty() || count == 1 || insideParallelLoop) {
+		for (int i = 0; i < count; i++) {
+			body(i);
+		}
+		return;
+	}
+
+	std::lock_guard<std::mutex> submitLock(submitMutex);
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		// Stragglers from the previous loop may still be reading its fields.
+		loopDone.wait(lock, [&] { return activeWorkers == 0; });
+		this->body = &body;
+		this->count = count;
+		nextIndex = 0;
+		remaining = count;
+		generation++;
+	}
+	wakeWorkers.notify_all();
+
+	runIterations();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	loopDone.wait(lock, [&] { return remaining == 0; });
+}
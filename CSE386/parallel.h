@@ -0,0 +1,86 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "defs.h"
+
+/**
+ * @class	ThreadPool
+ * @brief	A fixed set of worker threads that execute the iterations of a parallel
+ * 			loop. The thread that submits a loop takes part in it, so a machine with
+ * 			N cores gets N-1 workers. Only one loop runs at a time; a loop started
+ * 			from inside another loop's body runs serially on the calling thread.
+ */
+
+class ThreadPool {
+public:
+	static ThreadPool& getInstance();
+	int getNumThreads() const { return (int)workers.size() + 1; }
+	void parallelFor(int count, const std::function<void(int)>& body);
+	~ThreadPool();
+protected:
+	ThreadPool(int numWorkers);
+	void workerLoop();
+	void runIterations();
+
+	vector<std::thread> workers;				//!< The worker threads.
+	std::mutex submitMutex;						//!< Serializes submissions of loops.
+	std::mutex mutex;							//!< Guards the fields describing the current loop.
+	std::condition_variable wakeWorkers;		//!< Signalled when a loop is posted.
+	std::condition_variable loopDone;			//!< Signalled when a loop is finished.
+	const std::function<void(int)>* body;		//!< Body of the current loop.
+	int count;									//!< Number of iterations in the current loop.
+	std::atomic<int> nextIndex;					//!< Next iteration to be handed out.
+	std::atomic<int> remaining;					//!< Iterations not yet finished.
+	int activeWorkers;							//!< Workers currently inside runIterations.
+	unsigned long long generation;				//!< Incremented for every posted loop.
+	bool stopping;								//!< True when the pool is shutting down.
+};
+
+/**
+ * @fn	template <class Body> inline void parallelFor(int count, const Body &body)
+ * @brief	Calls body(i) for every i in [0, count), spreading the calls over the
+ * 			shared thread pool. Returns once all calls have finished. Iterations
+ * 			are handed out one at a time, so each should carry a reasonable amount
+ * 			of work (e.g., a row or a tile). The pool is handed a reference to the
+ * 			body, so however much a lambda captures, nothing is allocated.
+ * @tparam	Body	Any callable taking an int.
+ * @param	count	Number of iterations.
+ * @param	body 	The loop body.
+ */
+
+template <class Body>
+inline void parallelFor(int count, const Body& body) {
+	ThreadPool::getInstance().parallelFor(count, std::cref(body));
+}
+
+/**
+ * @fn	template <class Body> inline void parallelForRange(int count, int grainSize, const Body &body)
+ * @brief	Splits [0, count) into chunks of grainSize and calls body(begin, end)
+ * 			for each chunk on the shared thread pool.
+ * @tparam	Body		Any callable taking two ints.
+ * @param	count	 	Number of items.
+ * @param	grainSize	Number of items per chunk.
+ * @param	body	 	The loop body, called with a half-open range of items.
+ */
+
+template <class Body>
+inline void parallelForRange(int count, int grainSize, const Body& body) {
+	const int numChunks = (count + grainSize - 1) / grainSize;
+	parallelFor(numChunks, [&](int chunk) {
+		const int begin = chunk * grainSize;
+		const int end = begin + grainSize < count ? begin + grainSize : count;
+		body(begin, end);
+	});
+}
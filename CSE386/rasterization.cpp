@@ -9,6 +9,11 @@
 
 #include <cmath>
 #include "rasterization.h"
+#include "parallel.h"
+
+const int RASTER_BIN_SIZE = 64;		//!< Width and height of the screen bins of drawManyFilledTriangles; a multiple of FRAMEBUFFER_TILE_SIZE.
+const int RASTER_BLOCK_SIZE = FRAMEBUFFER_TILE_SIZE;	//!< Width and height of the blocks a triangle is accepted or rejected in.
+const int RASTER_SUBPIXEL_BITS = 8;	//!< Fraction bits of fixed-point window coordinates.
 
  /**
  * @fn	template <class T> T barycentricWeighting(double w1, double w2, double w3,
@@ -222,246 +227,216 @@ void drawAxisOnWindow(FrameBuffer& fb) {
 }
 
 /**
- * @fn	double cheapNonPerspectiveCorrectInterpolationForLines(const dvec2 &start, const dvec2 &end,
- *																const dvec2 &online)
- * @brief	Cheap non perspective correct interpolation for lines
- * @param	start 	The starting vertex.
- * @param	end   	The ending vertex
- * @param	online	The 2D point to interpolate.
- * @return	Interpolated value.
+ * @fn	static bool clipLineToWindow(const dvec4 &p0, const dvec4 &p1, double W, double H,
+ * 									double &t0, double &t1)
+ * @brief	Clips the segment p0-p1 to the rectangle [0,W]x[0,H] (Liang-Barsky).
+ * @param 	   	p0	First endpoint, in window coordinates.
+ * @param 	   	p1	Second endpoint, in window coordinates.
+ * @param 	   	W 	Window width.
+ * @param 	   	H 	Window height.
+ * @param [out]	t0	Parameter of the clipped start, p0 + t0 * (p1 - p0).
+ * @param [out]	t1	Parameter of the clipped end.
+ * @return	False if no part of the segment is inside the rectangle.
  */
 
-static double cheapNonPerspectiveCorrectInterpolationForLines(const dvec2& start, const dvec2& end,
-	const dvec2& online) {
-	return glm::length(online - start) / glm::length(end - start);
+static bool clipLineToWindow(const dvec4& p0, const dvec4& p1, double W, double H,
+	double& t0, double& t1) {
+	const double dx = p1.x - p0.x;
+	const double dy = p1.y - p0.y;
+	const double p[4] = { -dx, dx, -dy, dy };
+	const double q[4] = { p0.x, W - p0.x, p0.y, H - p0.y };
+	t0 = 0.0;
+	t1 = 1.0;
+	for (int i = 0; i < 4; i++) {
+		if (p[i] == 0.0) {
+			if (!(q[i] >= 0.0)) {
+				return false;
+			}
+		} else {
+			double t = q[i] / p[i];
+			if (p[i] < 0.0) {
+				t0 = std::max(t0, t);
+			} else {
+				t1 = std::min(t1, t);
+			}
+		}
+	}
+	return t0 <= t1;
 }
 
 /**
- * @fn	void drawVerticalLine(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+ * @fn	static void rasterizeLine(FrameBuffer &frameBuffer, const dvec3 &eyePos,
  *									const vector<LightSourcePtr> &lights,
- *									VertexData v0, VertexData v1, const dmat4 &viewingMatrix)
- * @brief	Draw vertical line
+ *									const VertexData &v0, const VertexData &v1, const Frame &eyeFrame,
+ *									bool drawLastPixel)
+ * @brief	Draws a line with integer Bresenham steps. The segment is first clipped
+ * 			to the window, so only on-screen pixels are stepped through. Each step
+ * 			moves one pixel along the major axis, so depth, normal and world
+ * 			position change by the same amount every step; these deltas are found
+ * 			once per line. The material is only interpolated when the endpoints'
+ * 			materials differ. Pixels behind the depth buffer are skipped before a
+ * 			fragment is made.
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
  * @param 		  	v0			 	The first endpoint.
  * @param 		  	v1			 	The second endpoint.
- * @param 		  	eyeFrame	    The camera's frame.
+ * @param 		  	eyeFrame		The camera frame.
+ * @param 		  	drawLastPixel	False if the line ends where the next one starts, so
+ * 									the shared pixel is drawn once; a line that
+ * 									stays within one pixel then draws nothing.
  */
 
-static void drawVerticalLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
-	const vector<LightSourcePtr>& lights, VertexData v0, VertexData v1,
-	const Frame& eyeFrame) {
-	if (v1.pos.y < v0.pos.y) {
-		std::swap(v0, v1);
+static void rasterizeLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights, const VertexData& v0, const VertexData& v1,
+	const Frame& eyeFrame, bool drawLastPixel) {
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	double t0, t1;
+	if (!clipLineToWindow(v0.pos, v1.pos, W, H, t0, t1)) {
+		return;
 	}
 
-	double zDifference = v1.pos.z - v0.pos.z;
-
-	for (double y = v0.pos.y; y < v1.pos.y; y++) {
-		// Interpolate vertex attributes
-		double weight = cheapNonPerspectiveCorrectInterpolationForLines(v0.pos.xy(),
-			v1.pos.xy(),
-			dvec2(v0.pos.x, y));
+	// A clipped end is not shared with the next line, so its pixel is drawn.
+	if (t1 < 1.0) {
+		drawLastPixel = true;
+	}
+	const dvec4 pos0 = v0.pos + (v1.pos - v0.pos) * t0;
+	const dvec4 pos1 = v0.pos + (v1.pos - v0.pos) * t1;
+	const dvec3 normal0 = v0.normal + (v1.normal - v0.normal) * t0;
+	const dvec3 worldPos0 = v0.worldPos + (v1.worldPos - v0.worldPos) * t0;
+	const int x0 = (int)std::floor(pos0.x);
+	const int y0 = (int)std::floor(pos0.y);
+	const int x1 = (int)std::floor(pos1.x);
+	const int y1 = (int)std::floor(pos1.y);
+
+	const int dx = std::abs(x1 - x0);
+	const int dy = std::abs(y1 - y0);
+	const int sx = x0 < x1 ? 1 : -1;
+	const int sy = y0 < y1 ? 1 : -1;
+	const int steps = std::max(dx, dy);
+	const int pixels = drawLastPixel ? steps + 1 : steps;
+	if (pixels == 0) {
+		return;
+	}
 
-		Fragment fragment;
+	// Attribute deltas per step
+	const double perStep = steps > 0 ? (t1 - t0) / steps : 0.0;
+	const double dz = (v1.pos.z - v0.pos.z) * perStep;
+	const dvec3 dNormal = (v1.normal - v0.normal) * perStep;
+	const dvec3 dWorldPos = (v1.worldPos - v0.worldPos) * perStep;
+	const bool blendMaterials = !(v0.material == v1.material);
+
+	Fragment fragment;
+	fragment.material = v0.material;
+	double z = pos0.z;
+	dvec3 normal = normal0;
+	dvec3 worldPos = worldPos0;
+
+	int x = x0;
+	int y = y0;
+	int err = dx - dy;
+	for (int i = 0; i < pixels; i++) {
+		if ((unsigned int)x < (unsigned int)W && (unsigned int)y < (unsigned int)H &&
+			z < frameBuffer.getDepth(x, y)) {
+			if (blendMaterials) {
+				double weight = t0 + i * perStep;
+				fragment.material = weightedAverage(1.0 - weight, v0.material, weight, v1.material);
+			}
+			fragment.windowPos = dvec3(x, y, z);
+			fragment.worldNormal = normal;
+			fragment.worldPos = worldPos;
+			FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
+		}
 
-		// Interpolate vertex attributes using alpha, beta, and gamma weights
-		double oneMinusW = 1.0 - weight;
-		fragment.material = weightedAverage(oneMinusW, v0.material, weight, v1.material);
-		double z = weightedAverage(oneMinusW, v0.pos.z, weight, v1.pos.z);
-		fragment.worldNormal = weightedAverage(oneMinusW, v0.normal, weight, v1.normal);
-		fragment.worldPos = weightedAverage(oneMinusW, v0.worldPos, weight, v1.worldPos);
-		fragment.windowPos = dvec3(v0.pos.x, y, z);
+		z += dz;
+		normal += dNormal;
+		worldPos += dWorldPos;
 
-		FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
+		int e2 = err << 1;
+		if (e2 > -dy) {
+			err -= dy;
+			x += sx;
+		}
+		if (e2 < dx) {
+			err += dx;
+			y += sy;
+		}
 	}
 }
 
 /**
- * @fn	static void drawHorizontalLine(FrameBuffer &frameBuffer, const dvec3 &eyePos,
- *										const vector<LightSourcePtr> &lights,
- *										VertexData v0, VertexData v1, const Frame &eyeFrame)
- * @brief	Draw horizontal line
- * @param [in,out]	frameBuffer  	Framebuffer.
- * @param 		  	eyePos		 	Eye position.
- * @param 		  	lights		 	Vector of lights in scene.
- * @param 		  	v0			 	The first endpoint.
- * @param 		  	v1			 	The second endpoint.
- * @param 		  	eyeFrame		The camera frame.
+ * @struct	LineSegment
+ * @brief	A line waiting in a batch, with the screen bin it starts in.
  */
 
-static void drawHorizontalLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
-	const vector<LightSourcePtr>& lights, VertexData v0, VertexData v1,
-	const Frame& eyeFrame) {
-	if (v1.pos.x < v0.pos.x) {
-		std::swap(v0, v1);
-	}
+struct LineSegment {
+	const VertexData* v0;	//!< First endpoint
+	const VertexData* v1;	//!< Second endpoint
+	int bin;				//!< RASTER_BIN_SIZE bin of the first endpoint
+};
 
-	for (double x = v0.pos.x; x < v1.pos.x; x++) {
-		// Interpolate vertex attributes
-		double weight = cheapNonPerspectiveCorrectInterpolationForLines(v0.pos.xy(),
-			v1.pos.xy(),
-			dvec2(x, v0.pos.y));
-
-		Fragment fragment;
-
-		// Interpolate vertex attributes using alpha, beta, and gamma weights
-		fragment.material = weightedAverage(1.0 - weight, v0.material, weight, v1.material);
-		double z = weightedAverage(1 - weight, v0.pos.z, weight, v1.pos.z);
-		fragment.worldNormal = weightedAverage(1.0 - weight, v0.normal, weight, v1.normal);
-		fragment.worldPos = weightedAverage(1.0 - weight, v0.worldPos, weight, v1.worldPos);
-		fragment.windowPos = dvec3(x, v1.pos.y, z);
+/**
+ * @fn	static void addLineSegment(vector<LineSegment> &segments, const FrameBuffer &frameBuffer,
+ *									const VertexData &v0, const VertexData &v1)
+ * @brief	Adds a line to a batch, finding the screen bin it starts in.
+ * @param [in,out]	segments   	The batch.
+ * @param 		  	frameBuffer	Framebuffer.
+ * @param 		  	v0		   	The first endpoint.
+ * @param 		  	v1		   	The second endpoint.
+ */
 
-		FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
-	}
+static void addLineSegment(vector<LineSegment>& segments, const FrameBuffer& frameBuffer,
+	const VertexData& v0, const VertexData& v1) {
+	const int binsPerRow = (frameBuffer.getWindowWidth() + RASTER_BIN_SIZE - 1) / RASTER_BIN_SIZE;
+	const double x = glm::clamp(v0.pos.x, 0.0, frameBuffer.getWindowWidth() - 1.0);
+	const double y = glm::clamp(v0.pos.y, 0.0, frameBuffer.getWindowHeight() - 1.0);
+	LineSegment segment;
+	segment.v0 = &v0;
+	segment.v1 = &v1;
+	segment.bin = ((int)y / RASTER_BIN_SIZE) * binsPerRow + (int)x / RASTER_BIN_SIZE;
+	segments.push_back(segment);
 }
 
 /**
- * @fn	static void midPointLine(FrameBuffer &frameBuffer, const dvec3 &eyePos, const vector<LightSourcePtr> &lights, VertexData v0, VertexData v1, const dmat4 &viewingMatrix)
- * @brief	Middle point line
+ * @fn	static void drawLineSegments(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+ *									const vector<LightSourcePtr> &lights,
+ *									const vector<LineSegment> &segments, const Frame &eyeFrame,
+ *									bool drawLastPixel)
+ * @brief	Draws a batch of lines a screen bin at a time, so that lines near each
+ * 			other on screen are drawn together while their pixels' depths are
+ * 			still in cache. The lines are put in bin order with a counting sort,
+ * 			which keeps the order they were given in within each bin.
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
- * @param 		  	v0			 	The first endpoint.
- * @param 		  	v1			 	The second endpoint.
+ * @param 		  	segments	 	The batch.
  * @param 		  	eyeFrame		The camera frame.
+ * @param 		  	drawLastPixel	False if each line's last pixel is drawn by another.
  */
 
-static void midPointLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
-	const vector<LightSourcePtr>& lights, VertexData v0, VertexData v1,
-	const Frame& eyeFrame) {
-	if (v1.pos.x < v0.pos.x) {
-		std::swap(v0, v1);
+static void drawLineSegments(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights, const vector<LineSegment>& segments,
+	const Frame& eyeFrame, bool drawLastPixel) {
+	const int binsPerRow = (frameBuffer.getWindowWidth() + RASTER_BIN_SIZE - 1) / RASTER_BIN_SIZE;
+	const int binsPerColumn = (frameBuffer.getWindowHeight() + RASTER_BIN_SIZE - 1) / RASTER_BIN_SIZE;
+	static thread_local vector<int> binStarts;
+	static thread_local vector<const LineSegment*> sorted;
+
+	binStarts.assign(binsPerRow * binsPerColumn + 1, 0);
+	for (const LineSegment& segment : segments) {
+		binStarts[segment.bin + 1]++;
+	}
+	for (size_t bin = 1; bin < binStarts.size(); bin++) {
+		binStarts[bin] += binStarts[bin - 1];
+	}
+	sorted.resize(segments.size());
+	for (const LineSegment& segment : segments) {
+		sorted[binStarts[segment.bin]++] = &segment;
 	}
 
-	// Calculate slope of the line
-	double m = (v1.pos.y - v0.pos.y) / (v1.pos.x - v0.pos.x);
-
-	if (m > 0 && m < 1.0) { // For slope in (0,1] More "run" than "rise"
-		double y = v0.pos.y;
-
-		for (double x = v0.pos.x; x < v1.pos.x; x += 1.0) {
-
-			// Interpolate vertex attributes
-			double weight = cheapNonPerspectiveCorrectInterpolationForLines(v0.pos.xy(),
-				v1.pos.xy(),
-				dvec2(x, y));
-
-			Fragment fragment;
-
-			// Interpolate vertex attributes using alpha, beta, and gamma weights
-			fragment.material = weightedAverage(1.0 - weight, v0.material, weight, v1.material);
-			double z = weightedAverage(1 - weight, v0.pos.z, weight, v1.pos.z);
-			fragment.worldNormal = weightedAverage(1.0 - weight, v0.normal, weight, v1.normal);
-			fragment.worldPos = weightedAverage(1.0 - weight, v0.worldPos, weight, v1.worldPos);
-			fragment.windowPos = dvec3(x, y, z);
-
-			FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
-
-			// Evaluate the implicit equation for the line to determine if
-			// the line will be above the midpoint between the pixel centers.
-			double fXY = (v0.pos.y - v1.pos.y) * (x + 1.0) +
-				(v1.pos.x - v0.pos.x) * (y + 0.5) +
-				v0.pos.x * v1.pos.y - v1.pos.x * v0.pos.y;
-
-			if (fXY < 0) {
-				y += 1.0;
-			}
-		}
-	} else if (m > 1) { // For slope in (1,infinity] More "run" than "rise"
-		double x = v0.pos.x;
-
-		for (double y = v0.pos.y; y < v1.pos.y; y += 1.0) {
-
-			// Interpolate vertex attributes
-			double weight = cheapNonPerspectiveCorrectInterpolationForLines(v0.pos.xy(),
-				v1.pos.xy(),
-				dvec2(x, y));
-
-			Fragment fragment;
-
-			// Interpolate vertex attributes using alpha, beta, and gamma weights
-			fragment.material = weightedAverage(1.0 - weight, v0.material, weight, v1.material);
-			double z = weightedAverage(1 - weight, v0.pos.z, weight, v1.pos.z);
-			fragment.worldNormal = weightedAverage(1.0 - weight, v0.normal, weight, v1.normal);
-			fragment.worldPos = weightedAverage(1.0 - weight, v0.worldPos, weight, v1.worldPos);
-			fragment.windowPos = dvec3(x, y, z);
-
-			FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
-
-			// Evaluate the implicit equation for the line to determine if
-			// the line will be left or right the midpoint between the pixel centers.
-			double fXY = (v0.pos.y - v1.pos.y) * (x + 0.5) +
-				(v1.pos.x - v0.pos.x) * (y + 1.0) +
-				v0.pos.x * v1.pos.y - v1.pos.x * v0.pos.y;
-
-			if (fXY > 0) {
-				x += 1.0;
-			}
-		}
-	} else if (m >= -1.0 && m < 0) { // For slope in [-1,0) More "run" than "rise"
-		double y = v0.pos.y;
-		double x = v0.pos.x;
-
-		for (double x = v0.pos.x; x < v1.pos.x; x += 1.0) {
-			// Interpolate vertex attributes
-			double weight = cheapNonPerspectiveCorrectInterpolationForLines(v0.pos.xy(),
-				v1.pos.xy(),
-				dvec2(x, y));
-
-			Fragment fragment;
-
-			// Interpolate vertex attributes using alpha, beta, and gamma weights
-			fragment.material = weightedAverage(1.0 - weight, v0.material, weight, v1.material);
-			double z = weightedAverage(1 - weight, v0.pos.z, weight, v1.pos.z);
-			fragment.worldNormal = weightedAverage(1.0 - weight, v0.normal, weight, v1.normal);
-			fragment.worldPos = weightedAverage(1.0 - weight, v0.worldPos, weight, v1.worldPos);
-			fragment.windowPos = dvec3(x, y, z);
-
-			FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
-
-			// Evaluate the implicit equation for the line to determine if
-			// the line will be below the midpoint between the pixel centers.
-			double fXY = (v0.pos.y - v1.pos.y) * (x + 1.0) +
-				(v1.pos.x - v0.pos.x) * (y - 0.5) +
-				v0.pos.x * v1.pos.y - v1.pos.x * v0.pos.y;
-
-			if (fXY > 0) {
-				y -= 1.0;
-			}
-		}
-	} else if (m < -1) { // For slope in [-infinity,-1) More "run" than "rise"
-		double x = v0.pos.x;
-
-		for (double y = v0.pos.y; y > v1.pos.y; y -= 1.0) {
-
-			// Interpolate vertex attributes
-			double weight = cheapNonPerspectiveCorrectInterpolationForLines(v0.pos.xy(),
-				v1.pos.xy(),
-				dvec2(x, y));
-
-			Fragment fragment;
-
-			// Interpolate vertex attributes using alpha, beta, and gamma weights
-			fragment.material = weightedAverage(1.0 - weight, v0.material, weight, v1.material);
-			double z = weightedAverage(1 - weight, v0.pos.z, weight, v1.pos.z);
-			fragment.worldNormal = weightedAverage(1.0 - weight, v0.normal, weight, v1.normal);
-			fragment.worldPos = weightedAverage(1.0 - weight, v0.worldPos, weight, v1.worldPos);
-			fragment.windowPos = dvec3(x, y, z);
-
-			FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
-
-			// Evaluate the implicit equation for the line to determine if
-			// the line will be left or right the midpoint between the pixel centers.
-			double fXY = (v0.pos.y - v1.pos.y) * (x + 0.5) +
-				(v1.pos.x - v0.pos.x) * (y - 1.0) +
-				v0.pos.x * v1.pos.y - v1.pos.x * v0.pos.y;
-
-			if (fXY < 0) {
-				x += 1.0;
-			}
-		}
+	for (const LineSegment* segment : sorted) {
+		rasterizeLine(frameBuffer, eyePos, lights, *segment->v0, *segment->v1, eyeFrame, drawLastPixel);
 	}
 }
 
@@ -469,7 +444,7 @@ static void midPointLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
  * @fn	void drawLine(FrameBuffer &frameBuffer, const dvec3 &eyePos,
  *						const vector<LightSourcePtr> &lights,
  *						const VertexData &v0, const VertexData &v1, const Frame &eyeFrame)
- * @brief	Draw line
+ * @brief	Draw line, both endpoints included.
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
@@ -482,20 +457,15 @@ void drawLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights,
 	const VertexData& v0, const VertexData& v1,
 	const Frame& eyeFrame) {
-	if (v0.pos.x == v1.pos.x) {
-		drawVerticalLine(frameBuffer, eyePos, lights, v0, v1, eyeFrame);
-	} else if (v0.pos.y == v1.pos.y) {
-		drawHorizontalLine(frameBuffer, eyePos, lights, v0, v1, eyeFrame);
-	} else {
-		midPointLine(frameBuffer, eyePos, lights, v0, v1, eyeFrame);
-	}
+	rasterizeLine(frameBuffer, eyePos, lights, v0, v1, eyeFrame, true);
 }
 
 /**
  * @fn	void drawManyLines(FrameBuffer &frameBuffer, const dvec3 &eyePos,
  *							const vector<LightSourcePtr> &lights,
  *							const vector<VertexData> &vertices, const Frame &eyeFrame)
- * @brief	Draw many lines
+ * @brief	Draw many lines, both endpoints included, in screen order rather than
+ * 			the order given.
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
@@ -507,9 +477,12 @@ void drawManyLines(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights,
 	const vector<VertexData>& vertices,
 	const Frame& eyeFrame) {
+	static thread_local vector<LineSegment> segments;
+	segments.clear();
 	for (unsigned int i = 0; (i + 1) < vertices.size(); i += 2) {
-		drawLine(frameBuffer, eyePos, lights, vertices[i], vertices[i + 1], eyeFrame);
+		addLineSegment(segments, frameBuffer, vertices[i], vertices[i + 1]);
 	}
+	drawLineSegments(frameBuffer, eyePos, lights, segments, eyeFrame, true);
 }
 
 /**
@@ -517,7 +490,8 @@ void drawManyLines(FrameBuffer& frameBuffer, const dvec3& eyePos,
  *									const vector<LightSourcePtr> &lights,
  *									const VertexData &v0, const VertexData &v1, const VertexData &v2,
  *									const Frame &eyeFrame)
- * @brief	Draw wire frame triangle.
+ * @brief	Draw wire frame triangle. Each corner is drawn once, by the edge it
+ * 			starts.
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
@@ -534,16 +508,16 @@ void drawWireFrameTriangle(FrameBuffer& frameBuffer,
 	const VertexData& v1,
 	const VertexData& v2,
 	const Frame& eyeFrame) {
-	drawLine(frameBuffer, eyePos, lights, v0, v1, eyeFrame);
-	drawLine(frameBuffer, eyePos, lights, v1, v2, eyeFrame);
-	drawLine(frameBuffer, eyePos, lights, v2, v0, eyeFrame);
+	rasterizeLine(frameBuffer, eyePos, lights, v0, v1, eyeFrame, false);
+	rasterizeLine(frameBuffer, eyePos, lights, v1, v2, eyeFrame, false);
+	rasterizeLine(frameBuffer, eyePos, lights, v2, v0, eyeFrame, false);
 }
 
 /**
  * @fn	void drawManyWireFrameTriangles(FrameBuffer &frameBuffer, const dvec3 &eyePos,
  *										const vector<LightSourcePtr> &lights,
  *										const vector<VertexData> &vertices, const Frame &eyeFrame)
- * @brief	Draw many wire frame triangles
+ * @brief	Draw many wire frame triangles, batching their edges as drawManyLines does.
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
@@ -556,68 +530,264 @@ void drawManyWireFrameTriangles(FrameBuffer& frameBuffer,
 	const vector<LightSourcePtr>& lights,
 	const vector<VertexData>& vertices,
 	const Frame& eyeFrame) {
+	static thread_local vector<LineSegment> segments;
+	segments.clear();
 	for (unsigned int i = 0; (i + 2) < vertices.size(); i += 3) {
-		drawWireFrameTriangle(frameBuffer, eyePos, lights,
-			vertices[i], vertices[i + 1], vertices[i + 2], eyeFrame);
+		addLineSegment(segments, frameBuffer, vertices[i], vertices[i + 1]);
+		addLineSegment(segments, frameBuffer, vertices[i + 1], vertices[i + 2]);
+		addLineSegment(segments, frameBuffer, vertices[i + 2], vertices[i]);
 	}
+	drawLineSegments(frameBuffer, eyePos, lights, segments, eyeFrame, false);
 }
 
 /**
- * @fn	static inline double f01(const VertexData &v0, const VertexData &v1, const VertexData &v2, double x, double y)
- * @brief	Computes f01. Implicit equation for the line between v0 and v1.
- * @see		*** page in textbook.
- * @param	v0	v0.
- * @param	v1	v1.
- * @param	v2	v2.
- * @param	x 	x coordinate.
- * @param	y 	y coordinate.
- * @return	f01.
+ * @struct	EdgeFunction
+ * @brief	The implicit equation of a triangle edge, E(X, Y) = A*X + B*Y + C, over
+ * 			fixed-point coordinates with RASTER_SUBPIXEL_BITS fraction bits. It is
+ * 			oriented to be positive inside the triangle and evaluated exactly in
+ * 			64-bit integers. A pixel on the edge (E == 0) belongs to the triangle
+ * 			only if the point (-1, -1) is on the inside of the edge, so pixels
+ * 			shared by two triangles are drawn once.
  */
 
-static inline double f01(const VertexData& v0, const VertexData& v1, const VertexData& v2,
-	double x, double y) {
-	return (v0.pos.y - v1.pos.y) * x + (v1.pos.x - v0.pos.x) * y +
-		(v0.pos.x * v1.pos.y) - (v1.pos.x * v0.pos.y);
+struct EdgeFunction {
+	long long A, B, C;		//!< coefficients.
+	long long stepX;		//!< change in E from one pixel to the next along x.
+	long long stepY;		//!< change in E from one pixel to the next along y.
+	long long bias;			//!< 0, or -1 for edges whose pixels belong to the neighbor.
+
+	/**
+	 * @fn	void set(long long xa, long long ya, long long xb, long long yb)
+	 * @brief	Sets up the edge from fixed-point point a to point b.
+	 */
+	void set(long long xa, long long ya, long long xb, long long yb) {
+		A = ya - yb;
+		B = xb - xa;
+		C = xa * yb - xb * ya;
+	}
+
+	/**
+	 * @fn	void orient(long long area)
+	 * @brief	Flips the edge if the triangle is clockwise and works out the
+	 * 			steps and the tie-breaking bias.
+	 */
+	void orient(long long area) {
+		if (area < 0) {
+			A = -A;
+			B = -B;
+			C = -C;
+		}
+		stepX = A << RASTER_SUBPIXEL_BITS;
+		stepY = B << RASTER_SUBPIXEL_BITS;
+		bias = at(-1, -1) > 0 ? 0 : -1;
+	}
 
+	/**
+	 * @fn	long long at(int x, int y) const
+	 * @brief	Evaluates the edge at pixel (x, y), without the bias.
+	 */
+	long long at(int x, int y) const {
+		return x * stepX + y * stepY + C;
+	}
+};
+
+/**
+ * @fn	static long long toFixed(double v)
+ * @brief	Converts a window coordinate to fixed point.
+ * @param	v	The coordinate.
+ * @return	v in units of 1 / 2^RASTER_SUBPIXEL_BITS pixels.
+ */
+
+static long long toFixed(double v) {
+	return (long long)std::floor(v * (1 << RASTER_SUBPIXEL_BITS) + 0.5);
 }
 
 /**
- * @fn	static inline double f12(const VertexData &v0, const VertexData &v1, const VertexData &v2,
- *									double x, double y)
- * @brief	Computes f12. Implicit equation for the line between v1 and v2.
- * @see		*** page in textbook.
- * @param	v0	v0.
- * @param	v1	v1.
- * @param	v2	v2.
- * @param	x 	x coordinate.
- * @param	y 	y coordinate.
- * @return	f12.
+ * @struct	TriangleAttributes
+ * @brief	What a triangle's fragments are made from, besides their depths.
+ */
+
+struct TriangleAttributes {
+	dvec3 normal[3];			//!< world normal vector at each vertex.
+	dvec3 worldPos[3];			//!< world position of each vertex.
+	const Material* material;	//!< the triangle's material.
+	int gBufferMaterialId;		//!< G-buffer id of the material, or -1.
+};
+
+/**
+ * @fn	static void shadePixel(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+ *							const vector<LightSourcePtr> &lights,
+ *							const TriangleAttributes &tri,
+ *							const Frame &eyeFrame, int x, int y, double z,
+ *							double alpha, double beta, double gamma)
+ * @brief	Interpolates a triangle's attributes at a pixel and processes the fragment.
+ * 			The material is the triangle's, and is not interpolated.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	eyePos	   	Eye position.
+ * @param 		  	lights	   	Vector of lights in scene.
+ * @param 		  	tri		   	The triangle.
+ * @param 		  	eyeFrame   	The camera's frame.
+ * @param 		  	x		   	The pixel's x.
+ * @param 		  	y		   	The pixel's y.
+ * @param 		  	z		   	The fragment's depth.
+ * @param 		  	alpha	   	Weight of v0.
+ * @param 		  	beta	   	Weight of v1.
+ * @param 		  	gamma	   	Weight of v2.
  */
 
-static inline double f12(const VertexData& v0, const VertexData& v1, const VertexData& v2,
-	double x, double y) {
-	return (v1.pos.y - v2.pos.y) * x + (v2.pos.x - v1.pos.x) * y +
-		(v1.pos.x * v2.pos.y) - (v2.pos.x * v1.pos.y);
+static void shadePixel(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights, const TriangleAttributes& tri,
+	const Frame& eyeFrame, int x, int y, double z, double alpha, double beta, double gamma) {
+	Fragment fragment;
 
+	// Interpolate vertex attributes using alpha, beta, and gamma weights
+	fragment.materialID = tri.gBufferMaterialId;
+	if (fragment.materialID < 0) {
+		fragment.material = *tri.material;
+	}
+	fragment.worldNormal = barycentricWeighting(alpha, beta, gamma,
+		tri.normal[0], tri.normal[1], tri.normal[2]);
+	fragment.worldPos = barycentricWeighting(alpha, beta, gamma,
+		tri.worldPos[0], tri.worldPos[1], tri.worldPos[2]);
+	fragment.windowPos = dvec3(x, y, z);
+	FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
 }
 
 /**
- * @fn	static inline double f20(const VertexData &v0, const VertexData &v1, const VertexData &v2,
- *									double x, double y)
- * @brief	Computes f20. Implicit equation for the line between v2 and v0.
- * @see		*** page in textbook.
- * @param	v0	v0.
- * @param	v1	v1.
- * @param	v2	v2.
- * @param	x 	x coordinate.
- * @param	y 	y coordinate.
- * @return	f02.
+ * @fn	static void rasterizeTriangle(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+ *								const vector<LightSourcePtr> &lights,
+ *								const CompactVertices &vertices, size_t first,
+ *								const Frame &eyeFrame, int gBufferMaterialId,
+ *								const BoundingBoxi &bounds)
+ * @brief	Draws the part of a filled triangle that lies within a rectangle of
+ * 			pixels. The edge functions are set up once; the bounding box is then
+ * 			walked in RASTER_BLOCK_SIZE square blocks, whose corners decide
+ * 			whether the block is outside an edge (skipped), inside all three
+ * 			(every pixel drawn without tests), or crossed by an edge (pixels
+ * 			tested by stepping the edge functions). With depth testing on, a
+ * 			block is also skipped when the triangle's nearest depth over it is
+ * 			no nearer than the framebuffer's farthest depth there, and each
+ * 			pixel's depth is tested before its attributes are interpolated.
+ * @param [in,out]	frameBuffer		 	Framebuffer.
+ * @param 		  	eyePos			 	Eye position.
+ * @param 		  	lights			 	Vector of lights in scene.
+ * @param 		  	vertices		 	The vertices, in window coordinates.
+ * @param 		  	first			 	Index of the triangle's first vertex.
+ * @param               eyeFrame        The camera's frame.
+ * @param 		  	gBufferMaterialId	G-buffer id of the triangle's material, or -1.
+ * @param 		  	bounds			 	The pixels that may be drawn.
  */
 
-static inline double f20(const VertexData& v0, const VertexData& v1, const VertexData& v2,
-	double x, double y) {
-	return (v2.pos.y - v0.pos.y) * x + (v0.pos.x - v2.pos.x) * y +
-		(v2.pos.x * v0.pos.y) - (v0.pos.x * v2.pos.y);
+static void rasterizeTriangle(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights,
+	const CompactVertices& vertices, size_t first,
+	const Frame& eyeFrame, int gBufferMaterialId, const BoundingBoxi& bounds) {
+	// Below 2^20 pixels, fixed-point coordinates take 28 bits and edge coefficients
+	// 29; every product of the two is under 2^57 and every edge value, a sum of
+	// three of them, under 2^60, so nothing overflows 64 bits.
+	const double LIMIT = 1 << 20;
+	long long X[3], Y[3];
+	for (int i = 0; i < 3; i++) {
+		const float x = vertices.x[first + i], y = vertices.y[first + i];
+		if (!(std::abs(x) < LIMIT && std::abs(y) < LIMIT)) {
+			return;			// not finite, or far beyond any window
+		}
+		X[i] = toFixed(x);
+		Y[i] = toFixed(y);
+	}
+
+	EdgeFunction e12, e20, e01;		// opposite v0, v1 and v2
+	e12.set(X[1], Y[1], X[2], Y[2]);
+	e20.set(X[2], Y[2], X[0], Y[0]);
+	e01.set(X[0], Y[0], X[1], Y[1]);
+	const long long area = e12.A * X[0] + e12.B * Y[0] + e12.C;
+	if (area == 0) {
+		return;
+	}
+	e12.orient(area);
+	e20.orient(area);
+	e01.orient(area);
+	const double invArea = 1.0 / (double)std::abs(area);
+
+	TriangleAttributes tri;
+	for (int i = 0; i < 3; i++) {
+		tri.normal[i] = vertices.getNormal(first + i);
+		tri.worldPos[i] = vertices.getWorldPos(first + i);
+	}
+	tri.material = &vertices.materials[vertices.materialIds[first]];
+	tri.gBufferMaterialId = gBufferMaterialId;
+
+	// Depth as a function of the pixel, for bounding it over a block
+	const double z0 = vertices.z[first], z1 = vertices.z[first + 1], z2 = vertices.z[first + 2];
+	const double zdx = (e12.stepX * z0 + e20.stepX * z1 + e01.stepX * z2) * invArea;
+	const double zdy = (e12.stepY * z0 + e20.stepY * z1 + e01.stepY * z2) * invArea;
+	const double zC = (e12.C * z0 + e20.C * z1 + e01.C * z2) * invArea;
+	const double Z_MARGIN = 1e-9;		// covers rounding between the plane and per-pixel depths
+	const bool depthTest = FragmentOps::performDepthTest;
+
+	// Pixels that can be inside, within the bounds
+	const long long ONE = 1 << RASTER_SUBPIXEL_BITS;
+	const long long minX = std::min(X[0], std::min(X[1], X[2]));
+	const long long maxX = std::max(X[0], std::max(X[1], X[2]));
+	const long long minY = std::min(Y[0], std::min(Y[1], Y[2]));
+	const long long maxY = std::max(Y[0], std::max(Y[1], Y[2]));
+	const int xMin = (int)std::max((minX + ONE - 1) >> RASTER_SUBPIXEL_BITS, (long long)bounds.lx);
+	const int xMax = (int)std::min(maxX >> RASTER_SUBPIXEL_BITS, (long long)(bounds.lx + bounds.width - 1));
+	const int yMin = (int)std::max((minY + ONE - 1) >> RASTER_SUBPIXEL_BITS, (long long)bounds.ly);
+	const int yMax = (int)std::min(maxY >> RASTER_SUBPIXEL_BITS, (long long)(bounds.ly + bounds.height - 1));
+
+	const EdgeFunction* edges[3] = { &e12, &e20, &e01 };
+	const int blockMask = ~(RASTER_BLOCK_SIZE - 1);
+	for (int by = yMin & blockMask; by <= yMax; by += RASTER_BLOCK_SIZE) {
+		const int y0 = std::max(by, yMin);
+		const int y1 = std::min(by + RASTER_BLOCK_SIZE - 1, yMax);
+		for (int bx = xMin & blockMask; bx <= xMax; bx += RASTER_BLOCK_SIZE) {
+			const int x0 = std::max(bx, xMin);
+			const int x1 = std::min(bx + RASTER_BLOCK_SIZE - 1, xMax);
+
+			// An edge function is linear, so its extremes over the block are at corners
+			bool outside = false, inside = true;
+			for (int i = 0; i < 3 && !outside; i++) {
+				const EdgeFunction& e = *edges[i];
+				const long long c00 = e.at(x0, y0) + e.bias;
+				const long long c10 = c00 + (x1 - x0) * e.stepX;
+				const long long c01 = c00 + (y1 - y0) * e.stepY;
+				const long long c11 = c10 + (y1 - y0) * e.stepY;
+				outside = std::max(std::max(c00, c10), std::max(c01, c11)) < 0;
+				inside = inside && std::min(std::min(c00, c10), std::min(c01, c11)) >= 0;
+			}
+			if (outside) {
+				continue;
+			}
+			if (depthTest) {
+				const double zNear = zC + std::min(x0 * zdx, x1 * zdx) + std::min(y0 * zdy, y1 * zdy);
+				if (zNear - Z_MARGIN >= frameBuffer.getTileMaxDepth(x0, y0)) {
+					continue;		// hidden behind what is already drawn
+				}
+			}
+
+			long long rowA = e12.at(x0, y0), rowB = e20.at(x0, y0), rowG = e01.at(x0, y0);
+			for (int y = y0; y <= y1; y++) {
+				long long a = rowA, b = rowB, g = rowG;
+				for (int x = x0; x <= x1; x++) {
+					if (inside || (a + e12.bias >= 0 && b + e20.bias >= 0 && g + e01.bias >= 0)) {
+						const double alpha = a * invArea, beta = b * invArea, gamma = g * invArea;
+						const double z = barycentricWeighting(alpha, beta, gamma, z0, z1, z2);
+						if (!depthTest || z < frameBuffer.getDepth(x, y)) {
+							shadePixel(frameBuffer, eyePos, lights, tri, eyeFrame, x, y, z,
+								alpha, beta, gamma);
+						}
+					}
+					a += e12.stepX;
+					b += e20.stepX;
+					g += e01.stepX;
+				}
+				rowA += e12.stepY;
+				rowB += e20.stepY;
+				rowG += e01.stepY;
+			}
+		}
+	}
 }
 
 /**
@@ -639,51 +809,18 @@ void drawFilledTriangle(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights,
 	const VertexData& v0, const VertexData& v1, const VertexData& v2,
 	const Frame& eyeFrame) {
-	// Find minimimum and maximum x and y limits for the triangle
-	double xMin = glm::floor(min(v0.pos.x, v1.pos.x, v2.pos.x));
-	double xMax = glm::ceil(max(v0.pos.x, v1.pos.x, v2.pos.x));
-	double yMin = glm::floor(min(v0.pos.y, v1.pos.y, v2.pos.y));
-	double yMax = glm::ceil(max(v0.pos.y, v1.pos.y, v2.pos.y));
-
-	double fAlpha = f12(v0, v1, v2, v0.pos.x, v0.pos.y);
-	double fBeta = f20(v0, v1, v2, v1.pos.x, v1.pos.y);
-	double fGamma = f01(v0, v1, v2, v2.pos.x, v2.pos.y);
-
-	for (double y = yMin; y <= yMax; y++) {
-		for (double x = xMin; x <= xMax; x++) {
-			// Calculate the weights for inperpolation
-			// If any weight is negative, the fragment is not in the triangle
-			double alpha = f12(v0, v1, v2, x, y) / fAlpha;
-			double beta = f20(v0, v1, v2, x, y) / fBeta;
-			double gamma = f01(v0, v1, v2, x, y) / fGamma;
-
-			// Determine if the pixel position is inside the triangle
-			if (alpha >= 0 && beta >= 0 && gamma >= 0) {
-				if ((alpha > 0 || fAlpha * f12(v0, v1, v2, -1, -1) > 0) &&
-					(beta > 0 || fBeta * f20(v0, v1, v2, -1, -1) > 0) &&
-					(gamma > 0 || fGamma * f01(v0, v1, v2, -1, -1) > 0)) {
-					Fragment fragment;
-
-					// Interpolate vertex attributes using alpha, beta, and gamma weights
-					fragment.material = barycentricWeighting(alpha, beta, gamma,
-						v0.material, v1.material, v2.material);
-					fragment.worldNormal = barycentricWeighting(alpha, beta, gamma,
-						v0.normal, v1.normal, v2.normal);
-					fragment.worldPos = barycentricWeighting(alpha, beta, gamma,
-						v0.worldPos, v1.worldPos, v2.worldPos);
-					double z = barycentricWeighting(alpha, beta, gamma,
-						v0.pos.z, v1.pos.z, v2.pos.z);
-					fragment.windowPos = dvec3(x, y, z);
-					FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
-				}
-			}
-		}
-	}
+	static thread_local CompactVertices triangle;
+	triangle.clear();
+	triangle.push_back(v0);
+	triangle.push_back(v1);
+	triangle.push_back(v2);
+	BoundingBoxi window(0, frameBuffer.getWindowWidth(), 0, frameBuffer.getWindowHeight());
+	rasterizeTriangle(frameBuffer, eyePos, lights, triangle, 0, eyeFrame, -1, window);
 }
 
 /**
  * @fn	void drawManyFilledTriangles(FrameBuffer &frameBuffer, const dvec3 &eyePos, const vector<LightSourcePtr> &lights, const vector<VertexData> &vertices, const dmat4 &viewingMatrix)
- * @brief	Draw many filled triangles,
+ * @brief	Draw many filled triangles, by converting them to the compact layout.
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
@@ -694,10 +831,76 @@ void drawFilledTriangle(FrameBuffer& frameBuffer, const dvec3& eyePos,
 void drawManyFilledTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights, const vector<VertexData>& vertices,
 	const Frame& eyeFrame) {
+	static thread_local CompactVertices compact;
+	compact.clear();
+	for (const VertexData& v : vertices) {
+		compact.push_back(v);
+	}
+	drawManyFilledTriangles(frameBuffer, eyePos, lights, compact, eyeFrame);
+}
+
+/**
+ * @fn	void drawManyFilledTriangles(FrameBuffer &frameBuffer, const dvec3 &eyePos, const vector<LightSourcePtr> &lights, const CompactVertices &vertices, const dmat4 &viewingMatrix)
+ * @brief	Draw many filled triangles. The window is split into square bins and
+ * 			each triangle is listed in the bins its bounding box overlaps. The
+ * 			bins are then drawn in parallel, each by one thread, which draws its
+ * 			triangles, clipped to the bin, in the order they were given. No two
+ * 			threads touch the same pixel, so the result is the same as drawing
+ * 			the triangles one after another. With deferred shading on, the
+ * 			triangles are drawn into the G-buffer. The bins are kept by each
+ * 			thread from one call to the next, so that drawing does not allocate
+ * 			once they have grown large enough.
+ * @param [in,out]	frameBuffer  	Framebuffer.
+ * @param 		  	eyePos		 	Eye position.
+ * @param 		  	lights		 	Vector of lights in scene.
+ * @param 		  	vertices	 	The vertice-triplets, in window coordinates.
+ * @param 		  	eyeFrame    	The camera's frame.
+ */
+
+void drawManyFilledTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights, const CompactVertices& vertices,
+	const Frame& eyeFrame) {
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	const int binsPerRow = (W + RASTER_BIN_SIZE - 1) / RASTER_BIN_SIZE;
+	const int binsPerColumn = (H + RASTER_BIN_SIZE - 1) / RASTER_BIN_SIZE;
+	static thread_local vector<vector<int>> bins;
+	static thread_local vector<int> gBufferMaterialIds;
+	bins.resize(std::max((size_t)binsPerRow * binsPerColumn, bins.size()));
+	for (vector<int>& bin : bins) {
+		bin.clear();
+	}
+	gBufferMaterialIds.assign(vertices.materials.size(), -1);
+	if (FragmentOps::deferredShading) {
+		for (size_t m = 0; m < vertices.materials.size(); m++) {
+			gBufferMaterialIds[m] = frameBuffer.addGBufferMaterial(vertices.materials[m]);
+		}
+	}
+
 	for (int i = 0; i < (int)vertices.size() - 2; i += 3) {
-		const VertexData& Vi = vertices[i];
-		const VertexData& Vi1 = vertices[i + 1];
-		const VertexData& Vi2 = vertices[i + 2];
-		drawFilledTriangle(frameBuffer, eyePos, lights, Vi, Vi1, Vi2, eyeFrame);
+		const float* x = &vertices.x[i];
+		const float* y = &vertices.y[i];
+		double xMin = std::max(glm::floor((double)min(x[0], x[1], x[2])), 0.0);
+		double xMax = std::min(glm::ceil((double)max(x[0], x[1], x[2])), W - 1.0);
+		double yMin = std::max(glm::floor((double)min(y[0], y[1], y[2])), 0.0);
+		double yMax = std::min(glm::ceil((double)max(y[0], y[1], y[2])), H - 1.0);
+		if (!(xMin <= xMax && yMin <= yMax)) {
+			continue;		// off screen (or degenerate)
+		}
+		for (int by = (int)yMin / RASTER_BIN_SIZE; by <= (int)yMax / RASTER_BIN_SIZE; by++) {
+			for (int bx = (int)xMin / RASTER_BIN_SIZE; bx <= (int)xMax / RASTER_BIN_SIZE; bx++) {
+				bins[by * binsPerRow + bx].push_back(i);
+			}
+		}
 	}
+
+	parallelFor(binsPerRow * binsPerColumn, [&](int bin) {
+		const int left = (bin % binsPerRow) * RASTER_BIN_SIZE;
+		const int bottom = (bin / binsPerRow) * RASTER_BIN_SIZE;
+		BoundingBoxi bounds(left, std::min(RASTER_BIN_SIZE, W - left), bottom, std::min(RASTER_BIN_SIZE, H - bottom));
+		for (int i : bins[bin]) {
+			rasterizeTriangle(frameBuffer, eyePos, lights, vertices, i, eyeFrame,
+				gBufferMaterialIds[vertices.materialIds[i]], bounds);
+		}
+	});
 }
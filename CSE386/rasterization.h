@@ -18,7 +18,7 @@ void drawWirePolygon(FrameBuffer& frameBuffer, const vector<dvec3>& pts, const c
 void drawLine(FrameBuffer& frameBuffer, int x1, int y1, int x2, int y2, const color& C);
 void drawLine(FrameBuffer& frameBuffer, const dvec2& pt1, const dvec2& pt2, const color& C);
 void drawLine(FrameBuffer& frameBuffer, const dvec3& eyePos,
-	vector<LightSourcePtr>& lights,
+	const vector<LightSourcePtr>& lights,
 	const VertexData& v0, const VertexData& v1,
 	const Frame& eyeFrame);
 void drawManyLines(FrameBuffer& frameBuffer, const dvec3& eyePos,
@@ -39,5 +39,8 @@ void drawManyWireFrameTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
 void drawManyFilledTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights, const vector<VertexData>& vertices,
 	const Frame& eyeFrame);
+void drawManyFilledTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights, const CompactVertices& vertices,
+	const Frame& eyeFrame);
 void drawArc(FrameBuffer& fb, const dvec2& center, double R,
 	double startRads, double lengthInRads, const color& rgb);
\ No newline at end of file
@@ -6,6 +6,7 @@
  * of this material is prohibited unless prior written
  * permission is granted.
  ****************************************************/
+#include <algorithm>
 #include "raytracer.h"
 #include "ishape.h"
 #include "io.h"
@@ -22,7 +23,26 @@
   */
 
 RayTracer::RayTracer(const color& defa)
-	: defaultColor(defa) {
+	: defaultColor(defa), denoiseBuffers(nullptr), textureFilter(TEXTURE_TRILINEAR) {
+}
+
+/**
+ * @fn	color getTextureColor(const OpaqueHitRecord &hit, const RaytracingCamera &camera, TextureFilter filter)
+ * @brief	Looks up the texture of a hit. Filtered lookups cover the texels the
+ * 			camera's pixel spans at the hit's distance. For reflected rays only the
+ * 			last segment's length is known, which underestimates the footprint.
+ * @param	hit   	A hit on a textured object.
+ * @param	camera	The camera.
+ * @param	filter	The texture filter.
+ * @return	The color of the texture at the hit.
+ */
+
+color getTextureColor(const OpaqueHitRecord& hit, const RaytracingCamera& camera, TextureFilter filter) {
+	if (filter == TEXTURE_NEAREST) {
+		return hit.texture->getPixelUV(hit.u, hit.v);
+	}
+	double footprint = hit.texelsPerUnit * camera.getPixelFootprint(hit.t);
+	return hit.texture->getFilteredUV(hit.u, hit.v, footprint, filter);
 }
 
 /**
@@ -39,6 +59,15 @@ void RayTracer::raytraceScene(FrameBuffer& frameBuffer, int depth,
 	const vector<VisibleIShapePtr>& objs = theScene.opaqueObjs;
 	const vector<PositionalLightPtr>& lights = theScene.lights;
 
+	if (denoiseBuffers != nullptr &&
+		(denoiseBuffers->getWidth() != frameBuffer.getWindowWidth() ||
+			denoiseBuffers->getHeight() != frameBuffer.getWindowHeight())) {
+		denoiseBuffers->setSize(frameBuffer.getWindowWidth(), frameBuffer.getWindowHeight());
+	}
+
+	PrimaryRayTiles tiles;
+	tiles.build(theScene, frameBuffer.getWindowWidth(), frameBuffer.getWindowHeight());
+
 	for (int y = 0; y < frameBuffer.getWindowHeight(); ++y) {
 		for (int x = 0; x < frameBuffer.getWindowWidth(); ++x) {
 			DEBUG_PIXEL = (x == xDebug && y == yDebug);
@@ -46,10 +75,13 @@ void RayTracer::raytraceScene(FrameBuffer& frameBuffer, int depth,
 				cout << "";
 			}
 			Ray ray = camera.getRay(x, y);
+			OpaqueHitRecord primaryHit;
+			const TileObjects& candidates = tiles.getTile(x, y);
 			if (n == 1) {
 				color C = black;
-				C = traceIndividualRay(ray, theScene, depth);
+				C = traceIndividualRay(ray, theScene, depth, &primaryHit, &candidates);
 				frameBuffer.setColor(x, y, C);
+				recordDenoiseData(x, y, C, primaryHit);
 			}
 			if (n == 3) {
 				vector<Ray> rays;
@@ -67,40 +99,308 @@ void RayTracer::raytraceScene(FrameBuffer& frameBuffer, int depth,
 				rays.push_back(Ray(camera.getRay(x + .167 + .666, y + .167 + .666)));
 
 				for (int i = 0; i < 9; i++) {
-					C += traceIndividualRay(rays[i], theScene, depth);
+					C += traceIndividualRay(rays[i], theScene, depth, i == 4 ? &primaryHit : nullptr, &candidates);
 				}
 				C /= 9;
 				frameBuffer.setColor(x, y, C);
+				recordDenoiseData(x, y, C, primaryHit);
 			}
 		frameBuffer.showAxes(x, y, ray, 0.25);
 		}
 	}
-	frameBuffer.showColorBuffer();
+	if (denoiseBuffers == nullptr) {
+		frameBuffer.showColorBuffer();
+	}
+}
+
+/**
+ * @fn	AccumulationBuffer::AccumulationBuffer()
+ * @brief	Constructs an empty accumulation buffer. It is sized on first use.
+ */
+
+AccumulationBuffer::AccumulationBuffer()
+	: tolerance(1.0 / 255.0), minSamples(4), maxSamples(256),
+	width(0), height(0), frameNumber(0), numConverged(0) {
+}
+
+/**
+ * @fn	void AccumulationBuffer::setSize(int width, int height)
+ * @brief	Resizes the buffer, discarding all accumulated samples.
+ * @param	width 	The width.
+ * @param	height	The height.
+ */
+
+void AccumulationBuffer::setSize(int width, int height) {
+	this->width = width;
+	this->height = height;
+	int area = width * height;
+	sum.resize(3 * area);
+	lumMean.resize(area);
+	lumM2.resize(area);
+	sampleCount.resize(area);
+	converged.resize(area);
+	reset();
+}
+
+/**
+ * @fn	void AccumulationBuffer::reset()
+ * @brief	Discards all accumulated samples. Must be called whenever the scene or
+ * 			camera changes.
+ */
+
+void AccumulationBuffer::reset() {
+	std::fill(sum.begin(), sum.end(), 0.0f);
+	std::fill(lumMean.begin(), lumMean.end(), 0.0f);
+	std::fill(lumM2.begin(), lumM2.end(), 0.0f);
+	std::fill(sampleCount.begin(), sampleCount.end(), 0);
+	std::fill(converged.begin(), converged.end(), 0);
+	frameNumber = 0;
+	numConverged = 0;
+}
+
+/**
+ * @fn	color AccumulationBuffer::getMean(int x, int y) const
+ * @brief	Gets the current estimate of a pixel's color.
+ * @param	x	The x coordinate.
+ * @param	y	The y coordinate.
+ * @return	The mean of all samples taken at (x, y), or black if there are none.
+ */
+
+color AccumulationBuffer::getMean(int x, int y) const {
+	int i = y * width + x;
+	if (sampleCount[i] == 0) {
+		return black;
+	}
+	const float* S = &sum[3 * i];
+	return color(S[0], S[1], S[2]) / (double)sampleCount[i];
+}
+
+/**
+ * @fn	double AccumulationBuffer::getError(int x, int y) const
+ * @brief	Estimates the standard error of the mean luminance at (x, y).
+ * @param	x	The x coordinate.
+ * @param	y	The y coordinate.
+ * @return	The standard error; very large when fewer than two samples exist.
+ */
+
+double AccumulationBuffer::getError(int x, int y) const {
+	int i = y * width + x;
+	int n = sampleCount[i];
+	if (n < 2) {
+		return FLT_MAX;
+	}
+	double variance = lumM2[i] / (n - 1.0);
+	return std::sqrt(variance / n);
+}
+
+/**
+ * @fn	void AccumulationBuffer::addSample(int x, int y, const color &C)
+ * @brief	Adds one sample to a pixel, updating its luminance statistics with
+ * 			Welford's algorithm.
+ * @param	x	The x coordinate.
+ * @param	y	The y coordinate.
+ * @param	C	The color of the sample.
+ */
+
+void AccumulationBuffer::addSample(int x, int y, const color& C) {
+	int i = y * width + x;
+	float* S = &sum[3 * i];
+	S[0] += (float)C.r;
+	S[1] += (float)C.g;
+	S[2] += (float)C.b;
+
+	float lum = (float)(0.2126 * C.r + 0.7152 * C.g + 0.0722 * C.b);
+	int n = ++sampleCount[i];
+	float delta = lum - lumMean[i];
+	lumMean[i] += delta / n;
+	lumM2[i] += delta * (lum - lumMean[i]);
+}
+
+/**
+ * @fn	static double nextRandom(unsigned int &state)
+ * @brief	Small xorshift generator used to jitter sample positions.
+ * @param [in,out]	state	The generator's state. Must not be zero.
+ * @return	A pseudo-random value in [0, 1).
+ */
+
+static double nextRandom(unsigned int& state) {
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return (state & 0xFFFFFF) / (double)0x1000000;
+}
+
+/**
+ * @fn	bool RayTracer::raytraceSceneProgressive(FrameBuffer &frameBuffer, int depth,
+ *												const IScene &theScene, AccumulationBuffer &accum,
+ *												int samplesPerPixel) const
+ * @brief	Adds one frame's worth of jittered samples to an accumulation buffer and
+ * 			displays the running estimate. Pixels that have not reached the minimum
+ * 			sample count are served first; the remainder of the frame's budget
+ * 			(samplesPerPixel * width * height) is split among the unconverged pixels
+ * 			in proportion to their estimated error. Converged pixels receive no more
+ * 			samples. The caller must reset accum whenever the scene changes.
+ * @param [in,out]	frameBuffer		Framebuffer.
+ * @param 		  	depth			The depth of recursion.
+ * @param 		  	theScene		The scene.
+ * @param [in,out]	accum			The accumulated samples from previous frames.
+ * @param 		  	samplesPerPixel	Average number of samples per pixel in this frame.
+ * @return	true iff every pixel has converged.
+ */
+
+bool RayTracer::raytraceSceneProgressive(FrameBuffer& frameBuffer, int depth,
+	const IScene& theScene, AccumulationBuffer& accum, int samplesPerPixel) const {
+	const RaytracingCamera& camera = *theScene.camera;
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+
+	if (accum.getWidth() != W || accum.getHeight() != H) {
+		accum.setSize(W, H);
+	}
+	if (denoiseBuffers != nullptr &&
+		(denoiseBuffers->getWidth() != W || denoiseBuffers->getHeight() != H)) {
+		denoiseBuffers->setSize(W, H);
+	}
+
+	PrimaryRayTiles tiles;
+	tiles.build(theScene, W, H);
+
+	// Decide how many samples each pixel receives in this frame.
+	const int area = W * H;
+	long long budget = (long long)samplesPerPixel * area;
+	double totalError = 0.0;
+	vector<int> numSamples(area, 0);
+	for (int y = 0; y < H; ++y) {
+		for (int x = 0; x < W; ++x) {
+			int i = y * W + x;
+			if (accum.converged[i]) {
+				continue;
+			}
+			int n = accum.sampleCount[i];
+			if (n < accum.minSamples) {
+				numSamples[i] = std::min(accum.minSamples - n, samplesPerPixel);
+				budget -= numSamples[i];
+			} else {
+				totalError += accum.getError(x, y);
+			}
+		}
+	}
+	if (budget > 0 && totalError > 0.0) {
+		double samplesPerUnitError = budget / totalError;
+		for (int y = 0; y < H; ++y) {
+			for (int x = 0; x < W; ++x) {
+				int i = y * W + x;
+				if (accum.converged[i] || accum.sampleCount[i] < accum.minSamples) {
+					continue;
+				}
+				int share = (int)std::ceil(accum.getError(x, y) * samplesPerUnitError);
+				numSamples[i] = std::min(share, accum.maxSamples - accum.sampleCount[i]);
+			}
+		}
+	}
+
+	for (int y = 0; y < H; ++y) {
+		for (int x = 0; x < W; ++x) {
+			DEBUG_PIXEL = (x == xDebug && y == yDebug);
+			int i = y * W + x;
+			unsigned int state = 2654435761u * (i + 1) ^ (unsigned int)(accum.sampleCount[i] * 40503 + 1);
+			if (state == 0) {
+				state = 1;
+			}
+			OpaqueHitRecord primaryHit;
+			bool isFirstSample = accum.sampleCount[i] == 0;
+			for (int s = 0; s < numSamples[i]; s++) {
+				double jx = nextRandom(state) - 0.5;
+				double jy = nextRandom(state) - 0.5;
+				Ray ray = camera.getRay(x + jx, y + jy);
+				accum.addSample(x, y, traceIndividualRay(ray, theScene, depth,
+					isFirstSample && s == 0 ? &primaryHit : nullptr, &tiles.getTile(x, y)));
+			}
+
+			int n = accum.sampleCount[i];
+			if (!accum.converged[i] && n >= accum.minSamples &&
+				(n >= accum.maxSamples || accum.getError(x, y) <= accum.tolerance)) {
+				accum.converged[i] = 1;
+				accum.numConverged++;
+			}
+			color mean = accum.getMean(x, y);
+			frameBuffer.setColor(x, y, mean);
+			if (isFirstSample && numSamples[i] > 0) {
+				recordDenoiseData(x, y, mean, primaryHit);
+			} else if (denoiseBuffers != nullptr) {
+				denoiseBuffers->setRadiance(x, y, mean);
+			}
+			frameBuffer.showAxes(x, y, camera.getRay(x, y), 0.25);
+		}
+	}
+	accum.frameNumber++;
+	if (denoiseBuffers == nullptr) {
+		frameBuffer.showColorBuffer();
+	}
+	return accum.numConverged == area;
+}
+
+/**
+ * @fn	void RayTracer::recordDenoiseData(int x, int y, const color &C, const OpaqueHitRecord &hit) const
+ * @brief	Stores a pixel's color together with the albedo, normal and depth of the
+ * 			opaque surface its primary ray hit. Does nothing unless denoiseBuffers is set.
+ * @param	x  	The x coordinate.
+ * @param	y  	The y coordinate.
+ * @param	C  	The pixel's color.
+ * @param	hit	The primary ray's closest opaque hit.
+ */
+
+void RayTracer::recordDenoiseData(int x, int y, const color& C, const OpaqueHitRecord& hit) const {
+	if (denoiseBuffers == nullptr) {
+		return;
+	}
+	if (hit.t == FLT_MAX) {
+		denoiseBuffers->setPixel(x, y, C, white, dvec3(0, 0, 0), 0.0);
+		return;
+	}
+	color albedo = hit.texture != nullptr ? hit.texture->getPixelUV(hit.u, hit.v) : hit.material.diffuse;
+	denoiseBuffers->setPixel(x, y, C, albedo, glm::normalize(hit.normal), hit.t);
 }
 
 /**
  * @fn	color RayTracer::traceIndividualRay(const Ray &ray,
  *											const IScene &theScene,
- *											int recursionLevel) const
+ *											int recursionLevel,
+ *											OpaqueHitRecord *primaryHit,
+ *											const TileObjects *candidates) const
  * @brief	Trace an individual ray.
- * @param	ray			  	The ray.
- * @param	theScene	  	The scene.
- * @param	recursionLevel	The recursion level.
+ * @param 		  	ray			  	The ray.
+ * @param 		  	theScene	  	The scene.
+ * @param 		  	recursionLevel	The recursion level.
+ * @param [out]	primaryHit	  	If not nullptr, receives the ray's closest opaque hit.
+ * @param 		  	candidates	  	If not nullptr, the only objects this ray can hit
+ * 									(reflected rays and shadow feelers still use the whole scene).
+ * 									Its opaque objects are only scanned when the scene
+ * 									has no hierarchy; otherwise the hierarchy is used.
  * @return	The color to be displayed as a result of this ray.
  */
 
-color RayTracer::traceIndividualRay(const Ray& ray, const IScene& theScene, int recursionLevel) const {
+color RayTracer::traceIndividualRay(const Ray& ray, const IScene& theScene, int recursionLevel,
+	OpaqueHitRecord* primaryHit, const TileObjects* candidates) const {
 	OpaqueHitRecord hit;
 	TransparentHitRecord transHit;
-	VisibleIShape::findIntersection(ray, theScene.opaqueObjs, hit);
-	TransparentIShape::findIntersection(ray, theScene.transparentObjs, transHit);
+	if (candidates != nullptr && !theScene.opaqueBVH.isBuilt()) {
+		VisibleIShape::findIntersection(ray, candidates->opaqueObjs, hit);
+	} else {
+		theScene.findOpaqueIntersection(ray, hit);
+	}
+	if (primaryHit != nullptr) {
+		*primaryHit = hit;
+	}
+	TransparentIShape::findIntersection(ray,
+		candidates != nullptr ? candidates->transparentObjs : theScene.transparentObjs, transHit);
 	color temp, C = black;
 	for (int i = 0; i < theScene.lights.size(); i++) {
 		if (hit.t != FLT_MAX && transHit.t == FLT_MAX) {
-			bool shadow = theScene.lights[i]->pointIsInAShadow(hit.interceptPt, hit.normal, theScene.opaqueObjs, theScene.camera->getFrame());
+			bool shadow = theScene.pointIsInAShadow(*theScene.lights[i], hit.interceptPt, hit.normal);
 			C = theScene.lights[i]->illuminate(hit.interceptPt, hit.normal, hit.material, theScene.camera->getFrame(), shadow);
 			if (hit.texture != nullptr) {
-				C = hit.texture->getPixelUV(hit.u, hit.v);
+				C = getTextureColor(hit, *theScene.camera, textureFilter);
 			}
 			temp += C;
 		}
@@ -110,20 +410,20 @@ color RayTracer::traceIndividualRay(const Ray& ray, const IScene& theScene, int
 		}
 		else if (hit.t != FLT_MAX && transHit.t != FLT_MAX) {
 			if (transHit.t < hit.t) { // transparent hit is closer
-				bool shadow = theScene.lights[i]->pointIsInAShadow(hit.interceptPt, hit.normal, theScene.opaqueObjs, theScene.camera->getFrame());
+				bool shadow = theScene.pointIsInAShadow(*theScene.lights[i], hit.interceptPt, hit.normal);
 				C = theScene.lights[i]->illuminate(hit.interceptPt, hit.normal, hit.material, theScene.camera->getFrame(), shadow);
 				C = C * (1 - transHit.alpha) + (transHit.alpha) * (transHit.transColor);
 				if (hit.texture != nullptr) {
-					C = hit.texture->getPixelUV(hit.u, hit.v);
+					C = getTextureColor(hit, *theScene.camera, textureFilter);
 					C = C * (1 - transHit.alpha) + (transHit.alpha) * (transHit.transColor);
 				}
 				temp += C;
 			}
 			else {
-				bool shadow = theScene.lights[i]->pointIsInAShadow(hit.interceptPt, hit.normal, theScene.opaqueObjs, theScene.camera->getFrame());
+				bool shadow = theScene.pointIsInAShadow(*theScene.lights[i], hit.interceptPt, hit.normal);
 				C = theScene.lights[i]->illuminate(hit.interceptPt, hit.normal, hit.material, theScene.camera->getFrame(), shadow);
 				if (hit.texture != nullptr) {
-					C = hit.texture->getPixelUV(hit.u, hit.v);
+					C = getTextureColor(hit, *theScene.camera, textureFilter);
 					C = C * (1 - transHit.alpha) + (transHit.alpha) * (transHit.transColor);
 				}
 				temp += C;
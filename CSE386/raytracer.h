@@ -13,6 +13,46 @@
 #include "framebuffer.h"
 #include "camera.h"
 #include "iscene.h"
+#include "denoiser.h"
+
+/**
+ * @struct	AccumulationBuffer
+ * @brief	Floating-point per-pixel sample statistics used by progressive rendering.
+ * 			Every pixel keeps the running sum of its samples, the running mean and
+ * 			variance of their luminance, and a flag telling whether the estimate
+ * 			has converged.
+ */
+
+struct AccumulationBuffer {
+	double tolerance;		//!< pixel converges when its luminance error falls below this.
+	int minSamples;			//!< samples taken before a pixel may be declared converged.
+	int maxSamples;			//!< a pixel is never sampled more than this.
+	AccumulationBuffer();
+	void setSize(int width, int height);
+	void reset();
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	int getFrameNumber() const { return frameNumber; }
+	int getSampleCount(int x, int y) const { return sampleCount[y * width + x]; }
+	bool isConverged(int x, int y) const { return converged[y * width + x] != 0; }
+	int getNumConverged() const { return numConverged; }
+	color getMean(int x, int y) const;
+	double getError(int x, int y) const;
+	void addSample(int x, int y, const color& C);
+protected:
+	friend struct RayTracer;
+	int width;						//!< width of buffer
+	int height;						//!< height of buffer
+	int frameNumber;				//!< number of frames accumulated so far
+	int numConverged;				//!< number of pixels flagged as converged
+	vector<float> sum;				//!< RGB running sums, 3 floats per pixel
+	vector<float> lumMean;			//!< running mean of sample luminance
+	vector<float> lumM2;			//!< running sum of squared luminance deviations (Welford)
+	vector<int> sampleCount;		//!< number of samples taken per pixel
+	vector<unsigned char> converged;	//!< 1 when the pixel has converged
+};
+
+color getTextureColor(const OpaqueHitRecord& hit, const RaytracingCamera& camera, TextureFilter filter);
 
  /**
   * @struct	RayTracer
@@ -21,9 +61,17 @@
 
 struct RayTracer {
 	color defaultColor;			//!< the color to use if no intersection is present.
+	DenoiseBuffers* denoiseBuffers;	//!< when not nullptr, receives per-pixel data for the denoiser, and the caller shows the denoised buffer.
+	TextureFilter textureFilter;	//!< how textures are sampled.
 	RayTracer(const color& defaultColor);
 	void raytraceScene(FrameBuffer& frameBuffer, int depth,
 		const IScene& theScene, int n) const;
+	void raytraceSceneWavefront(FrameBuffer& frameBuffer, int depth,
+		const IScene& theScene, int n) const;
+	bool raytraceSceneProgressive(FrameBuffer& frameBuffer, int depth,
+		const IScene& theScene, AccumulationBuffer& accum, int samplesPerPixel) const;
 protected:
-	color traceIndividualRay(const Ray& ray, const IScene& theScene, int recursionLevel) const;
+	color traceIndividualRay(const Ray& ray, const IScene& theScene, int recursionLevel,
+		OpaqueHitRecord* primaryHit = nullptr, const TileObjects* candidates = nullptr) const;
+	void recordDenoiseData(int x, int y, const color& C, const OpaqueHitRecord& hit) const;
 };
\ No newline at end of file
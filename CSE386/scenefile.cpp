@@ -0,0 +1,638 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <map>
+#include "scenefile.h"
+#include "io.h"
+#include "light.h"
+#include "instance.h"
+#include "mappedfile.h"
+#include "meshloader.h"
+#include "textureregistry.h"
+
+const char SCENE_COMPILED_MAGIC[8] = { 'C', 'S', 'E', 'S', 'C', 'E', 'N', 'E' };
+const int SCENE_COMPILED_VERSION = 1;
+
+/**
+ * @struct	CompiledSceneHeader
+ * @brief	Start of a compiled scene. It is followed by the camera record, the
+ * 			material, light and object tables, the texture and mesh file names,
+ * 			the meshes' file stamps, the meshes, and the top-level hierarchy.
+ */
+
+struct CompiledSceneHeader {
+	char magic[8];				//!< SCENE_COMPILED_MAGIC.
+	int version;				//!< SCENE_COMPILED_VERSION.
+	int padding;				//!< unused; zero.
+	long long sourceSize;		//!< size of the scene file it was compiled from.
+	long long sourceTime;		//!< modification time of that file.
+};
+
+/**
+ * @struct	NamedMaterial
+ * @brief	A material that scene files can use without declaring it.
+ */
+
+struct NamedMaterial {
+	const char* name;			//!< name used in scene files.
+	const Material* material;	//!< the material.
+};
+
+const NamedMaterial BUILT_IN_MATERIALS[] = {
+	{ "brass", &brass }, { "bronze", &bronze }, { "polishedBronze", &polishedBronze },
+	{ "chrome", &chrome }, { "copper", &copper }, { "polishedCopper", &polishedCopper },
+	{ "gold", &gold }, { "polishedGold", &polishedGold }, { "tin", &tin },
+	{ "silver", &silver }, { "polishedSilver", &polishedSilver },
+	{ "blackPlastic", &blackPlastic }, { "cyanPlastic", &cyanPlastic },
+	{ "greenPlastic", &greenPlastic }, { "redPlastic", &redPlastic },
+	{ "whitePlastic", &whitePlastic }, { "yellowPlastic", &yellowPlastic },
+	{ "blackRubber", &blackRubber }, { "cyanRubber", &cyanRubber },
+	{ "greenRubber", &greenRubber }, { "redRubber", &redRubber },
+	{ "whiteRubber", &whiteRubber }, { "yellowRubber", &yellowRubber },
+	{ "pewter", &pewter }, { "emerald", &emerald }, { "jade", &jade },
+	{ "obsidian", &obsidian }, { "perl", &perl }, { "ruby", &ruby },
+	{ "turquoise", &turquoise }
+};
+
+/**
+ * @fn	SceneDescription::SceneDescription()
+ * @brief	Constructs an empty description, with a perspective camera on the
+ * 			positive z axis looking at the origin.
+ */
+
+SceneDescription::SceneDescription() {
+	camera.isPerspective = 1;
+	camera.pos = dvec3(0, 0, 10);
+	camera.lookAt = ORIGIN3D;
+	camera.up = Y_AXIS;
+	camera.fovOrScale = glm::radians(60.0);
+}
+
+/**
+ * @fn	static string resolvePath(const string &directory, const string &fileName)
+ * @brief	Makes a file name from a scene file relative to the scene file.
+ * @param	directory	The scene file's directory, including the final separator.
+ * @param	fileName 	The file name as written in the scene file.
+ * @return	The file name to open.
+ */
+
+static string resolvePath(const string& directory, const string& fileName) {
+	bool isAbsolute = !fileName.empty() &&
+		(fileName[0] == '/' || fileName[0] == '\\' || (fileName.size() > 1 && fileName[1] == ':'));
+	return isAbsolute ? fileName : directory + fileName;
+}
+
+/**
+ * @fn	static bool findMaterial(const string &name, std::map<string, int> &ids, SceneDescription &desc, int &id)
+ * @brief	Finds a material by name, adding a built-in material to the table the
+ * 			first time it is used.
+ * @param 		  	name	The name.
+ * @param [in,out]	ids 	Indices of the materials in the table so far, by name.
+ * @param [in,out]	desc	The description being parsed.
+ * @param [out]   	id  	Index of the material in the table.
+ * @return	false if there is no such material.
+ */
+
+static bool findMaterial(const string& name, std::map<string, int>& ids, SceneDescription& desc, int& id) {
+	std::map<string, int>::const_iterator it = ids.find(name);
+	if (it != ids.end()) {
+		id = it->second;
+		return true;
+	}
+	for (size_t i = 0; i < sizeof(BUILT_IN_MATERIALS) / sizeof(BUILT_IN_MATERIALS[0]); i++) {
+		if (name == BUILT_IN_MATERIALS[i].name) {
+			id = (int)desc.materials.size();
+			desc.materials.push_back(*BUILT_IN_MATERIALS[i].material);
+			ids[name] = id;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	static bool findName(const std::map<string, int> &ids, const string &name, int &id)
+ * @brief	Finds a declared texture or mesh by name.
+ * @param 	   	ids 	Table indices by name.
+ * @param 	   	name	The name.
+ * @param [out]	id  	Index of the texture or mesh.
+ * @return	false if the name was not declared.
+ */
+
+static bool findName(const std::map<string, int>& ids, const string& name, int& id) {
+	std::map<string, int>::const_iterator it = ids.find(name);
+	if (it == ids.end()) {
+		return false;
+	}
+	id = it->second;
+	return true;
+}
+
+/**
+ * @fn	static bool readOption(std::istream &is, string &option)
+ * @brief	Reads the optional word at the end of a record. Running out of words is
+ * 			not an error; an earlier failure on the line is kept.
+ * @param [in,out]	is	  	The rest of the line.
+ * @param [out]   	option	The word.
+ * @return	true iff there was a word to read.
+ */
+
+static bool readOption(std::istream& is, string& option) {
+	if (is.fail()) {
+		return false;
+	}
+	if (is >> option) {
+		return true;
+	}
+	is.clear();
+	return false;
+}
+
+/**
+ * @fn	bool SceneFile::parse(std::istream &in, const string &directory, SceneDescription &desc)
+ * @brief	Parses the text form of a scene. Errors are reported with their line number.
+ * @param [in,out]	in		 	The text.
+ * @param 		  	directory	Prefix for relative file names (empty or ending in a separator).
+ * @param [out]   	desc	 	The description.
+ * @return	true iff every line was understood.
+ */
+
+bool SceneFile::parse(std::istream& in, const string& directory, SceneDescription& desc) {
+	desc = SceneDescription();
+	std::map<string, int> materialIds, textureIds, meshIds;
+	string line;
+	for (int lineNumber = 1; std::getline(in, line); lineNumber++) {
+		std::istringstream is(line);
+		string keyword;
+		if (!(is >> keyword) || keyword[0] == '#') {
+			continue;
+		}
+		string error;
+		if (keyword == "camera") {
+			string kind;
+			SceneCameraRecord& cam = desc.camera;
+			is >> kind >> cam.pos >> cam.lookAt >> cam.up >> cam.fovOrScale;
+			if (kind == "perspective") {
+				cam.isPerspective = 1;
+				cam.fovOrScale = glm::radians(cam.fovOrScale);
+			} else if (kind == "orthographic") {
+				cam.isPerspective = 0;
+			} else {
+				error = "unknown camera " + kind;
+			}
+		} else if (keyword == "material") {
+			string name;
+			Material mat;
+			is >> name >> mat;
+			materialIds[name] = (int)desc.materials.size();
+			desc.materials.push_back(mat);
+		} else if (keyword == "texture" || keyword == "mesh") {
+			string name, fileName;
+			is >> name >> fileName;
+			vector<string>& files = keyword == "texture" ? desc.textureFiles : desc.meshFiles;
+			(keyword == "texture" ? textureIds : meshIds)[name] = (int)files.size();
+			files.push_back(resolvePath(directory, fileName));
+		} else if (keyword == "light") {
+			string kind, option;
+			SceneLightRecord light;
+			LightATParams atParams(0.0, 1.0, 0.0);
+			light.attenuation = 0;
+			light.dir = -Y_AXIS;
+			light.fov = 0;
+			is >> kind >> light.pos >> light.lightColor;
+			if (kind == "spot") {
+				light.isSpot = 1;
+				is >> light.dir >> light.fov;
+				light.fov = glm::radians(light.fov);
+			} else if (kind == "positional") {
+				light.isSpot = 0;
+			} else {
+				error = "unknown light " + kind;
+			}
+			if (readOption(is, option)) {
+				if (option == "attenuation") {
+					is >> atParams;
+					light.attenuation = 1;
+				} else {
+					error = "unexpected " + option;
+				}
+			}
+			light.atParams = dvec3(atParams.constant, atParams.linear, atParams.quadratic);
+			desc.lights.push_back(light);
+		} else if (keyword == "object") {
+			string surface, shape, option;
+			SceneObjectRecord obj;
+			obj.isTransparent = 0;
+			obj.material = obj.texture = obj.mesh = -1;
+			obj.point = obj.vector = ORIGIN3D;
+			obj.radius = obj.length = 0;
+			obj.transform = dmat4(1.0);
+			obj.transColor = black;
+			obj.alpha = 1.0;
+			is >> surface;
+			if (surface == "transparent") {
+				obj.isTransparent = 1;
+				is >> obj.transColor >> obj.alpha;
+			} else if (!findMaterial(surface, materialIds, desc, obj.material)) {
+				error = "unknown material " + surface;
+			}
+			is >> shape;
+			if (shape == "plane") {
+				obj.shape = SCENE_PLANE;
+				is >> obj.point >> obj.vector;
+			} else if (shape == "sphere") {
+				obj.shape = SCENE_SPHERE;
+				is >> obj.point >> obj.radius;
+			} else if (shape == "disk") {
+				obj.shape = SCENE_DISK;
+				is >> obj.point >> obj.vector >> obj.radius;
+			} else if (shape == "cylindery" || shape == "cylinderz" ||
+						shape == "closedcylindery" || shape == "coney") {
+				obj.shape = shape == "cylindery" ? SCENE_CYLINDER_Y :
+							shape == "cylinderz" ? SCENE_CYLINDER_Z :
+							shape == "closedcylindery" ? SCENE_CLOSED_CYLINDER_Y : SCENE_CONE_Y;
+				is >> obj.point >> obj.radius >> obj.length;
+			} else if (shape == "ellipsoid") {
+				obj.shape = SCENE_ELLIPSOID;
+				is >> obj.point >> obj.vector;
+			} else if (shape == "mesh" || shape == "instance") {
+				string name;
+				obj.shape = shape == "mesh" ? SCENE_MESH : SCENE_INSTANCE;
+				is >> name;
+				if (!findName(meshIds, name, obj.mesh)) {
+					error = "unknown mesh " + name;
+				}
+				if (obj.shape == SCENE_INSTANCE) {
+					is >> obj.transform;
+				}
+			} else {
+				error = "unknown shape " + shape;
+			}
+			if (readOption(is, option)) {
+				string name;
+				if (option != "texture") {
+					error = "unexpected " + option;
+				} else if (!(is >> name) || !findName(textureIds, name, obj.texture)) {
+					error = "unknown texture " + name;
+				}
+			}
+			desc.objects.push_back(obj);
+		} else {
+			error = "unknown record " + keyword;
+		}
+		if (error.empty() && is.fail()) {
+			error = "cannot read " + keyword;
+		}
+		if (!error.empty()) {
+			std::cerr << "Scene line " << lineNumber << ": " << error << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	RaytracingCamera* SceneFile::createCamera(const SceneCameraRecord &camera, int width, int height)
+ * @brief	Creates the camera a scene file describes.
+ * @param	camera	The camera record.
+ * @param	width 	Width of the image, in pixels.
+ * @param	height	Height of the image, in pixels.
+ * @return	The new camera.
+ */
+
+RaytracingCamera* SceneFile::createCamera(const SceneCameraRecord& camera, int width, int height) {
+	if (camera.isPerspective) {
+		return new PerspectiveCamera(camera.pos, camera.lookAt, camera.up, camera.fovOrScale, width, height);
+	}
+	return new OrthographicCamera(camera.pos, camera.lookAt, camera.up, width, height, camera.fovOrScale);
+}
+
+/**
+ * @fn	bool SceneFile::createObjects(SceneDescription &desc, IScene &scene, int width, int height)
+ * @brief	Adds the camera, lights and objects of a description to a scene. The
+ * 			description's meshes and textures must already be loaded.
+ * @param [in,out]	desc  	The description.
+ * @param [in,out]	scene 	The scene.
+ * @param 		  	width 	Width of the image, in pixels.
+ * @param 		  	height	Height of the image, in pixels.
+ * @return	false, leaving the scene unchanged, if a record is invalid.
+ */
+
+bool SceneFile::createObjects(SceneDescription& desc, IScene& scene, int width, int height) {
+	for (size_t i = 0; i < desc.objects.size(); i++) {
+		const SceneObjectRecord& rec = desc.objects[i];
+		bool usesMesh = rec.shape == SCENE_MESH || rec.shape == SCENE_INSTANCE;
+		if (rec.shape < SCENE_PLANE || rec.shape > SCENE_INSTANCE ||
+			(!rec.isTransparent && (rec.material < 0 || rec.material >= (int)desc.materials.size())) ||
+			(rec.texture >= (int)desc.textures.size()) ||
+			(usesMesh && (rec.mesh < 0 || rec.mesh >= (int)desc.meshes.size()))) {
+			std::cerr << "Scene object " << i << " is invalid" << endl;
+			return false;
+		}
+	}
+	scene.camera = createCamera(desc.camera, width, height);
+	for (size_t i = 0; i < desc.lights.size(); i++) {
+		const SceneLightRecord& rec = desc.lights[i];
+		PositionalLightPtr light = rec.isSpot ? new SpotLight(rec.pos, rec.dir, rec.fov, rec.lightColor)
+											: new PositionalLight(rec.pos, rec.lightColor);
+		light->attenuationIsTurnedOn = rec.attenuation != 0;
+		light->atParams = LightATParams(rec.atParams.x, rec.atParams.y, rec.atParams.z);
+		scene.addLight(light);
+	}
+	for (size_t i = 0; i < desc.objects.size(); i++) {
+		const SceneObjectRecord& rec = desc.objects[i];
+		IShapePtr shape = nullptr;
+		switch (rec.shape) {
+		case SCENE_PLANE:				shape = new IPlane(rec.point, rec.vector); break;
+		case SCENE_SPHERE:				shape = new ISphere(rec.point, rec.radius); break;
+		case SCENE_DISK:				shape = new IDisk(rec.point, rec.vector, rec.radius); break;
+		case SCENE_CYLINDER_Y:			shape = new ICylinderY(rec.point, rec.radius, rec.length); break;
+		case SCENE_CYLINDER_Z:			shape = new ICylinderZ(rec.point, rec.radius, rec.length); break;
+		case SCENE_CLOSED_CYLINDER_Y:	shape = new IClosedCylinderY(rec.point, rec.radius, rec.length); break;
+		case SCENE_CONE_Y:				shape = new IConeY(rec.point, rec.radius, rec.length); break;
+		case SCENE_ELLIPSOID:			shape = new IEllipsoid(rec.point, rec.vector); break;
+		case SCENE_MESH:				shape = desc.meshes[rec.mesh]; break;
+		default:						shape = new IInstance(desc.meshes[rec.mesh], rec.transform); break;
+		}
+		if (rec.isTransparent) {
+			scene.addTransparentObject(new TransparentIShape(shape, rec.transColor, rec.alpha));
+		} else {
+			Image* texture = rec.texture >= 0 ? desc.textures[rec.texture] : nullptr;
+			TextureRegistry::getInstance().decodeInBackground(texture);
+			scene.addOpaqueObject(new VisibleIShape(shape, desc.materials[rec.material], texture));
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	static void deleteMeshes(SceneDescription &desc)
+ * @brief	Deletes the meshes of a description that no scene object uses yet.
+ * @param [in,out]	desc	The description; its meshes are cleared.
+ */
+
+static void deleteMeshes(SceneDescription& desc) {
+	for (size_t i = 0; i < desc.meshes.size(); i++) {
+		delete desc.meshes[i];
+	}
+	desc.meshes.clear();
+}
+
+/**
+ * @fn	bool SceneFile::build(SceneDescription &desc, IScene &scene, int width, int height)
+ * @brief	Builds a scene from a description: loads its meshes and textures, adds
+ * 			everything to the scene and builds the top-level hierarchy.
+ * @param [in,out]	desc  	The description; its meshes and textures are filled in.
+ * @param [in,out]	scene 	The scene, which should be empty.
+ * @param 		  	width 	Width of the image, in pixels.
+ * @param 		  	height	Height of the image, in pixels.
+ * @return	true iff the scene was built.
+ */
+
+bool SceneFile::build(SceneDescription& desc, IScene& scene, int width, int height) {
+	desc.meshes.clear();
+	for (size_t i = 0; i < desc.meshFiles.size(); i++) {
+		IndexedMesh mesh;
+		if (!MeshLoader::loadOBJ(desc.meshFiles[i], mesh)) {
+			deleteMeshes(desc);
+			return false;
+		}
+		desc.meshes.push_back(mesh.createTriangleMesh());
+	}
+	desc.textures.clear();
+	for (size_t i = 0; i < desc.textureFiles.size(); i++) {
+		desc.textures.push_back(TextureRegistry::getInstance().get(desc.textureFiles[i]));
+	}
+	if (!createObjects(desc, scene, width, height)) {
+		deleteMeshes(desc);
+		return false;
+	}
+	scene.buildAccelerationStructure();
+	return true;
+}
+
+/**
+ * @fn	static void writeStrings(std::ostream &out, const vector<string> &strings)
+ * @brief	Writes a list of strings in binary form.
+ * @param	out	   	The binary output stream.
+ * @param	strings	The strings.
+ */
+
+static void writeStrings(std::ostream& out, const vector<string>& strings) {
+	long long n = (long long)strings.size();
+	out.write((const char*)&n, sizeof(n));
+	for (size_t i = 0; i < strings.size(); i++) {
+		writeArray(out, vector<char>(strings[i].begin(), strings[i].end()));
+	}
+}
+
+/**
+ * @fn	static bool readStrings(const char* &p, const char *end, vector<string> &strings)
+ * @brief	Reads a list of strings written by writeStrings.
+ * @param [in,out]	p	   	The position to read from; advanced past the strings.
+ * @param 		  	end	   	The end of the readable memory.
+ * @param [out]   	strings	The strings.
+ * @return	false if the data is truncated.
+ */
+
+static bool readStrings(const char*& p, const char* end, vector<string>& strings) {
+	long long n;
+	if (end - p < (long long)sizeof(n)) {
+		return false;
+	}
+	std::memcpy(&n, p, sizeof(n));
+	p += sizeof(n);
+	strings.clear();
+	vector<char> chars;
+	for (long long i = 0; i < n; i++) {
+		if (!readArray(p, end, chars)) {
+			return false;
+		}
+		strings.push_back(string(chars.begin(), chars.end()));
+	}
+	return true;
+}
+
+/**
+ * @fn	static bool getMeshStamps(const vector<string> &meshFiles, vector<long long> &stamps)
+ * @brief	Gets the size and modification time of each mesh file.
+ * @param 	   	meshFiles	The mesh files.
+ * @param [out]	stamps   	Size and time of each file, in turn.
+ * @return	false if a file is missing.
+ */
+
+static bool getMeshStamps(const vector<string>& meshFiles, vector<long long>& stamps) {
+	stamps.resize(2 * meshFiles.size());
+	for (size_t i = 0; i < meshFiles.size(); i++) {
+		if (!getFileStamp(meshFiles[i], stamps[2 * i], stamps[2 * i + 1])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	bool SceneFile::writeCompiled(const string &compiledName, const string &sourceName,
+ * 									const SceneDescription &desc, const IScene &scene)
+ * @brief	Saves a built scene as a compiled scene, stamped with the scene file's
+ * 			and the meshes' sizes and modification times. The file is in the
+ * 			machine's own byte order.
+ * @param	compiledName	Name of the compiled scene.
+ * @param	sourceName  	Name of the scene file.
+ * @param	desc			The description the scene was built from.
+ * @param	scene			The scene, with its top-level hierarchy built.
+ * @return	true iff the compiled scene was written.
+ */
+
+bool SceneFile::writeCompiled(const string& compiledName, const string& sourceName,
+	const SceneDescription& desc, const IScene& scene) {
+	CompiledSceneHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, SCENE_COMPILED_MAGIC, sizeof(header.magic));
+	header.version = SCENE_COMPILED_VERSION;
+	vector<long long> meshStamps;
+	if (!scene.opaqueBVH.isBuilt() || desc.meshes.size() != desc.meshFiles.size() ||
+		!getFileStamp(sourceName, header.sourceSize, header.sourceTime) ||
+		!getMeshStamps(desc.meshFiles, meshStamps)) {
+		return false;
+	}
+
+	std::ofstream out(compiledName.c_str(), std::ios::binary);
+	out.write((const char*)&header, sizeof(header));
+	out.write((const char*)&desc.camera, sizeof(desc.camera));
+	writeArray(out, desc.materials);
+	writeArray(out, desc.lights);
+	writeArray(out, desc.objects);
+	writeStrings(out, desc.textureFiles);
+	writeStrings(out, desc.meshFiles);
+	writeArray(out, meshStamps);
+	for (size_t i = 0; i < desc.meshes.size(); i++) {
+		desc.meshes[i]->write(out);
+	}
+	scene.opaqueBVH.write(out);
+	if (!out) {
+		std::cerr << "Cannot write " << compiledName << endl;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @fn	bool SceneFile::readCompiled(const string &compiledName, const string &sourceName,
+ * 									SceneDescription &desc, IScene &scene, int width, int height)
+ * @brief	Loads a compiled scene, provided it was compiled from the current
+ * 			versions of the scene file and its meshes. The meshes' and the scene's
+ * 			hierarchies are copied from the mapped file as they are; nothing is
+ * 			parsed or rebuilt.
+ * @param 		  	compiledName	Name of the compiled scene.
+ * @param 		  	sourceName  	Name of the scene file.
+ * @param [out]   	desc			The description.
+ * @param [in,out]	scene			The scene, which should be empty.
+ * @param 		  	width			Width of the image, in pixels.
+ * @param 		  	height			Height of the image, in pixels.
+ * @return	true iff the compiled scene was valid and up to date.
+ */
+
+bool SceneFile::readCompiled(const string& compiledName, const string& sourceName,
+	SceneDescription& desc, IScene& scene, int width, int height) {
+	long long compiledSize, compiledTime, sourceSize, sourceTime;
+	if (!getFileStamp(compiledName, compiledSize, compiledTime) ||
+		!getFileStamp(sourceName, sourceSize, sourceTime)) {
+		return false;
+	}
+	MappedFile file;
+	if (!file.open(compiledName) || file.getSize() < sizeof(CompiledSceneHeader) + sizeof(SceneCameraRecord)) {
+		return false;
+	}
+	CompiledSceneHeader header;
+	std::memcpy(&header, file.getData(), sizeof(header));
+	if (std::memcmp(header.magic, SCENE_COMPILED_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != SCENE_COMPILED_VERSION ||
+		header.sourceSize != sourceSize || header.sourceTime != sourceTime) {
+		return false;
+	}
+
+	const char* p = file.getData() + sizeof(header);
+	const char* end = file.getData() + file.getSize();
+	vector<long long> savedStamps, meshStamps;
+	desc = SceneDescription();
+	std::memcpy(&desc.camera, p, sizeof(desc.camera));
+	p += sizeof(desc.camera);
+	if (!readArray(p, end, desc.materials) || !readArray(p, end, desc.lights) ||
+		!readArray(p, end, desc.objects) || !readStrings(p, end, desc.textureFiles) ||
+		!readStrings(p, end, desc.meshFiles) || !readArray(p, end, savedStamps)) {
+		std::cerr << compiledName << " is truncated" << endl;
+		return false;
+	}
+	if (!getMeshStamps(desc.meshFiles, meshStamps) || meshStamps != savedStamps) {
+		return false;
+	}
+	for (size_t i = 0; i < desc.meshFiles.size(); i++) {
+		ITriangleMesh* mesh = new ITriangleMesh();
+		if (!mesh->read(p, end)) {
+			std::cerr << compiledName << " is damaged" << endl;
+			delete mesh;
+			deleteMeshes(desc);
+			return false;
+		}
+		desc.meshes.push_back(mesh);
+	}
+	for (size_t i = 0; i < desc.textureFiles.size(); i++) {
+		desc.textures.push_back(TextureRegistry::getInstance().get(desc.textureFiles[i]));
+	}
+	if (!createObjects(desc, scene, width, height)) {
+		deleteMeshes(desc);
+		return false;
+	}
+	if (!scene.opaqueBVH.read(p, end, scene.opaqueObjs)) {
+		std::cerr << compiledName << " has a damaged hierarchy; rebuilding it" << endl;
+		scene.buildAccelerationStructure();
+	}
+	return true;
+}
+
+/**
+ * @fn	bool SceneFile::load(const string &fileName, IScene &scene, SceneDescription &desc,
+ * 							int width, int height, bool useCompiled)
+ * @brief	Loads a scene file into a scene, from its compiled form if that is up to
+ * 			date. Otherwise the text is parsed, the scene built, and a fresh
+ * 			compiled scene written. Returns once the scene's textures are decoded.
+ * @param 		  	fileName   	Name of the scene file.
+ * @param [in,out]	scene	   	The scene, which should be empty.
+ * @param [out]   	desc	   	The description of the scene.
+ * @param 		  	width	   	Width of the image, in pixels.
+ * @param 		  	height	   	Height of the image, in pixels.
+ * @param 		  	useCompiled	false to always parse and never write a compiled scene.
+ * @return	true iff the scene was loaded.
+ */
+
+bool SceneFile::load(const string& fileName, IScene& scene, SceneDescription& desc,
+	int width, int height, bool useCompiled) {
+	const string compiledName = getCompiledName(fileName);
+	if (useCompiled && readCompiled(compiledName, fileName, desc, scene, width, height)) {
+		TextureRegistry::getInstance().waitForPrefetch();
+		return true;
+	}
+	std::ifstream in(fileName.c_str());
+	if (!in) {
+		std::cerr << "Cannot open " << fileName << endl;
+		return false;
+	}
+	size_t slash = fileName.find_last_of("/\\");
+	string directory = slash == string::npos ? string() : fileName.substr(0, slash + 1);
+	if (!parse(in, directory, desc) || !build(desc, scene, width, height)) {
+		std::cerr << "Cannot load " << fileName << endl;
+		return false;
+	}
+	if (useCompiled) {
+		writeCompiled(compiledName, fileName, desc, scene);
+	}
+	TextureRegistry::getInstance().waitForPrefetch();
+	return true;
+}
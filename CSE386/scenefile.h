@@ -0,0 +1,140 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <istream>
+#include "defs.h"
+#include "colorandmaterials.h"
+#include "iscene.h"
+#include "trianglemesh.h"
+#include "image.h"
+
+/**
+ * @enum	SceneShape
+ * @brief	The kinds of shape a scene file can place.
+ */
+
+enum SceneShape {
+	SCENE_PLANE, SCENE_SPHERE, SCENE_DISK, SCENE_CYLINDER_Y, SCENE_CYLINDER_Z,
+	SCENE_CLOSED_CYLINDER_Y, SCENE_CONE_Y, SCENE_ELLIPSOID, SCENE_MESH, SCENE_INSTANCE
+};
+
+/**
+ * @struct	SceneCameraRecord
+ * @brief	The camera of a scene file.
+ */
+
+struct SceneCameraRecord {
+	int isPerspective;		//!< 1 for a perspective camera, 0 for orthographic.
+	dvec3 pos;				//!< position of the camera.
+	dvec3 lookAt;			//!< point the camera looks at.
+	dvec3 up;				//!< up direction.
+	double fovOrScale;		//!< field of view in radians, or the orthographic scale factor.
+};
+
+/**
+ * @struct	SceneLightRecord
+ * @brief	One light of a scene file.
+ */
+
+struct SceneLightRecord {
+	int isSpot;				//!< 1 for a spot light, 0 for a positional light.
+	int attenuation;		//!< 1 if attenuation is turned on.
+	dvec3 pos;				//!< position of the light.
+	color lightColor;		//!< color of the light.
+	dvec3 dir;				//!< direction of a spot light.
+	double fov;				//!< cone angle of a spot light, in radians.
+	dvec3 atParams;			//!< constant, linear and quadratic attenuation.
+};
+
+/**
+ * @struct	SceneObjectRecord
+ * @brief	One object of a scene file. Which fields are used depends on shape:
+ * 			point is the point on a plane or the center of the other shapes,
+ * 			vector the normal of a plane or disk or the radii of an ellipsoid,
+ * 			and radius and length the sizes of disks, spheres, cylinders and cones.
+ */
+
+struct SceneObjectRecord {
+	int shape;				//!< a SceneShape.
+	int isTransparent;		//!< 1 for a transparent object, 0 for an opaque one.
+	int material;			//!< index into the material table (opaque objects).
+	int texture;			//!< index into the texture table, or -1.
+	int mesh;				//!< index into the mesh table (meshes and instances), or -1.
+	dvec3 point;			//!< point on a plane, or center.
+	dvec3 vector;			//!< normal, or radii.
+	double radius;			//!< radius.
+	double length;			//!< length or height.
+	dmat4 transform;		//!< placement of an instance.
+	color transColor;		//!< color of a transparent object.
+	double alpha;			//!< opacity of a transparent object.
+};
+
+/**
+ * @struct	SceneDescription
+ * @brief	Everything a scene file says, with names resolved to table indices.
+ * 			The records are plain data, so a compiled scene holds them as they
+ * 			are in memory. meshes and textures are filled in when the scene is
+ * 			built or read back.
+ */
+
+struct SceneDescription {
+	SceneCameraRecord camera;			//!< the camera.
+	vector<Material> materials;			//!< material table.
+	vector<string> textureFiles;		//!< texture table: PPM files.
+	vector<string> meshFiles;			//!< mesh table: OBJ files.
+	vector<SceneLightRecord> lights;	//!< the lights.
+	vector<SceneObjectRecord> objects;	//!< the objects, in scene order.
+	vector<ITriangleMesh*> meshes;		//!< one mesh per entry of meshFiles.
+	vector<Image*> textures;			//!< one image per entry of textureFiles.
+	SceneDescription();
+};
+
+/**
+ * @struct	SceneFile
+ * @brief	Reads scenes from text files, one record per line:
+ * 			  camera perspective pos lookAt up fovDegrees
+ * 			  camera orthographic pos lookAt up scale
+ * 			  material name ambient diffuse specular shininess
+ * 			  texture name file.ppm
+ * 			  mesh name file.obj
+ * 			  light positional pos color [attenuation constant-linear-quadratic]
+ * 			  light spot pos color dir fovDegrees [attenuation ...]
+ * 			  object surface shape ... [texture name]
+ * 			where surface is a material name (declared or built in, such as gold)
+ * 			or "transparent color alpha", and shape is one of
+ * 			  plane point normal | sphere center radius | disk center normal radius
+ * 			  cylindery|cylinderz|closedcylindery|coney center radius length
+ * 			  ellipsoid center radii | mesh name | instance name matrix
+ * 			Vectors, colors and materials are written as io.cpp reads them, e.g.
+ * 			[ 1 2 3 ]. Lines starting with # are comments. File names are relative
+ * 			to the scene file.
+ *
+ * 			Loading also writes a compiled scene next to the file (name +
+ * 			".compiled"): the records, each triangle mesh with its hierarchy, and
+ * 			the scene's top-level hierarchy. While the text file and its meshes are
+ * 			unchanged, later loads map the compiled scene and copy those arrays
+ * 			straight into place instead of parsing and rebuilding.
+ */
+
+struct SceneFile {
+	static bool load(const string& fileName, IScene& scene, SceneDescription& desc,
+		int width, int height, bool useCompiled = true);
+	static bool parse(std::istream& in, const string& directory, SceneDescription& desc);
+	static bool build(SceneDescription& desc, IScene& scene, int width, int height);
+	static bool readCompiled(const string& compiledName, const string& sourceName,
+		SceneDescription& desc, IScene& scene, int width, int height);
+	static bool writeCompiled(const string& compiledName, const string& sourceName,
+		const SceneDescription& desc, const IScene& scene);
+	static RaytracingCamera* createCamera(const SceneCameraRecord& camera, int width, int height);
+	static string getCompiledName(const string& fileName) { return fileName + ".compiled"; }
+protected:
+	static bool createObjects(SceneDescription& desc, IScene& scene, int width, int height);
+};
@@ -0,0 +1,231 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include "shadowpacket.h"
+#include "simd.h"
+
+/**
+ * @fn	void ShadowOccluders::build(const vector<VisibleIShapePtr> &objs)
+ * @brief	Collects the shapes of the opaque objects and their bounds.
+ * @param	objs	The opaque objects of the scene.
+ */
+
+void ShadowOccluders::build(const vector<VisibleIShapePtr>& objs) {
+	shapes.resize(objs.size());
+	boxes.resize(objs.size());
+	isBounded.resize(objs.size());
+	for (size_t i = 0; i < objs.size(); i++) {
+		shapes[i] = objs[i]->shape;
+		BoundingBox box;
+		isBounded[i] = shapes[i]->getBoundingBox(box);
+		if (isBounded[i]) {
+			dvec3 largest = glm::max(glm::abs(box.lo), glm::abs(box.hi));
+			double pad = 1.0E-4 * (1.0 + std::max(largest.x, std::max(largest.y, largest.z)));
+			box.lo -= dvec3(pad, pad, pad);
+			box.hi += dvec3(pad, pad, pad);
+		}
+		boxes[i] = box;
+	}
+}
+
+/**
+ * @fn	static bool sphereMayTouchCone(const dvec3 &apex, const dvec3 &axis, double halfAngle,
+ * 										double length, const dvec3 &center, double radius)
+ * @brief	Conservative test of a sphere against a cone of finite length.
+ * @param	apex	 	The cone's apex.
+ * @param	axis	 	The cone's unit axis.
+ * @param	halfAngle	The cone's half angle, in radians.
+ * @param	length   	The cone's length, measured from the apex.
+ * @param	center   	Center of the sphere.
+ * @param	radius   	Radius of the sphere.
+ * @return	false only if the sphere is certainly outside the cone.
+ */
+
+static bool sphereMayTouchCone(const dvec3& apex, const dvec3& axis, double halfAngle,
+	double length, const dvec3& center, double radius) {
+	dvec3 v = center - apex;
+	double d = glm::length(v);
+	if (d <= radius) {
+		return true;
+	}
+	if (d - radius > length) {
+		return false;
+	}
+	double angle = std::acos(glm::clamp(glm::dot(v / d, axis), -1.0, 1.0));
+	return angle <= halfAngle + std::asin(radius / d) + 1.0E-6;
+}
+
+/**
+ * @fn	static bool blocks(const IShape &shape, const ShadowRay &s)
+ * @brief	Exact test of one feeler against one shape.
+ * @return	true iff the shape is hit before the feeler reaches its light.
+ */
+
+static bool blocks(const IShape& shape, const ShadowRay& s) {
+	HitRecord hit;
+	shape.findClosestIntersection(s.ray, hit);
+	return hit.t < s.maxT;
+}
+
+/**
+ * @fn	static float safeInverse(double d)
+ * @brief	Inverse of a direction component, kept finite so the slab test never
+ * 			multiplies zero by infinity.
+ */
+
+static float safeInverse(double d) {
+	const double TINY = 1.0E-12;
+	if (std::fabs(d) < TINY) {
+		d = d < 0 ? -TINY : TINY;
+	}
+	return (float)(1.0 / d);
+}
+
+/**
+ * @fn	void traceShadowPacket(const ShadowOccluders &occluders, const dvec3 &lightPos,
+ * 							const ShadowRay *rays, int count, unsigned char *occluded)
+ * @brief	Decides which feelers of a packet are blocked. All feelers must run from
+ * 			their origins toward lightPos. The packet's bounds (a box and a cone with
+ * 			its apex at the light) are tested once against each occluder; occluders
+ * 			that survive are tested against four feelers at a time with a
+ * 			single-precision box test, and only feelers that pass it get the exact
+ * 			test. The results are the same as testing each feeler on its own.
+ * @param 		  	occluders	The shapes that may cast shadows.
+ * @param 		  	lightPos 	The point every feeler is aimed at.
+ * @param 		  	rays	 	The feelers.
+ * @param 		  	count	 	Number of feelers.
+ * @param [out]	occluded 	Receives 1 for each blocked feeler and 0 otherwise.
+ */
+
+void traceShadowPacket(const ShadowOccluders& occluders, const dvec3& lightPos,
+	const ShadowRay* rays, int count, unsigned char* occluded) {
+	std::fill(occluded, occluded + count, 0);
+	if (count == 0) {
+		return;
+	}
+
+	// Every feeler lies within the box around its origin and the light, and
+	// within the cone from the light that contains all the origins.
+	BoundingBox packetBox;
+	packetBox.expand(lightPos);
+	dvec3 axis(0, 0, 0);
+	double coneLength = 0.0;
+	for (int i = 0; i < count; i++) {
+		dvec3 toOrigin = rays[i].ray.origin - lightPos;
+		double d = glm::length(toOrigin);
+		packetBox.expand(rays[i].ray.origin);
+		coneLength = std::max(coneLength, d);
+		if (d > 0) {
+			axis += toOrigin / d;
+		}
+	}
+	double halfAngle = PI;
+	if (glm::length(axis) > 0) {
+		axis = glm::normalize(axis);
+		halfAngle = 0.0;
+		for (int i = 0; i < count; i++) {
+			dvec3 toOrigin = rays[i].ray.origin - lightPos;
+			double d = glm::length(toOrigin);
+			if (d > 0) {
+				double cosine = glm::clamp(glm::dot(toOrigin / d, axis), -1.0, 1.0);
+				halfAngle = std::max(halfAngle, std::acos(cosine));
+			}
+		}
+	}
+	const bool useCone = halfAngle < PI_2;
+
+	// Feelers in structure-of-arrays form, padded to a multiple of four. Blocked
+	// and padding lanes get a negative maxT, so the box test rejects them.
+	const int numGroups = (count + 3) / 4;
+	const int numLanes = 4 * numGroups;
+	thread_local vector<float> soa;
+	soa.resize(7 * numLanes);
+	float* ox = &soa[0];
+	float* oy = ox + numLanes;
+	float* oz = oy + numLanes;
+	float* ix = oz + numLanes;
+	float* iy = ix + numLanes;
+	float* iz = iy + numLanes;
+	float* tMax = iz + numLanes;
+	for (int i = 0; i < numLanes; i++) {
+		if (i < count) {
+			const Ray& ray = rays[i].ray;
+			ox[i] = (float)ray.origin.x;
+			oy[i] = (float)ray.origin.y;
+			oz[i] = (float)ray.origin.z;
+			ix[i] = safeInverse(ray.dir.x);
+			iy[i] = safeInverse(ray.dir.y);
+			iz[i] = safeInverse(ray.dir.z);
+			tMax[i] = (float)(rays[i].maxT * (1.0 + 1.0E-5) + 1.0E-4);
+		} else {
+			ox[i] = oy[i] = oz[i] = 0.0f;
+			ix[i] = iy[i] = iz[i] = 1.0f;
+			tMax[i] = -1.0f;
+		}
+	}
+
+	int numLeft = count;
+	for (size_t j = 0; j < occluders.shapes.size() && numLeft > 0; j++) {
+		const IShape& shape = *occluders.shapes[j];
+		if (!occluders.isBounded[j]) {
+			for (int i = 0; i < count; i++) {
+				if (!occluded[i] && blocks(shape, rays[i])) {
+					occluded[i] = 1;
+					tMax[i] = -1.0f;
+					numLeft--;
+				}
+			}
+			continue;
+		}
+
+		const BoundingBox& box = occluders.boxes[j];
+		if (!box.overlaps(packetBox)) {
+			continue;
+		}
+		if (useCone && !sphereMayTouchCone(lightPos, axis, halfAngle, coneLength,
+				box.center(), glm::length(box.extent()) / 2)) {
+			continue;
+		}
+
+		const Float4 loX((float)box.lo.x), loY((float)box.lo.y), loZ((float)box.lo.z);
+		const Float4 hiX((float)box.hi.x), hiY((float)box.hi.y), hiZ((float)box.hi.z);
+		for (int g = 0; g < numLanes; g += 4) {
+			Float4 oX = Float4::load(ox + g), oY = Float4::load(oy + g), oZ = Float4::load(oz + g);
+			Float4 iX = Float4::load(ix + g), iY = Float4::load(iy + g), iZ = Float4::load(iz + g);
+			Float4 t1 = (loX - oX) * iX, t2 = (hiX - oX) * iX;
+			Float4 tNear = min(t1, t2), tFar = max(t1, t2);
+			t1 = (loY - oY) * iY;
+			t2 = (hiY - oY) * iY;
+			tNear = max(tNear, min(t1, t2));
+			tFar = min(tFar, max(t1, t2));
+			t1 = (loZ - oZ) * iZ;
+			t2 = (hiZ - oZ) * iZ;
+			tNear = max(tNear, min(t1, t2));
+			tFar = min(tFar, max(t1, t2));
+			tNear = max(tNear, Float4(0.0f));
+			tFar = min(tFar, Float4::load(tMax + g));
+
+			int mask = moveMask(tNear <= tFar);
+			while (mask != 0) {
+				int lane = 0;
+				while (!(mask & (1 << lane))) {
+					lane++;
+				}
+				mask &= ~(1 << lane);
+				const int i = g + lane;
+				if (blocks(shape, rays[i])) {
+					occluded[i] = 1;
+					tMax[i] = -1.0f;
+					numLeft--;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,45 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include "defs.h"
+#include "ishape.h"
+
+const int SHADOW_TILE_SIZE = 8;		//!< Feelers from a SHADOW_TILE_SIZE^2 pixel tile form one packet.
+
+/**
+ * @struct	ShadowRay
+ * @brief	A shadow feeler waiting in the any-hit queue.
+ */
+
+struct ShadowRay {
+	Ray ray;				//!< the shadow feeler.
+	double maxT;			//!< distance to the light; only closer hits block it.
+	int hit;				//!< index of the hit being shaded.
+	int light;				//!< index of the light the feeler points at.
+	int tile;				//!< screen tile of the pixel being shaded.
+};
+
+/**
+ * @struct	ShadowOccluders
+ * @brief	The opaque shapes that can cast shadows, with their bounding boxes
+ * 			padded slightly so single-precision box tests never reject a hit
+ * 			the exact test would find.
+ */
+
+struct ShadowOccluders {
+	vector<IShapePtr> shapes;			//!< the shapes.
+	vector<BoundingBox> boxes;			//!< padded bounds of each shape.
+	vector<unsigned char> isBounded;	//!< 0 for shapes without bounds (e.g., planes).
+	void build(const vector<VisibleIShapePtr>& objs);
+};
+
+void traceShadowPacket(const ShadowOccluders& occluders, const dvec3& lightPos,
+	const ShadowRay* rays, int count, unsigned char* occluded);
@@ -0,0 +1,154 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+/**
+ * @struct	Float4
+ * @brief	Four floats processed together. Maps onto SSE registers when the
+ * 			compiler targets SSE2 and falls back to plain arrays otherwise, so
+ * 			code written with it builds on every platform. Comparisons return
+ * 			masks (all bits set in lanes where the comparison holds) meant to
+ * 			be used with select, any and all.
+ */
+
+struct Float4 {
+#ifdef SIMD_SSE
+	__m128 v;
+	Float4() : v(_mm_setzero_ps()) {}
+	Float4(__m128 V) : v(V) {}
+	Float4(float a) : v(_mm_set1_ps(a)) {}
+	Float4(float a, float b, float c, float d) : v(_mm_setr_ps(a, b, c, d)) {}
+	static Float4 load(const float* p) { return _mm_loadu_ps(p); }
+	void store(float* p) const { _mm_storeu_ps(p, v); }
+	float operator [] (int i) const { float f[4]; store(f); return f[i]; }
+#else
+	float v[4];
+	Float4() { v[0] = v[1] = v[2] = v[3] = 0.0f; }
+	Float4(float a) { v[0] = v[1] = v[2] = v[3] = a; }
+	Float4(float a, float b, float c, float d) { v[0] = a; v[1] = b; v[2] = c; v[3] = d; }
+	static Float4 load(const float* p) { return Float4(p[0], p[1], p[2], p[3]); }
+	void store(float* p) const { p[0] = v[0]; p[1] = v[1]; p[2] = v[2]; p[3] = v[3]; }
+	float operator [] (int i) const { return v[i]; }
+#endif
+};
+
+#ifdef SIMD_SSE
+
+inline Float4 operator + (const Float4& a, const Float4& b) { return _mm_add_ps(a.v, b.v); }
+inline Float4 operator - (const Float4& a, const Float4& b) { return _mm_sub_ps(a.v, b.v); }
+inline Float4 operator * (const Float4& a, const Float4& b) { return _mm_mul_ps(a.v, b.v); }
+inline Float4 operator / (const Float4& a, const Float4& b) { return _mm_div_ps(a.v, b.v); }
+inline Float4 operator < (const Float4& a, const Float4& b) { return _mm_cmplt_ps(a.v, b.v); }
+inline Float4 operator <= (const Float4& a, const Float4& b) { return _mm_cmple_ps(a.v, b.v); }
+inline Float4 operator > (const Float4& a, const Float4& b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline Float4 operator >= (const Float4& a, const Float4& b) { return _mm_cmpge_ps(a.v, b.v); }
+inline Float4 operator & (const Float4& a, const Float4& b) { return _mm_and_ps(a.v, b.v); }
+inline Float4 operator | (const Float4& a, const Float4& b) { return _mm_or_ps(a.v, b.v); }
+inline Float4 min(const Float4& a, const Float4& b) { return _mm_min_ps(a.v, b.v); }
+inline Float4 max(const Float4& a, const Float4& b) { return _mm_max_ps(a.v, b.v); }
+inline Float4 sqrt(const Float4& a) { return _mm_sqrt_ps(a.v); }
+inline Float4 abs(const Float4& a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+inline Float4 select(const Float4& mask, const Float4& a, const Float4& b) {
+	return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+inline int moveMask(const Float4& mask) { return _mm_movemask_ps(mask.v); }
+inline unsigned int truncateToBytes(const Float4& a) {
+	__m128i i = _mm_cvttps_epi32(a.v);
+	i = _mm_packs_epi32(i, i);
+	return (unsigned int)_mm_cvtsi128_si32(_mm_packus_epi16(i, i));
+}
+
+#else
+
+#define FLOAT4_BINARY_OP(OP, EXPR)										\
+	inline Float4 OP(const Float4& a, const Float4& b) {				\
+		Float4 r;														\
+		for (int i = 0; i < 4; i++) { float x = a.v[i], y = b.v[i]; r.v[i] = (EXPR); }	\
+		return r;														\
+	}
+
+/* Masks are stored as floats whose bits are all set, as SSE does. */
+inline float maskBits(bool b) { unsigned int u = b ? 0xFFFFFFFFu : 0u; float f; std::memcpy(&f, &u, 4); return f; }
+inline unsigned int floatBits(float f) { unsigned int u; std::memcpy(&u, &f, 4); return u; }
+inline float bitsFloat(unsigned int u) { float f; std::memcpy(&f, &u, 4); return f; }
+
+FLOAT4_BINARY_OP(operator +, x + y)
+FLOAT4_BINARY_OP(operator -, x - y)
+FLOAT4_BINARY_OP(operator *, x * y)
+FLOAT4_BINARY_OP(operator /, x / y)
+FLOAT4_BINARY_OP(operator <, maskBits(x < y))
+FLOAT4_BINARY_OP(operator <=, maskBits(x <= y))
+FLOAT4_BINARY_OP(operator >, maskBits(x > y))
+FLOAT4_BINARY_OP(operator >=, maskBits(x >= y))
+FLOAT4_BINARY_OP(operator &, bitsFloat(floatBits(x) & floatBits(y)))
+FLOAT4_BINARY_OP(operator |, bitsFloat(floatBits(x) | floatBits(y)))
+FLOAT4_BINARY_OP(min, y < x ? y : x)
+FLOAT4_BINARY_OP(max, y > x ? y : x)
+
+#undef FLOAT4_BINARY_OP
+
+inline Float4 sqrt(const Float4& a) {
+	return Float4(std::sqrt(a.v[0]), std::sqrt(a.v[1]), std::sqrt(a.v[2]), std::sqrt(a.v[3]));
+}
+inline Float4 abs(const Float4& a) {
+	return Float4(std::fabs(a.v[0]), std::fabs(a.v[1]), std::fabs(a.v[2]), std::fabs(a.v[3]));
+}
+inline Float4 select(const Float4& mask, const Float4& a, const Float4& b) {
+	Float4 r;
+	for (int i = 0; i < 4; i++) {
+		r.v[i] = floatBits(mask.v[i]) != 0 ? a.v[i] : b.v[i];
+	}
+	return r;
+}
+inline int moveMask(const Float4& mask) {
+	int m = 0;
+	for (int i = 0; i < 4; i++) {
+		m |= (floatBits(mask.v[i]) >> 31) << i;
+	}
+	return m;
+}
+inline unsigned int truncateToBytes(const Float4& a) {
+	unsigned int bytes = 0;
+	for (int i = 0; i < 4; i++) {
+		bytes |= (unsigned int)a.v[i] << (8 * i);
+	}
+	return bytes;
+}
+
+#endif
+
+inline Float4& operator += (Float4& a, const Float4& b) { a = a + b; return a; }
+inline Float4& operator -= (Float4& a, const Float4& b) { a = a - b; return a; }
+inline Float4& operator *= (Float4& a, const Float4& b) { a = a * b; return a; }
+inline bool any(const Float4& mask) { return moveMask(mask) != 0; }
+inline bool all(const Float4& mask) { return moveMask(mask) == 0xF; }
+
+/**
+ * @fn	inline Float4 expNegApprox(const Float4 &x)
+ * @brief	Cheap approximation of exp(-x) for x >= 0, computed as (1 - x/16)^16
+ * 			and clamped to zero. Good enough for filter weights.
+ * @param	x	Non-negative exponents.
+ * @return	Approximately exp(-x).
+ */
+
+inline Float4 expNegApprox(const Float4& x) {
+	Float4 r = max(Float4(1.0f) - x * Float4(1.0f / 16.0f), Float4(0.0f));
+	r = r * r;
+	r = r * r;
+	r = r * r;
+	return r * r;
+}
@@ -1,7 +1,9 @@
+#include <algorithm>
 #include <istream>
 #include <fstream>
 #include <vector>
 #include <iomanip>
+#include <random>
 #include <sstream>
 #include <tuple>
 #include "defs.h"
@@ -11,6 +13,14 @@
 #include "light.h"
 #include "camera.h"
 #include "ishape.h"
+#include "meshloader.h"
+#include "image.h"
+#include "iscene.h"
+#include "scenefile.h"
+#include "trianglemesh.h"
+#include "framebuffer.h"
+#include "raytracer.h"
+#include "fragmentops.h"
 
 ostream& operator << (ostream& os, const IPlane& plane) {
 	os << plane.a << ' ' << plane.n;
@@ -2598,6 +2608,626 @@ void initTesting() {
 }
 void finishTesting() {
 }
+void reportCase(ostream& os, const string& description, bool passed, int& corr, int& total) {
+	total++;
+	os << description << endl;
+	if (passed) {
+		corr++;
+		os << " Correct" << endl << endl;
+	} else {
+		os << " Incorrect" << endl << endl;
+	}
+}
+
+void writeTestFile(const string& fileName, const string& contents) {
+	std::ofstream out(fileName.c_str(), std::ios::binary);
+	out.write(contents.data(), contents.size());
+}
+
+string readTestFile(const string& fileName) {
+	std::ifstream in(fileName.c_str(), std::ios::binary);
+	std::ostringstream contents;
+	contents << in.rdbuf();
+	return contents.str();
+}
+
+bool sameMesh(const IndexedMesh& a, const IndexedMesh& b) {
+	return a.positions == b.positions && a.normals == b.normals &&
+			a.texCoords == b.texCoords && a.indices == b.indices;
+}
+
+bool indicesInRange(const IndexedMesh& mesh) {
+	for (int index : mesh.indices) {
+		if (index < 0 || index >= mesh.getNumVertices()) {
+			return false;
+		}
+	}
+	return mesh.indices.size() % 3 == 0;
+}
+
+const string TEST_OBJ = "# unit quad\n"
+						"v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\n"
+						"vt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\n"
+						"vn 0 0 1\n"
+						"f 1/1/1 2/2/1 3/3/1 4/4/1\n";
+
+void runOBJParsingTests(const char* name, double maxPts) {
+	std::ostream& os = std::cout;
+	os << name << std::endl;
+	int corr = 0, total = 0;
+	IndexedMesh mesh;
+
+	bool ok = MeshLoader::parseOBJ(TEST_OBJ.c_str(), TEST_OBJ.size(), mesh);
+	reportCase(os, "parseOBJ(quad) --> 4 vertices, 2 triangles, normals (0,0,1)",
+		ok && mesh.getNumVertices() == 4 && mesh.getNumTriangles() == 2 &&
+		mesh.texCoords.size() == 4 && ave(mesh.normals[0], dvec3(0, 0, 1)) && indicesInRange(mesh), corr, total);
+
+	const string relative = "v 0 0 0\nv 1 0 0\nv 0 1 0\nf -3 -2 -1\n";
+	ok = MeshLoader::parseOBJ(relative.c_str(), relative.size(), mesh);
+	reportCase(os, "parseOBJ(relative indices) --> 1 triangle, computed normal (0,0,1)",
+		ok && mesh.getNumTriangles() == 1 && mesh.indices[0] == 0 && mesh.indices[2] == 2 &&
+		ave(mesh.normals[1], dvec3(0, 0, 1)), corr, total);
+
+	const vector<string> malformed = {
+		"v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4\n",
+		"v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 99999999999\n",
+		"v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 x\n",
+		"v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1/9 2/9 3/9\n",
+		"v 0 0 zero\nv 1 0 0\nv 0 1 0\nf 1 2 3\n",
+	};
+	for (const string& text : malformed) {
+		string shown = text;
+		std::replace(shown.begin(), shown.end(), '\n', ';');
+		ok = MeshLoader::parseOBJ(text.c_str(), text.size(), mesh);
+		reportCase(os, "parseOBJ(" + shown + ") --> false", !ok, corr, total);
+	}
+
+	bool allSafe = true;
+	for (size_t length = 0; length < TEST_OBJ.size(); length++) {
+		ok = MeshLoader::parseOBJ(TEST_OBJ.c_str(), length, mesh);
+		allSafe = allSafe && (!ok || indicesInRange(mesh));
+	}
+	reportCase(os, "parseOBJ(every truncation of quad) --> false or a consistent mesh", allSafe, corr, total);
+
+	ok = MeshLoader::loadOBJ("noSuchFile.obj", mesh, false);
+	reportCase(os, "loadOBJ(noSuchFile.obj) --> false", !ok, corr, total);
+
+	displayPoints(os, corr, total, maxPts);
+}
+
+void runMeshCacheTests(const char* name, double maxPts) {
+	std::ostream& os = std::cout;
+	os << name << std::endl;
+	int corr = 0, total = 0;
+	const string objName = "testMesh.obj";
+	const string cacheName = MeshLoader::getCacheName(objName);
+	writeTestFile(objName, TEST_OBJ);
+	std::remove(cacheName.c_str());
+
+	IndexedMesh parsed, cached, loaded;
+	MeshLoader::parseOBJ(TEST_OBJ.c_str(), TEST_OBJ.size(), parsed);
+	bool ok = MeshLoader::loadOBJ(objName, loaded) && MeshLoader::readCache(cacheName, objName, cached);
+	reportCase(os, "loadOBJ then readCache --> the parsed mesh", ok && sameMesh(cached, parsed), corr, total);
+
+	const string good = readTestFile(cacheName);
+	string badIndex = good;
+	const int missingVertex = 1000;
+	std::memcpy(&badIndex[badIndex.size() - sizeof(int)], &missingVertex, sizeof(int));
+	string badMagic = good;
+	badMagic[0] ^= 0xFF;
+	const vector<std::pair<string, string>> corrupted = {
+		std::make_pair("truncated", good.substr(0, good.size() - sizeof(int))),
+		std::make_pair("index out of range", badIndex),
+		std::make_pair("bad magic", badMagic),
+		std::make_pair("empty", string()),
+	};
+	for (const auto& c : corrupted) {
+		writeTestFile(cacheName, c.second);
+		ok = !MeshLoader::readCache(cacheName, objName, cached);
+		writeTestFile(cacheName, c.second);
+		ok = ok && MeshLoader::loadOBJ(objName, loaded) && sameMesh(loaded, parsed);
+		reportCase(os, "cache " + c.first + " --> rejected, loadOBJ parses the file again", ok, corr, total);
+	}
+
+	MeshLoader::writeCache(cacheName, objName, parsed);
+	writeTestFile(objName, TEST_OBJ + "f 1 3 4\n");
+	ok = !MeshLoader::readCache(cacheName, objName, cached) &&
+		MeshLoader::loadOBJ(objName, loaded) && loaded.getNumTriangles() == 3;
+	reportCase(os, "cache of an older file --> rejected", ok, corr, total);
+
+	std::remove(objName.c_str());
+	std::remove(cacheName.c_str());
+	displayPoints(os, corr, total, maxPts);
+}
+
+bool sameColor(const color& C, double r, double g, double b) {
+	return ave(C, color(r, g, b));
+}
+
+void runPPMTests(const char* name, double maxPts) {
+	std::ostream& os = std::cout;
+	os << name << std::endl;
+	int corr = 0, total = 0;
+	const string fileName = "testImage.ppm";
+
+	writeTestFile(fileName, "P3\n# two texels\n2 1\n255\n255 0 0  0 51 255\n");
+	{
+		Image image(fileName);
+		reportCase(os, "P3 2x1 with a comment --> (1,0,0) (0,0.2,1)",
+			image.W == 2 && image.H == 1 && sameColor(image.getTexel(0, 0, 0), 1, 0, 0) &&
+			sameColor(image.getTexel(0, 1, 0), 0, 0.2, 1), corr, total);
+	}
+
+	writeTestFile(fileName, "P3 1 1 15 15 0 5\n");
+	{
+		Image image(fileName);
+		reportCase(os, "P3 with maximum 15 --> samples scaled to 255",
+			image.W == 1 && sameColor(image.getTexel(0, 0, 0), 1, 0, 85 / 255.0), corr, total);
+	}
+
+	string raw = "P6\n2 2\n255\n";
+	const unsigned char texels[12] = { 255, 0, 0, 0, 255, 0, 0, 0, 255, 255, 255, 255 };
+	raw.append((const char*)texels, sizeof(texels));
+	writeTestFile(fileName, raw);
+	{
+		Image image(fileName);
+		reportCase(os, "P6 2x2 --> red, green, blue, white",
+			image.W == 2 && image.H == 2 && sameColor(image.getTexel(0, 0, 0), 1, 0, 0) &&
+			sameColor(image.getTexel(0, 1, 0), 0, 1, 0) && sameColor(image.getTexel(0, 0, 1), 0, 0, 1) &&
+			sameColor(image.getTexel(0, 1, 1), 1, 1, 1), corr, total);
+	}
+	{
+		Image image(fileName, false, true);
+		bool sizeKnown = image.W == 2 && image.H == 2 && !image.isLoaded();
+		reportCase(os, "P6 deferred --> size known before decoding, texels after",
+			sizeKnown && sameColor(image.getTexel(0, 1, 1), 1, 1, 1) && image.isLoaded(), corr, total);
+	}
+
+	writeTestFile(fileName, raw.substr(0, raw.size() - 4));
+	{
+		Image image(fileName);
+		reportCase(os, "P6 truncated --> loaded with its size, no crash",
+			image.W == 2 && image.H == 2 && image.getNumLevels() >= 1, corr, total);
+	}
+	writeTestFile(fileName, "P3\n2 1\n255\n255 0 0  0\n");
+	{
+		Image image(fileName);
+		reportCase(os, "P3 truncated --> texels read so far kept",
+			image.W == 2 && sameColor(image.getTexel(0, 0, 0), 1, 0, 0), corr, total);
+	}
+
+	const vector<string> malformed = {
+		"P5\n1 1\n255\n\x01\x02\x03",
+		"P6\n0 5\n255\n",
+		"P6\n-1 1\n255\n\x01\x02\x03",
+		"P6\n99999999 99999999\n255\n\x01\x02\x03",
+		"P6\n1 1\n70000\n\x01\x02\x03",
+		"P6\n1 1",
+		"",
+	};
+	for (const string& text : malformed) {
+		string shown = text.substr(0, text.find("\n255\n"));
+		std::replace(shown.begin(), shown.end(), '\n', ' ');
+		writeTestFile(fileName, text);
+		Image image(fileName);
+		reportCase(os, "PPM header \"" + shown + "\" --> rejected", image.W == 0 && image.H == 0, corr, total);
+	}
+	{
+		Image image("noSuchFile.ppm");
+		reportCase(os, "PPM noSuchFile.ppm --> rejected", image.W == 0, corr, total);
+	}
+
+	std::remove(fileName.c_str());
+	displayPoints(os, corr, total, maxPts);
+}
+
+const string TEST_SCENE = "# test scene\n"
+	"camera perspective [ 0 2 10 ] [ 0 0 0 ] [ 0 1 0 ] 60\n"
+	"material shiny [ 0.1 0.1 0.1 ] [ 0.2 0.5 0.8 ] [ 1 1 1 ] 40\n"
+	"mesh quad testMesh.obj\n"
+	"object tin plane [ 0 -2 0 ] [ 0 1 0 ]\n"
+	"object shiny sphere [ -2 0 0 ] 1\n"
+	"object gold mesh quad\n"
+	"object silver instance quad [ [ 2 0 0 1 ] [ 0 2 0 -1 ] [ 0 0 1 -1 ] [ 0 0 0 1 ] ]\n"
+	"object transparent [ 1 0 0 ] 0.25 plane [ 0 0 -3 ] [ 0 0 1 ]\n"
+	"light positional [ 0 20 0 ] [ 1 1 1 ]\n"
+	"light spot [ 0 5 0 ] [ 1 1 1 ] [ 0 -1 0 ] 90 attenuation [ 1 0.1 0 ]\n";
+
+vector<Ray> testRays() {
+	vector<Ray> rays;
+	const dvec3 eye(0, 2, 10);
+	for (int y = -6; y <= 6; y++) {
+		for (int x = -8; x <= 8; x++) {
+			rays.push_back(Ray(eye, glm::normalize(dvec3(x * 0.5, y * 0.5, -1) - eye)));
+		}
+	}
+	return rays;
+}
+
+bool sameHits(const IScene& a, const IScene& b) {
+	for (const Ray& ray : testRays()) {
+		OpaqueHitRecord hitA, hitB;
+		int indexA, indexB;
+		a.findOpaqueIntersection(ray, hitA, &indexA);
+		b.findOpaqueIntersection(ray, hitB, &indexB);
+		if (indexA != indexB || !approximatelyEqual(hitA.t, hitB.t)) {
+			return false;
+		}
+	}
+	return a.opaqueObjs.size() == b.opaqueObjs.size() && a.transparentObjs.size() == b.transparentObjs.size() &&
+			a.lights.size() == b.lights.size();
+}
+
+void runSceneParsingTests(const char* name, double maxPts) {
+	std::ostream& os = std::cout;
+	os << name << std::endl;
+	int corr = 0, total = 0;
+	SceneDescription desc;
+
+	std::istringstream scene(TEST_SCENE);
+	bool ok = SceneFile::parse(scene, "scenes/", desc);
+	reportCase(os, "parse(test scene) --> 5 objects, 2 lights, 4 materials",
+		ok && desc.objects.size() == 5 && desc.lights.size() == 2 && desc.materials.size() == 4 &&
+		desc.meshFiles.size() == 1 && desc.meshFiles[0] == "scenes/testMesh.obj", corr, total);
+	reportCase(os, "parse(test scene) --> angles in radians, spot light attenuated",
+		ok && approximatelyEqual(desc.camera.fovOrScale, glm::radians(60.0)) && desc.lights[1].isSpot == 1 &&
+		approximatelyEqual(desc.lights[1].fov, PI_2) && desc.lights[1].attenuation == 1 &&
+		ave(desc.lights[1].atParams, dvec3(1, 0.1, 0)), corr, total);
+	reportCase(os, "parse(test scene) --> instance transform and transparent plane",
+		ok && desc.objects[3].shape == SCENE_INSTANCE && approximatelyEqual(desc.objects[3].transform[3][0], 1.0) &&
+		desc.objects[4].isTransparent == 1 && approximatelyEqual(desc.objects[4].alpha, 0.25), corr, total);
+
+	const vector<string> malformed = {
+		"camera fisheye [ 0 0 0 ] [ 0 0 -1 ] [ 0 1 0 ] 60",
+		"object gold cube [ 0 0 0 ] 1",
+		"object unobtainium sphere [ 0 0 0 ] 1",
+		"object gold sphere [ 0 0 0 ]",
+		"object gold mesh nosuchmesh",
+		"object gold sphere [ 0 0 0 ] 1 texture nosuchtexture",
+		"object gold sphere [ 0 0 0 ] 1 shiny",
+		"light positional [ 0 20 0 ]",
+		"light flood [ 0 20 0 ] [ 1 1 1 ]",
+		"frobnicate",
+	};
+	for (const string& line : malformed) {
+		std::istringstream in("material shiny [ 0 0 0 ] [ 1 1 1 ] [ 1 1 1 ] 10\n" + line + "\n");
+		reportCase(os, "parse(" + line + ") --> false", !SceneFile::parse(in, "", desc), corr, total);
+	}
+
+	bool allSafe = true;
+	for (size_t length = 0; length < TEST_SCENE.size(); length++) {
+		std::istringstream in(TEST_SCENE.substr(0, length));
+		if (SceneFile::parse(in, "", desc)) {
+			for (const SceneObjectRecord& obj : desc.objects) {
+				allSafe = allSafe && obj.material < (int)desc.materials.size() && obj.mesh < (int)desc.meshFiles.size();
+			}
+		}
+	}
+	reportCase(os, "parse(every truncation of test scene) --> false or consistent records", allSafe, corr, total);
+
+	displayPoints(os, corr, total, maxPts);
+}
+
+void runCompiledSceneTests(const char* name, double maxPts) {
+	std::ostream& os = std::cout;
+	os << name << std::endl;
+	int corr = 0, total = 0;
+	const string sceneName = "testScene.scene";
+	const string compiledName = SceneFile::getCompiledName(sceneName);
+	writeTestFile("testMesh.obj", TEST_OBJ);
+	writeTestFile(sceneName, TEST_SCENE);
+	std::remove(compiledName.c_str());
+
+	IScene parsed, compiled;
+	SceneDescription parsedDesc, compiledDesc;
+	bool ok = SceneFile::load(sceneName, parsed, parsedDesc, 100, 100);
+	ok = ok && SceneFile::readCompiled(compiledName, sceneName, compiledDesc, compiled, 100, 100);
+	reportCase(os, "load then readCompiled --> the same hits as the parsed scene",
+		ok && sameHits(parsed, compiled) && compiled.opaqueBVH.isBuilt(), corr, total);
+
+	const string good = readTestFile(compiledName);
+	bool allTruncationsRejected = true;
+	bool allLoadsMatch = true;
+	for (int k = 0; k < 16; k++) {
+		const string truncated = good.substr(0, good.size() * k / 16);
+		IScene scene;
+		SceneDescription desc;
+		writeTestFile(compiledName, truncated);
+		if (SceneFile::readCompiled(compiledName, sceneName, desc, scene, 100, 100)) {
+			allTruncationsRejected = allTruncationsRejected && sameHits(parsed, scene);
+		}
+		IScene reloaded;
+		writeTestFile(compiledName, truncated);
+		allLoadsMatch = allLoadsMatch && SceneFile::load(sceneName, reloaded, desc, 100, 100) &&
+						sameHits(parsed, reloaded);
+	}
+	reportCase(os, "compiled scene truncated --> rejected or hierarchy rebuilt", allTruncationsRejected, corr, total);
+	reportCase(os, "compiled scene truncated --> load parses the file again", allLoadsMatch, corr, total);
+
+	bool allDamageSurvived = true;
+	for (int k = 1; k < 64; k++) {
+		string damaged = good;
+		damaged[damaged.size() * k / 64] ^= 0x5A;
+		IScene scene;
+		SceneDescription desc;
+		writeTestFile(compiledName, damaged);
+		allDamageSurvived = allDamageSurvived && SceneFile::load(sceneName, scene, desc, 100, 100);
+		for (const Ray& ray : testRays()) {
+			OpaqueHitRecord hit;
+			scene.findOpaqueIntersection(ray, hit);
+		}
+	}
+	reportCase(os, "compiled scene with damaged bytes --> loads and traces without crashing", allDamageSurvived, corr, total);
+
+	writeTestFile(compiledName, good);
+	writeTestFile(sceneName, TEST_SCENE + "object gold sphere [ 0 0 -20 ] 1\n");
+	IScene changed;
+	ok = !SceneFile::readCompiled(compiledName, sceneName, compiledDesc, changed, 100, 100);
+	reportCase(os, "compiled scene of an older file --> rejected", ok, corr, total);
+
+	std::remove(sceneName.c_str());
+	std::remove(compiledName.c_str());
+	std::remove("testMesh.obj");
+	std::remove(MeshLoader::getCacheName("testMesh.obj").c_str());
+	displayPoints(os, corr, total, maxPts);
+}
+
+double closestTriangleHit(const vector<dvec3>& positions, const vector<int>& indices,
+							const Ray& ray, double& edgeMargin) {
+	double closestT = FLT_MAX;
+	edgeMargin = 1.0;
+	for (size_t i = 0; i < indices.size(); i += 3) {
+		const dvec3& a = positions[indices[i]];
+		const dvec3 e1 = positions[indices[i + 1]] - a;
+		const dvec3 e2 = positions[indices[i + 2]] - a;
+		const dvec3 p = glm::cross(ray.dir, e2);
+		const double det = glm::dot(e1, p);
+		if (std::fabs(det) < 1.0E-12) {
+			continue;
+		}
+		const dvec3 s = ray.origin - a;
+		const double u = glm::dot(s, p) / det;
+		const dvec3 q = glm::cross(s, e1);
+		const double v = glm::dot(ray.dir, q) / det;
+		const double t = glm::dot(e2, q) / det;
+		if (u >= 0 && v >= 0 && u + v <= 1 && t > EPSILON && t < closestT) {
+			closestT = t;
+			edgeMargin = std::min(std::min(u, v), 1 - u - v);
+		}
+	}
+	return closestT;
+}
+
+void runMeshBVHTests(const char* name, double maxPts) {
+	std::ostream& os = std::cout;
+	os << name << std::endl;
+	int corr = 0, total = 0;
+	std::mt19937 random(386);
+	std::uniform_real_distribution<double> coord(-5.0, 5.0), offset(-0.5, 0.5);
+
+	vector<dvec3> positions;
+	vector<int> indices;
+	for (int i = 0; i < 2000; i++) {
+		const dvec3 center(coord(random), coord(random), coord(random));
+		for (int k = 0; k < 3; k++) {
+			indices.push_back((int)positions.size());
+			positions.push_back(center + dvec3(offset(random), offset(random), offset(random)));
+		}
+	}
+	IndexedMesh quad;
+	MeshLoader::parseOBJ(TEST_OBJ.c_str(), TEST_OBJ.size(), quad);
+	const vector<std::pair<string, ITriangleMesh*>> meshes = {
+		std::make_pair(string("2000 scattered triangles"), new ITriangleMesh(positions, indices)),
+		std::make_pair(string("one quad"), new ITriangleMesh(quad.positions, quad.indices)),
+	};
+	const vector<vector<dvec3>*> meshPositions = { &positions, &quad.positions };
+	const vector<vector<int>*> meshIndices = { &indices, &quad.indices };
+
+	for (size_t m = 0; m < meshes.size(); m++) {
+		int agree = 0, hits = 0;
+		const int numRays = 2000;
+		for (int i = 0; i < numRays; i++) {
+			const dvec3 origin = m == 0 ? dvec3(coord(random), coord(random), 8.0) :
+											dvec3(offset(random) + 0.5, offset(random) + 0.5, 2.0);
+			const dvec3 target = m == 0 ? dvec3(coord(random), coord(random), -8.0) :
+											dvec3(2 * offset(random) + 0.5, 2 * offset(random) + 0.5, -1.0);
+			const Ray ray(origin, glm::normalize(target - origin));
+			double edgeMargin;
+			const double expectedT = closestTriangleHit(*meshPositions[m], *meshIndices[m], ray, edgeMargin);
+			HitRecord hit;
+			meshes[m].second->findClosestIntersection(ray, hit);
+			const bool nearEdge = expectedT != FLT_MAX && edgeMargin < 1.0E-4;
+			const bool bothMiss = expectedT == FLT_MAX && hit.t == FLT_MAX;
+			const bool sameHit = expectedT != FLT_MAX && std::fabs(hit.t - expectedT) <= 1.0E-4 * std::max(1.0, expectedT);
+			if (bothMiss || sameHit || nearEdge) {
+				agree++;
+			}
+			hits += expectedT != FLT_MAX ? 1 : 0;
+		}
+		reportCase(os, "ITriangleMesh(" + meshes[m].first + ") --> same closest hits as testing every triangle (" +
+			std::to_string(hits) + " of " + std::to_string(numRays) + " rays hit)", agree == numRays && hits > 0, corr, total);
+		delete meshes[m].second;
+	}
+
+	displayPoints(os, corr, total, maxPts);
+}
+
+void runSceneBVHTests(const char* name, double maxPts) {
+	std::ostream& os = std::cout;
+	os << name << std::endl;
+	int corr = 0, total = 0;
+	std::mt19937 random(2022);
+	std::uniform_real_distribution<double> coord(-20.0, 20.0), size(0.2, 2.0), angle(0.0, TWO_PI);
+
+	ITriangleMesh* cylinder = new ITriangleMesh(EShape::createECylinder(gold, 12));
+	IScene scene;
+	scene.addOpaqueObject(new VisibleIShape(new IPlane(dvec3(0, -25, 0), dvec3(0, 1, 0)), tin));
+	for (int i = 0; i < 300; i++) {
+		const dvec3 center(coord(random), coord(random), coord(random));
+		switch (i % 3) {
+		case 0:
+			scene.addOpaqueObject(new VisibleIShape(new ISphere(center, size(random)), silver));
+			break;
+		case 1:
+			scene.addOpaqueObject(new VisibleIShape(new IEllipsoid(center, dvec3(size(random), size(random), size(random))), copper));
+			break;
+		default:
+			scene.addOpaqueObject(new VisibleIShape(new IInstance(cylinder,
+				T(center.x, center.y, center.z) * Ry(angle(random)) * S(size(random))), gold));
+			break;
+		}
+	}
+	scene.buildAccelerationStructure();
+
+	int sameClosest = 0, sameOccluded = 0, hits = 0;
+	const int numRays = 5000;
+	for (int i = 0; i < numRays; i++) {
+		const dvec3 origin(coord(random), coord(random), coord(random));
+		const dvec3 target(coord(random), coord(random), coord(random));
+		const Ray ray(origin, glm::normalize(target - origin));
+		OpaqueHitRecord expected;
+		int expectedIndex = -1;
+		expected.t = FLT_MAX;
+		for (int k = 0; k < (int)scene.opaqueObjs.size(); k++) {
+			OpaqueHitRecord hit;
+			scene.opaqueObjs[k]->findClosestIntersection(ray, hit);
+			if (hit.t < expected.t) {
+				expected = hit;
+				expectedIndex = k;
+			}
+		}
+		OpaqueHitRecord actual;
+		int actualIndex;
+		scene.opaqueBVH.findIntersection(ray, actual, &actualIndex);
+		if (actualIndex == expectedIndex && actual.t == expected.t) {
+			sameClosest++;
+		}
+		const double maxT = glm::distance(origin, target);
+		if (scene.opaqueBVH.isOccluded(ray, maxT) == (expected.t < maxT)) {
+			sameOccluded++;
+		}
+		hits += expectedIndex >= 0 ? 1 : 0;
+	}
+	reportCase(os, "SceneBVH::findIntersection(300 objects) --> same object and t as testing every object (" +
+		std::to_string(hits) + " of " + std::to_string(numRays) + " rays hit)", sameClosest == numRays, corr, total);
+	reportCase(os, "SceneBVH::isOccluded(300 objects) --> same answer as testing every object",
+		sameOccluded == numRays, corr, total);
+
+	IScene empty;
+	empty.buildAccelerationStructure();
+	OpaqueHitRecord hit;
+	int index;
+	empty.opaqueBVH.findIntersection(Ray(ORIGIN3D, Y_AXIS), hit, &index);
+	reportCase(os, "SceneBVH::findIntersection(no objects) --> no hit",
+		hit.t == FLT_MAX && index == -1 && !empty.opaqueBVH.isOccluded(Ray(ORIGIN3D, Y_AXIS), 100.0), corr, total);
+
+	displayPoints(os, corr, total, maxPts);
+}
+
+void runWavefrontTests(const char* name, double maxPts) {
+	std::ostream& os = std::cout;
+	os << name << std::endl;
+	int corr = 0, total = 0;
+	const int W = 64, H = 48;
+
+	IScene scene;
+	scene.camera = new PerspectiveCamera(dvec3(5, 5, 5), dvec3(0, 1, 0), Y_AXIS, glm::radians(90.0), W, H);
+	scene.addOpaqueObject(new VisibleIShape(new IPlane(dvec3(0, -2, 0), dvec3(0, 1, 0)), tin));
+	scene.addOpaqueObject(new VisibleIShape(new ISphere(dvec3(-2, 0, 1), 1.5), silver));
+	scene.addOpaqueObject(new VisibleIShape(new IDisk(dvec3(0, 0, -2), dvec3(0, 0, 1), 3.0), copper));
+	scene.addOpaqueObject(new VisibleIShape(new IConeY(dvec3(2, 1, -1), 1, 2), gold));
+	scene.addOpaqueObject(new VisibleIShape(new IInstance(new ITriangleMesh(EShape::createECylinder(ruby, 16)),
+		T(1, 0, 2) * S(1, 3, 1)), ruby));
+	scene.addTransparentObject(new TransparentIShape(new IPlane(dvec3(0, 0, -1), dvec3(0, 0, 1)), red, 0.25));
+	scene.addLight(new PositionalLight(dvec3(0, 20, 0), white));
+	scene.addLight(new SpotLight(dvec3(0, 5, 0), dvec3(0, -1, 0), glm::radians(90.0), white));
+	scene.buildAccelerationStructure();
+
+	RayTracer rayTracer(paleGreen);
+	FrameBuffer byRay(W, H), wavefront(W, H);
+	for (int depth = 0; depth <= 2; depth++) {
+		for (int n = 1; n <= 2; n++) {
+			rayTracer.raytraceScene(byRay, depth, scene, n);
+			rayTracer.raytraceSceneWavefront(wavefront, depth, scene, n);
+			int samePixels = 0;
+			for (int y = 0; y < H; y++) {
+				for (int x = 0; x < W; x++) {
+					if (ave(byRay.getColor(x, y), wavefront.getColor(x, y))) {
+						samePixels++;
+					}
+				}
+			}
+			reportCase(os, "raytraceSceneWavefront(depth " + std::to_string(depth) + ", n " + std::to_string(n) +
+				") --> the colors traceIndividualRay gives", samePixels == W * H, corr, total);
+		}
+	}
+
+	displayPoints(os, corr, total, maxPts);
+}
+
+void runDeferredShadingTests(const char* name, double maxPts) {
+	std::ostream& os = std::cout;
+	os << name << std::endl;
+	int corr = 0, total = 0;
+	const int W = 61, H = 37;	// Not whole tiles, so spans end early
+	const vector<Material> materials = { gold, copper, pewter, greenPlastic, tin, ruby };
+
+	FrameBuffer deferred(W, H), expected(W, H);
+	deferred.clearColorAndDepthBuffers();
+	std::mt19937 random(44);
+	std::uniform_real_distribution<double> coord(-5.0, 5.0), unit(-1.0, 1.0);
+	std::uniform_int_distribution<int> material(-1, (int)materials.size() - 1);
+	for (int y = 0; y < H; y++) {
+		for (int x = 0; x < W; x++) {
+			int m = material(random);
+			if (m >= 0) {
+				dvec3 normal = glm::normalize(dvec3(unit(random), unit(random), unit(random)));
+				dvec3 worldPos(coord(random), coord(random), coord(random));
+				deferred.setGBuffer(x, y, normal, worldPos, deferred.addGBufferMaterial(materials[m]));
+				deferred.setDepth(x, y, 0.5);
+			}
+		}
+	}
+
+	const dmat4 viewingMatrix = glm::lookAt(dvec3(2, 8, 9), dvec3(0, 0, 0), Y_AXIS);
+	const Frame eyeFrame = Frame::createOrthoNormalBasis(viewingMatrix);
+	PositionalLight positional(dvec3(1, 6, 3), white);
+	SpotLight spot(dvec3(-1, 7, 2), dvec3(0.2, -1, 0.1), glm::radians(70.0), white);
+	LightSourcePtr lightsToTry[] = { &positional, &spot };
+	for (LightSourcePtr light : lightsToTry) {
+		for (int attenuation = 0; attenuation <= 1; attenuation++) {
+			PositionalLight* positionalLight = static_cast<PositionalLight*>(light);
+			positionalLight->attenuationIsTurnedOn = attenuation == 1;
+			positionalLight->atParams = LightATParams(1.0, 0.1, 0.01);
+			deferred.clearColorBuffer();
+			FragmentOps::shadeGBuffer(deferred, vector<LightSourcePtr>{ light }, viewingMatrix);
+
+			// What applyLighting gives for the same G-buffer pixel
+			int samePixels = 0;
+			for (int y = 0; y < H; y++) {
+				for (int x = 0; x < W; x++) {
+					dvec3 normal, worldPos;
+					int id = deferred.getGBuffer(x, y, normal, worldPos);
+					expected.setColor(x, y, deferred.getColor(x, y));
+					if (id >= 0) {
+						expected.setColor(x, y, light->illuminate(worldPos, normal,
+							deferred.getGBufferMaterial(id), eyeFrame, false));
+					}
+					color diff = glm::abs(expected.getColor(x, y) - deferred.getColor(x, y));
+					if (std::max(diff.r, std::max(diff.g, diff.b)) <= 1.0 / 255) {
+						samePixels++;
+					}
+				}
+			}
+			reportCase(os, std::string("shadeGBuffer(") + (light == &spot ? "spot" : "positional") +
+				(attenuation == 1 ? ", attenuated" : "") + ") --> the colors illuminate gives",
+				samePixels == W * H, corr, total);
+		}
+	}
+
+	displayPoints(os, corr, total, maxPts);
+}
+
 void createTests() {
 	initCreateTests();
 	// ==================== C++ ==================== 
@@ -3227,6 +3857,15 @@ void runTests() {
 	//runTests("multiplyMatricesAndVertex", multiplyMatricesAndVertex, 2);
 	//runTests("multiplyMatrixAndVertices", multiplyMatrixAndVertices, 2);
 	//runTests("multiplyMatricesAndVertices", multiplyMatricesAndVertices, 2);
+	runOBJParsingTests("OBJParsingTests", 2.0);
+	runMeshCacheTests("MeshCacheTests", 2.0);
+	runPPMTests("PPMTests", 2.0);
+	runSceneParsingTests("SceneParsingTests", 2.0);
+	runCompiledSceneTests("CompiledSceneTests", 2.0);
+	runMeshBVHTests("MeshBVHTests", 2.0);
+	runSceneBVHTests("SceneBVHTests", 2.0);
+	runWavefrontTests("WavefrontTests", 2.0);
+	runDeferredShadingTests("DeferredShadingTests", 2.0);
 	cout << endl << "Total Points = " << pts << endl;
 }
 int main(int argc, char* argv[]) {
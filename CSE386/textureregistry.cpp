@@ -0,0 +1,192 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include "textureregistry.h"
+#include "mappedfile.h"
+
+const size_t PREFETCH_PAGE_SIZE = 4096;		//!< Stride at which prefetched files are touched.
+
+/**
+ * @fn	TextureRegistry &TextureRegistry::getInstance()
+ * @brief	Gets the shared registry, creating it on first use.
+ * @return	The registry.
+ */
+
+TextureRegistry& TextureRegistry::getInstance() {
+	static TextureRegistry registry;
+	return registry;
+}
+
+/**
+ * @fn	TextureRegistry::TextureRegistry()
+ * @brief	Starts the prefetch thread.
+ */
+
+TextureRegistry::TextureRegistry()
+	: busy(false), stopping(false) {
+	prefetcher = std::thread(&TextureRegistry::prefetchLoop, this);
+}
+
+/**
+ * @fn	TextureRegistry::~TextureRegistry()
+ * @brief	Stops the prefetch thread and deletes the textures.
+ */
+
+TextureRegistry::~TextureRegistry() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakePrefetcher.notify_all();
+	prefetcher.join();
+	for (auto& entry : images) {
+		delete entry.second;
+	}
+}
+
+/**
+ * @fn	Image* TextureRegistry::get(const string &fileName, bool isSRGB)
+ * @brief	Gets the texture in a PPM file. The first request for a file creates a
+ * 			deferred image and queues the file to be read ahead; later requests
+ * 			return the same image.
+ * @param	fileName	The PPM file.
+ * @param	isSRGB  	true if the file is sRGB encoded.
+ * @return	The texture, owned by the registry.
+ */
+
+Image* TextureRegistry::get(const string& fileName, bool isSRGB) {
+	const std::pair<string, bool> key(fileName, isSRGB);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = images.find(key);
+		if (it != images.end()) {
+			return it->second;
+		}
+	}
+	Image* image = new Image(fileName, isSRGB, true);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto result = images.insert(std::make_pair(key, image));
+		if (!result.second) {
+			delete image;			// another thread registered it first
+			return result.first->second;
+		}
+		if (image->isLoaded()) {
+			return image;			// unreadable or tiled; nothing to prefetch
+		}
+		queue.push_back(PrefetchRequest{ image, false });
+	}
+	wakePrefetcher.notify_one();
+	return image;
+}
+
+/**
+ * @fn	void TextureRegistry::decodeInBackground(Image *image)
+ * @brief	Queues a texture a shape is bound to, to be decoded on the prefetch
+ * 			thread rather than by the first lookup during a render.
+ * @param	image	The texture.
+ */
+
+void TextureRegistry::decodeInBackground(Image* image) {
+	if (image == nullptr || image->isLoaded()) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(PrefetchRequest{ image, true });
+	}
+	wakePrefetcher.notify_one();
+}
+
+/**
+ * @fn	void TextureRegistry::waitForPrefetch()
+ * @brief	Waits until every queued file has been read ahead and every queued
+ * 			texture decoded. Call it before rendering.
+ */
+
+void TextureRegistry::waitForPrefetch() {
+	std::unique_lock<std::mutex> lock(mutex);
+	prefetchDone.wait(lock, [this] { return queue.empty() && !busy; });
+}
+
+/**
+ * @fn	int TextureRegistry::getNumTextures() const
+ * @brief	Gets the number of distinct textures requested.
+ * @return	The number of textures.
+ */
+
+int TextureRegistry::getNumTextures() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return (int)images.size();
+}
+
+/**
+ * @fn	int TextureRegistry::getNumLoaded() const
+ * @brief	Gets the number of textures that have been decoded.
+ * @return	The number of decoded textures.
+ */
+
+int TextureRegistry::getNumLoaded() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	int count = 0;
+	for (auto& entry : images) {
+		count += entry.second->isLoaded() && entry.second->W > 0 ? 1 : 0;
+	}
+	return count;
+}
+
+/**
+ * @fn	void TextureRegistry::prefetchLoop()
+ * @brief	Body of the prefetch thread: reads queued files and decodes queued
+ * 			textures until the registry is destroyed.
+ */
+
+void TextureRegistry::prefetchLoop() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wakePrefetcher.wait(lock, [this] { return stopping || !queue.empty(); });
+		if (stopping) {
+			return;
+		}
+		PrefetchRequest request = queue.front();
+		queue.pop_front();
+		busy = true;
+		lock.unlock();
+		if (request.decode) {
+			request.image->load();
+		} else {
+			prefetchFile(request.image->getFileName());
+		}
+		lock.lock();
+		busy = false;
+		if (queue.empty()) {
+			prefetchDone.notify_all();
+		}
+	}
+}
+
+/**
+ * @fn	void TextureRegistry::prefetchFile(const string &fileName)
+ * @brief	Brings a file into the operating system's cache by mapping it and
+ * 			touching every page, without decoding it.
+ * @param	fileName	The file.
+ */
+
+void TextureRegistry::prefetchFile(const string& fileName) {
+	MappedFile file;
+	if (!file.open(fileName)) {
+		return;
+	}
+	const volatile char* data = file.getData();
+	char sum = 0;
+	for (size_t i = 0; i < file.getSize(); i += PREFETCH_PAGE_SIZE) {
+		sum += data[i];
+	}
+	(void)sum;
+}
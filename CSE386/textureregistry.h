@@ -0,0 +1,65 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include "defs.h"
+#include "image.h"
+
+/**
+ * @class	TextureRegistry
+ * @brief	Owns the textures of a program, one per file. Asking for a file a
+ * 			second time returns the same image, and images live as long as the
+ * 			registry. Images are handed out deferred: only their size is read,
+ * 			and the texels are decoded when the image is first looked up, so
+ * 			textures that are never hit are never decoded. Meanwhile a background
+ * 			thread reads the requested files, so their I/O overlaps with building
+ * 			the rest of the scene. Textures a shape is bound to are decoded on that
+ * 			thread as well; waitForPrefetch, called before the first render, then
+ * 			leaves only textures that no shape uses to be decoded on lookup.
+ */
+
+class TextureRegistry {
+public:
+	static TextureRegistry& getInstance();
+	Image* get(const string& fileName, bool isSRGB = false);
+	void decodeInBackground(Image* image);
+	void waitForPrefetch();
+	int getNumTextures() const;
+	int getNumLoaded() const;
+	~TextureRegistry();
+protected:
+	TextureRegistry();
+	void prefetchLoop();
+	static void prefetchFile(const string& fileName);
+
+	/**
+	 * @struct	PrefetchRequest
+	 * @brief	A texture waiting for the prefetch thread.
+	 */
+
+	struct PrefetchRequest {
+		Image* image;	//!< The texture.
+		bool decode;	//!< True to decode it, false to only read its file ahead.
+	};
+
+	std::map<std::pair<string, bool>, Image*> images;	//!< The textures, by file and encoding.
+	std::deque<PrefetchRequest> queue;			//!< Textures waiting to be read ahead or decoded.
+	mutable std::mutex mutex;					//!< Guards images, queue, busy and stopping.
+	std::condition_variable wakePrefetcher;		//!< Signalled when a request is queued.
+	std::condition_variable prefetchDone;		//!< Signalled when the queue runs empty.
+	std::thread prefetcher;						//!< Reads queued files ahead and decodes bound textures.
+	bool busy;									//!< True while the prefetcher works on a request.
+	bool stopping;								//!< True when the registry is shutting down.
+};
@@ -0,0 +1,320 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <cstring>
+#include "tilecache.h"
+
+/**
+ * @struct	ThreadTiles
+ * @brief	The tiles a thread has copied out of tile caches, least recently used
+ * 			first to go, and the counters it adds its lookups to.
+ */
+
+struct ThreadTiles {
+	long long cacheIds[TILE_CACHE_THREAD_TILES];		//!< cache each copy came from, or -1.
+	long long keys[TILE_CACHE_THREAD_TILES];			//!< file and tile of each copy.
+	unsigned long long lastUse[TILE_CACHE_THREAD_TILES];	//!< lookup each copy was last used by.
+	unsigned long long clock;							//!< lookups made by the thread.
+	int statShard;										//!< the StatShard the thread counts in.
+	unsigned char tiles[TILE_CACHE_THREAD_TILES][TEXTURE_TILE_BYTES];	//!< the copies.
+	ThreadTiles();
+};
+
+static std::atomic<int> nextStatShard(0);		//!< Spreads threads over the StatShards.
+static std::atomic<long long> nextCacheId(0);	//!< Numbers TileCaches.
+
+/**
+ * @fn	ThreadTiles::ThreadTiles()
+ * @brief	Constructs a thread's empty set of copies.
+ */
+
+ThreadTiles::ThreadTiles() : clock(0) {
+	for (int i = 0; i < TILE_CACHE_THREAD_TILES; i++) {
+		cacheIds[i] = -1;
+		keys[i] = -1;
+		lastUse[i] = 0;
+	}
+	statShard = nextStatShard.fetch_add(1) % TILE_CACHE_STAT_SHARDS;
+}
+
+/**
+ * @fn	static ThreadTiles &getThreadTiles()
+ * @brief	Gets the calling thread's tile copies, creating them on first use.
+ * @return	The thread's copies.
+ */
+
+static ThreadTiles& getThreadTiles() {
+	static thread_local ThreadTiles threadTiles;
+	return threadTiles;
+}
+
+/**
+ * @fn	TileCache &TileCache::getInstance()
+ * @brief	Gets the cache shared by all tiled textures, creating it on first use
+ * 			with room for TILE_CACHE_DEFAULT_TILES tiles. It is never destroyed,
+ * 			so images deleted during program exit can still release their files.
+ * @return	The tile cache.
+ */
+
+TileCache& TileCache::getInstance() {
+	static TileCache* cache = new TileCache(TILE_CACHE_DEFAULT_TILES);
+	return *cache;
+}
+
+/**
+ * @fn	TileCache::TileCache(int capacity)
+ * @brief	Constructs an empty cache.
+ * @param	capacity	Number of tiles the cache holds.
+ */
+
+TileCache::TileCache(int capacity)
+	: id(nextCacheId.fetch_add(1)) {
+	setCapacity(capacity);
+}
+
+/**
+ * @fn	void TileCache::setCapacity(int numTiles)
+ * @brief	Changes the number of tiles held, emptying the cache. Not to be called
+ * 			while textures are being looked up.
+ * @param	numTiles	Number of tiles the cache holds (at least 1).
+ */
+
+void TileCache::setCapacity(int numTiles) {
+	std::lock_guard<std::mutex> lock(mutex);
+	numTiles = std::max(1, numTiles);
+	storage.assign((size_t)numTiles * TEXTURE_TILE_BYTES, 0);
+	slots.resize(numTiles);
+	freeSlots.clear();
+	for (int i = numTiles - 1; i >= 0; i--) {
+		slots[i].key = -1;
+		slots[i].prev = slots[i].next = -1;
+		freeSlots.push_back(i);
+	}
+	index.clear();
+	head = tail = -1;
+	evictions = 0;
+	for (int i = 0; i < TILE_CACHE_STAT_SHARDS; i++) {
+		statShards[i].lookups.store(0, std::memory_order_relaxed);
+		statShards[i].misses.store(0, std::memory_order_relaxed);
+	}
+}
+
+/**
+ * @fn	int TileCache::registerFile(const RandomAccessFile *file, long long dataOffset)
+ * @brief	Registers a tiled texture file, whose tiles follow one another from
+ * 			dataOffset on.
+ * @param	file	  	The open file; it must stay open until releaseFile.
+ * @param	dataOffset	Offset of the first tile in the file.
+ * @return	The id to look the file's tiles up with.
+ */
+
+int TileCache::registerFile(const RandomAccessFile* file, long long dataOffset) {
+	std::lock_guard<std::mutex> lock(mutex);
+	files.push_back(file);
+	dataOffsets.push_back(dataOffset);
+	return (int)files.size() - 1;
+}
+
+/**
+ * @fn	void TileCache::releaseFile(int fileId)
+ * @brief	Drops a file's tiles and forgets the file.
+ * @param	fileId	The id returned by registerFile.
+ */
+
+void TileCache::releaseFile(int fileId) {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (int i = 0; i < (int)slots.size(); i++) {
+		if (slots[i].key >= 0 && (slots[i].key >> 40) == fileId) {
+			index.erase(slots[i].key);
+			unlink(i);
+			slots[i].key = -1;
+			freeSlots.push_back(i);
+		}
+	}
+	files[fileId] = nullptr;
+}
+
+/**
+ * @fn	bool TileCache::getTexel(int fileId, long long tile, int texel, unsigned char *rgb)
+ * @brief	Looks up one texel. The calling thread's own copy of the tile is used if
+ * 			it has one; otherwise the tile is copied from the shared tiles, or read
+ * 			from the file if it is not cached, replacing the thread's least
+ * 			recently used copy.
+ * @param 	   	fileId	The file's id.
+ * @param 	   	tile  	Index of the tile in the file.
+ * @param 	   	texel 	Index of the texel in the tile (row * TEXTURE_TILE_SIZE + column).
+ * @param [out]	rgb   	Receives the texel's three bytes.
+ * @return	false if the tile could not be read.
+ */
+
+bool TileCache::getTexel(int fileId, long long tile, int texel, unsigned char* rgb) {
+	ThreadTiles& local = getThreadTiles();
+	StatShard& shard = statShards[local.statShard];
+	shard.lookups.fetch_add(1, std::memory_order_relaxed);
+	const long long key = makeKey(fileId, tile);
+	local.clock++;
+
+	int oldest = 0;
+	for (int i = 0; i < TILE_CACHE_THREAD_TILES; i++) {
+		if (local.keys[i] == key && local.cacheIds[i] == id) {
+			local.lastUse[i] = local.clock;
+			std::memcpy(rgb, local.tiles[i] + 3 * texel, 3);
+			return true;
+		}
+		if (local.lastUse[i] < local.lastUse[oldest]) {
+			oldest = i;
+		}
+	}
+
+	local.cacheIds[oldest] = -1;		// its copy is about to be overwritten
+	if (!fetchTile(fileId, tile, local.tiles[oldest], shard)) {
+		return false;
+	}
+	local.cacheIds[oldest] = id;
+	local.keys[oldest] = key;
+	local.lastUse[oldest] = local.clock;
+	std::memcpy(rgb, local.tiles[oldest] + 3 * texel, 3);
+	return true;
+}
+
+/**
+ * @fn	bool TileCache::fetchTile(int fileId, long long tile, unsigned char *tileData, StatShard &shard)
+ * @brief	Copies a whole tile out of the shared tiles, reading it from its file
+ * 			and caching it if it is not there.
+ * @param 	   	fileId  	The file's id.
+ * @param 	   	tile		Index of the tile in the file.
+ * @param [out]	tileData	Receives the tile's TEXTURE_TILE_BYTES bytes.
+ * @param [out]	shard   	The calling thread's counters; a read from the file is a miss.
+ * @return	false if the tile could not be read.
+ */
+
+bool TileCache::fetchTile(int fileId, long long tile, unsigned char* tileData, StatShard& shard) {
+	const long long key = makeKey(fileId, tile);
+	const RandomAccessFile* file;
+	long long offset;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = index.find(key);
+		if (it != index.end()) {
+			unlink(it->second);
+			pushFront(it->second);
+			std::memcpy(tileData, &storage[(size_t)it->second * TEXTURE_TILE_BYTES], TEXTURE_TILE_BYTES);
+			return true;
+		}
+		file = files[fileId];
+		offset = dataOffsets[fileId] + tile * TEXTURE_TILE_BYTES;
+	}
+
+	shard.misses.fetch_add(1, std::memory_order_relaxed);
+	if (file == nullptr || !file->read(offset, tileData, TEXTURE_TILE_BYTES)) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (index.find(key) == index.end()) {		// another thread may have read it meanwhile
+		int slot = claimSlot();
+		std::memcpy(&storage[(size_t)slot * TEXTURE_TILE_BYTES], tileData, TEXTURE_TILE_BYTES);
+		slots[slot].key = key;
+		index[key] = slot;
+		pushFront(slot);
+	}
+	return true;
+}
+
+/**
+ * @fn	TileCacheStats TileCache::getFrameStats() const
+ * @brief	Gets the activity since the last call to resetFrameStats, summing the
+ * 			threads' counters.
+ * @return	The counts.
+ */
+
+TileCacheStats TileCache::getFrameStats() const {
+	TileCacheStats stats;
+	stats.lookups = stats.misses = 0;
+	for (int i = 0; i < TILE_CACHE_STAT_SHARDS; i++) {
+		stats.lookups += statShards[i].lookups.load(std::memory_order_relaxed);
+		stats.misses += statShards[i].misses.load(std::memory_order_relaxed);
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	stats.evictions = evictions;
+	return stats;
+}
+
+/**
+ * @fn	void TileCache::resetFrameStats()
+ * @brief	Zeroes the activity counts, typically at the start of a frame.
+ */
+
+void TileCache::resetFrameStats() {
+	for (int i = 0; i < TILE_CACHE_STAT_SHARDS; i++) {
+		statShards[i].lookups.store(0, std::memory_order_relaxed);
+		statShards[i].misses.store(0, std::memory_order_relaxed);
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	evictions = 0;
+}
+
+/**
+ * @fn	int TileCache::claimSlot()
+ * @brief	Finds a slot for a new tile: a free one if there is one, otherwise the
+ * 			least recently used one, whose tile is dropped. The lock must be held.
+ * @return	The slot, unlinked from the recently-used list.
+ */
+
+int TileCache::claimSlot() {
+	if (!freeSlots.empty()) {
+		int slot = freeSlots.back();
+		freeSlots.pop_back();
+		return slot;
+	}
+	int slot = tail;
+	unlink(slot);
+	index.erase(slots[slot].key);
+	evictions++;
+	return slot;
+}
+
+/**
+ * @fn	void TileCache::unlink(int slot)
+ * @brief	Removes a slot from the recently-used list. The lock must be held.
+ * @param	slot	The slot.
+ */
+
+void TileCache::unlink(int slot) {
+	Slot& s = slots[slot];
+	if (s.prev >= 0) {
+		slots[s.prev].next = s.next;
+	} else if (head == slot) {
+		head = s.next;
+	}
+	if (s.next >= 0) {
+		slots[s.next].prev = s.prev;
+	} else if (tail == slot) {
+		tail = s.prev;
+	}
+	s.prev = s.next = -1;
+}
+
+/**
+ * @fn	void TileCache::pushFront(int slot)
+ * @brief	Makes a slot the most recently used. The lock must be held.
+ * @param	slot	The slot, not in the list.
+ */
+
+void TileCache::pushFront(int slot) {
+	slots[slot].prev = -1;
+	slots[slot].next = head;
+	if (head >= 0) {
+		slots[head].prev = slot;
+	}
+	head = slot;
+	if (tail < 0) {
+		tail = slot;
+	}
+}
@@ -0,0 +1,96 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include "defs.h"
+#include "mappedfile.h"
+
+const int TEXTURE_TILE_SIZE = 64;		//!< Width and height of a texture tile, in texels.
+const int TEXTURE_TILE_BYTES = 3 * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE;	//!< Size of a tile, in bytes.
+const int TILE_CACHE_DEFAULT_TILES = 2048;	//!< Tiles the shared cache holds unless told otherwise.
+const int TILE_CACHE_THREAD_TILES = 4;		//!< Tiles each thread keeps its own copies of.
+const int TILE_CACHE_STAT_SHARDS = 64;		//!< Counters the threads' lookups are spread over.
+
+/**
+ * @struct	TileCacheStats
+ * @brief	Counts of tile cache activity since the last reset.
+ */
+
+struct TileCacheStats {
+	long long lookups;			//!< texels looked up.
+	long long misses;			//!< lookups whose tile had to be read from its file.
+	long long evictions;		//!< tiles dropped to make room.
+};
+
+/**
+ * @class	TileCache
+ * @brief	A fixed number of texture tiles, shared by every tiled texture, so the
+ * 			memory used for them is bounded however many or large the textures
+ * 			are. Tiles are read from their files on demand and the least recently
+ * 			used tile is replaced. Safe to use from several threads. Each thread
+ * 			also keeps copies of the last TILE_CACHE_THREAD_TILES tiles it used,
+ * 			so most lookups take no lock; the shared tiles are only locked when a
+ * 			thread moves on to a new tile, and files are read without the lock.
+ */
+
+class TileCache {
+public:
+	static TileCache& getInstance();
+	TileCache(int capacity);
+	void setCapacity(int numTiles);
+	int getCapacity() const { return (int)slots.size(); }
+	int registerFile(const RandomAccessFile* file, long long dataOffset);
+	void releaseFile(int fileId);
+	bool getTexel(int fileId, long long tile, int texel, unsigned char* rgb);
+	TileCacheStats getFrameStats() const;
+	void resetFrameStats();
+protected:
+	/**
+	 * @struct	Slot
+	 * @brief	A place for one tile, linked into the recently-used list.
+	 */
+	struct Slot {
+		long long key;			//!< file and tile held, or -1 when free.
+		int prev;				//!< more recently used slot, or -1.
+		int next;				//!< less recently used slot, or -1.
+	};
+
+	/**
+	 * @struct	StatShard
+	 * @brief	Lookup counts of the threads that use it, padded to a cache line of
+	 * 			its own so that threads counting lookups do not share one.
+	 */
+	struct StatShard {
+		std::atomic<long long> lookups;		//!< texels looked up.
+		std::atomic<long long> misses;		//!< lookups whose tile was read from its file.
+		char padding[64 - 2 * sizeof(std::atomic<long long>)];
+	};
+
+	mutable std::mutex mutex;						//!< Guards everything below.
+	vector<unsigned char> storage;					//!< TEXTURE_TILE_BYTES per slot.
+	vector<Slot> slots;								//!< The slots.
+	vector<int> freeSlots;							//!< Slots holding no tile.
+	std::unordered_map<long long, int> index;		//!< Slot of each cached tile, by key.
+	int head;										//!< Most recently used slot, or -1.
+	int tail;										//!< Least recently used slot, or -1.
+	vector<const RandomAccessFile*> files;			//!< Registered files, by id (nullptr once released).
+	vector<long long> dataOffsets;					//!< Offset of tile 0 in each file.
+	long long evictions;							//!< Tiles dropped since the last reset.
+	StatShard statShards[TILE_CACHE_STAT_SHARDS];	//!< Lookups and misses since the last reset.
+	long long id;									//!< Tells this cache's tiles apart in the threads' copies.
+
+	static long long makeKey(int fileId, long long tile) { return ((long long)fileId << 40) | tile; }
+	void unlink(int slot);
+	void pushFront(int slot);
+	int claimSlot();
+	bool fetchTile(int fileId, long long tile, unsigned char* tileData, StatShard& shard);
+};
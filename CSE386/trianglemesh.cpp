@@ -0,0 +1,599 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include "trianglemesh.h"
+#include "mappedfile.h"
+#include "simd.h"
+
+const int MESH_NUM_BINS = 12;			//!< Candidate split planes per axis while building.
+const int MESH_MAX_SAH_DEPTH = 64;		//!< Deeper nodes are split at the median to bound the depth.
+const int MESH_STACK_SIZE = 128;		//!< Enough for any hierarchy buildNode can produce.
+
+/**
+ * @fn	ITriangleMesh::ITriangleMesh()
+ * @brief	Constructs a mesh with no triangles, to be filled in by read.
+ */
+
+ITriangleMesh::ITriangleMesh() {
+}
+
+/**
+ * @fn	ITriangleMesh::ITriangleMesh(const vector<dvec3> &positions, const vector<int> &indices,
+ * 									const vector<dvec3> &normals)
+ * @brief	Constructs a mesh from indexed triangles.
+ * @param	positions	The vertex positions.
+ * @param	indices  	Three indices into positions for each triangle.
+ * @param	normals  	Vertex normals, one per position. If there are none, they are
+ * 						computed by averaging the normals of the triangles around each vertex.
+ */
+
+ITriangleMesh::ITriangleMesh(const vector<dvec3>& positions, const vector<int>& indices,
+	const vector<dvec3>& normals)
+	: positions(positions) {
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		bool valid = true;
+		for (int k = 0; k < 3; k++) {
+			valid = valid && indices[i + k] >= 0 && indices[i + k] < (int)positions.size();
+		}
+		if (valid) {
+			this->indices.insert(this->indices.end(), indices.begin() + i, indices.begin() + i + 3);
+		} else {
+			std::cerr << "Triangle " << i / 3 << " has an index out of range; skipped" << endl;
+		}
+	}
+	if (normals.size() == positions.size()) {
+		this->normals.resize(normals.size());
+		for (size_t i = 0; i < normals.size(); i++) {
+			this->normals[i] = glm::normalize(normals[i]);
+		}
+	} else {
+		computeNormals();
+	}
+	buildHierarchy();
+}
+
+/**
+ * @fn	ITriangleMesh::ITriangleMesh(const EShapeData &triangles)
+ * @brief	Constructs a mesh from the triangles of a pipeline shape, keeping its
+ * 			vertex normals.
+ * @param	triangles	Vertex data, each successive triplet being a triangle.
+ */
+
+ITriangleMesh::ITriangleMesh(const EShapeData& triangles) {
+	const size_t numVerts = triangles.size() - triangles.size() % 3;
+	positions.resize(numVerts);
+	normals.resize(numVerts);
+	indices.resize(numVerts);
+	bool haveNormals = true;
+	for (size_t i = 0; i < numVerts; i++) {
+		positions[i] = dvec3(triangles[i].pos);
+		haveNormals = haveNormals && glm::length(triangles[i].normal) > 0;
+		normals[i] = haveNormals ? glm::normalize(triangles[i].normal) : Y_AXIS;
+		indices[i] = (int)i;
+	}
+	if (!haveNormals) {
+		computeNormals();
+	}
+	buildHierarchy();
+}
+
+/**
+ * @fn	void ITriangleMesh::computeNormals()
+ * @brief	Sets each vertex normal to the area-weighted average of the normals of
+ * 			the triangles that share the vertex.
+ */
+
+void ITriangleMesh::computeNormals() {
+	normals.assign(positions.size(), dvec3(0, 0, 0));
+	for (size_t i = 0; i < indices.size(); i += 3) {
+		const dvec3& a = positions[indices[i]];
+		dvec3 n = glm::cross(positions[indices[i + 1]] - a, positions[indices[i + 2]] - a);
+		for (int k = 0; k < 3; k++) {
+			normals[indices[i + k]] += n;
+		}
+	}
+	for (dvec3& n : normals) {
+		n = glm::length(n) > 0 ? glm::normalize(n) : Y_AXIS;
+	}
+}
+
+/**
+ * @fn	static double surfaceArea(const BoundingBox &box)
+ * @brief	Surface area of a box; zero if it is empty.
+ */
+
+static double surfaceArea(const BoundingBox& box) {
+	if (box.isEmpty()) {
+		return 0.0;
+	}
+	dvec3 e = box.extent();
+	return 2.0 * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+/**
+ * @fn	static int numPacks(int numTriangles)
+ * @brief	Number of packs needed to hold a number of triangles.
+ */
+
+static int numPacks(int numTriangles) {
+	return (numTriangles + MESH_PACK_SIZE - 1) / MESH_PACK_SIZE;
+}
+
+/**
+ * @fn	void ITriangleMesh::buildHierarchy()
+ * @brief	Builds the bounding volume hierarchy over all the triangles.
+ */
+
+void ITriangleMesh::buildHierarchy() {
+	const int numTris = getNumTriangles();
+	nodes.clear();
+	packs.clear();
+	if (numTris == 0) {
+		return;
+	}
+	vector<BoundingBox> boxes(numTris);
+	vector<dvec3> centroids(numTris);
+	vector<int> tris(numTris);
+	for (int i = 0; i < numTris; i++) {
+		for (int k = 0; k < 3; k++) {
+			boxes[i].expand(positions[indices[3 * i + k]]);
+		}
+		centroids[i] = boxes[i].center();
+		tris[i] = i;
+	}
+	nodes.reserve(2 * numPacks(numTris));
+	packs.reserve(numPacks(numTris) * 2);
+	buildNode(tris, boxes, centroids, 0, numTris, 0);
+}
+
+/**
+ * @fn	int ITriangleMesh::buildNode(vector<int> &tris, const vector<BoundingBox> &boxes,
+ * 								const vector<dvec3> &centroids, int begin, int end, int depth)
+ * @brief	Builds the subtree over tris[begin, end). Nodes are split where the
+ * 			surface area heuristic estimates the cheapest traversal, choosing among
+ * 			evenly spaced planes along the axis where the triangles' centroids are
+ * 			most spread out.
+ * @param [in,out]	tris	 	Triangle indices; reordered so each subtree's are contiguous.
+ * @param 		  	boxes	 	Bounds of each triangle.
+ * @param 		  	centroids	Center of each triangle's bounds.
+ * @param 		  	begin	 	First triangle of the subtree.
+ * @param 		  	end		 	One past the last triangle of the subtree.
+ * @param 		  	depth	 	Depth of the subtree's root.
+ * @return	Index of the subtree's root.
+ */
+
+int ITriangleMesh::buildNode(vector<int>& tris, const vector<BoundingBox>& boxes,
+	const vector<dvec3>& centroids, int begin, int end, int depth) {
+	const int index = (int)nodes.size();
+	nodes.push_back(MeshBVHNode());
+
+	BoundingBox box, centroidBox;
+	for (int i = begin; i < end; i++) {
+		box.expand(boxes[tris[i]]);
+		centroidBox.expand(centroids[tris[i]]);
+	}
+	// Padding keeps rays that graze a face from missing the box through round-off.
+	dvec3 largest = glm::max(glm::abs(box.lo), glm::abs(box.hi));
+	double pad = 1.0E-9 * (1.0 + std::max(largest.x, std::max(largest.y, largest.z)));
+	box.lo -= dvec3(pad, pad, pad);
+	box.hi += dvec3(pad, pad, pad);
+	nodes[index].box = box;
+
+	const int count = end - begin;
+	if (count <= MESH_PACK_SIZE) {
+		makeLeaf(nodes[index], tris, begin, end);
+		return index;
+	}
+
+	const dvec3 spread = centroidBox.extent();
+	const int axis = spread.x >= spread.y && spread.x >= spread.z ? 0 : (spread.y >= spread.z ? 1 : 2);
+	const double lo = centroidBox.lo[axis];
+	const double width = spread[axis];
+	int mid = begin;
+
+	if (width > 0 && depth < MESH_MAX_SAH_DEPTH) {
+		auto binOf = [&](int tri) {
+			int b = (int)(MESH_NUM_BINS * (centroids[tri][axis] - lo) / width);
+			return std::min(b, MESH_NUM_BINS - 1);
+		};
+		BoundingBox binBoxes[MESH_NUM_BINS];
+		int binCounts[MESH_NUM_BINS] = { 0 };
+		for (int i = begin; i < end; i++) {
+			int b = binOf(tris[i]);
+			binCounts[b]++;
+			binBoxes[b].expand(boxes[tris[i]]);
+		}
+
+		// Cost of splitting after each bin, measured in pack tests.
+		double leftCost[MESH_NUM_BINS - 1];
+		BoundingBox running;
+		int runningCount = 0;
+		for (int b = 0; b < MESH_NUM_BINS - 1; b++) {
+			running.expand(binBoxes[b]);
+			runningCount += binCounts[b];
+			leftCost[b] = surfaceArea(running) * numPacks(runningCount);
+		}
+		int bestSplit = -1;
+		double bestCost = FLT_MAX;
+		running = BoundingBox();
+		runningCount = 0;
+		for (int b = MESH_NUM_BINS - 1; b > 0; b--) {
+			running.expand(binBoxes[b]);
+			runningCount += binCounts[b];
+			double cost = leftCost[b - 1] + surfaceArea(running) * numPacks(runningCount);
+			if (runningCount > 0 && runningCount < count && cost < bestCost) {
+				bestCost = cost;
+				bestSplit = b - 1;
+			}
+		}
+
+		if (bestSplit >= 0) {
+			const double area = surfaceArea(box);
+			if (count <= MESH_MAX_LEAF_SIZE && area * numPacks(count) <= area + bestCost) {
+				makeLeaf(nodes[index], tris, begin, end);
+				return index;
+			}
+			mid = (int)(std::partition(tris.begin() + begin, tris.begin() + end,
+				[&](int tri) { return binOf(tri) <= bestSplit; }) - tris.begin());
+		}
+	}
+
+	if (mid == begin || mid == end) {
+		if (count <= MESH_MAX_LEAF_SIZE) {
+			makeLeaf(nodes[index], tris, begin, end);
+			return index;
+		}
+		mid = begin + count / 2;
+		std::nth_element(tris.begin() + begin, tris.begin() + mid, tris.begin() + end,
+			[&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+	}
+
+	buildNode(tris, boxes, centroids, begin, mid, depth + 1);
+	const int right = buildNode(tris, boxes, centroids, mid, end, depth + 1);
+	nodes[index].first = right;
+	nodes[index].numPacks = 0;
+	return index;
+}
+
+/**
+ * @fn	void ITriangleMesh::makeLeaf(MeshBVHNode &node, const vector<int> &tris, int begin, int end)
+ * @brief	Turns a node into a leaf holding tris[begin, end), packed four at a time.
+ * @param [in,out]	node 	The node.
+ * @param 		  	tris 	Triangle indices.
+ * @param 		  	begin	First triangle of the leaf.
+ * @param 		  	end  	One past the last triangle of the leaf.
+ */
+
+void ITriangleMesh::makeLeaf(MeshBVHNode& node, const vector<int>& tris, int begin, int end) {
+	node.first = (int)packs.size();
+	node.numPacks = 0;
+	for (int i = begin; i < end; i += MESH_PACK_SIZE) {
+		TrianglePack pack;
+		BoundingBox bounds;
+		for (int j = i; j < std::min(i + MESH_PACK_SIZE, end); j++) {
+			for (int k = 0; k < 3; k++) {
+				bounds.expand(positions[indices[3 * tris[j] + k]]);
+			}
+		}
+		pack.center = bounds.center();
+		for (int lane = 0; lane < MESH_PACK_SIZE; lane++) {
+			dvec3 v0(0, 0, 0), e1(0, 0, 0), e2(0, 0, 0);
+			pack.tri[lane] = -1;
+			if (i + lane < end) {
+				const int tri = tris[i + lane];
+				const dvec3& a = positions[indices[3 * tri]];
+				v0 = a - pack.center;
+				e1 = positions[indices[3 * tri + 1]] - a;
+				e2 = positions[indices[3 * tri + 2]] - a;
+				pack.tri[lane] = tri;
+			}
+			for (int c = 0; c < 3; c++) {
+				pack.v0[c][lane] = (float)v0[c];
+				pack.e1[c][lane] = (float)e1[c];
+				pack.e2[c][lane] = (float)e2[c];
+			}
+		}
+		packs.push_back(pack);
+		node.numPacks++;
+	}
+}
+
+/**
+ * @fn	bool ITriangleMesh::intersectTriangle(int tri, const Ray &ray, double &t, double &u, double &v) const
+ * @brief	Exact Moller-Trumbore test of one triangle.
+ * @param 		  	tri	The triangle.
+ * @param 		  	ray	The ray.
+ * @param [out]	t  	The ray's t value at the hit.
+ * @param [out]	u  	Barycentric weight of the second vertex.
+ * @param [out]	v  	Barycentric weight of the third vertex.
+ * @return	true iff the ray hits the triangle in front of its origin.
+ */
+
+bool ITriangleMesh::intersectTriangle(int tri, const Ray& ray, double& t, double& u, double& v) const {
+	const dvec3& a = positions[indices[3 * tri]];
+	const dvec3 e1 = positions[indices[3 * tri + 1]] - a;
+	const dvec3 e2 = positions[indices[3 * tri + 2]] - a;
+	const dvec3 p = glm::cross(ray.dir, e2);
+	const double det = glm::dot(e1, p);
+	if (det == 0.0) {
+		return false;
+	}
+	const double invDet = 1.0 / det;
+	const dvec3 s = ray.origin - a;
+	u = glm::dot(s, p) * invDet;
+	if (u < 0.0 || u > 1.0) {
+		return false;
+	}
+	const dvec3 q = glm::cross(s, e1);
+	v = glm::dot(ray.dir, q) * invDet;
+	if (v < 0.0 || u + v > 1.0) {
+		return false;
+	}
+	t = glm::dot(e2, q) * invDet;
+	return t > 0.0;
+}
+
+/**
+ * @fn	static Float4 sumAbs(const Float4 &x, const Float4 &y, const Float4 &z)
+ * @brief	L1 lengths of four vectors.
+ */
+
+static Float4 sumAbs(const Float4& x, const Float4& y, const Float4& z) {
+	return abs(x) + abs(y) + abs(z);
+}
+
+/**
+ * @fn	void ITriangleMesh::intersectPack(const TrianglePack &pack, const Ray &ray, double &closestT,
+ * 									int &closestTri, double &closestU, double &closestV) const
+ * @brief	Intersects a ray with the four triangles of a pack. A single-precision
+ * 			Moller-Trumbore test runs on all four at once, with its limits widened
+ * 			by a bound on its round-off error; triangles that pass it get the exact
+ * 			test, so the result is the same as testing each triangle exactly.
+ * @param 		  	pack	  	The pack.
+ * @param 		  	ray		  	The ray.
+ * @param [in,out]	closestT  	The closest hit so far; updated if a closer one is found.
+ * @param [in,out]	closestTri	The triangle of the closest hit.
+ * @param [in,out]	closestU  	Barycentric u of the closest hit.
+ * @param [in,out]	closestV  	Barycentric v of the closest hit.
+ */
+
+void ITriangleMesh::intersectPack(const TrianglePack& pack, const Ray& ray, double& closestT,
+	int& closestTri, double& closestU, double& closestV) const {
+	const float ERROR_SCALE = 1.0E-5f;		// about 80 float ulps per unit of magnitude
+	const dvec3 o = ray.origin - pack.center;
+	const Float4 ox((float)o.x), oy((float)o.y), oz((float)o.z);
+	const Float4 dx((float)ray.dir.x), dy((float)ray.dir.y), dz((float)ray.dir.z);
+	const Float4 v0x = Float4::load(pack.v0[0]), v0y = Float4::load(pack.v0[1]), v0z = Float4::load(pack.v0[2]);
+	const Float4 e1x = Float4::load(pack.e1[0]), e1y = Float4::load(pack.e1[1]), e1z = Float4::load(pack.e1[2]);
+	const Float4 e2x = Float4::load(pack.e2[0]), e2y = Float4::load(pack.e2[1]), e2z = Float4::load(pack.e2[2]);
+
+	const Float4 px = dy * e2z - dz * e2y;
+	const Float4 py = dz * e2x - dx * e2z;
+	const Float4 pz = dx * e2y - dy * e2x;
+	const Float4 det = e1x * px + e1y * py + e1z * pz;
+	const Float4 sx = ox - v0x, sy = oy - v0y, sz = oz - v0z;
+	const Float4 qx = sy * e1z - sz * e1y;
+	const Float4 qy = sz * e1x - sx * e1z;
+	const Float4 qz = sx * e1y - sy * e1x;
+
+	// Compare the numerators against |det| rather than dividing, flipping signs when det < 0.
+	const Float4 negative = det < Float4(0.0f);
+	const Float4 absDet = abs(det);
+	const Float4 u = select(negative, Float4(0.0f) - (sx * px + sy * py + sz * pz), sx * px + sy * py + sz * pz);
+	const Float4 v = select(negative, Float4(0.0f) - (dx * qx + dy * qy + dz * qz), dx * qx + dy * qy + dz * qz);
+	const Float4 t = select(negative, Float4(0.0f) - (e2x * qx + e2y * qy + e2z * qz), e2x * qx + e2y * qy + e2z * qz);
+
+	const Float4 edges = sumAbs(e1x, e1y, e1z) + sumAbs(e2x, e2y, e2z);
+	const Float4 size = sumAbs(sx, sy, sz) + sumAbs(v0x, v0y, v0z) + edges;
+	const Float4 margin = Float4(ERROR_SCALE) * size * edges * sumAbs(dx, dy, dz);
+	const float tLimit = closestT < FLT_MAX ? (float)closestT : FLT_MAX;
+	const Float4 tMargin = margin * (size + Float4(tLimit < 1.0E18f ? tLimit : 1.0E18f));
+
+	Float4 mask = (u >= Float4(0.0f) - margin) & (v >= Float4(0.0f) - margin) &
+		(u + v <= absDet + margin) & (t > Float4(0.0f) - tMargin) &
+		(t <= Float4(tLimit) * absDet + tMargin);
+	int bits = moveMask(mask);
+	for (int lane = 0; lane < MESH_PACK_SIZE; lane++) {
+		const int tri = pack.tri[lane];
+		if (!(bits & (1 << lane)) || tri < 0) {
+			continue;
+		}
+		double tHit, uHit, vHit;
+		if (intersectTriangle(tri, ray, tHit, uHit, vHit) && tHit < closestT) {
+			closestT = tHit;
+			closestTri = tri;
+			closestU = uHit;
+			closestV = vHit;
+		}
+	}
+}
+
+/**
+ * @fn	static double safeInverse(double d)
+ * @brief	Inverse of a direction component, kept finite so the slab test never
+ * 			multiplies zero by infinity.
+ */
+
+static double safeInverse(double d) {
+	const double TINY = 1.0E-300;
+	if (std::fabs(d) < TINY) {
+		d = d < 0 ? -TINY : TINY;
+	}
+	return 1.0 / d;
+}
+
+/**
+ * @fn	static bool hitsBox(const BoundingBox &box, const Ray &ray, const dvec3 &invDir,
+ * 						double tLimit, double &tNear)
+ * @brief	Slab test of a ray against a box.
+ * @param 		  	box   	The box.
+ * @param 		  	ray   	The ray.
+ * @param 		  	invDir	Componentwise inverse of the ray's direction.
+ * @param 		  	tLimit	Hits farther than this do not count.
+ * @param [out]	tNear 	Where the ray enters the box.
+ * @return	true iff the ray passes through the box between 0 and tLimit.
+ */
+
+static bool hitsBox(const BoundingBox& box, const Ray& ray, const dvec3& invDir,
+	double tLimit, double& tNear) {
+	double tFar = tLimit;
+	tNear = 0.0;
+	for (int a = 0; a < 3; a++) {
+		double t1 = (box.lo[a] - ray.origin[a]) * invDir[a];
+		double t2 = (box.hi[a] - ray.origin[a]) * invDir[a];
+		tNear = std::max(tNear, std::min(t1, t2));
+		tFar = std::min(tFar, std::max(t1, t2));
+	}
+	return tNear <= tFar;
+}
+
+/**
+ * @fn	void ITriangleMesh::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Finds the closest intersection of a ray with the mesh. The hierarchy is
+ * 			walked front to back, skipping nodes farther than the closest hit so far.
+ * 			The normal is interpolated from the triangle's vertex normals.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The hit; t is FLT_MAX if the ray misses the mesh.
+ */
+
+void ITriangleMesh::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
+	hit.t = FLT_MAX;
+	if (nodes.empty()) {
+		return;
+	}
+	const dvec3 invDir(safeInverse(ray.dir.x), safeInverse(ray.dir.y), safeInverse(ray.dir.z));
+	double closestT = FLT_MAX, closestU = 0.0, closestV = 0.0;
+	int closestTri = -1;
+
+	int stack[MESH_STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const int index = stack[--top];
+		const MeshBVHNode& node = nodes[index];
+		double tNear;
+		if (!hitsBox(node.box, ray, invDir, closestT, tNear)) {
+			continue;
+		}
+		if (node.numPacks > 0) {
+			for (int p = node.first; p < node.first + node.numPacks; p++) {
+				intersectPack(packs[p], ray, closestT, closestTri, closestU, closestV);
+			}
+			continue;
+		}
+		// Visit the nearer child first.
+		const int left = index + 1;
+		const int right = node.first;
+		double tLeft, tRight;
+		const bool hitLeft = hitsBox(nodes[left].box, ray, invDir, closestT, tLeft);
+		const bool hitRight = hitsBox(nodes[right].box, ray, invDir, closestT, tRight);
+		if (hitLeft && hitRight) {
+			stack[top++] = tLeft <= tRight ? right : left;
+			stack[top++] = tLeft <= tRight ? left : right;
+		} else if (hitLeft) {
+			stack[top++] = left;
+		} else if (hitRight) {
+			stack[top++] = right;
+		}
+	}
+
+	if (closestTri < 0) {
+		return;
+	}
+	const int* tri = &indices[3 * closestTri];
+	dvec3 n = (1.0 - closestU - closestV) * normals[tri[0]] +
+		closestU * normals[tri[1]] + closestV * normals[tri[2]];
+	if (glm::length(n) == 0.0) {
+		n = glm::cross(positions[tri[1]] - positions[tri[0]], positions[tri[2]] - positions[tri[0]]);
+	}
+	hit.t = closestT;
+	hit.interceptPt = ray.getPoint(closestT);
+	hit.normal = glm::normalize(n);
+}
+
+/**
+ * @fn	bool ITriangleMesh::getBoundingBox(BoundingBox &box) const
+ * @brief	Gets the bounds of the mesh.
+ * @param [out]	box	The bounding box.
+ * @return	true unless the mesh has no triangles.
+ */
+
+bool ITriangleMesh::getBoundingBox(BoundingBox& box) const {
+	if (nodes.empty()) {
+		return false;
+	}
+	box = nodes[0].box;
+	return true;
+}
+
+/**
+ * @fn	void ITriangleMesh::write(std::ostream &out) const
+ * @brief	Writes the mesh, hierarchy included, in binary form.
+ * @param	out	The binary output stream.
+ */
+
+void ITriangleMesh::write(std::ostream& out) const {
+	writeArray(out, positions);
+	writeArray(out, normals);
+	writeArray(out, indices);
+	writeArray(out, nodes);
+	writeArray(out, packs);
+}
+
+/**
+ * @fn	bool ITriangleMesh::read(const char* &p, const char *end)
+ * @brief	Restores a mesh saved by write. The hierarchy is copied as it was saved,
+ * 			not rebuilt.
+ * @param [in,out]	p  	The position to read from; advanced past the mesh.
+ * @param 		  	end	The end of the readable memory.
+ * @return	false if the data is truncated or inconsistent, or the hierarchy is
+ * 			too deep to traverse.
+ */
+
+bool ITriangleMesh::read(const char*& p, const char* end) {
+	if (!readArray(p, end, positions) || !readArray(p, end, normals) ||
+		!readArray(p, end, indices) || !readArray(p, end, nodes) ||
+		!readArray(p, end, packs)) {
+		return false;
+	}
+	const int numVerts = (int)positions.size();
+	if (normals.size() != positions.size() || indices.size() % 3 != 0) {
+		return false;
+	}
+	for (size_t i = 0; i < indices.size(); i++) {
+		if (indices[i] < 0 || indices[i] >= numVerts) {
+			return false;
+		}
+	}
+	// Children follow their parents, so a backward pass sees them first and can
+	// find how deep a traversal stack each subtree needs.
+	vector<int> stackNeeded(nodes.size(), 0);
+	for (int i = (int)nodes.size() - 1; i >= 0; i--) {
+		const MeshBVHNode& node = nodes[i];
+		bool valid = node.numPacks > 0 ? node.first >= 0 && node.first <= (int)packs.size() &&
+											node.numPacks <= (int)packs.size() - node.first
+										: node.first > i + 1 && node.first < (int)nodes.size();
+		if (valid && node.numPacks == 0) {
+			stackNeeded[i] = std::max(2, 1 + std::max(stackNeeded[i + 1], stackNeeded[node.first]));
+			valid = stackNeeded[i] <= MESH_STACK_SIZE;
+		}
+		if (!valid) {
+			return false;
+		}
+	}
+	for (size_t i = 0; i < packs.size(); i++) {
+		for (int k = 0; k < MESH_PACK_SIZE; k++) {
+			if (packs[i].tri[k] < -1 || packs[i].tri[k] >= getNumTriangles()) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,79 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include "defs.h"
+#include "ishape.h"
+#include "eshape.h"
+
+const int MESH_PACK_SIZE = 4;		//!< Triangles intersected at once.
+const int MESH_MAX_LEAF_SIZE = 16;	//!< A BVH node with more triangles than this is always split.
+
+/**
+ * @struct	MeshBVHNode
+ * @brief	A node of a triangle mesh's bounding volume hierarchy. The left child of
+ * 			an interior node immediately follows it; the right child is at index
+ * 			first. A leaf holds numPacks triangle packs, starting at index first.
+ */
+
+struct MeshBVHNode {
+	BoundingBox box;		//!< bounds of everything below this node.
+	int first;				//!< right child (interior node) or first pack (leaf).
+	int numPacks;			//!< number of packs in a leaf; 0 for interior nodes.
+};
+
+/**
+ * @struct	TrianglePack
+ * @brief	Up to four triangles in structure-of-arrays form, in single precision
+ * 			and relative to the pack's center, ready for four-wide intersection.
+ * 			Unused lanes have triangle index -1.
+ */
+
+struct TrianglePack {
+	dvec3 center;			//!< origin of the pack's coordinates.
+	float v0[3][4];			//!< first vertex of each triangle, x, y and z rows.
+	float e1[3][4];			//!< first edge (v1 - v0) of each triangle.
+	float e2[3][4];			//!< second edge (v2 - v0) of each triangle.
+	int tri[4];				//!< index of each triangle in the mesh.
+};
+
+/**
+ * @struct	ITriangleMesh
+ * @brief	A mesh of triangles that the ray tracer treats as one shape. The
+ * 			triangles are kept in a bounding volume hierarchy, intersected four
+ * 			at a time, and shaded with normals interpolated from the vertices.
+ */
+
+struct ITriangleMesh : public IShape {
+	ITriangleMesh();
+	ITriangleMesh(const vector<dvec3>& positions, const vector<int>& indices,
+		const vector<dvec3>& normals = vector<dvec3>());
+	ITriangleMesh(const EShapeData& triangles);
+	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual bool getBoundingBox(BoundingBox& box) const;
+	int getNumTriangles() const { return (int)indices.size() / 3; }
+	void write(std::ostream& out) const;
+	bool read(const char*& p, const char* end);
+protected:
+	vector<dvec3> positions;		//!< vertex positions.
+	vector<dvec3> normals;			//!< unit vertex normals.
+	vector<int> indices;			//!< three vertex indices per triangle.
+	vector<MeshBVHNode> nodes;		//!< the hierarchy; nodes[0] is the root.
+	vector<TrianglePack> packs;		//!< the triangles of the leaves.
+
+	void computeNormals();
+	void buildHierarchy();
+	int buildNode(vector<int>& tris, const vector<BoundingBox>& boxes,
+		const vector<dvec3>& centroids, int begin, int end, int depth);
+	void makeLeaf(MeshBVHNode& node, const vector<int>& tris, int begin, int end);
+	bool intersectTriangle(int tri, const Ray& ray, double& t, double& u, double& v) const;
+	void intersectPack(const TrianglePack& pack, const Ray& ray, double& closestT,
+		int& closestTri, double& closestU, double& closestV) const;
+};
@@ -15,7 +15,7 @@
 #include <string>
 #include "defs.h"
 
-extern bool DEBUG_PIXEL;
+extern thread_local bool DEBUG_PIXEL;
 extern int xDebug, yDebug;
 void mouseUtility(int, int, int, int);
 void keyboardUtility(unsigned char key, int x, int y);
@@ -22,6 +22,7 @@ struct VertexData {
 	dvec3 worldPos;		//!< Saved world position, for lighting calculations.
 	Material material;	//!< This vertex's material.
 
+	VertexData() {}
 	VertexData(const dvec4& pos, const dvec3& norm,
 		const Material& mat, const dvec3& worldPos);
 	VertexData(const dvec4& pos) : VertexData(pos, Z_AXIS, bronze, ORIGIN3D) {
@@ -37,3 +38,31 @@ struct VertexData {
 };
 
 VertexData operator * (double w, const VertexData& V1);
+
+const int COMPACT_MATERIAL_SEARCH = 8;	//!< Recent materials CompactVertices looks through before adding one.
+
+/**
+ * @struct	CompactVertices
+ * @brief	Vertices in the compact layout the raster pipeline works on: each
+ * 			coordinate in its own stream of floats, and a 16-bit index into a
+ * 			table of the draw's materials in place of a whole Material. A
+ * 			triangle is drawn with the material of its first vertex. Each
+ * 			successive triplet is a triangle.
+ */
+
+struct CompactVertices {
+	vector<float> x, y, z;					//!< window coordinates.
+	vector<float> nx, ny, nz;				//!< world normal vectors.
+	vector<float> wx, wy, wz;				//!< world positions.
+	vector<unsigned short> materialIds;		//!< index of each vertex's material.
+	vector<Material> materials;				//!< the materials used.
+
+	size_t size() const { return x.size(); }
+	void clear();
+	void push_back(const VertexData& v);
+	unsigned short addMaterial(const Material& mat);
+	dvec3 getWindowPos(size_t i) const { return dvec3(x[i], y[i], z[i]); }
+	dvec3 getNormal(size_t i) const { return dvec3(nx[i], ny[i], nz[i]); }
+	dvec3 getWorldPos(size_t i) const { return dvec3(wx[i], wy[i], wz[i]); }
+};
+
@@ -19,91 +19,82 @@ vector<IPlane> VertexOps::allButNearNDCPlanes{ IPlane(dvec3(1, 0, 0), dvec3(-1,
 												IPlane(dvec3(0, -1, 0), dvec3(0, 1, 0)),
 	//												IPlane(dvec3(0, 0, -1), dvec3(0, 0, 1))
 };
+bool VertexOps::cullObjects = true;
+CullStats VertexOps::cullStats = { 0, 0, 0 };
+
+const double CULL_DEPTH_MARGIN = 1e-6;	//!< Allows for window coordinates being rounded to floats.
+const double GUARD_BAND = 4.0;			//!< NDC |x| and |y| within which triangles are scissored while rasterized instead of clipped.
+const unsigned int OUTCODE_LEFT = 1;	//!< x < -1
+const unsigned int OUTCODE_RIGHT = 2;	//!< x > 1
+const unsigned int OUTCODE_BOTTOM = 4;	//!< y < -1
+const unsigned int OUTCODE_TOP = 8;		//!< y > 1
+const unsigned int OUTCODE_FAR = 16;	//!< z > 1
+const unsigned int OUTCODE_GUARD = 32;	//!< beyond the guard band
 
 /**
- * @fn	vector<VertexData> triangulate(const vector<VertexData> &poly)
- * @brief	Triangulates the given polygon
- * @param	poly	The polygon to be decomposed into individual triangles.
- * @return	A vector of triangles, which comprise the original polygon.
- */
-
-vector<VertexData> triangulate(const vector<VertexData>& poly) {
-	vector<VertexData> triangles;
-
-	for (unsigned int i = 1; i < poly.size() - 1; i++) {
-		triangles.push_back(poly[0]);
-		triangles.push_back(poly[i]);
-		triangles.push_back(poly[i + 1]);
-	}
-
-	return triangles;
-}
-
-/**
- * @fn	vector<VertexData> VertexOps::clipAgainstPlane(vector<VertexData> &verts, const IPlane &plane)
+ * @fn	int VertexOps::clipAgainstPlane(const VertexData *verts, int count, const IPlane &plane,
+ *										VertexData *output)
  * @brief	Clips a polygon against a single plane
- * @param [in,out]	verts	The array of vertices.
- * @param 		  	plane	The plane that will do the clipping.
- * @return	The polygon that exludes the portions outside the given plane.
+ * @param 		  	verts 	The polygon's vertices.
+ * @param 		  	count 	The number of vertices.
+ * @param 		  	plane 	The plane that will do the clipping.
+ * @param [out]	output	Receives the polygon that excludes the portions outside the
+ * 						given plane; room for CLIP_MAX_VERTICES vertices.
+ * @return	The number of vertices in output.
  */
 
-vector<VertexData> VertexOps::clipAgainstPlane(vector<VertexData>& verts, const IPlane& plane) {
-	vector<VertexData> output;
+int VertexOps::clipAgainstPlane(const VertexData* verts, int count, const IPlane& plane,
+	VertexData* output) {
+	int n = 0;
 
-	if (verts.size() > 2) {
-		verts.push_back(verts[0]);
-
-		for (unsigned int i = 1; i < verts.size(); i++) {
-			bool v0In = plane.onFrontSide(verts[i - 1].pos.xyz());
-			bool v1In = plane.onFrontSide(verts[i].pos.xyz());
+	if (count > 2) {
+		bool v0In = plane.onFrontSide(verts[0].pos.xyz());
+		for (int i = 1; i <= count && n + 2 <= CLIP_MAX_VERTICES; i++) {
+			const VertexData& v0 = verts[i - 1];
+			const VertexData& v1 = verts[i % count];
+			bool v1In = plane.onFrontSide(v1.pos.xyz());
 
 			if (v0In && v1In) {
-				output.push_back(verts[i]);
+				output[n++] = v1;
 			} else if (v0In || v1In) {
 				double t;
-				plane.findIntersection(verts[i - 1].pos.xyz(), verts[i].pos.xyz(), t);
-				VertexData I(1.0 - t, verts[i - 1], t, verts[i]);
-				output.push_back(I);
+				plane.findIntersection(v0.pos.xyz(), v1.pos.xyz(), t);
+				output[n] = VertexData(1.0 - t, v0, t, v1);
+				output[n].normal = glm::normalize(output[n].normal);
+				n++;
 				if (!v0In && v1In) {
-					output.push_back(verts[i]);
+					output[n++] = v1;
 				}
 			}
+			v0In = v1In;
 		}
 	}
-	return output;
+	return n;
 }
 
 /**
- * @fn	vector<VertexData> VertexOps::clipPolygon(const vector<VertexData> &clipCoords)
- * @brief	Clip polygon against the normalized view volumn - 2x2x2 cube.
- * @param	clipCoords	The array of triangles.
- * @param	planes		Planes to clip against
- * @return	The array of triangles, after performing clipping.
+ * @fn	int VertexOps::clipPolygon(VertexData *polygon, int count, const IPlane *planes, int numPlanes)
+ * @brief	Clips a polygon, in place, against several planes.
+ * @param [in,out]	polygon  	The polygon's vertices; room for CLIP_MAX_VERTICES.
+ * @param 		  	count	 	The number of vertices.
+ * @param 		  	planes   	Planes to clip against.
+ * @param 		  	numPlanes	The number of planes.
+ * @return	The number of vertices left, 0 if less than a triangle remains.
  */
 
-vector<VertexData> VertexOps::clipPolygon(const vector<VertexData>& clipCoords,
-	const vector<IPlane>& planes) {
-	vector<VertexData> ndcCoords;
-
-	if (clipCoords.size() > 2) {
-		for (unsigned int i = 0; i < clipCoords.size() - 2; i += 3) {
-			vector<VertexData> polygon;
-			polygon.push_back(clipCoords[i]);
-			polygon.push_back(clipCoords[i + 1]);
-			polygon.push_back(clipCoords[i + 2]);
+int VertexOps::clipPolygon(VertexData* polygon, int count, const IPlane* planes, int numPlanes) {
+	VertexData scratch[CLIP_MAX_VERTICES];
+	VertexData* in = polygon;
+	VertexData* out = scratch;
 
-			for (const IPlane& plane : planes) {
-				polygon = clipAgainstPlane(polygon, plane);
-			}
-			if (polygon.size() > 3) {
-				polygon = triangulate(polygon);
-			}
-			for (const VertexData& v : polygon) {
-				ndcCoords.push_back(v);
-			}
-		}
+	for (int i = 0; i < numPlanes && count > 2; i++) {
+		count = clipAgainstPlane(in, count, planes[i], out);
+		std::swap(in, out);
 	}
-	return ndcCoords;
+	if (in != polygon) {
+		std::copy(in, in + count, polygon);
+	}
+	return count > 2 ? count : 0;
 }
 
 /**
@@ -154,36 +145,25 @@ vector<VertexData> VertexOps::clipLineSegments(const vector<VertexData>& clipCoo
 }
 
 /**
-* @fn	vector<VertexData> VertexOps::processBackwardFacingTriangles(const vector<VertexData> &triangleVerts,
-*																	 bool renderBackfaces)
-* @brief	Removes the backward facing triangles
-* @param	triangleVerts	The vector of triangle vertices.
-* @return	Vector of triangle vertices, without those facing backward.
+* @fn	bool VertexOps::processBackwardFacingTriangle(VertexData *triangle, bool renderBackfaces)
+* @brief	Decides whether a triangle is drawn, turning its normals around if it faces
+* 			backward and is drawn anyway.
+* @param [in,out]	triangle		The triangle's three vertices.
+* @param 		  	renderBackfaces	True if backward facing triangles are drawn.
+* @return	True if the triangle is to be drawn.
 */
 
-vector<VertexData> VertexOps::processBackwardFacingTriangles(const vector<VertexData>& triangleVerts, bool renderBackfaces) {
-	vector<VertexData> triangles;
-
-	for (int i = 0; i < (int)triangleVerts.size() - 2; i += 3) {
-		dvec3 n = normalFrom3Points(triangleVerts[i].pos.xyz(),
-			triangleVerts[i + 1].pos.xyz(),
-			triangleVerts[i + 2].pos.xyz());
-		if (n.z >= 0.0) {
-			triangles.push_back(triangleVerts[i]);
-			triangles.push_back(triangleVerts[i + 1]);
-			triangles.push_back(triangleVerts[i + 2]);
-		} else if (renderBackfaces) {
-			triangles.push_back(triangleVerts[i]);
-			triangles.back().normal *= -1;
-
-			triangles.push_back(triangleVerts[i + 1]);
-			triangles.back().normal *= -1;
-
-			triangles.push_back(triangleVerts[i + 2]);
-			triangles.back().normal *= -1;
+bool VertexOps::processBackwardFacingTriangle(VertexData* triangle, bool renderBackfaces) {
+	dvec3 n = normalFrom3Points(triangle[0].pos.xyz(), triangle[1].pos.xyz(), triangle[2].pos.xyz());
+	if (n.z >= 0.0) {
+		return true;
+	} else if (renderBackfaces) {
+		for (int i = 0; i < 3; i++) {
+			triangle[i].normal *= -1;
 		}
+		return true;
 	}
-	return triangles;
+	return false;
 }
 
 /**
@@ -244,12 +224,133 @@ double computeNearPlane(const dmat4& PM) {
 	return nearf;
 }
 
+/**
+ * @fn	static void perspectiveDivide(VertexData &v)
+ * @brief	Divides a projected vertex by its w.
+ * @param [in,out]	v	The vertex.
+ */
+
+static void perspectiveDivide(VertexData& v) {
+	if (v.pos.w >= 0) {
+		v.pos /= v.pos.w;
+	} else {							// should not happen
+		v.pos.x /= -v.pos.w;
+		v.pos.y /= -v.pos.w;
+		v.pos.z = -std::abs(v.pos.z / -v.pos.w);
+		v.pos.w = 1.0;
+	}
+}
+
+static thread_local CompactVertices windowTriangles;	//!< Each thread's triangles in window coordinates, kept between draws.
+
+/**
+ * @fn	static VertexData transformToEyeCoordinates(const VertexData &v, const dmat4 &modelingMatrix,
+ *													const dmat3 &normalMatrix, const dmat4 &viewingMatrix)
+ * @brief	Transforms an object's vertex into eye coordinates, keeping its world
+ * 			position for lighting.
+ * @param	v			  	The vertex.
+ * @param	modelingMatrix	The modeling matrix.
+ * @param	normalMatrix  	The matrix transforming normals to world coordinates.
+ * @param	viewingMatrix 	The viewing matrix.
+ * @return	The transformed vertex.
+ */
+
+static VertexData transformToEyeCoordinates(const VertexData& v, const dmat4& modelingMatrix,
+	const dmat3& normalMatrix, const dmat4& viewingMatrix) {
+	const dvec4 worldPos = modelingMatrix * v.pos;
+	return VertexData(viewingMatrix * worldPos, normalMatrix * v.normal, v.material, worldPos.xyz());
+}
+
+/**
+ * @fn	static unsigned int outcode(const dvec4 &ndc)
+ * @brief	Finds which planes of the view volume, other than the near plane, a
+ * 			vertex is outside of, and whether it is beyond the guard band.
+ * @param	ndc	The vertex, in normalized device coordinates.
+ * @return	The OUTCODE_ bits.
+ */
+
+static unsigned int outcode(const dvec4& ndc) {
+	return (ndc.x < -1.0 ? OUTCODE_LEFT : 0) | (ndc.x > 1.0 ? OUTCODE_RIGHT : 0) |
+		(ndc.y < -1.0 ? OUTCODE_BOTTOM : 0) | (ndc.y > 1.0 ? OUTCODE_TOP : 0) |
+		(ndc.z > 1.0 ? OUTCODE_FAR : 0) |
+		(std::abs(ndc.x) > GUARD_BAND || std::abs(ndc.y) > GUARD_BAND ? OUTCODE_GUARD : 0);
+}
+
+/**
+ * @fn	void VertexOps::processEyeTriangle(VertexData *polygon, const PipelineMatrices &pipeMats,
+ *											const IPlane &nearPlane, bool renderBackfaces)
+ * @brief	Takes one triangle from eye coordinates to window coordinates: clips it
+ * 			on the near plane, projects it, removes it if it faces backward, clips
+ * 			it to the view volume and adds the triangles left to windowTriangles.
+ * 			Clipping is avoided where it can be. The near plane only clips a
+ * 			triangle that crosses it. After projection, the vertices' outcodes
+ * 			reject a triangle wholly outside one plane, and a triangle that only
+ * 			strays outside the side planes, within the guard band, is left for
+ * 			the rasterizer to scissor. Only a triangle crossing the far plane or
+ * 			reaching beyond the guard band is clipped.
+ * @param [in,out]	polygon		   	The triangle, in eye coordinates; room for
+ * 									CLIP_MAX_VERTICES vertices.
+ * @param 		  	pipeMats	   	The pipeline matrices.
+ * @param 		  	nearPlane	   	The near plane, in eye coordinates.
+ * @param 		  	renderBackfaces	True if backfaces are to be rendered.
+ */
+
+void VertexOps::processEyeTriangle(VertexData* polygon, const PipelineMatrices& pipeMats,
+	const IPlane& nearPlane, bool renderBackfaces) {
+	VertexData triangle[CLIP_MAX_VERTICES];
+
+	int n = 0;
+	for (int j = 0; j < 3; j++) {
+		n += nearPlane.onFrontSide(polygon[j].pos.xyz()) ? 1 : 0;
+	}
+	if (n == 0) {
+		return;
+	} else if (n < 3) {
+		n = clipPolygon(polygon, 3, &nearPlane, 1);
+	}
+	for (int j = 0; j < n; j++) {
+		polygon[j].pos = pipeMats.projectionMatrix * polygon[j].pos;
+		perspectiveDivide(polygon[j]);
+	}
+
+	for (int j = 1; j + 1 < n; j++) {		// triangulate
+		triangle[0] = polygon[0];
+		triangle[1] = polygon[j];
+		triangle[2] = polygon[j + 1];
+		const unsigned int code0 = outcode(triangle[0].pos);
+		const unsigned int code1 = outcode(triangle[1].pos);
+		const unsigned int code2 = outcode(triangle[2].pos);
+		if ((code0 & code1 & code2 & ~OUTCODE_GUARD) != 0) {
+			continue;					// wholly outside one plane
+		}
+		if (!processBackwardFacingTriangle(triangle, renderBackfaces)) {
+			continue;
+		}
+		int m = 3;
+		if (((code0 | code1 | code2) & (OUTCODE_FAR | OUTCODE_GUARD)) != 0) {
+			m = clipPolygon(triangle, 3, allButNearNDCPlanes.data(), (int)allButNearNDCPlanes.size());
+		}
+		for (int k = 0; k < m; k++) {
+			triangle[k].pos = pipeMats.viewportMatrix * triangle[k].pos;
+		}
+		for (int k = 1; k + 1 < m; k++) {
+			windowTriangles.push_back(triangle[0]);
+			windowTriangles.push_back(triangle[k]);
+			windowTriangles.push_back(triangle[k + 1]);
+		}
+	}
+}
+
 /**
  * @fn	void VertexOps::processTriangleVertices(FrameBuffer &frameBuffer, const dvec3 &eyePos,
  *												const vector<LightSourcePtr> &lights,
  *												const vector<VertexData> &objectCoords)
  * @brief	Transforms the triangle vertices through pipeline:
  *					object -> world -> eye -> clip/ndc -> window.
+ * 			Triangles are streamed through the pipeline one at a time, in fixed
+ * 			size clip buffers on the stack. The window coordinates are gathered in
+ * 			a buffer that each thread keeps from one call to the next, so a draw
+ * 			does not allocate once the buffer has grown large enough.
  * @param [in,out]	frameBuffer 	Buffer for frame data.
  * @param 		  	eyePos			The eye position.
  * @param 		  	lights			The lights.
@@ -263,38 +364,82 @@ void VertexOps::processTriangleVertices(FrameBuffer& frameBuffer, const dvec3& e
 	const PipelineMatrices& pipeMats,
 	bool renderBackfaces) {
 	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
-	const dmat4& projectionMatrix = pipeMats.projectionMatrix;
-	const dmat4& viewportMatrix = pipeMats.viewportMatrix;
 
-	vector<VertexData> worldCoords = transformVerticesToWorldCoordinates(modelingMatrix, objectCoords);
-	vector<VertexData> eyeCoords = transformVertices(viewingMatrix, worldCoords);
+	// 3 x 3 matrix for transforming normal vectors to world coordinates
+	const dmat3 normalMatrix = glm::transpose(glm::inverse(dmat3(modelingMatrix)));
+	const IPlane nearPlane(dvec4(0.0, 0.0, computeNearPlane(pipeMats.projectionMatrix), 1.0), -Z_AXIS);
+	VertexData polygon[CLIP_MAX_VERTICES];
 
-	double nearZ = computeNearPlane(projectionMatrix);
-	vector <IPlane> nearPlane = { IPlane(dvec4(0.0, 0.0, nearZ, 1.0), -Z_AXIS) };
-	vector<VertexData> eyeCoordsClippedOnNearPlane = clipPolygon(eyeCoords, nearPlane);
-
-	vector<VertexData> projCoords = transformVertices(projectionMatrix, eyeCoordsClippedOnNearPlane);
-	vector<VertexData> clipCoords;
-
-	for (VertexData v : projCoords) {		// Perspective division
-		if (v.pos.w >= 0) {
-			v.pos /= v.pos.w;
-		} else {							// should not happen
-			v.pos.x /= -v.pos.w;
-			v.pos.y /= -v.pos.w;
-			v.pos.z = -std::abs(v.pos.z / -v.pos.w);
-			v.pos.w = 1.0;
+	windowTriangles.clear();
+	for (size_t i = 0; i + 2 < objectCoords.size(); i += 3) {
+		for (int j = 0; j < 3; j++) {
+			polygon[j] = transformToEyeCoordinates(objectCoords[i + j], modelingMatrix, normalMatrix, viewingMatrix);
 		}
-		clipCoords.push_back(v);
+		processEyeTriangle(polygon, pipeMats, nearPlane, renderBackfaces);
 	}
 
-	clipCoords = processBackwardFacingTriangles(clipCoords, renderBackfaces);
+	Frame eyeFrame = Frame::createOrthoNormalBasis(viewingMatrix);
+	drawManyFilledTriangles(frameBuffer, eyePos, lights, windowTriangles, eyeFrame);
+}
 
-	vector<VertexData> ndcCoords = clipPolygon(clipCoords, allButNearNDCPlanes);
-	vector<VertexData> windowCoords = transformVertices(viewportMatrix, ndcCoords);
+/**
+ * @fn	void VertexOps::processIndexedTriangleVertices(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+ *														const vector<LightSourcePtr> &lights,
+ *														const EIndexedShapeData &mesh)
+ * @brief	Transforms the triangles of an indexed shape through the pipeline, like
+ * 			processTriangleVertices. A vertex is transformed to eye coordinates
+ * 			the first time a triangle uses it and is then kept in a post-transform
+ * 			cache, so each vertex is transformed once however many triangles share
+ * 			it. Like the window coordinates, the cache is kept by each thread from
+ * 			one call to the next.
+ * @param [in,out]	frameBuffer	   	Buffer for frame data.
+ * @param 		  	eyePos		   	The eye position.
+ * @param 		  	lights		   	The lights.
+ * @param 		  	mesh		   	The shape, in object coordinates.
+ * @param 		  	modelingMatrix 	The transformation applied to the object.
+ * @param 		  	pipeMats	   	The pipeline matrices.
+ * @param 		  	renderBackfaces	True if backfaces are to be rendered.
+ */
+
+void VertexOps::processIndexedTriangleVertices(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights,
+	const EIndexedShapeData& mesh,
+	const dmat4& modelingMatrix,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
+	static thread_local vector<VertexData> eyeCoords;		// post-transform cache
+	static thread_local vector<unsigned int> cachedDraw;	// draw whose vertex is in the cache
+	static thread_local unsigned int drawNumber = 0;
+
+	if (++drawNumber == 0) {					// wrapped around; forget every draw
+		std::fill(cachedDraw.begin(), cachedDraw.end(), 0);
+		drawNumber = 1;
+	}
+	if (eyeCoords.size() < mesh.vertices.size()) {
+		eyeCoords.resize(mesh.vertices.size());
+		cachedDraw.resize(mesh.vertices.size(), 0);
+	}
+
+	const dmat3 normalMatrix = glm::transpose(glm::inverse(dmat3(modelingMatrix)));
+	const IPlane nearPlane(dvec4(0.0, 0.0, computeNearPlane(pipeMats.projectionMatrix), 1.0), -Z_AXIS);
+	VertexData polygon[CLIP_MAX_VERTICES];
+
+	windowTriangles.clear();
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+		for (int j = 0; j < 3; j++) {
+			const unsigned int v = mesh.indices[i + j];
+			if (cachedDraw[v] != drawNumber) {
+				eyeCoords[v] = transformToEyeCoordinates(mesh.vertices[v], modelingMatrix, normalMatrix, viewingMatrix);
+				cachedDraw[v] = drawNumber;
+			}
+			polygon[j] = eyeCoords[v];
+		}
+		processEyeTriangle(polygon, pipeMats, nearPlane, renderBackfaces);
+	}
 
 	Frame eyeFrame = Frame::createOrthoNormalBasis(viewingMatrix);
-	drawManyFilledTriangles(frameBuffer, eyePos, lights, windowCoords, eyeFrame);
+	drawManyFilledTriangles(frameBuffer, eyePos, lights, windowTriangles, eyeFrame);
 }
 
 /**
@@ -342,7 +487,7 @@ void VertexOps::processLineSegments(FrameBuffer& frameBuffer, const dvec3& eyePo
 /**
  * @fn	void VertexOps::render(FrameBuffer &frameBuffer, const vector<VertexData> &verts,
  *								const vector<LightSourcePtr> &lights, const dmat4 &TM)
- * @brief	Renders this object
+ * @brief	Renders this object, unless cullObjects is on and it cannot be seen.
  * @param [in,out]	frameBuffer	Buffer for frame data.
  * @param 		  	verts	   	The vertices.
  * @param 		  	lights	   	The lights.
@@ -358,11 +503,126 @@ void VertexOps::render(FrameBuffer& frameBuffer, const vector<VertexData>& verts
 	bool renderBackfaces) {
 	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
 
+	if (cullObjects) {
+		BoundingBox objectBox;
+		for (const VertexData& v : verts) {
+			objectBox.expand(v.pos.xyz());
+		}
+		if (isCulled(frameBuffer, objectBox, modelingMatrix, pipeMats)) {
+			return;
+		}
+	}
 	dvec3 eyePos = glm::inverse(viewingMatrix)[3].xyz();
 	VertexOps::processTriangleVertices(frameBuffer, eyePos, lights, verts,
 		modelingMatrix, pipeMats, renderBackfaces);
 }
 
+/**
+ * @fn	void VertexOps::render(FrameBuffer &frameBuffer, const EIndexedShapeData &mesh,
+ *								const vector<LightSourcePtr> &lights, const dmat4 &TM)
+ * @brief	Renders an indexed object, unless cullObjects is on and it cannot be seen.
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param 		  	mesh	   	The vertices and the triangles' indices.
+ * @param 		  	lights	   	The lights.
+ * @param           modelingMatrix  The transformation applied to the object
+ * @param 		  	pipeMats    The pipeline matrices
+ * @param           renderBackfaces True if backfaces are to be rendered
+ */
+
+void VertexOps::render(FrameBuffer& frameBuffer, const EIndexedShapeData& mesh,
+	const vector<LightSourcePtr>& lights,
+	const dmat4& modelingMatrix,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
+
+	if (cullObjects && isCulled(frameBuffer, mesh.bounds, modelingMatrix, pipeMats)) {
+		return;
+	}
+	dvec3 eyePos = glm::inverse(viewingMatrix)[3].xyz();
+	VertexOps::processIndexedTriangleVertices(frameBuffer, eyePos, lights, mesh,
+		modelingMatrix, pipeMats, renderBackfaces);
+}
+
+/**
+ * @fn	bool VertexOps::isCulled(FrameBuffer &frameBuffer, const BoundingBox &objectBox,
+ *								const dmat4 &modelingMatrix, const PipelineMatrices &pipeMats)
+ * @brief	Decides whether an object can be skipped, from its bounding box. The
+ * 			box's corners are taken to clip coordinates; if they are all outside
+ * 			one plane of the view volume, so is the object. Otherwise, when depth
+ * 			testing is on and the box is wholly in front of the near plane, its
+ * 			window rectangle and nearest depth are found, and the object is
+ * 			hidden if no block of the framebuffer under the rectangle holds a
+ * 			depth farther than that. Updates the counts given by getCullStats.
+ * @param [in,out]	frameBuffer   	The frame buffer.
+ * @param 		  	objectBox	  	Box around the object, in object coordinates.
+ * @param 		  	modelingMatrix	The transformation applied to the object.
+ * @param 		  	pipeMats	  	The pipeline matrices.
+ * @return	True if nothing of the object would be drawn.
+ */
+
+bool VertexOps::isCulled(FrameBuffer& frameBuffer, const BoundingBox& objectBox,
+	const dmat4& modelingMatrix, const PipelineMatrices& pipeMats) {
+	cullStats.draws++;
+	if (objectBox.isEmpty()) {
+		cullStats.frustumCulled++;
+		return true;
+	}
+
+	const dmat4 toClip = pipeMats.projectionMatrix * pipeMats.viewingMatrix * modelingMatrix;
+	dvec4 corners[8];
+	unsigned int outsideAll = 0x3F;			// planes that every corner is outside of
+	bool inFront = true;					// every corner in front of the near plane
+	for (int i = 0; i < 8; i++) {
+		const dvec4 p = toClip * dvec4((i & 1) ? objectBox.hi.x : objectBox.lo.x,
+										(i & 2) ? objectBox.hi.y : objectBox.lo.y,
+										(i & 4) ? objectBox.hi.z : objectBox.lo.z, 1.0);
+		const unsigned int outside = (p.x < -p.w ? 1 : 0) | (p.x > p.w ? 2 : 0) |
+									(p.y < -p.w ? 4 : 0) | (p.y > p.w ? 8 : 0) |
+									(p.z < -p.w ? 16 : 0) | (p.z > p.w ? 32 : 0);
+		outsideAll &= outside;
+		inFront = inFront && p.w > 0.0 && (outside & 16) == 0;
+		corners[i] = p;
+	}
+	if (outsideAll != 0) {
+		cullStats.frustumCulled++;
+		return true;
+	}
+	if (!FragmentOps::performDepthTest || !inFront) {
+		return false;
+	}
+
+	BoundingBox windowBox;
+	for (const dvec4& p : corners) {
+		windowBox.expand((pipeMats.viewportMatrix * (p / p.w)).xyz());
+	}
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	const int x0 = (int)std::max(0.0, std::floor(windowBox.lo.x));
+	const int x1 = (int)std::min(W - 1.0, std::ceil(windowBox.hi.x));
+	const int y0 = (int)std::max(0.0, std::floor(windowBox.lo.y));
+	const int y1 = (int)std::min(H - 1.0, std::ceil(windowBox.hi.y));
+	const double zNear = windowBox.lo.z - CULL_DEPTH_MARGIN;
+	for (int y = y0 - y0 % FRAMEBUFFER_TILE_SIZE; y <= y1; y += FRAMEBUFFER_TILE_SIZE) {
+		for (int x = x0 - x0 % FRAMEBUFFER_TILE_SIZE; x <= x1; x += FRAMEBUFFER_TILE_SIZE) {
+			if (zNear < frameBuffer.getTileMaxDepth(x, y)) {
+				return false;
+			}
+		}
+	}
+	cullStats.occlusionCulled++;
+	return true;
+}
+
+/**
+ * @fn	void VertexOps::resetCullStats()
+ * @brief	Zeroes the culling counts, typically at the start of a frame.
+ */
+
+void VertexOps::resetCullStats() {
+	cullStats.draws = cullStats.frustumCulled = cullStats.occlusionCulled = 0;
+}
+
 /**
  * @fn	void VertexOps::getViewportTransformation()
  * @brief	Sets viewport transformation based on the current viewport settings.
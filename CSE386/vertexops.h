@@ -15,6 +15,9 @@
 #include "vertexdata.h"
 #include "iscene.h"
 #include "rasterization.h"
+#include "eshape.h"
+
+const int CLIP_MAX_VERTICES = 16;	//!< Room for a triangle clipped against the view volume (at most 9 vertices).
 
  /**
   * @class	PipelineMatrices
@@ -27,6 +30,17 @@ struct PipelineMatrices {
 	dmat4 viewportMatrix;
 };
 
+/**
+ * @struct	CullStats
+ * @brief	Counts of the objects VertexOps::render skipped, since the last reset.
+ */
+
+struct CullStats {
+	long long draws;			//!< objects rendered or skipped.
+	long long frustumCulled;	//!< objects entirely outside the view volume.
+	long long occlusionCulled;	//!< objects entirely behind what was already drawn.
+};
+
 /**
  * @class	VertexOps
  * @brief	Class to encapsulate the methods related to vertex processing for Pipeline graphics.
@@ -35,6 +49,7 @@ struct PipelineMatrices {
 class VertexOps {
 public:
 	static vector<IPlane> allButNearNDCPlanes;		//!< 5 of the 6 planes of the 2x2x2 cube.
+	static bool cullObjects;						//!< True ==> render skips objects that cannot be seen. Typically true
 
 	static void processTriangleVertices(FrameBuffer& frameBuffer, const dvec3& eyePos,
 		const vector<LightSourcePtr>& lights,
@@ -42,6 +57,12 @@ public:
 		const dmat4& modelingMatrix,
 		const PipelineMatrices& pipeMats,
 		bool renderBackfaces);
+	static void processIndexedTriangleVertices(FrameBuffer& frameBuffer, const dvec3& eyePos,
+		const vector<LightSourcePtr>& lights,
+		const EIndexedShapeData& mesh,
+		const dmat4& modelingMatrix,
+		const PipelineMatrices& pipeMats,
+		bool renderBackfaces);
 	static void processLineSegments(FrameBuffer& frameBuffer, const dvec3& eyePos,
 		const vector<LightSourcePtr>& lights,
 		const vector<VertexData>& objectCoords,
@@ -53,15 +74,26 @@ public:
 		const PipelineMatrices& pipeMats,
 		bool renderBackfaces
 	);
+	static void render(FrameBuffer& frameBuffer, const EIndexedShapeData& mesh,
+		const vector<LightSourcePtr>& lights,
+		const dmat4& modelingMatrix,
+		const PipelineMatrices& pipeMats,
+		bool renderBackfaces);
 	static dmat4 getViewportTransformation(int left, int width, int bottom, int height);
+	static bool isCulled(FrameBuffer& frameBuffer, const BoundingBox& objectBox,
+		const dmat4& modelingMatrix, const PipelineMatrices& pipeMats);
+	static CullStats getCullStats() { return cullStats; }
+	static void resetCullStats();
 protected:
-	static vector<VertexData> clipAgainstPlane(vector<VertexData>& verts, const IPlane& plane);
-	static vector<VertexData> clipPolygon(const vector<VertexData>& clipCoords,
-		const vector<IPlane>& planes);
+	static CullStats cullStats;						//!< Objects skipped since the last reset.
+	static int clipAgainstPlane(const VertexData* verts, int count, const IPlane& plane,
+		VertexData* output);
+	static int clipPolygon(VertexData* polygon, int count, const IPlane* planes, int numPlanes);
 	static vector<VertexData> clipLineSegments(const vector<VertexData>& clipCoords,
 		const vector<IPlane>& planes);
-	static vector<VertexData> processBackwardFacingTriangles(const vector<VertexData>& triangleVerts,
-		bool renderBackfaces);
+	static bool processBackwardFacingTriangle(VertexData* triangle, bool renderBackfaces);
+	static void processEyeTriangle(VertexData* polygon, const PipelineMatrices& pipeMats,
+		const IPlane& nearPlane, bool renderBackfaces);
 	static vector<VertexData> transformVerticesToWorldCoordinates(const dmat4& modelMatrix,
 		const vector<VertexData>& vertices);
 	static vector<VertexData> transformVertices(const dmat4& TM, const vector<VertexData>& vertices);
@@ -7,6 +7,7 @@
  * permission is granted.
  ****************************************************/
 
+#include <algorithm>
 #include "vertexdata.h"
 #include "utilities.h"
 #include "ishape.h"
@@ -97,3 +98,70 @@ VertexData VertexData::operator + (const VertexData& other) const {
 	result.worldPos += other.worldPos;
 	return result;
 }
+
+/**
+ * @fn	void CompactVertices::clear()
+ * @brief	Removes every vertex and material, keeping the memory for reuse.
+ */
+
+void CompactVertices::clear() {
+	x.clear();
+	y.clear();
+	z.clear();
+	nx.clear();
+	ny.clear();
+	nz.clear();
+	wx.clear();
+	wy.clear();
+	wz.clear();
+	materialIds.clear();
+	materials.clear();
+}
+
+/**
+ * @fn	void CompactVertices::push_back(const VertexData &v)
+ * @brief	Adds a vertex, whose pos is in window coordinates.
+ * @param	v	The vertex.
+ */
+
+void CompactVertices::push_back(const VertexData& v) {
+	x.push_back((float)v.pos.x);
+	y.push_back((float)v.pos.y);
+	z.push_back((float)v.pos.z);
+	nx.push_back((float)v.normal.x);
+	ny.push_back((float)v.normal.y);
+	nz.push_back((float)v.normal.z);
+	wx.push_back((float)v.worldPos.x);
+	wy.push_back((float)v.worldPos.y);
+	wz.push_back((float)v.worldPos.z);
+	materialIds.push_back(addMaterial(v.material));
+}
+
+/**
+ * @fn	unsigned short CompactVertices::addMaterial(const Material &mat)
+ * @brief	Finds a material in the table, adding it if need be. Only the last
+ * 			COMPACT_MATERIAL_SEARCH materials are searched until the table is full,
+ * 			which is enough for shapes that alternate between a few materials.
+ * @param	mat	The material.
+ * @return	The material's index.
+ */
+
+unsigned short CompactVertices::addMaterial(const Material& mat) {
+	const int MAX_MATERIALS = 1 << 16;
+	int first = std::max(0, (int)materials.size() - COMPACT_MATERIAL_SEARCH);
+	if ((int)materials.size() == MAX_MATERIALS) {
+		first = 0;
+	}
+	for (int i = (int)materials.size() - 1; i >= first; i--) {
+		if (materials[i] == mat) {
+			return (unsigned short)i;
+		}
+	}
+	if ((int)materials.size() == MAX_MATERIALS) {
+		std::cerr << "Too many materials in one draw" << endl;
+		return (unsigned short)(MAX_MATERIALS - 1);
+	}
+	materials.push_back(mat);
+	return (unsigned short)(materials.size() - 1);
+}
+
@@ -0,0 +1,455 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include "raytracer.h"
+#include "wavefront.h"
+#include "parallel.h"
+
+const int WAVEFRONT_GRAIN_SIZE = 256;	//!< Queue entries handed to a thread at a time.
+
+/**
+ * @fn	int directionOctant(const dvec3 &dir)
+ * @brief	Classifies a direction by the signs of its components. Rays in the same
+ * 			octant traverse the scene in a similar order.
+ * @param	dir	The direction.
+ * @return	A value in [0, 8).
+ */
+
+int directionOctant(const dvec3& dir) {
+	return (dir.x < 0 ? 1 : 0) | (dir.y < 0 ? 2 : 0) | (dir.z < 0 ? 4 : 0);
+}
+
+/**
+ * @fn	template <class T, class KeyFunction> static void bucketSort(vector<T> &items, int numKeys, KeyFunction key)
+ * @brief	Stable counting sort of items by a small integer key.
+ * @param [in,out]	items  	The items to sort.
+ * @param 		  	numKeys	Keys lie in [0, numKeys).
+ * @param 		  	key	   	Maps an item to its key.
+ */
+
+template <class T, class KeyFunction>
+static void bucketSort(vector<T>& items, int numKeys, KeyFunction key) {
+	vector<int> start(numKeys + 1, 0);
+	for (const T& item : items) {
+		start[key(item) + 1]++;
+	}
+	for (int k = 0; k < numKeys; k++) {
+		start[k + 1] += start[k];
+	}
+	vector<T> sorted(items.size());
+	for (const T& item : items) {
+		sorted[start[key(item)]++] = item;
+	}
+	items.swap(sorted);
+}
+
+/**
+ * @fn	static bool sameAppearance(const VisibleIShape &a, const VisibleIShape &b)
+ * @brief	Determines if two objects have the same material and texture.
+ * @return	true iff they would be shaded identically.
+ */
+
+static bool sameAppearance(const VisibleIShape& a, const VisibleIShape& b) {
+	return a.texture == b.texture &&
+		a.material.ambient == b.material.ambient &&
+		a.material.diffuse == b.material.diffuse &&
+		a.material.specular == b.material.specular &&
+		a.material.shininess == b.material.shininess;
+}
+
+/**
+ * @fn	static vector<int> assignMaterialIds(const vector<VisibleIShapePtr> &objs, int &numMaterials)
+ * @brief	Numbers the distinct material/texture combinations used by the objects.
+ * @param 		  	objs			The opaque objects.
+ * @param [out]	numMaterials	The number of distinct combinations.
+ * @return	The material number of each object.
+ */
+
+static vector<int> assignMaterialIds(const vector<VisibleIShapePtr>& objs, int& numMaterials) {
+	vector<int> ids(objs.size());
+	numMaterials = 0;
+	for (size_t i = 0; i < objs.size(); i++) {
+		ids[i] = numMaterials;
+		for (size_t j = 0; j < i; j++) {
+			if (sameAppearance(*objs[i], *objs[j])) {
+				ids[i] = ids[j];
+				break;
+			}
+		}
+		if (ids[i] == numMaterials) {
+			numMaterials++;
+		}
+	}
+	return ids;
+}
+
+/**
+ * @fn	static void generatePrimaryRays(const RaytracingCamera &camera, int W, int firstPixel,
+ * 										int numPixels, int n, vector<WavefrontRay> &rays)
+ * @brief	Ray generation stage. Produces every camera ray of a batch of pixels,
+ * 			using the same sample positions as RayTracer::raytraceScene.
+ * @param 		  	camera	  	The camera.
+ * @param 		  	W		  	Width of the image.
+ * @param 		  	firstPixel	Index of the first pixel of the batch.
+ * @param 		  	numPixels 	Number of pixels in the batch.
+ * @param 		  	n		  	1 for one sample per pixel, 3 for a 3x3 grid.
+ * @param [out]	rays	  	The generated rays.
+ */
+
+static void generatePrimaryRays(const RaytracingCamera& camera, int W, int firstPixel,
+	int numPixels, int n, vector<WavefrontRay>& rays) {
+	static const double xOffsets[9] = { 0.0, .333, .666, 0.0, .333, .667, 0.0, .333, .666 };
+	static const double yOffsets[9] = { 0.0, 0.0, 0.0, .333, .333, .333, .666, .666, .666 };
+	const int samplesPerPixel = n == 3 ? 9 : 1;
+	rays.resize(numPixels * samplesPerPixel);
+	parallelForRange(numPixels, WAVEFRONT_GRAIN_SIZE, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			const int x = (firstPixel + i) % W;
+			const int y = (firstPixel + i) / W;
+			for (int s = 0; s < samplesPerPixel; s++) {
+				WavefrontRay& r = rays[i * samplesPerPixel + s];
+				r.path = i * samplesPerPixel + s;
+				r.ray = n == 3 ? camera.getRay(x + .167 + xOffsets[s], y + .167 + yOffsets[s])
+								: camera.getRay(x, y);
+			}
+		}
+	});
+}
+
+/**
+ * @struct	WavefrontBatch
+ * @brief	Where the samples of the current batch come from.
+ */
+
+struct WavefrontBatch {
+	int width;				//!< width of the image.
+	int firstPixel;			//!< index of the batch's first pixel.
+	int numPixels;			//!< number of pixels in the batch.
+	int samplesPerPixel;	//!< samples (paths) per pixel.
+};
+
+/**
+ * @fn	static void traceClosestHits(const IScene &theScene, const vector<int> &materialIds,
+ * 									const PrimaryRayTiles *tiles, const WavefrontBatch &batch,
+ * 									WavefrontQueues &queues)
+ * @brief	Closest-hit stage. Intersects every queued ray with the opaque and the
+ * 			transparent objects and moves it to the hit queue.
+ * @param 		  	theScene   	The scene.
+ * @param 		  	materialIds	Material number of each opaque object.
+ * @param 		  	tiles	   	If not nullptr, the rays are primary rays and are only
+ * 								intersected with the candidates of their pixel's tile.
+ * 								Opaque objects go through the scene's top-level
+ * 								hierarchy whenever it has been built.
+ * @param 		  	batch	   	The batch being rendered.
+ * @param [in,out]	queues	   	The work queues.
+ */
+
+static void traceClosestHits(const IScene& theScene, const vector<int>& materialIds,
+	const PrimaryRayTiles* tiles, const WavefrontBatch& batch, WavefrontQueues& queues) {
+	queues.hits.resize(queues.rays.size());
+	parallelForRange((int)queues.rays.size(), WAVEFRONT_GRAIN_SIZE, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			WavefrontHit& h = queues.hits[i];
+			h.path = queues.rays[i].path;
+			h.ray = queues.rays[i].ray;
+			h.hit.t = FLT_MAX;
+			h.material = -1;
+			const TileObjects* candidates = nullptr;
+			if (tiles != nullptr) {
+				const int pixel = batch.firstPixel + h.path / batch.samplesPerPixel;
+				candidates = &tiles->getTile(pixel % batch.width, pixel / batch.width);
+			}
+			if (candidates == nullptr || theScene.opaqueBVH.isBuilt()) {
+				int object;
+				theScene.findOpaqueIntersection(h.ray, h.hit, &object);
+				h.material = object >= 0 ? materialIds[object] : -1;
+			} else {
+				for (size_t j = 0; j < candidates->opaqueObjs.size(); j++) {
+					OpaqueHitRecord hitForThisShape;
+					candidates->opaqueObjs[j]->findClosestIntersection(h.ray, hitForThisShape);
+					if (hitForThisShape.t < h.hit.t) {
+						h.hit = hitForThisShape;
+						h.material = materialIds[candidates->opaqueIndices[j]];
+					}
+				}
+			}
+			TransparentIShape::findIntersection(h.ray,
+				candidates != nullptr ? candidates->transparentObjs : theScene.transparentObjs, h.transHit);
+		}
+	});
+	queues.rays.clear();
+}
+
+/**
+ * @fn	static void traceShadowRays(const IScene &theScene, const ShadowOccluders &occluders,
+ * 								const WavefrontBatch &batch, WavefrontQueues &queues)
+ * @brief	Any-hit stage. Queues a shadow feeler from every opaque hit toward every
+ * 			light, groups the feelers into packets by light and screen tile, and
+ * 			traces each packet as a whole.
+ * @param 		  	theScene 	The scene.
+ * @param 		  	occluders	The shapes that may cast shadows.
+ * @param 		  	batch	 	The batch being rendered.
+ * @param [in,out]	queues   	The work queues.
+ */
+
+static void traceShadowRays(const IScene& theScene, const ShadowOccluders& occluders,
+	const WavefrontBatch& batch, WavefrontQueues& queues) {
+	const int numLights = (int)theScene.lights.size();
+	const Frame& eyeFrame = theScene.camera->getFrame();
+	const int tilesPerRow = (batch.width + SHADOW_TILE_SIZE - 1) / SHADOW_TILE_SIZE;
+	const int firstTileRow = batch.firstPixel / batch.width / SHADOW_TILE_SIZE;
+	const int lastTileRow = (batch.firstPixel + batch.numPixels - 1) / batch.width / SHADOW_TILE_SIZE;
+	const int numTiles = (lastTileRow - firstTileRow + 1) * tilesPerRow;
+
+	queues.shadowRays.clear();
+	for (int i = 0; i < (int)queues.hits.size(); i++) {
+		const OpaqueHitRecord& hit = queues.hits[i].hit;
+		if (hit.t == FLT_MAX) {
+			continue;
+		}
+		const int pixel = batch.firstPixel + queues.hits[i].path / batch.samplesPerPixel;
+		const int x = pixel % batch.width;
+		const int y = pixel / batch.width;
+		const int tile = (y / SHADOW_TILE_SIZE - firstTileRow) * tilesPerRow + x / SHADOW_TILE_SIZE;
+		for (int l = 0; l < numLights; l++) {
+			ShadowRay s;
+			s.ray = theScene.lights[l]->getShadowFeeler(hit.interceptPt, hit.normal, eyeFrame);
+			s.maxT = glm::distance(hit.interceptPt, theScene.lights[l]->pos);
+			s.hit = i;
+			s.light = l;
+			s.tile = tile;
+			queues.shadowRays.push_back(s);
+		}
+	}
+	bucketSort(queues.shadowRays, numLights * numTiles,
+		[&](const ShadowRay& s) { return s.light * numTiles + s.tile; });
+
+	// Each run of feelers with the same light and tile is one packet.
+	vector<int> packetStart;
+	for (int i = 0; i < (int)queues.shadowRays.size(); i++) {
+		if (i == 0 || queues.shadowRays[i].light != queues.shadowRays[i - 1].light ||
+			queues.shadowRays[i].tile != queues.shadowRays[i - 1].tile) {
+			packetStart.push_back(i);
+		}
+	}
+	packetStart.push_back((int)queues.shadowRays.size());
+
+	queues.packetResults.resize(queues.shadowRays.size());
+	parallelFor((int)packetStart.size() - 1, [&](int p) {
+		const int begin = packetStart[p];
+		const int count = packetStart[p + 1] - begin;
+		const dvec3& lightPos = theScene.lights[queues.shadowRays[begin].light]->pos;
+		traceShadowPacket(occluders, lightPos, &queues.shadowRays[begin], count,
+			&queues.packetResults[begin]);
+	});
+
+	queues.occluded.assign(queues.hits.size() * numLights, 0);
+	for (int i = 0; i < (int)queues.shadowRays.size(); i++) {
+		const ShadowRay& s = queues.shadowRays[i];
+		queues.occluded[s.hit * numLights + s.light] = queues.packetResults[i];
+	}
+}
+
+/**
+ * @fn	static color shadeHit(const WavefrontHit &h, const IScene &theScene, TextureFilter filter,
+ * 							const unsigned char *occluded)
+ * @brief	Local shading of one hit; the same model as RayTracer::traceIndividualRay.
+ * @param	h			The hit.
+ * @param	theScene	The scene.
+ * @param	filter		How textures are sampled.
+ * @param	occluded	The any-hit results of this hit, one per light.
+ * @return	The color contributed by the lights at this hit.
+ */
+
+static color shadeHit(const WavefrontHit& h, const IScene& theScene, TextureFilter filter,
+	const unsigned char* occluded) {
+	const OpaqueHitRecord& hit = h.hit;
+	const TransparentHitRecord& transHit = h.transHit;
+	const Frame& eyeFrame = theScene.camera->getFrame();
+	const int numLights = (int)theScene.lights.size();
+	color temp = black, C = black;
+	for (int i = 0; i < numLights; i++) {
+		if (hit.t != FLT_MAX && transHit.t == FLT_MAX) {
+			C = theScene.lights[i]->illuminate(hit.interceptPt, hit.normal, hit.material, eyeFrame, occluded[i] != 0);
+			if (hit.texture != nullptr) {
+				C = getTextureColor(hit, *theScene.camera, filter);
+			}
+			temp += C;
+		} else if (hit.t == FLT_MAX && transHit.t != FLT_MAX) {
+			C = (black) * (1 - transHit.alpha) + (transHit.alpha) * (transHit.transColor);
+			temp += C;
+		} else if (hit.t != FLT_MAX && transHit.t != FLT_MAX) {
+			C = theScene.lights[i]->illuminate(hit.interceptPt, hit.normal, hit.material, eyeFrame, occluded[i] != 0);
+			if (transHit.t < hit.t) {
+				C = C * (1 - transHit.alpha) + (transHit.alpha) * (transHit.transColor);
+			}
+			if (hit.texture != nullptr) {
+				C = getTextureColor(hit, *theScene.camera, filter);
+				C = C * (1 - transHit.alpha) + (transHit.alpha) * (transHit.transColor);
+			}
+			temp += C;
+		}
+	}
+	return temp;
+}
+
+/**
+ * @fn	static void shadeHits(const IScene &theScene, TextureFilter filter, int numMaterials,
+ * 							WavefrontQueues &queues, color *bounceColors)
+ * @brief	Shading stage. Shades the queued hits grouped by material.
+ * @param 		  	theScene	The scene.
+ * @param 		  	filter		How textures are sampled.
+ * @param 		  	numMaterials	Number of distinct materials.
+ * @param [in,out]	queues			The work queues.
+ * @param [out]	bounceColors	Receives the color of each path at this bounce.
+ */
+
+static void shadeHits(const IScene& theScene, TextureFilter filter, int numMaterials,
+	WavefrontQueues& queues, color* bounceColors) {
+	const int numLights = (int)theScene.lights.size();
+	queues.shadeOrder.resize(queues.hits.size());
+	for (int i = 0; i < (int)queues.hits.size(); i++) {
+		queues.shadeOrder[i] = i;
+	}
+	bucketSort(queues.shadeOrder, numMaterials + 1,
+		[&](int i) { return queues.hits[i].material + 1; });
+
+	parallelForRange((int)queues.shadeOrder.size(), WAVEFRONT_GRAIN_SIZE, [&](int begin, int end) {
+		for (int k = begin; k < end; k++) {
+			const int i = queues.shadeOrder[k];
+			const WavefrontHit& h = queues.hits[i];
+			bounceColors[h.path] = shadeHit(h, theScene, filter, &queues.occluded[i * numLights]);
+		}
+	});
+}
+
+/**
+ * @fn	static void generateReflectionRays(WavefrontQueues &queues)
+ * @brief	Secondary-ray stage. Queues the mirror reflection of every ray that hit
+ * 			an opaque object. Rays that hit nothing opaque end their path.
+ * @param [in,out]	queues	The work queues.
+ */
+
+static void generateReflectionRays(WavefrontQueues& queues) {
+	queues.rays.clear();
+	for (const WavefrontHit& h : queues.hits) {
+		if (h.hit.t == FLT_MAX) {
+			continue;
+		}
+		glm::dvec3 i = glm::normalize(h.ray.dir);
+		glm::dvec3 n = glm::normalize(h.hit.normal);
+
+		glm::dvec3 rDirection = i - 2.0 * glm::dot(i, n) * n;
+		glm::dvec3 rOrigin = h.hit.interceptPt + EPSILON * n;
+
+		WavefrontRay r;
+		r.ray = Ray(rOrigin, rDirection);
+		r.path = h.path;
+		queues.rays.push_back(r);
+	}
+}
+
+/**
+ * @fn	void RayTracer::raytraceSceneWavefront(FrameBuffer &frameBuffer, int depth,
+ * 												const IScene &theScene, int n) const
+ * @brief	Raytraces the scene breadth-first. Instead of following each pixel's rays
+ * 			recursively, the pixels are processed in large batches that flow through
+ * 			separate stages: ray generation, closest hit, shadow any-hit, shading and
+ * 			reflection-ray generation. Rays are sorted by direction octant before
+ * 			they are traced, primary rays only test the objects in their screen
+ * 			tile's frustum, shadow feelers are traced in packets per light and
+ * 			screen tile, and hits are sorted by material before they are shaded.
+ * 			The image is the same as the one raytraceScene produces.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	depth	   	The depth of recursion.
+ * @param 		  	theScene   	The scene.
+ * @param 		  	n		   	3 for 3x3 anti-aliasing; otherwise one sample per pixel.
+ */
+
+void RayTracer::raytraceSceneWavefront(FrameBuffer& frameBuffer, int depth,
+	const IScene& theScene, int n) const {
+	const RaytracingCamera& camera = *theScene.camera;
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	const int samplesPerPixel = n == 3 ? 9 : 1;
+	const int centerSample = samplesPerPixel / 2;
+	const int numBounces = depth + 1;
+
+	if (denoiseBuffers != nullptr &&
+		(denoiseBuffers->getWidth() != W || denoiseBuffers->getHeight() != H)) {
+		denoiseBuffers->setSize(W, H);
+	}
+
+	int numMaterials;
+	vector<int> materialIds = assignMaterialIds(theScene.opaqueObjs, numMaterials);
+	ShadowOccluders occluders;
+	occluders.build(theScene.opaqueObjs);
+	PrimaryRayTiles tiles;
+	tiles.build(theScene, W, H);
+
+	WavefrontQueues queues;
+	vector<color> bounceColors;
+	vector<OpaqueHitRecord> primaryHits;
+	const int pixelsPerBatch = std::max(1, WAVEFRONT_BATCH_SIZE / samplesPerPixel);
+
+	for (int firstPixel = 0; firstPixel < W * H; firstPixel += pixelsPerBatch) {
+		const int numPixels = std::min(pixelsPerBatch, W * H - firstPixel);
+		const int numPaths = numPixels * samplesPerPixel;
+		const WavefrontBatch batch = { W, firstPixel, numPixels, samplesPerPixel };
+		bounceColors.assign(numBounces * numPaths, black);
+		primaryHits.resize(numPixels);
+
+		generatePrimaryRays(camera, W, firstPixel, numPixels, n, queues.rays);
+		for (int bounce = 0; bounce < numBounces && !queues.rays.empty(); bounce++) {
+			bucketSort(queues.rays, 8, [](const WavefrontRay& r) { return directionOctant(r.ray.dir); });
+			traceClosestHits(theScene, materialIds, bounce == 0 ? &tiles : nullptr, batch, queues);
+			if (bounce == 0) {
+				for (const WavefrontHit& h : queues.hits) {
+					if (h.path % samplesPerPixel == centerSample) {
+						primaryHits[h.path / samplesPerPixel] = h.hit;
+					}
+				}
+			}
+			traceShadowRays(theScene, occluders, batch, queues);
+			shadeHits(theScene, textureFilter, numMaterials, queues, &bounceColors[bounce * numPaths]);
+			if (bounce + 1 < numBounces) {
+				generateReflectionRays(queues);
+			} else {
+				queues.rays.clear();
+			}
+		}
+
+		// Combine the bounces innermost first, in the order the recursive tracer adds them.
+		parallelForRange(numPixels, WAVEFRONT_GRAIN_SIZE, [&](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				const int x = (firstPixel + i) % W;
+				const int y = (firstPixel + i) / W;
+				color C = black;
+				for (int s = 0; s < samplesPerPixel; s++) {
+					const int path = i * samplesPerPixel + s;
+					color sampleColor = bounceColors[depth * numPaths + path];
+					for (int bounce = depth - 1; bounce >= 0; bounce--) {
+						sampleColor = bounceColors[bounce * numPaths + path] + sampleColor * 0.3;
+					}
+					C += sampleColor;
+				}
+				if (samplesPerPixel > 1) {
+					C /= samplesPerPixel;
+				}
+				frameBuffer.setColor(x, y, C);
+				recordDenoiseData(x, y, C, primaryHits[i]);
+				frameBuffer.showAxes(x, y, camera.getRay(x, y), 0.25);
+			}
+		});
+	}
+	if (denoiseBuffers == nullptr) {
+		frameBuffer.showColorBuffer();
+	}
+}
@@ -0,0 +1,58 @@
+/****************************************************
+ * 2016-2022 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include "defs.h"
+#include "ishape.h"
+#include "hitrecord.h"
+#include "shadowpacket.h"
+
+const int WAVEFRONT_BATCH_SIZE = 1 << 16;	//!< Maximum number of samples in flight at once.
+
+/**
+ * @struct	WavefrontRay
+ * @brief	A ray waiting in the closest-hit queue.
+ */
+
+struct WavefrontRay {
+	Ray ray;				//!< the ray.
+	int path;				//!< the sample this ray contributes to.
+};
+
+/**
+ * @struct	WavefrontHit
+ * @brief	The result of the closest-hit stage for one ray, waiting to be shaded.
+ */
+
+struct WavefrontHit {
+	int path;						//!< the sample this hit contributes to.
+	Ray ray;						//!< the ray that produced the hit.
+	OpaqueHitRecord hit;			//!< closest opaque hit (t == FLT_MAX if none).
+	TransparentHitRecord transHit;	//!< closest transparent hit (t == FLT_MAX if none).
+	int material;					//!< material of the opaque hit, or -1 if none.
+};
+
+/**
+ * @struct	WavefrontQueues
+ * @brief	The work queues that connect the stages of the wavefront ray tracer.
+ * 			Each stage drains one queue and fills the next, so every stage runs
+ * 			the same code over a large batch.
+ */
+
+struct WavefrontQueues {
+	vector<WavefrontRay> rays;			//!< rays waiting for the closest-hit stage.
+	vector<WavefrontHit> hits;			//!< hits waiting for the shadow and shading stages.
+	vector<ShadowRay> shadowRays;		//!< feelers waiting for the any-hit stage.
+	vector<unsigned char> packetResults;	//!< any-hit results, one per queued feeler.
+	vector<unsigned char> occluded;		//!< any-hit results, numLights per hit.
+	vector<int> shadeOrder;				//!< hit indices sorted by material.
+};
+
+int directionOctant(const dvec3& dir);